@@ -47,6 +47,55 @@ static String layoutGroupsKey("Layout");
 
 using namespace SonoAudio;
 
+static const float compressorKneeDb = 2.0f;
+static const float expanderKneeDb = 3.0f;
+static const float limiterKneeDb = 3.0f; // the faust default
+static const float dynamicsSmoothingTime = 0.02f; // seconds
+
+static void setMultichannelCompressorParams(MultichannelCompressor & comp, const CompressorParams & cparams, float thresholdDb, float ratio, float kneeDb, bool useMakeup=true)
+{
+    comp.setParameters(thresholdDb, ratio, kneeDb, cparams.attackMs * 1e-3f, cparams.releaseMs * 1e-3f,
+                       useMakeup ? cparams.makeupGainDb : 0.0f);
+}
+
+static void setMultichannelExpanderParams(MultichannelExpander & exp, const CompressorParams & cparams, float thresholdDb, float ratio)
+{
+    exp.setParameters(thresholdDb, ratio, expanderKneeDb, cparams.attackMs * 1e-3f, cparams.releaseMs * 1e-3f);
+}
+
+static inline void setZone(float * zone, float value)
+{
+    if (zone) *zone = value;
+}
+
+static ChannelGroup::DynamicsZones findDynamicsZones(MapUI & control, const std::string & prefix)
+{
+    ChannelGroup::DynamicsZones zones;
+    zones.threshold = control.getParamZone(prefix + "/threshold");
+    zones.ratio = control.getParamZone(prefix + "/ratio");
+    zones.knee = control.getParamZone(prefix + "/knee");
+    zones.attack = control.getParamZone(prefix + "/attack");
+    zones.release = control.getParamZone(prefix + "/release");
+    zones.makeupGain = control.getParamZone(prefix + "/makeup_gain");
+    return zones;
+}
+
+static ChannelGroup::EqZones findEqZones(MapUI & control)
+{
+    ChannelGroup::EqZones zones;
+    zones.lowShelfGain = control.getParamZone("/parametric_eq/low_shelf/gain");
+    zones.lowShelfFreq = control.getParamZone("/parametric_eq/low_shelf/transition_freq");
+    zones.para1Gain = control.getParamZone("/parametric_eq/para1/peak_gain");
+    zones.para1Freq = control.getParamZone("/parametric_eq/para1/peak_frequency");
+    zones.para1Q = control.getParamZone("/parametric_eq/para1/peak_q");
+    zones.para2Gain = control.getParamZone("/parametric_eq/para2/peak_gain");
+    zones.para2Freq = control.getParamZone("/parametric_eq/para2/peak_frequency");
+    zones.para2Q = control.getParamZone("/parametric_eq/para2/peak_q");
+    zones.highShelfGain = control.getParamZone("/parametric_eq/high_shelf/gain");
+    zones.highShelfFreq = control.getParamZone("/parametric_eq/high_shelf/transition_freq");
+    return zones;
+}
+
 ChannelGroup::ChannelGroup()
 {
 }
@@ -56,12 +105,10 @@ void ChannelGroup::copyParametersFrom(const ChannelGroup& other)
 {
     params = other.params;
 
-    compressorParamsChanged = true;
-    expanderParamsChanged = true;
-    eqParamsChanged = true;
-    limiterParamsChanged = true;
     monitorDelayParamsChanged = true;
 
+    prepareMultichannelEffects();
+    publishEffectParams();
 }
 
 void ChannelGroupParams::setToDefaults(bool isplugin)
@@ -92,11 +139,13 @@ void ChannelGroup::init(double sampRate)
     sampleRate = sampRate;
     
     if (!compressor) {
-        compressor = std::make_unique<faustCompressor>();
+        compressor = std::make_unique<CompressorKernel>();
         compressorControl = std::make_unique<MapUI>();
     }
     compressor->init(sampleRate);
     compressor->buildUserInterface(compressorControl.get());
+    compressorZones = findDynamicsZones(*compressorControl, "/compressor");
+    compressorOutputLevel = compressorControl->getParamZone("/compressor/outgain");
 
     //DBG("Compressor Params:");
     //for(int i=0; i < mInputCompressorControl.getParamsCount(); i++){
@@ -104,12 +153,14 @@ void ChannelGroup::init(double sampRate)
     //}
 
     if (!expander) {
-        expander = std::make_unique<faustExpander>();
+        expander = std::make_unique<ExpanderKernel>();
         expanderControl = std::make_unique<MapUI>();
     }
 
     expander->init(sampleRate);
     expander->buildUserInterface(expanderControl.get());
+    expanderZones = findDynamicsZones(*expanderControl, "/expander");
+    expanderOutputGain = expanderControl->getParamZone("/expander/outgain");
 
     //DBG("Expander Params:");
     //for(int i=0; i < mInputExpanderControl.getParamsCount(); i++){
@@ -118,11 +169,12 @@ void ChannelGroup::init(double sampRate)
 
     for (int j=0; j < 2; ++j) {
         if (!eq[j]) {
-            eq[j] = std::make_unique<faustParametricEQ>();
+            eq[j] = std::make_unique<ParametricEQKernel>();
             eqControl[j] = std::make_unique<MapUI>();
         }
         eq[j]->init(sampleRate);
         eq[j]->buildUserInterface(eqControl[j].get());
+        eqZones[j] = findEqZones(*eqControl[j]);
     }
 
     //DBG("EQ Params:");
@@ -131,18 +183,39 @@ void ChannelGroup::init(double sampRate)
     //}
 
     if (!limiter) {
-        limiter = std::make_unique<faustCompressor>();
+        limiter = std::make_unique<CompressorKernel>();
         limiterControl = std::make_unique<MapUI>();
     }
 
     limiter->init(sampleRate);
     limiter->buildUserInterface(limiterControl.get());
+    limiterZones = findDynamicsZones(*limiterControl, "/compressor");
 
     //DBG("Limiter Params:");
     //for(int i=0; i < mInputLimiterControl.getParamsCount(); i++){
     //    DBG(mInputLimiterControl.getParamAddress(i));
     //}
 
+    if (multichannelEffectsReady.load()) {
+        multiExpander->init(sampleRate);
+        multiCompressor->init(sampleRate);
+        multiEq->init(sampleRate);
+        multiLimiter->init(sampleRate);
+    }
+    else {
+        prepareMultichannelEffects();
+    }
+
+    // the audio thread isn't using this group yet, apply the settings directly
+    activeEffects.compressorParams = params.compressorParams;
+    activeEffects.expanderParams = params.expanderParams;
+    activeEffects.limiterParams = params.limiterParams;
+    activeEffects.eqParams = params.eqParams;
+    compressorSmoother.reset(activeEffects.compressorParams);
+    expanderSmoother.reset(activeEffects.expanderParams);
+    limiterSmoother.reset(activeEffects.limiterParams);
+    compressorParamsChanged = expanderParamsChanged = limiterParamsChanged = eqParamsChanged = false;
+
     commitCompressorParams();
     commitExpanderParams();
     commitEqParams();
@@ -239,15 +312,15 @@ void ChannelGroup::processBlock (AudioBuffer<float>& frombuffer,
 
     procstate.lastlevel = dogain;
 
-    // these all operate ONLY when the channel group has 1 or 2 channels (and when the effects have been initialized)
+    if (params.numChannels > 0 && compressor) {
+        updateEffectParams(numSamples);
+    }
+
+    // the faust versions operate ONLY when the channel group has 1 or 2 channels (and when the effects have been initialized)
     if (params.numChannels > 0 && params.numChannels <= 2 && compressor)
     {
         // apply input expander
-        if (expanderParamsChanged) {
-            commitExpanderParams();
-            expanderParamsChanged = false;
-        }
-        if (_lastExpanderEnabled || params.expanderParams.enabled) {
+        if (_lastExpanderEnabled || activeEffects.expanderParams.enabled) {
             if (tobufNumChan - destStartChan > 1 && numchan == 2 && destNumChans >= 2) {
                 float *bufs[2] = { tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1)};
                 expander->compute(numSamples, bufs, bufs);
@@ -256,15 +329,11 @@ void ChannelGroup::processBlock (AudioBuffer<float>& frombuffer,
                 expander->compute(numSamples, bufs, bufs);
             }
         }
-        _lastExpanderEnabled = params.expanderParams.enabled;
+        _lastExpanderEnabled = activeEffects.expanderParams.enabled;
 
 
         // apply input compressor
-        if (compressorParamsChanged) {
-            commitCompressorParams();
-            compressorParamsChanged = false;
-        }
-        if (_lastCompressorEnabled || params.compressorParams.enabled) {
+        if (_lastCompressorEnabled || activeEffects.compressorParams.enabled) {
             if (tobufNumChan - destStartChan > 1 && numchan == 2 && destNumChans >= 2) {
                 float *bufs[2] = { tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1)};
                 compressor->compute(numSamples, bufs, bufs);
@@ -273,15 +342,11 @@ void ChannelGroup::processBlock (AudioBuffer<float>& frombuffer,
                 compressor->compute(numSamples, bufs, bufs);
             }
         }
-        _lastCompressorEnabled = params.compressorParams.enabled;
+        _lastCompressorEnabled = activeEffects.compressorParams.enabled;
 
 
         // apply input EQ
-        if (eqParamsChanged) {
-            commitEqParams();
-            eqParamsChanged = false;
-        }
-        if (_lastEqEnabled || params.eqParams.enabled) {
+        if (_lastEqEnabled || activeEffects.eqParams.enabled) {
             if (tobufNumChan - destStartChan > 1 && numchan == 2 && destNumChans >= 2) {
                 // only 2 channels support for now... TODO
                 float *bufs[2] = { tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1)};
@@ -293,15 +358,11 @@ void ChannelGroup::processBlock (AudioBuffer<float>& frombuffer,
                 eq[0]->compute(numSamples, &inbuf, &outbuf);
             }
         }
-        _lastEqEnabled = params.eqParams.enabled;
+        _lastEqEnabled = activeEffects.eqParams.enabled;
 
 
         // apply input limiter
-        if (limiterParamsChanged) {
-            commitLimiterParams();
-            limiterParamsChanged = false;
-        }
-        if (_lastLimiterEnabled || params.limiterParams.enabled) {
+        if (_lastLimiterEnabled || activeEffects.limiterParams.enabled) {
             if (tobufNumChan - destStartChan > 1 && numchan == 2 && destNumChans >= 2) {
                 float *bufs[2] = { tobuffer.getWritePointer(destStartChan), tobuffer.getWritePointer(destStartChan+1)};
                 limiter->compute(numSamples, bufs, bufs);
@@ -310,9 +371,42 @@ void ChannelGroup::processBlock (AudioBuffer<float>& frombuffer,
                 limiter->compute(numSamples, bufs, bufs);
             }
         }
-        _lastLimiterEnabled = params.limiterParams.enabled;
+        _lastLimiterEnabled = activeEffects.limiterParams.enabled;
     }
-    
+    else if (params.numChannels > 2 && multichannelEffectsReady.load(std::memory_order_acquire))
+    {
+        // the same chain, linked across all the channels of the group
+        float * bufs[MAX_CHANNELS];
+        int numbufs = 0;
+        for (int desti = destStartChan; numbufs < numchan && desti < destStartChan+destNumChans && desti < tobufNumChan; ++desti) {
+            bufs[numbufs++] = tobuffer.getWritePointer(desti);
+        }
+
+        if (numbufs > 0 && (_lastExpanderEnabled || activeEffects.expanderParams.enabled)) {
+            multiExpander->compute(numSamples, bufs, numbufs);
+        }
+        _lastExpanderEnabled = activeEffects.expanderParams.enabled;
+
+        if (numbufs > 0 && (_lastCompressorEnabled || activeEffects.compressorParams.enabled)) {
+            multiCompressor->compute(numSamples, bufs, numbufs);
+            // the meters read the gain reduction from the faust compressor
+            if (compressorOutputLevel) {
+                *compressorOutputLevel = multiCompressor->getGainReductionDb();
+            }
+        }
+        _lastCompressorEnabled = activeEffects.compressorParams.enabled;
+
+        if (numbufs > 0 && (_lastEqEnabled || activeEffects.eqParams.enabled)) {
+            multiEq->compute(numSamples, bufs, numbufs);
+        }
+        _lastEqEnabled = activeEffects.eqParams.enabled;
+
+        if (numbufs > 0 && (_lastLimiterEnabled || activeEffects.limiterParams.enabled)) {
+            multiLimiter->compute(numSamples, bufs, numbufs);
+        }
+        _lastLimiterEnabled = activeEffects.limiterParams.enabled;
+    }
+
     // apply to reverb buffer
     if (reverbbuffer) {
         processReverbSend(tobuffer, destStartChan, jmin(params.numChannels, destNumChans), *reverbbuffer, revStartChan, revNumChans, numSamples, revEnabled, true, revgainfactor, &revprocstate);
@@ -772,76 +866,141 @@ void ChannelGroupParams::setFromChannelLayoutValueTree(const ValueTree & layoutv
 
 void ChannelGroup::commitAllParams()
 {
-    commitCompressorParams();
-    commitLimiterParams();
-    commitEqParams();
-    commitExpanderParams();
+    prepareMultichannelEffects();
+
+    publishEffectParams();
     commitMonitorDelayParams();
 }
 
+void ChannelGroup::publishEffectParams()
+{
+    // more than one thread can change the params (e.g. loading state while the UI is open)
+    const ScopedLock lock(_publishEffectsLock);
+
+    publishedEffects.compressorParams = params.compressorParams;
+    publishedEffects.expanderParams = params.expanderParams;
+    publishedEffects.limiterParams = params.limiterParams;
+    publishedEffects.eqParams = params.eqParams;
+    ++_publishedEffectsVersion;
+}
+
+bool ChannelGroup::DynamicsSmoother::advance(const CompressorParams & target, float coef)
+{
+    thresholdDb += (target.thresholdDb - thresholdDb) * coef;
+    ratio += (target.ratio - ratio) * coef;
+
+    if (fabsf(target.thresholdDb - thresholdDb) < 0.01f && fabsf(target.ratio - ratio) < 0.001f) {
+        reset(target);
+        return false;
+    }
+    return true;
+}
+
+void ChannelGroup::updateEffectParams(int numSamples)
+{
+    // called from audio thread context
+
+    if (_publishedEffectsVersion.get() != _activeEffectsVersion) {
+        // if a publish holds the lock right now, it's picked up next block
+        const ScopedTryLock sl (_publishEffectsLock);
+        if (sl.isLocked()) {
+            activeEffects = publishedEffects;
+            _activeEffectsVersion = _publishedEffectsVersion.get();
+            compressorParamsChanged = expanderParamsChanged = limiterParamsChanged = eqParamsChanged = true;
+        }
+    }
+
+    if (compressorParamsChanged || expanderParamsChanged || limiterParamsChanged) {
+        // block rate smoothing, the same time whatever the block size
+        const float coef = 1.0f - expf(-numSamples / (dynamicsSmoothingTime * (float) sampleRate));
+
+        if (compressorParamsChanged) {
+            compressorParamsChanged = compressorSmoother.advance(activeEffects.compressorParams, coef);
+            commitCompressorParams();
+        }
+        if (expanderParamsChanged) {
+            expanderParamsChanged = expanderSmoother.advance(activeEffects.expanderParams, coef);
+            commitExpanderParams();
+        }
+        if (limiterParamsChanged) {
+            limiterParamsChanged = limiterSmoother.advance(activeEffects.limiterParams, coef);
+            commitLimiterParams();
+        }
+    }
+
+    if (eqParamsChanged) {
+        commitEqParams();
+        eqParamsChanged = false;
+    }
+}
 
 void ChannelGroup::commitCompressorParams()
 {
-    if (!compressorControl) return;
-    compressorControl->setParamValue("/compressor/Bypass", params.compressorParams.enabled ? 0.0f : 1.0f);
-    compressorControl->setParamValue("/compressor/knee", 2.0f);
-    compressorControl->setParamValue("/compressor/threshold", params.compressorParams.thresholdDb);
-    compressorControl->setParamValue("/compressor/ratio", params.compressorParams.ratio);
-    compressorControl->setParamValue("/compressor/attack", params.compressorParams.attackMs * 1e-3);
-    compressorControl->setParamValue("/compressor/release", params.compressorParams.releaseMs * 1e-3);
-    compressorControl->setParamValue("/compressor/makeup_gain", params.compressorParams.makeupGainDb);
-
-    float * tmp = compressorControl->getParamZone("/compressor/outgain");
-    if (tmp != compressorOutputLevel) {
-        compressorOutputLevel = tmp; // pointer
+    const auto & cparams = activeEffects.compressorParams;
+
+    setZone(compressorZones.knee, compressorKneeDb);
+    setZone(compressorZones.threshold, compressorSmoother.thresholdDb);
+    setZone(compressorZones.ratio, compressorSmoother.ratio);
+    setZone(compressorZones.attack, cparams.attackMs * 1e-3f);
+    setZone(compressorZones.release, cparams.releaseMs * 1e-3f);
+    setZone(compressorZones.makeupGain, cparams.makeupGainDb);
+
+    if (multichannelEffectsReady.load()) {
+        setMultichannelCompressorParams(*multiCompressor, cparams, compressorSmoother.thresholdDb, compressorSmoother.ratio, compressorKneeDb);
     }
 }
 
 
 void ChannelGroup::commitExpanderParams()
 {
-    if (!expanderControl) return;
-    //mInputCompressorControl.setParamValue("/compressor/Bypass", mInputCompressorParams.enabled ? 0.0f : 1.0f);
-    expanderControl->setParamValue("/expander/knee", 3.0f);
-    expanderControl->setParamValue("/expander/threshold", params.expanderParams.thresholdDb);
-    expanderControl->setParamValue("/expander/ratio", params.expanderParams.ratio);
-    expanderControl->setParamValue("/expander/attack", params.expanderParams.attackMs * 1e-3);
-    expanderControl->setParamValue("/expander/release", params.expanderParams.releaseMs * 1e-3);
+    const auto & cparams = activeEffects.expanderParams;
 
-    float * tmp = expanderControl->getParamZone("/expander/outgain");
+    setZone(expanderZones.knee, expanderKneeDb);
+    setZone(expanderZones.threshold, expanderSmoother.thresholdDb);
+    setZone(expanderZones.ratio, expanderSmoother.ratio);
+    setZone(expanderZones.attack, cparams.attackMs * 1e-3f);
+    setZone(expanderZones.release, cparams.releaseMs * 1e-3f);
 
-    if (tmp != expanderOutputGain) {
-        expanderOutputGain = tmp; // pointer
+    if (multichannelEffectsReady.load()) {
+        setMultichannelExpanderParams(*multiExpander, cparams, expanderSmoother.thresholdDb, expanderSmoother.ratio);
     }
 }
 
 void ChannelGroup::commitLimiterParams()
 {
-    if (!limiterControl) return;
+    const auto & cparams = activeEffects.limiterParams;
+
+    setZone(limiterZones.knee, limiterKneeDb);
+    setZone(limiterZones.threshold, limiterSmoother.thresholdDb);
+    setZone(limiterZones.ratio, limiterSmoother.ratio);
+    setZone(limiterZones.attack, cparams.attackMs * 1e-3f);
+    setZone(limiterZones.release, cparams.releaseMs * 1e-3f);
 
-    limiterControl->setParamValue("/compressor/Bypass", params.limiterParams.enabled ? 0.0f : 1.0f);
-    limiterControl->setParamValue("/compressor/threshold", params.limiterParams.thresholdDb);
-    limiterControl->setParamValue("/compressor/ratio", params.limiterParams.ratio);
-    limiterControl->setParamValue("/compressor/attack", params.limiterParams.attackMs * 1e-3);
-    limiterControl->setParamValue("/compressor/release", params.limiterParams.releaseMs * 1e-3);
+    if (multichannelEffectsReady.load()) {
+        setMultichannelCompressorParams(*multiLimiter, cparams, limiterSmoother.thresholdDb, limiterSmoother.ratio, limiterKneeDb, false);
+    }
 }
 
 
 void ChannelGroup::commitEqParams()
 {
-    if (!eqControl[0]) return;
-
-    for (int i=0; i < 2; ++i) {
-        eqControl[i]->setParamValue("/parametric_eq/low_shelf/gain", params.eqParams.lowShelfGain);
-        eqControl[i]->setParamValue("/parametric_eq/low_shelf/transition_freq", params.eqParams.lowShelfFreq);
-        eqControl[i]->setParamValue("/parametric_eq/para1/peak_gain", params.eqParams.para1Gain);
-        eqControl[i]->setParamValue("/parametric_eq/para1/peak_frequency", params.eqParams.para1Freq);
-        eqControl[i]->setParamValue("/parametric_eq/para1/peak_q", params.eqParams.para1Q);
-        eqControl[i]->setParamValue("/parametric_eq/para2/peak_gain", params.eqParams.para2Gain);
-        eqControl[i]->setParamValue("/parametric_eq/para2/peak_frequency", params.eqParams.para2Freq);
-        eqControl[i]->setParamValue("/parametric_eq/para2/peak_q", params.eqParams.para2Q);
-        eqControl[i]->setParamValue("/parametric_eq/high_shelf/gain", params.eqParams.highShelfGain);
-        eqControl[i]->setParamValue("/parametric_eq/high_shelf/transition_freq", params.eqParams.highShelfFreq);
+    const auto & eqparams = activeEffects.eqParams;
+
+    for (auto & zones : eqZones) {
+        setZone(zones.lowShelfGain, eqparams.lowShelfGain);
+        setZone(zones.lowShelfFreq, eqparams.lowShelfFreq);
+        setZone(zones.para1Gain, eqparams.para1Gain);
+        setZone(zones.para1Freq, eqparams.para1Freq);
+        setZone(zones.para1Q, eqparams.para1Q);
+        setZone(zones.para2Gain, eqparams.para2Gain);
+        setZone(zones.para2Freq, eqparams.para2Freq);
+        setZone(zones.para2Q, eqparams.para2Q);
+        setZone(zones.highShelfGain, eqparams.highShelfGain);
+        setZone(zones.highShelfFreq, eqparams.highShelfFreq);
+    }
+
+    if (multichannelEffectsReady.load()) {
+        multiEq->setParameters(eqparams);
     }
 }
 
@@ -851,4 +1010,33 @@ void ChannelGroup::commitMonitorDelayParams()
     setMonitoringDelayEnabled(params.monitorDelayParams.enabled, params.numChannels);
 }
 
-
+void ChannelGroup::prepareMultichannelEffects()
+{
+    if (params.numChannels <= 2 || multichannelEffectsReady.load()) return;
+
+    // the send thread can get here at the same time as the message thread
+    const ScopedLock lock(_multichannelEffectsLock);
+    if (multichannelEffectsReady.load()) return;
+
+    multiExpander = std::make_unique<MultichannelExpander>();
+    multiCompressor = std::make_unique<MultichannelCompressor>();
+    multiEq = std::make_unique<MultichannelParametricEQ>();
+    multiLimiter = std::make_unique<MultichannelCompressor>();
+
+    multiExpander->init(sampleRate);
+    multiCompressor->init(sampleRate);
+    multiEq->init(sampleRate);
+    multiLimiter->init(sampleRate);
+
+    // the audio thread keeps them up to date from then on
+    const auto & cp = params.compressorParams;
+    const auto & ep = params.expanderParams;
+    const auto & lp = params.limiterParams;
+    setMultichannelExpanderParams(*multiExpander, ep, ep.thresholdDb, ep.ratio);
+    setMultichannelCompressorParams(*multiCompressor, cp, cp.thresholdDb, cp.ratio, compressorKneeDb);
+    multiEq->setParameters(params.eqParams);
+    setMultichannelCompressorParams(*multiLimiter, lp, lp.thresholdDb, lp.ratio, limiterKneeDb, false);
+
+    // the audio thread only uses them after this
+    multichannelEffectsReady.store(true, std::memory_order_release);
+}
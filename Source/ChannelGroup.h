@@ -5,10 +5,8 @@
 
 #include "JuceHeader.h"
 
-#include "faustCompressor.h"
-#include "faustExpander.h"
-#include "faustParametricEQ.h"
-#include "faustLimiter.h"
+#include "FaustKernels.h"
+#include "MultichannelEffects.h"
 
 #include "EffectParams.h"
 
@@ -57,13 +55,13 @@ struct ChannelGroupParams
 
     bool sendMainMix = true; // used for remote peers
 
-    // compressor (only used for 1 or 2 channel groups)
+    // compressor
     CompressorParams compressorParams;
 
     // gate/expander
     CompressorParams expanderParams;
 
-    // EQ (stereo only)
+    // EQ
     ParametricEqParams eqParams;
 
     // limiter
@@ -118,14 +116,20 @@ public:
     // shallow copy of parameters and state
     void copyParametersFrom(const ChannelGroup& other);
 
+    // hands the compressor, expander, limiter and EQ settings in params to the
+    // audio thread, which applies them at its next block. call after changing them,
+    // from any thread but the audio thread
+    void publishEffectParams();
+
+    // publishes the effect params and applies the monitor delay
     void commitAllParams();
     
-    void commitCompressorParams();
-    void commitExpanderParams();
-    void commitLimiterParams();
-    void commitEqParams();
     void commitMonitorDelayParams();
 
+    // creates the multichannel effects if the group has more than 2 channels,
+    // not from the audio thread
+    void prepareMultichannelEffects();
+
     void setMonitoringDelayEnabled(bool enabled, int numchans);
     void setMonitoringDelayTimeMs(double delayms);
 
@@ -136,33 +140,111 @@ public:
     ProcessState inRevProcState;
     ProcessState revProcState;
 
-    // compressor (only used for 1 or 2 channel groups)
-    std::unique_ptr<faustCompressor> compressor;
+    // the faust controls, looked up once in init() so that applying
+    // settings on the audio thread is just stores
+    struct DynamicsZones
+    {
+        float * threshold = nullptr;
+        float * ratio = nullptr;
+        float * knee = nullptr;
+        float * attack = nullptr;
+        float * release = nullptr;
+        float * makeupGain = nullptr; // not on the expander
+    };
+
+    struct EqZones
+    {
+        float * lowShelfGain = nullptr;
+        float * lowShelfFreq = nullptr;
+        float * para1Gain = nullptr;
+        float * para1Freq = nullptr;
+        float * para1Q = nullptr;
+        float * para2Gain = nullptr;
+        float * para2Freq = nullptr;
+        float * para2Q = nullptr;
+        float * highShelfGain = nullptr;
+        float * highShelfFreq = nullptr;
+    };
+
+    // the effect settings as the audio thread uses them
+    struct EffectSettings
+    {
+        CompressorParams compressorParams;
+        CompressorParams expanderParams;
+        CompressorParams limiterParams;
+        ParametricEqParams eqParams;
+    };
+
+    // threshold and ratio glide to new settings instead of jumping, which
+    // would step the gain. the EQ and the makeup gain are smoothed by faust
+    struct DynamicsSmoother
+    {
+        float thresholdDb = 0.0f;
+        float ratio = 1.0f;
+
+        void reset(const CompressorParams & target) { thresholdDb = target.thresholdDb; ratio = target.ratio; }
+        // returns true while still moving
+        bool advance(const CompressorParams & target, float coef);
+    };
+
+    // audio thread
+    void updateEffectParams(int numSamples);
+    void commitCompressorParams();
+    void commitExpanderParams();
+    void commitLimiterParams();
+    void commitEqParams();
+
+    // written by publishEffectParams() under the lock, from whatever thread changed the params,
+    // the audio thread only tries the lock to take them when the version changed
+    EffectSettings publishedEffects;
+    CriticalSection _publishEffectsLock;
+    Atomic<int> _publishedEffectsVersion { 0 };
+    int _activeEffectsVersion = 0;
+    EffectSettings activeEffects; // only touched by the audio thread after init()
+
+    // compressor (faust version used for 1 or 2 channel groups)
+    std::unique_ptr<CompressorKernel> compressor;
     std::unique_ptr<MapUI> compressorControl;
+    DynamicsZones compressorZones;
+    DynamicsSmoother compressorSmoother;
     float * compressorOutputLevel = nullptr;
-    bool compressorParamsChanged = false;
+    bool compressorParamsChanged = false; // audio thread, still applying
     bool _lastCompressorEnabled = false;
 
     // gate/expander
-    std::unique_ptr<faustExpander> expander;
+    std::unique_ptr<ExpanderKernel> expander;
     std::unique_ptr<MapUI>  expanderControl;
+    DynamicsZones expanderZones;
+    DynamicsSmoother expanderSmoother;
     bool expanderParamsChanged = false;
     bool _lastExpanderEnabled = false;
     float * expanderOutputGain = nullptr;
 
-    // EQ (stereo only)
-    std::unique_ptr<faustParametricEQ> eq[2];
+    // EQ (faust version used for 1 or 2 channel groups)
+    std::unique_ptr<ParametricEQKernel> eq[2];
     std::unique_ptr<MapUI>  eqControl[2];
+    EqZones eqZones[2];
     bool eqParamsChanged = false;
     bool _lastEqEnabled = false;
 
     // limiter
     //faustLimiter mInputLimiter;
-    std::unique_ptr<faustCompressor> limiter;
+    std::unique_ptr<CompressorKernel> limiter;
     std::unique_ptr<MapUI>  limiterControl;
+    DynamicsZones limiterZones;
+    DynamicsSmoother limiterSmoother;
     bool limiterParamsChanged = false;
     bool _lastLimiterEnabled = false;
 
+    // the linked versions of the above for groups with more than 2 channels,
+    // only created once a group has that many, and kept from then on
+    std::unique_ptr<MultichannelExpander> multiExpander;
+    std::unique_ptr<MultichannelCompressor> multiCompressor;
+    std::unique_ptr<MultichannelParametricEQ> multiEq;
+    std::unique_ptr<MultichannelCompressor> multiLimiter;
+    std::atomic<bool> multichannelEffectsReady { false };
+    CriticalSection _multichannelEffectsLock;
+
     // monitoring delay
     std::unique_ptr<juce::dsp::DelayLine<float,juce::dsp::DelayLineInterpolationTypes::None> > monitorDelayLine;
     bool monitorDelayParamsChanged = false;
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+/*
+ The Faust effect kernels. The scalar builds here are generated from the .dsp
+ files in scripts/ by the make*.sh scripts and checked in. Configuring with
+ -DSONOBUS_FAUST_VECTOR=ON also generates vector mode (-vec) builds of the same
+ sources at build time, and the effects use those instead. The scalar ones are
+ always included so SonoBusBench can compare them.
+
+ The limiter is a faustCompressor, so it follows the compressor.
+
+ Faust only supports running a kernel in place (-inpl) for scalar code, and the
+ effects always do, so the vector builds are wrapped in InPlaceKernel.
+ */
+
+#include "JuceHeader.h"
+
+#include "faustCompressor.h"
+#include "faustExpander.h"
+#include "faustParametricEQ.h"
+#include "faustLimiter.h"
+#include "zitaRev.h"
+
+#if SONOBUS_FAUST_VECTOR
+#include "faustvec/faustCompressorVec.h"
+#include "faustvec/faustExpanderVec.h"
+#include "faustvec/faustParametricEQVec.h"
+#include "faustvec/zitaRevVec.h"
+#endif
+
+namespace SonoAudio {
+
+#if SONOBUS_FAUST_VECTOR
+
+/*
+ A vector mode kernel that can be run with the same buffers for its inputs and
+ outputs. The generated code writes the outputs of a whole vector while it still
+ reads the inputs of that vector (and of the other channels), so the inputs are
+ copied to a scratch block first. That's done in chunks, nothing is allocated.
+ */
+template <class Kernel>
+class InPlaceKernel : public Kernel
+{
+public:
+    using Kernel::compute;
+
+    void compute(int count, FAUSTFLOAT ** inputs, FAUSTFLOAT ** outputs) override
+    {
+        const int numins = Kernel::getNumInputs();
+        const int numouts = Kernel::getNumOutputs();
+        jassert(numins <= maxChannels && numouts <= maxChannels);
+
+        FAUSTFLOAT * ins[maxChannels];
+        FAUSTFLOAT * outs[maxChannels];
+
+        for (int pos = 0; pos < count; pos += chunkSize) {
+            const int n = jmin(chunkSize, count - pos);
+            for (int ch = 0; ch < numins; ++ch) {
+                std::copy(inputs[ch] + pos, inputs[ch] + pos + n, scratch[ch]);
+                ins[ch] = scratch[ch];
+            }
+            for (int ch = 0; ch < numouts; ++ch) {
+                outs[ch] = outputs[ch] + pos;
+            }
+            Kernel::compute(n, ins, outs);
+        }
+    }
+
+private:
+    static constexpr int maxChannels = 2;
+    static constexpr int chunkSize = 256;
+    FAUSTFLOAT scratch[maxChannels][chunkSize];
+};
+
+using CompressorKernel = InPlaceKernel<faustCompressorVec>;
+using ExpanderKernel = InPlaceKernel<faustExpanderVec>;
+using ParametricEQKernel = InPlaceKernel<faustParametricEQVec>;
+using ReverbKernel = InPlaceKernel<zitaRevVec>;
+#else
+using CompressorKernel = faustCompressor;
+using ExpanderKernel = faustExpander;
+using ParametricEQKernel = faustParametricEQ;
+using ReverbKernel = zitaRev;
+#endif
+
+}
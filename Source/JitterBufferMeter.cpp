@@ -34,6 +34,14 @@ void JitterBufferMeter::setFillRatio (float ratio, float stdev)
     }
 }
 
+void JitterBufferMeter::setDelayMarker (float ratio)
+{
+    if (fabsf(ratio - _marker) > 0.005f) {
+        _marker = ratio;
+        repaint();
+    }
+}
+
 
 void JitterBufferMeter::paint (Graphics& g)
 {
@@ -73,6 +81,12 @@ void JitterBufferMeter::paint (Graphics& g)
     g.setColour(jitterColor);
     g.fillRoundedRectangle(edgebox, radius);
     //g.fillRect(edgebox);
+
+    if (_marker >= 0.0f) {
+        float mx = jlimit(1.0f, width - 2.0f, (float)width * _marker);
+        g.setColour(Colours::white.withAlpha(0.6f));
+        g.fillRect(mx, 1.0f, 1.0f, height - 2.0f);
+    }
     
 }
 
@@ -17,12 +17,15 @@ public:
 
     void setRecvMode(bool recvmode);
     void setFillRatio (float ratio, float stdev);
+    // fraction of the buffer taken up by the arrival delay percentile, < 0 to hide
+    void setDelayMarker (float ratio);
     
 private:
 
     bool  _recvmode = true;
     float _ratio = 0.0f;
     float _stdev = 0.0f;
+    float _marker = -1.0f;
     
     Colour  jitterColor;
     Colour  barColor;
@@ -0,0 +1,553 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "EffectParams.h"
+
+#include <cmath>
+
+namespace SonoAudio {
+
+#ifndef MAX_CHANNELS
+#define MAX_CHANNELS 64
+#endif
+
+/*
+ Multichannel versions of the Faust compressor, expander and parametric EQ
+ for channel groups with more than 2 channels, with the same math as the
+ generated code in faustCompressor.h, faustExpander.h and faustParametricEQ.h.
+
+ The dynamics are channel linked: every channel has its own envelope, the
+ loudest one drives a single gain for all of them, which is what the stereo
+ Faust versions do with their 2 channels. The EQ applies the same settings to
+ every channel, so its coefficients (the expensive part) are computed once
+ per sample for all of them.
+
+ The per channel filter and envelope state is kept in lanes of 4 channels,
+ and a block is processed in tiles that get transposed so each sample of the
+ 4 channels is contiguous, which lets the compiler use SIMD registers across
+ the channels. Everything is sized for MAX_CHANNELS up front, compute() doesn't
+ allocate.
+ */
+
+namespace MultichannelDetail {
+
+    static constexpr int laneWidth = 4;
+    static constexpr int maxLaneGroups = (MAX_CHANNELS + laneWidth - 1) / laneWidth;
+    static constexpr int tileSize = 64;
+
+    struct alignas(16) Lanes
+    {
+        float v[laneWidth];
+    };
+
+    // gathers up to 4 channels of a tile into lanes, missing channels are silent
+    inline void loadTile(Lanes * dest, float * const * channels, int numChannels, int group, int start, int count)
+    {
+        for (int l = 0; l < laneWidth; ++l) {
+            const int ch = group * laneWidth + l;
+            if (ch < numChannels) {
+                const float * src = channels[ch] + start;
+                for (int i = 0; i < count; ++i) {
+                    dest[i].v[l] = src[i];
+                }
+            }
+            else {
+                for (int i = 0; i < count; ++i) {
+                    dest[i].v[l] = 0.0f;
+                }
+            }
+        }
+    }
+
+    inline void storeTile(const Lanes * src, float * const * channels, int numChannels, int group, int start, int count)
+    {
+        for (int l = 0; l < laneWidth; ++l) {
+            const int ch = group * laneWidth + l;
+            if (ch >= numChannels) break;
+            float * dest = channels[ch] + start;
+            for (int i = 0; i < count; ++i) {
+                dest[i] = src[i].v[l];
+            }
+        }
+    }
+
+    inline float timeConstantCoef(float seconds, float invSampleRate)
+    {
+        // as in the Faust code, a (nearly) zero time constant is instant
+        const float t = std::max<float>(invSampleRate, seconds);
+        return std::fabs(t) < 1.1920929e-07f ? 0.0f : std::exp(-(invSampleRate / t));
+    }
+
+    // runs the peak envelope followers of every channel over one tile and
+    // leaves the loudest envelope of each sample in level
+    inline void followEnvelopes(Lanes * envelopes, Lanes * tile, float * level, float * const * channels, int numChannels,
+                                int start, int count, float attackCoef, float releaseCoef)
+    {
+        for (int i = 0; i < count; ++i) {
+            level[i] = 0.0f;
+        }
+
+        const int groups = (numChannels + laneWidth - 1) / laneWidth;
+        for (int g = 0; g < groups; ++g) {
+            loadTile(tile, channels, numChannels, g, start, count);
+
+            Lanes env = envelopes[g];
+            for (int i = 0; i < count; ++i) {
+                Lanes & x = tile[i];
+                for (int l = 0; l < laneWidth; ++l) {
+                    const float a = std::fabs(x.v[l]);
+                    const float coef = env.v[l] > a ? releaseCoef : attackCoef;
+                    env.v[l] = env.v[l] * coef + a * (1.0f - coef);
+                    x.v[l] = env.v[l];
+                }
+            }
+            envelopes[g] = env;
+
+            for (int i = 0; i < count; ++i) {
+                const auto & e = tile[i].v;
+                level[i] = std::max<float>(level[i], std::max<float>(std::max<float>(e[0], e[1]), std::max<float>(e[2], e[3])));
+            }
+        }
+    }
+
+    inline void applyGains(const float * gains, float * const * channels, int numChannels, int start, int count)
+    {
+        for (int ch = 0; ch < numChannels; ++ch) {
+            FloatVectorOperations::multiply(channels[ch] + start, gains, count);
+        }
+    }
+}
+
+
+// the faust compressor (also used as the limiter), linked across all channels
+class MultichannelCompressor
+{
+public:
+    MultichannelCompressor() {}
+
+    void init(double sampleRate)
+    {
+        invSampleRate = 1.0f / std::min<float>(192000.0f, std::max<float>(1.0f, (float) sampleRate));
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto & env : envelopes) {
+            env = {};
+        }
+        smoothedMakeup = 0.0f;
+    }
+
+    void setParameters(float thresholdDb, float ratio, float kneeDb, float attackSec, float releaseSec, float makeupGainDb)
+    {
+        threshold = thresholdDb;
+        ratioTerm = 1.0f - ratio;
+        knee = kneeDb;
+        attack = attackSec;
+        release = releaseSec;
+        makeup = makeupGainDb;
+    }
+
+    void compute(int numSamples, float * const * channels, int numChannels)
+    {
+        using namespace MultichannelDetail;
+
+        const float makeupTarget = 0.001f * makeup;
+        const float attackCoef = timeConstantCoef(attack, invSampleRate);
+        const float releaseCoef = timeConstantCoef(release, invSampleRate);
+        const float invKnee = 1.0f / (knee + 0.001f);
+
+        Lanes tile[tileSize];
+        float gains[tileSize];
+
+        for (int start = 0; start < numSamples; start += tileSize) {
+            const int count = std::min(tileSize, numSamples - start);
+
+            followEnvelopes(envelopes, tile, gains, channels, numChannels, start, count, attackCoef, releaseCoef);
+
+            // one gain computation for all the channels
+            for (int i = 0; i < count; ++i) {
+                smoothedMakeup = makeupTarget + 0.999f * smoothedMakeup;
+                const float over = std::max<float>(0.0f, knee + 20.0f * std::log10(gains[i]) - threshold);
+                const float kneefrac = std::min<float>(1.0f, std::max<float>(0.0f, invKnee * over));
+                const float reduction = ratioTerm * ((over * kneefrac) / (1.0f - ratioTerm * kneefrac));
+                gainReductionDb = reduction;
+                gains[i] = std::pow(10.0f, 0.05f * (smoothedMakeup + reduction));
+            }
+
+            applyGains(gains, channels, numChannels, start, count);
+        }
+    }
+
+    // the last gain reduction in dB (negative), like the outgain bargraph of the Faust version
+    float getGainReductionDb() const { return gainReductionDb; }
+
+private:
+    MultichannelDetail::Lanes envelopes[MultichannelDetail::maxLaneGroups];
+    float smoothedMakeup = 0.0f;
+    float invSampleRate = 1.0f / 48000.0f;
+
+    float threshold = -20.0f;
+    float ratioTerm = -1.0f;
+    float knee = 3.0f;
+    float attack = 0.002f;
+    float release = 0.5f;
+    float makeup = 0.0f;
+
+    float gainReductionDb = 0.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MultichannelCompressor)
+};
+
+
+// the faust expander/gate, linked across all channels
+class MultichannelExpander
+{
+public:
+    MultichannelExpander() {}
+
+    void init(double sampleRate)
+    {
+        invSampleRate = 1.0f / std::min<float>(192000.0f, std::max<float>(1.0f, (float) sampleRate));
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto & env : envelopes) {
+            env = {};
+        }
+    }
+
+    void setParameters(float thresholdDb, float ratio, float kneeDb, float attackSec, float releaseSec)
+    {
+        threshold = thresholdDb;
+        ratioTerm = 1.0f - ratio;
+        knee = kneeDb;
+        attack = attackSec;
+        release = releaseSec;
+    }
+
+    void compute(int numSamples, float * const * channels, int numChannels)
+    {
+        using namespace MultichannelDetail;
+
+        const float attackCoef = timeConstantCoef(attack, invSampleRate);
+        const float releaseCoef = timeConstantCoef(release, invSampleRate);
+        const float kneeThreshold = threshold + knee;
+        const float invKnee = 1.0f / (knee + 0.001f);
+
+        Lanes tile[tileSize];
+        float gains[tileSize];
+
+        for (int start = 0; start < numSamples; start += tileSize) {
+            const int count = std::min(tileSize, numSamples - start);
+
+            followEnvelopes(envelopes, tile, gains, channels, numChannels, start, count, attackCoef, releaseCoef);
+
+            for (int i = 0; i < count; ++i) {
+                const float under = std::max<float>(0.0f, kneeThreshold - 20.0f * std::log10(gains[i]));
+                const float reduction = ratioTerm * (under * std::min<float>(1.0f, std::max<float>(0.0f, invKnee * under)));
+                gainDb = reduction;
+                gains[i] = std::pow(10.0f, 0.05f * reduction);
+            }
+
+            applyGains(gains, channels, numChannels, start, count);
+        }
+    }
+
+    // the last gain in dB, like the gain bargraph of the Faust version
+    float getGainDb() const { return gainDb; }
+
+private:
+    MultichannelDetail::Lanes envelopes[MultichannelDetail::maxLaneGroups];
+    float invSampleRate = 1.0f / 48000.0f;
+
+    float threshold = -40.0f;
+    float ratioTerm = -1.0f;
+    float knee = 3.0f;
+    float attack = 0.001f;
+    float release = 0.1f;
+
+    float gainDb = 0.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MultichannelExpander)
+};
+
+
+// the faust parametric EQ (low shelf, 2 peaks, high shelf) on every channel with the same settings
+class MultichannelParametricEQ
+{
+public:
+    MultichannelParametricEQ() {}
+
+    void init(double sampleRate)
+    {
+        const float sr = std::min<float>(192000.0f, std::max<float>(1.0f, (float) sampleRate));
+        piOverSr = 3.14159274f / sr;
+        twoPiOverSr = 6.28318548f / sr;
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto & state : states) {
+            state = {};
+        }
+        smoothed = {};
+        coefsValid = false;
+    }
+
+    void setParameters(const ParametricEqParams & params)
+    {
+        target = params;
+    }
+
+    void compute(int numSamples, float * const * channels, int numChannels)
+    {
+        using namespace MultichannelDetail;
+
+        Lanes tile[tileSize];
+        Coefs coefs[tileSize];
+
+        const int groups = (numChannels + laneWidth - 1) / laneWidth;
+
+        for (int start = 0; start < numSamples; start += tileSize) {
+            const int count = std::min(tileSize, numSamples - start);
+
+            // the shared part, the smoothed settings and the filter coefficients
+            for (int i = 0; i < count; ++i) {
+                computeCoefs(coefs[i]);
+            }
+
+            // then every 4 channels through the filters
+            for (int g = 0; g < groups; ++g) {
+                loadTile(tile, channels, numChannels, g, start, count);
+                filterTile(states[g], coefs, tile, count);
+                storeTile(tile, channels, numChannels, g, start, count);
+            }
+        }
+    }
+
+private:
+    // the smoothed settings, one pole like the Faust si.smoo
+    struct Smoothed
+    {
+        float lowShelfFreq = 0.0f;
+        float lowShelfGain = 0.0f;
+        float para1Freq = 0.0f;
+        float para1Gain = 0.0f;
+        float para2Freq = 0.0f;
+        float para2Gain = 0.0f;
+        float para2Q = 0.0f;
+        float highShelfFreq = 0.0f;
+        float highShelfGain = 0.0f;
+
+        bool operator== (const Smoothed & o) const {
+            return lowShelfFreq == o.lowShelfFreq && lowShelfGain == o.lowShelfGain
+                && para1Freq == o.para1Freq && para1Gain == o.para1Gain
+                && para2Freq == o.para2Freq && para2Gain == o.para2Gain && para2Q == o.para2Q
+                && highShelfFreq == o.highShelfFreq && highShelfGain == o.highShelfGain;
+        }
+    };
+
+    // per sample, shared by all channels
+    struct Coefs
+    {
+        // low shelf, first and second order parts
+        float lsIn, lsA, lsInv3, lsD2, lsD1, lsH, lsG, lsInv8;
+        // the two peaks
+        float p1d1, p1a2, p1inv, p1b0, p1b2;
+        float p2d1, p2a2, p2inv, p2b0, p2b2;
+        // high shelf
+        float hsIn, hsA, hsInv3, hsD2, hsD1, hsHG, hsInv8;
+    };
+
+    // per 4 channels, the previous samples of every filter section
+    struct State
+    {
+        using Lanes = MultichannelDetail::Lanes;
+        Lanes v0, r5, r4a, r4b, r8, r7a, r7b;
+        Lanes r3a, r3b, r2a, r2b;
+        Lanes v1, r1, r0a, r0b, r18, r17a, r17b;
+    };
+
+    static float smoo(float targetValue, float prev) { return 0.001f * targetValue + 0.999f * prev; }
+    static float dbToGain(float db) { return std::pow(10.0f, 0.05f * db); }
+
+    void computeCoefs(Coefs & c)
+    {
+        Smoothed next;
+        next.lowShelfFreq = smoo(target.lowShelfFreq, smoothed.lowShelfFreq);
+        next.lowShelfGain = smoo(target.lowShelfGain, smoothed.lowShelfGain);
+        next.para1Freq = smoo(target.para1Freq, smoothed.para1Freq);
+        next.para1Gain = smoo(target.para1Gain, smoothed.para1Gain);
+        next.para2Freq = smoo(target.para2Freq, smoothed.para2Freq);
+        next.para2Gain = smoo(target.para2Gain, smoothed.para2Gain);
+        next.para2Q = smoo(target.para2Q, smoothed.para2Q);
+        next.highShelfFreq = smoo(target.highShelfFreq, smoothed.highShelfFreq);
+        next.highShelfGain = smoo(target.highShelfGain, smoothed.highShelfGain);
+
+        // once the smoothing has settled the coefficients don't change anymore
+        // (para1Q isn't smoothed, it's compared separately)
+        if (coefsValid && next == smoothed && lastPara1Q == target.para1Q) {
+            c = lastCoefs;
+            return;
+        }
+        smoothed = next;
+        lastPara1Q = target.para1Q;
+
+        const auto & s = smoothed;
+
+        // low shelf
+        {
+            const float t1 = std::tan(piOverSr * s.lowShelfFreq);
+            const float t2 = 1.0f / t1;
+            const float t3 = t2 + 1.0f;
+            const float t4 = 1.0f - t2;
+            const float t5 = ((t2 - 1.0f) / t1) + 1.0f;
+            const float t6 = t1 * t1;
+            const float t7 = 1.0f - (1.0f / t6);
+            const float t8 = ((t2 + 1.0f) / t1) + 1.0f;
+            c.lsIn = 1.0f / (t1 * t3);
+            c.lsA = t4 / t3;
+            c.lsInv3 = 1.0f / t3;
+            c.lsD2 = t5 / t8;
+            c.lsD1 = 2.0f * t7 / t8;
+            c.lsH = 1.0f / t6;
+            c.lsG = dbToGain(s.lowShelfGain);
+            c.lsInv8 = 1.0f / t8;
+        }
+
+        // first peak, its Q isn't smoothed
+        {
+            const float t9 = std::tan(piOverSr * s.para1Freq);
+            const float t10 = 1.0f / t9;
+            const float t12 = std::sin(twoPiOverSr * s.para1Freq);
+            const float q = piOverSr / target.para1Q;
+            const float t13 = q * ((s.para1Freq * dbToGain(std::fabs(s.para1Gain))) / t12);
+            const float t14 = q * (s.para1Freq / t12);
+            const bool boost = s.para1Gain > 0.0f;
+            const float t15 = boost ? t14 : t13;
+            const float t18 = boost ? t13 : t14;
+            const float t17 = ((t10 + t15) / t9) + 1.0f;
+            c.p1d1 = 2.0f * (1.0f - (1.0f / (t9 * t9)));
+            c.p1a2 = ((t10 - t15) / t9) + 1.0f;
+            c.p1inv = 1.0f / t17;
+            c.p1b0 = ((t10 + t18) / t9) + 1.0f;
+            c.p1b2 = ((t10 - t18) / t9) + 1.0f;
+        }
+
+        // second peak
+        {
+            const float t19 = std::tan(piOverSr * s.para2Freq);
+            const float t20 = 1.0f / t19;
+            const float t22 = s.para2Q * std::sin(twoPiOverSr * s.para2Freq);
+            const float t23 = piOverSr * ((s.para2Freq * dbToGain(std::fabs(s.para2Gain))) / t22);
+            const float t24 = piOverSr * (s.para2Freq / t22);
+            const bool boost = s.para2Gain > 0.0f;
+            const float t25 = boost ? t24 : t23;
+            const float t28 = boost ? t23 : t24;
+            const float t27 = ((t20 + t25) / t19) + 1.0f;
+            c.p2d1 = 2.0f * (1.0f - (1.0f / (t19 * t19)));
+            c.p2a2 = ((t20 - t25) / t19) + 1.0f;
+            c.p2inv = 1.0f / t27;
+            c.p2b0 = ((t20 + t28) / t19) + 1.0f;
+            c.p2b2 = ((t20 - t28) / t19) + 1.0f;
+        }
+
+        // high shelf
+        {
+            const float t31 = std::tan(piOverSr * s.highShelfFreq);
+            const float t32 = 1.0f / t31;
+            const float t33 = t32 + 1.0f;
+            const float t34 = 1.0f - t32;
+            const float t35 = ((t32 - 1.0f) / t31) + 1.0f;
+            const float t36 = t31 * t31;
+            const float t37 = 1.0f - (1.0f / t36);
+            const float t38 = ((t32 + 1.0f) / t31) + 1.0f;
+            c.hsIn = 1.0f / (t31 * t33);
+            c.hsA = t34 / t33;
+            c.hsInv3 = 1.0f / t33;
+            c.hsD2 = t35 / t38;
+            c.hsD1 = 2.0f * t37 / t38;
+            c.hsHG = dbToGain(s.highShelfGain) / t36;
+            c.hsInv8 = 1.0f / t38;
+        }
+
+        lastCoefs = c;
+        coefsValid = true;
+    }
+
+    static void filterTile(State & st, const Coefs * coefs, MultichannelDetail::Lanes * tile, int count)
+    {
+        using namespace MultichannelDetail;
+
+        State s = st;
+
+        for (int i = 0; i < count; ++i) {
+            const Coefs & c = coefs[i];
+            float * io = tile[i].v;
+
+            for (int l = 0; l < laneWidth; ++l) {
+                const float x = io[l];
+
+                // low shelf, the shelved low part plus the remaining high part
+                const float r5 = (x - s.v0.v[l]) * c.lsIn - s.r5.v[l] * c.lsA;
+                const float r4 = r5 - s.r4b.v[l] * c.lsD2 - s.r4a.v[l] * c.lsD1;
+                const float r8 = (x + s.v0.v[l]) * c.lsInv3 - s.r8.v[l] * c.lsA;
+                const float r7 = r8 - s.r7b.v[l] * c.lsD2 - s.r7a.v[l] * c.lsD1;
+                const float low = ((r4 + s.r4b.v[l] - 2.0f * s.r4a.v[l]) * c.lsH + (r7 + s.r7b.v[l] + 2.0f * s.r7a.v[l]) * c.lsG) * c.lsInv8;
+
+                // peak 1
+                const float r3 = low - (s.r3b.v[l] * c.p1a2 + s.r3a.v[l] * c.p1d1) * c.p1inv;
+                const float p1 = (s.r3a.v[l] * c.p1d1 + r3 * c.p1b0 + s.r3b.v[l] * c.p1b2) * c.p1inv;
+
+                // peak 2
+                const float r2 = p1 - (s.r2b.v[l] * c.p2a2 + s.r2a.v[l] * c.p2d1) * c.p2inv;
+                const float p2 = (s.r2a.v[l] * c.p2d1 + r2 * c.p2b0 + s.r2b.v[l] * c.p2b2) * c.p2inv;
+
+                // high shelf, the shelved high part plus the remaining low part
+                const float r1 = (p2 - s.v1.v[l]) * c.hsIn - s.r1.v[l] * c.hsA;
+                const float r0 = r1 - s.r0b.v[l] * c.hsD2 - s.r0a.v[l] * c.hsD1;
+                const float r18 = (p2 + s.v1.v[l]) * c.hsInv3 - s.r18.v[l] * c.hsA;
+                const float r17 = r18 - s.r17b.v[l] * c.hsD2 - s.r17a.v[l] * c.hsD1;
+                io[l] = ((r0 + s.r0b.v[l] - 2.0f * s.r0a.v[l]) * c.hsHG + (r17 + s.r17b.v[l] + 2.0f * s.r17a.v[l])) * c.hsInv8;
+
+                s.v0.v[l] = x;
+                s.r5.v[l] = r5;
+                s.r4b.v[l] = s.r4a.v[l]; s.r4a.v[l] = r4;
+                s.r8.v[l] = r8;
+                s.r7b.v[l] = s.r7a.v[l]; s.r7a.v[l] = r7;
+                s.r3b.v[l] = s.r3a.v[l]; s.r3a.v[l] = r3;
+                s.r2b.v[l] = s.r2a.v[l]; s.r2a.v[l] = r2;
+                s.v1.v[l] = p2;
+                s.r1.v[l] = r1;
+                s.r0b.v[l] = s.r0a.v[l]; s.r0a.v[l] = r0;
+                s.r18.v[l] = r18;
+                s.r17b.v[l] = s.r17a.v[l]; s.r17a.v[l] = r17;
+            }
+        }
+
+        st = s;
+    }
+
+    State states[MultichannelDetail::maxLaneGroups];
+    ParametricEqParams target;
+    Smoothed smoothed;
+    float lastPara1Q = 0.0f;
+    Coefs lastCoefs;
+    bool coefsValid = false;
+
+    float piOverSr = 3.14159274f / 48000.0f;
+    float twoPiOverSr = 6.28318548f / 48000.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MultichannelParametricEQ)
+};
+
+}
@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2020 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+namespace SonoAudio
+{
+
+/*
+ Simulates a bad network path for datagrams: delay with a configurable
+ jitter distribution, Gilbert-Elliott burst loss, reordering, duplication
+ and a bandwidth cap with a drop-tail queue.
+
+ It doesn't look at any clock itself, the caller passes the current time
+ (in seconds) to push() and popDue(), so it can run against the real clock
+ or a virtual one. For the same settings (including the seed) and the same
+ sequence of calls the outcome is always the same.
+
+ Not thread safe, the caller has to serialize all calls.
+ */
+class NetworkImpairment
+{
+public:
+    enum JitterDistribution {
+        JitterUniform = 0,
+        JitterNormal,
+        JitterExponential,
+        JitterPareto // heavy tail, occasional very late packets
+    };
+
+    struct Settings
+    {
+        double delayMs = 0.0; // fixed one-way delay
+        double jitterMs = 0.0; // scale of the random extra delay
+        int jitterDistribution = JitterExponential;
+
+        // Gilbert-Elliott loss: per packet transition probabilities between
+        // the good and the bad state, and the loss probability in each of them
+        float goodToBad = 0.0f;
+        float badToGood = 1.0f;
+        float lossGood = 0.0f;
+        float lossBad = 1.0f;
+
+        float reorderProb = 0.0f; // held back by reorderMs, so later ones overtake it
+        double reorderMs = 10.0;
+        float duplicateProb = 0.0f;
+
+        double bandwidthKbps = 0.0; // 0 is unlimited
+        double maxQueueMs = 200.0; // packets that would wait longer for the link are dropped
+
+        int64 seed = 1;
+
+        bool isActive() const {
+            return delayMs > 0.0 || jitterMs > 0.0 || goodToBad > 0.0f || lossGood > 0.0f
+                || reorderProb > 0.0f || duplicateProb > 0.0f || bandwidthKbps > 0.0;
+        }
+    };
+
+    struct Stats
+    {
+        int64 packetsIn = 0;
+        int64 delivered = 0;
+        int64 lost = 0;
+        int64 queueDropped = 0;
+        int64 reordered = 0;
+        int64 duplicated = 0;
+    };
+
+    NetworkImpairment() {}
+
+    explicit NetworkImpairment(const Settings & settings_) { setSettings(settings_); }
+
+    void setSettings(const Settings & settings_)
+    {
+        settings = settings_;
+        random.setSeed(settings.seed);
+        badState = false;
+    }
+
+    const Settings & getSettings() const { return settings; }
+
+    const Stats & getStats() const { return stats; }
+    void resetStats() { stats = Stats(); }
+
+    int getNumPending() const { return pending.size(); }
+
+    // drop everything in flight
+    void clear()
+    {
+        pending.clear();
+        lastDueTime = 0.0;
+        linkFreeTime = 0.0;
+    }
+
+    // returns false if the packet was dropped
+    bool push(const void * data, int size, void * tag, double now)
+    {
+        ++stats.packetsIn;
+
+        // burst loss
+        if (badState) {
+            if (random.nextFloat() < settings.badToGood) badState = false;
+        } else {
+            if (random.nextFloat() < settings.goodToBad) badState = true;
+        }
+        if (random.nextFloat() < (badState ? settings.lossBad : settings.lossGood)) {
+            ++stats.lost;
+            return false;
+        }
+
+        // the link serializes the packets, and only queues so much
+        double sendtime = now;
+        if (settings.bandwidthKbps > 0.0) {
+            const double start = jmax(now, linkFreeTime);
+            if ((start - now) * 1e3 > settings.maxQueueMs) {
+                ++stats.queueDropped;
+                return false;
+            }
+            linkFreeTime = start + (size * 8.0) / (settings.bandwidthKbps * 1e3);
+            sendtime = linkFreeTime;
+        }
+
+        double due = sendtime + (settings.delayMs + nextJitterMs()) * 1e-3;
+
+        if (settings.reorderProb > 0.0f && random.nextFloat() < settings.reorderProb) {
+            due += settings.reorderMs * 1e-3;
+            ++stats.reordered;
+        } else {
+            // jitter alone doesn't reorder, like a real queue
+            due = jmax(due, lastDueTime);
+            lastDueTime = due;
+        }
+
+        addPacket(data, size, tag, due);
+
+        if (settings.duplicateProb > 0.0f && random.nextFloat() < settings.duplicateProb) {
+            addPacket(data, size, tag, due + nextJitterMs() * 1e-3);
+            ++stats.duplicated;
+        }
+        return true;
+    }
+
+    // time the next packet is due, or < 0 if there is none
+    double getNextDueTime() const
+    {
+        return pending.isEmpty() ? -1.0 : pending.getUnchecked(0)->due;
+    }
+
+    // hands all packets due at 'now' to deliver(const char * data, int size, void * tag), in order
+    template<typename Function>
+    int popDue(double now, Function && deliver)
+    {
+        int count = 0;
+        while (!pending.isEmpty() && pending.getUnchecked(0)->due <= now) {
+            std::unique_ptr<Packet> packet (pending.removeAndReturn(0));
+            deliver(static_cast<const char*>(packet->data.getData()), (int) packet->data.getSize(), packet->tag);
+            ++stats.delivered;
+            ++count;
+        }
+        return count;
+    }
+
+    // "delay=40,jitter=10,dist=pareto,p=0.01,r=0.3,lossbad=0.8,reorder=0.01,dup=0.001,kbps=2000,seed=3"
+    static bool parseSettings(const String & spec, Settings & retsettings)
+    {
+        Settings s;
+        auto tokens = StringArray::fromTokens(spec, ",; ", "");
+        tokens.removeEmptyStrings();
+
+        for (auto & token : tokens) {
+            auto key = token.upToFirstOccurrenceOf("=", false, false).trim().toLowerCase();
+            auto value = token.fromFirstOccurrenceOf("=", false, false).trim();
+            if (value.isEmpty()) return false;
+
+            if (key == "delay") s.delayMs = value.getDoubleValue();
+            else if (key == "jitter") s.jitterMs = value.getDoubleValue();
+            else if (key == "dist") {
+                if (value == "uniform") s.jitterDistribution = JitterUniform;
+                else if (value == "normal") s.jitterDistribution = JitterNormal;
+                else if (value == "exp") s.jitterDistribution = JitterExponential;
+                else if (value == "pareto") s.jitterDistribution = JitterPareto;
+                else return false;
+            }
+            else if (key == "loss") s.lossGood = value.getFloatValue(); // independent loss
+            else if (key == "p") s.goodToBad = value.getFloatValue();
+            else if (key == "r") s.badToGood = value.getFloatValue();
+            else if (key == "lossgood") s.lossGood = value.getFloatValue();
+            else if (key == "lossbad") s.lossBad = value.getFloatValue();
+            else if (key == "reorder") s.reorderProb = value.getFloatValue();
+            else if (key == "reorderms") s.reorderMs = value.getDoubleValue();
+            else if (key == "dup") s.duplicateProb = value.getFloatValue();
+            else if (key == "kbps") s.bandwidthKbps = value.getDoubleValue();
+            else if (key == "queuems") s.maxQueueMs = value.getDoubleValue();
+            else if (key == "seed") s.seed = value.getLargeIntValue();
+            else return false;
+        }
+
+        retsettings = s;
+        return true;
+    }
+
+private:
+
+    struct Packet
+    {
+        MemoryBlock data;
+        void * tag;
+        double due;
+    };
+
+    void addPacket(const void * data, int size, void * tag, double due)
+    {
+        auto packet = new Packet { MemoryBlock(data, (size_t) size), tag, due };
+
+        // keep sorted by due time, usually it goes at the end
+        int index = pending.size();
+        while (index > 0 && pending.getUnchecked(index - 1)->due > due) {
+            --index;
+        }
+        pending.insert(index, packet);
+    }
+
+    double nextJitterMs()
+    {
+        if (settings.jitterMs <= 0.0) return 0.0;
+
+        const double u = random.nextDouble();
+        switch (settings.jitterDistribution) {
+            case JitterUniform:
+                return u * settings.jitterMs;
+            case JitterNormal: {
+                // half normal, so it only ever adds delay
+                const double u2 = jmax(1e-12, random.nextDouble());
+                return std::abs(std::sqrt(-2.0 * std::log(u2)) * std::cos(MathConstants<double>::twoPi * u)) * settings.jitterMs;
+            }
+            case JitterPareto: {
+                const double alpha = 2.5;
+                return settings.jitterMs * (std::pow(1.0 - u, -1.0 / alpha) - 1.0) * (alpha - 1.0);
+            }
+            case JitterExponential:
+            default:
+                return -std::log(jmax(1e-12, 1.0 - u)) * settings.jitterMs;
+        }
+    }
+
+    Settings settings;
+    Stats stats;
+    Random random { 1 };
+    bool badState = false;
+    double lastDueTime = 0.0;
+    double linkFreeTime = 0.0;
+    OwnedArray<Packet> pending;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NetworkImpairment)
+};
+
+}
@@ -477,6 +477,7 @@ PeerViewInfo * PeersContainerView::createPeerViewInfo()
     pvf->autosizeButton->addItem(TRANS("Auto Up"), SonobusAudioProcessor::AutoNetBufferModeAutoIncreaseOnly);
     pvf->autosizeButton->addItem(TRANS("Auto"), SonobusAudioProcessor::AutoNetBufferModeAutoFull);
     pvf->autosizeButton->addItem(TRANS("Initial Auto"), SonobusAudioProcessor::AutoNetBufferModeInitAuto);    
+    pvf->autosizeButton->addItem(TRANS("Statistical"), SonobusAudioProcessor::AutoNetBufferModeStatistical);
     pvf->autosizeButton->addListener(this);
     
     pvf->bufferMinButton = std::make_unique<SonoDrawableButton>("", DrawableButton::ButtonStyle::ImageFitted);
@@ -1739,6 +1740,7 @@ void PeersContainerView::updatePeerViews(int specific)
         String buflab = (autobufmode == SonobusAudioProcessor::AutoNetBufferModeOff ? "" :
                          autobufmode == SonobusAudioProcessor::AutoNetBufferModeAutoIncreaseOnly ? " (Auto+)" :
                          autobufmode == SonobusAudioProcessor::AutoNetBufferModeInitAuto ? ( initCompleted ? " (IA-Man)" : " (IA-Auto)"  ) :
+                         autobufmode == SonobusAudioProcessor::AutoNetBufferModeStatistical ? " (Stat)" :
                          " (Auto)");
         pvf->bufferLabel->setText(String::formatted("%d ms", (int) lrintf(buftimeMs)) + buflab, dontSendNotification);
 
@@ -1892,6 +1894,14 @@ void PeersContainerView::timerCallback(int timerId)
             if (processor.getRemotePeerReceiveBufferFillRatio(i, ratio, stdev)) {
                 pvf->jitterBufferMeter->setFillRatio(ratio, stdev);
             }
+
+            float delayms, medianms, maxms;
+            float buftimems = processor.getRemotePeerBufferTime(i);
+            if (buftimems > 0.0f && processor.getRemotePeerArrivalJitter(i, delayms, medianms, maxms)) {
+                pvf->jitterBufferMeter->setDelayMarker(delayms / buftimems);
+            } else {
+                pvf->jitterBufferMeter->setDelayMarker(-1.0f);
+            }
         }
     }
 }
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2020 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+
+namespace SonoAudio
+{
+
+/*
+ A small pool of pre-spawned realtime threads for splitting independent
+ jobs of an audio callback across cores.
+
+ run() is called from the audio thread, which also works on the jobs
+ itself and returns once all of them are done. Nothing is allocated or
+ locked there, the only system call is waking the (already running)
+ workers. If the workers are late, the audio thread just ends up doing
+ more of the jobs itself, so each job must only touch its own data.
+
+ A job is only started by whoever flips its state from pending to taken,
+ so a job a worker has claimed but not started by the deadline (because
+ it was preempted in between) is run by the audio thread instead. Jobs
+ that are already running have to be waited for.
+ */
+class RealtimeWorkerPool
+{
+public:
+    typedef void (*JobFunction)(void * context, int index);
+
+    // jobs past this are run by the audio thread itself
+    static constexpr int maxJobs = 256;
+
+    RealtimeWorkerPool() {}
+    ~RealtimeWorkerPool() { stop(); }
+
+    // not from the audio thread
+    void start(int numThreads)
+    {
+        stop();
+
+        for (int i=0; i < numThreads; ++i) {
+            auto worker = workers.add(new Worker(*this));
+#if JUCE_WINDOWS
+            // do not use startRealtimeThread() call because it triggers the whole process to be realtime, which we don't want
+            worker->startThread(Thread::Priority::highest);
+#else
+            // as high as the audio thread itself (hopefully)
+            if (!worker->startRealtimeThread({ 8, 1 })) {
+                DBG("Worker thread failed to start realtime: trying regular");
+                worker->startThread(Thread::Priority::highest);
+            }
+#endif
+        }
+        running = numThreads > 0;
+    }
+
+    // not from the audio thread
+    void stop()
+    {
+        running = false;
+        for (auto worker : workers) {
+            worker->signalThreadShouldExit();
+            worker->wakeup.signal();
+        }
+        for (auto worker : workers) {
+            worker->stopThread(400);
+        }
+        workers.clear();
+    }
+
+    bool isRunning() const { return running.load(); }
+    int getNumThreads() const { return workers.size(); }
+
+    // run job(context, i) for all i in [0, count), returns when they're all done.
+    // Jobs the workers claimed but haven't started after maxWaitSeconds are run here.
+    void run(JobFunction job, void * context, int count, double maxWaitSeconds)
+    {
+        if (count <= 0) return;
+
+        const int pooled = jmin(count, maxJobs);
+
+        currentJob = job;
+        currentContext = context;
+        remaining.store(pooled, std::memory_order_relaxed);
+
+        generation = (generation + 1) & 0xffff;
+        for (int i=0; i < pooled; ++i) {
+            jobStates[i].store(generation << 1, std::memory_order_relaxed);
+        }
+
+        // publish generation + count + index 0 all at once, so a late worker
+        // from the last round can never claim a job of this one with stale values
+        state.store(((uint64) generation << 48) | ((uint64) pooled << 32), std::memory_order_release);
+
+        const int wakecount = jmin(pooled - 1, workers.size());
+        for (int i=0; i < wakecount; ++i) {
+            workers.getUnchecked(i)->wakeup.signal();
+        }
+
+        // help out
+        runJobs();
+
+        for (int i = pooled; i < count; ++i) {
+            job(context, i);
+        }
+
+        // wait for the ones the workers claimed
+        const auto deadline = Time::getHighResolutionTicks() + Time::secondsToHighResolutionTicks(maxWaitSeconds);
+        bool tookover = false;
+
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            if (!tookover && Time::getHighResolutionTicks() >= deadline) {
+                // whatever hasn't been started yet is done here, the rest is running
+                for (int i=0; i < pooled; ++i) {
+                    runJob(generation, (uint32) i);
+                }
+                tookover = true;
+            }
+        }
+    }
+
+private:
+
+    class Worker : public Thread
+    {
+    public:
+        Worker(RealtimeWorkerPool & pool_) : Thread("SonoBusWorker"), pool(pool_) {}
+
+        void run() override {
+            while (!threadShouldExit()) {
+                wakeup.wait(100);
+                pool.runJobs();
+            }
+        }
+
+        RealtimeWorkerPool & pool;
+        WaitableEvent wakeup;
+    };
+
+    void runJobs()
+    {
+        while (true) {
+            auto s = state.load(std::memory_order_acquire);
+            const uint32 index = (uint32) (s & 0xffffffff);
+            const uint32 count = (uint32) ((s >> 32) & 0xffff);
+            if (index >= count) {
+                break;
+            }
+            if (state.compare_exchange_weak(s, s + 1, std::memory_order_acq_rel)) {
+                runJob((uint32) (s >> 48), index);
+            }
+        }
+    }
+
+    // runs the job unless someone else already started it, or it belongs to an earlier round
+    void runJob(uint32 gen, uint32 index)
+    {
+        uint32 expected = gen << 1;
+        if (jobStates[index].compare_exchange_strong(expected, expected | 1, std::memory_order_acq_rel)) {
+            currentJob(currentContext, (int) index);
+            remaining.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    OwnedArray<Worker> workers;
+    std::atomic<bool> running { false };
+
+    // [generation:16][count:16][next index:32]
+    std::atomic<uint64> state { 0 };
+    std::atomic<int> remaining { 0 };
+    // [generation:16][taken:1] per job
+    std::atomic<uint32> jobStates[maxJobs] {};
+    JobFunction currentJob = nullptr;
+    void * currentContext = nullptr;
+    uint32 generation = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RealtimeWorkerPool)
+};
+
+}
@@ -0,0 +1,594 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2020 Jesse Chappell
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "TripleBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace SonoAudio
+{
+
+/*
+ Mixes the buffers we send to each peer: our send mix plus whatever other
+ peers are cross-routed to it, for all destinations in one pass.
+
+ The routing is set up as a dense gain matrix per destination (its send
+ channels by the source channels routed to it) between beginUpdate() and
+ endUpdate(), which only needs to happen when the routing or the pans
+ changed. endUpdate() then compiles the matrices into a plan:
+
+ - every distinct row of a source's gains (one pan of one source) becomes
+   a bus, mixed once per block no matter how many destinations get it
+ - a destination channel is the send mix plus its buses, or, if it gets
+   most of the buses of that channel, the total of them minus the few it
+   doesn't get. A cue mix of everyone to everyone is linear in the number
+   of peers that way, instead of quadratic.
+
+ process() walks the block in short tiles, so the sources, the buses and the
+ totals of a tile are still in the cache while every destination is mixed
+ from them. A gain that differs from the last compiled one is ramped over the
+ next block, the same way AudioBuffer::addFromWithRamp() would.
+
+ The updates happen on some other thread than the audio thread (one at a time),
+ where compiling allocates the plan and its output buffers. The plans are handed
+ over through a TripleBuffer, the audio thread switches to the newest one with
+ usePublishedPlan() and never allocates.
+
+ The destinations and sources are indices into the peers while the routing is
+ set, and each of them has a key that identifies the peer for good. The audio
+ thread finds them by key, so a plan keeps working when peers come and go
+ until the next update: a peer that left mixes as silence, a new one isn't
+ routed yet.
+ */
+class SendMatrixMixer
+{
+public:
+    SendMatrixMixer() {}
+
+    // what the next update sizes the plan for, only grows. it doesn't allocate,
+    // so the audio thread can call it, until the update the current plan
+    // keeps working for the blocks it fits, see canProcess()
+    void prepare(int maxDestinations_, int maxSources_, int maxChannels_, int maxSamples_)
+    {
+        bool grown = growTo(maxDestinations, maxDestinations_);
+        grown = growTo(maxSources, maxSources_) || grown;
+        grown = growTo(maxChannels, maxChannels_) || grown;
+        grown = growTo(maxSamples, maxSamples_) || grown;
+        if (grown) {
+            layoutChanged = true;
+        }
+    }
+
+    //==========================================================================
+    // compiling the routing, not on the audio thread
+
+    // whether prepare() changed the layout since the last update
+    bool needsUpdate() const { return layoutChanged.load(); }
+
+    void beginUpdate()
+    {
+        newDestinations.clear();
+        newInputs.clear();
+        newGains.clear();
+        newStartGains.clear();
+        staging.clear();
+        building = -1;
+        layoutChanged = false;
+        buildDestinations = maxDestinations.load(std::memory_order_acquire);
+        buildSources = maxSources.load(std::memory_order_acquire);
+        buildChannels = maxChannels.load(std::memory_order_acquire);
+        buildSamples = maxSamples.load(std::memory_order_acquire);
+        newKeys.assign((size_t) jmax(buildDestinations, buildSources), 0);
+    }
+
+    // the peer at this index (as a destination or a source) while the routing
+    // is set, key is nonzero and never used for another peer
+    void setKey(int index, uint64 key)
+    {
+        if (index < 0 || index >= (int) newKeys.size()) return;
+        newKeys[(size_t) index] = key;
+    }
+
+    // the following setGain() calls are for this destination, which gets
+    // our send mix on its first numChannels channels plus the routed sources
+    void addDestination(int index, int numChannels)
+    {
+        finishDestination();
+        if (index < 0 || index >= buildDestinations) return;
+
+        Destination dest;
+        dest.index = index;
+        dest.numChannels = jlimit(0, buildChannels, numChannels);
+        dest.firstInput = (int) newInputs.size();
+        newDestinations.push_back(dest);
+        building = (int) newDestinations.size() - 1;
+    }
+
+    // gain of a source channel in a channel of the current destination,
+    // adds up if the same pair is set more than once
+    void setGain(int channel, int source, int sourceChannel, float gain)
+    {
+        if (building < 0 || source < 0 || source >= buildSources) return;
+        auto & dest = newDestinations[(size_t) building];
+        if (channel < 0 || channel >= dest.numChannels) return;
+
+        int input = dest.firstInput;
+        for ( ; input < (int) newInputs.size(); ++input) {
+            if (newInputs[(size_t) input].source == source && newInputs[(size_t) input].channel == sourceChannel) break;
+        }
+        if (input == (int) newInputs.size()) {
+            newInputs.push_back({ source, sourceChannel });
+        }
+
+        staging.push_back({ channel, input - dest.firstInput, gain });
+    }
+
+    // compiles and publishes the plan
+    void endUpdate()
+    {
+        finishDestination();
+
+        std::swap(destinations, newDestinations);
+        std::swap(inputs, newInputs);
+        std::swap(gains, newGains);
+        std::swap(startGains, newStartGains);
+        std::swap(keys, newKeys);
+
+        compile(plans.getWriteSlot());
+        plans.publish();
+    }
+
+    //==========================================================================
+    // audio thread
+
+    // call at the start of every block, before setSource(). switches to the plan
+    // endUpdate() published last, if there's a new one, and forgets the sources
+    // of the last block, they might be gone
+    void usePublishedPlan()
+    {
+        if (auto * plan = plans.getNewValue()) {
+            active = plan;
+        }
+        if (active) {
+            std::fill(active->sources.begin(), active->sources.end(), Source());
+        }
+    }
+
+    // whether there's anything routed and the plan has room for the block
+    bool canProcess(int numSamples) const
+    {
+        return active && !active->rows.empty() && numSamples <= active->output.getNumSamples();
+    }
+
+    // the channels of the peer with this key for this block, before process().
+    // index is where it is now, which is usually where it was when the plan was compiled
+    void setSource(int index, uint64 key, const float * const * channels, int numChannels)
+    {
+        const int slot = findSlot(index, key);
+        if (slot < 0 || slot >= (int) active->sources.size()) return;
+        active->sources[(size_t) slot] = { channels, numChannels };
+    }
+
+    // the mix for the peer with this key after process(),
+    // nullptr if nothing is routed to it and it gets the plain send mix
+    const float * const * getOutput(int index, uint64 key) const
+    {
+        const int slot = findSlot(index, key);
+        if (slot < 0 || slot >= (int) active->destinationSlots.size() || active->destinationSlots[(size_t) slot] < 0) return nullptr;
+        return active->output.getArrayOfReadPointers() + slot * active->channelsPerOutput;
+    }
+
+    // mixes all destinations, sendMix is added to every one of them as is
+    void process(const float * const * sendMix, int numSendMixChannels, int numSamples)
+    {
+        if (!canProcess(numSamples)) return;
+
+        auto & plan = *active;
+        const int numChannels = plan.channelsPerOutput;
+
+        const float * zeros = plan.scratch.data();
+        float * totalscratch = plan.scratch.data() + tileSize;
+        float * busscratch = totalscratch + (size_t) numChannels * tileSize;
+
+        for (int start = 0; start < numSamples; start += tileSize) {
+            const int len = jmin(tileSize, numSamples - start);
+
+            // every bus once
+            for (size_t b = 0; b < plan.buses.size(); ++b) {
+                plan.busPointers[b] = mixBus(plan, plan.buses[b], busscratch + b * tileSize, zeros, start, len, numSamples);
+            }
+
+            // the totals the mix-minus rows need
+            for (int c = 0; c < numChannels; ++c) {
+                const auto & total = plan.channelTotals[(size_t) c];
+                if (!total.needed) continue;
+
+                float * sum = totalscratch + (size_t) c * tileSize;
+                FloatVectorOperations::clear(sum, len);
+                for (auto b : total.buses) {
+                    FloatVectorOperations::add(sum, plan.busPointers[(size_t) b], len);
+                }
+            }
+
+            for (auto & row : plan.rows) {
+                float * out = plan.output.getWritePointer(row.output, start);
+
+                if (row.channel < numSendMixChannels) {
+                    FloatVectorOperations::copy(out, sendMix[row.channel] + start, len);
+                } else {
+                    FloatVectorOperations::clear(out, len);
+                }
+
+                const int * rowbuses = plan.rowBuses.data() + row.firstBus;
+                if (row.minus) {
+                    FloatVectorOperations::add(out, totalscratch + (size_t) row.channel * tileSize, len);
+                    for (int n = 0; n < row.numBuses; ++n) {
+                        FloatVectorOperations::subtract(out, plan.busPointers[(size_t) rowbuses[n]], len);
+                    }
+                } else {
+                    for (int n = 0; n < row.numBuses; ++n) {
+                        FloatVectorOperations::add(out, plan.busPointers[(size_t) rowbuses[n]], len);
+                    }
+                }
+            }
+        }
+
+        // the plan is ours until the next one, the ramps are done now
+        if (plan.ramping) {
+            for (auto & term : plan.terms) term.startGain = term.endGain;
+            plan.ramping = false;
+        }
+    }
+
+private:
+
+    struct Source
+    {
+        const float * const * channels = nullptr;
+        int numChannels = 0;
+    };
+
+    struct Input
+    {
+        int source;
+        int channel;
+    };
+
+    struct Destination
+    {
+        int index = 0;
+        int numChannels = 0;
+        int firstInput = 0;
+        int numInputs = 0;
+        int firstGain = 0; // numChannels x numInputs, by channel
+    };
+
+    struct Route
+    {
+        int channel;
+        int input;
+        float gain;
+    };
+
+    // one source channel of a bus
+    struct Term
+    {
+        int channel;
+        float startGain;
+        float endGain;
+    };
+
+    // the gains of one source for one destination channel
+    struct Bus
+    {
+        int source;
+        int firstTerm;
+        int numTerms;
+    };
+
+    // one channel of one destination
+    struct Row
+    {
+        int output;
+        int channel;
+        // the buses are the ones to subtract from the channel total
+        bool minus;
+        int firstBus;
+        int numBuses;
+    };
+
+    // all buses the rows of a channel use
+    struct ChannelTotal
+    {
+        std::vector<int> buses;
+        bool needed = false;
+    };
+
+    // what the audio thread needs of a compiled routing
+    struct Plan
+    {
+        int channelsPerOutput = 0;
+        // by index when the routing was set
+        std::vector<uint64> keys;
+        std::vector<int> destinationSlots;
+        std::vector<Source> sources;
+        std::vector<Bus> buses;
+        std::vector<Term> terms;
+        std::vector<Row> rows;
+        std::vector<int> rowBuses;
+        std::vector<ChannelTotal> channelTotals;
+        bool ramping = false;
+
+        // maxDestinations x maxChannels
+        AudioBuffer<float> output;
+
+        // per tile: zeros, the channel totals, then the buses
+        std::vector<float> scratch;
+        std::vector<const float *> busPointers;
+    };
+
+    // small enough that a tile of every source and bus stays in the cache
+    static constexpr int tileSize = 128;
+
+    static bool growTo(std::atomic<int> & value, int newValue)
+    {
+        int current = value.load();
+        while (newValue > current) {
+            if (value.compare_exchange_weak(current, newValue)) return true;
+        }
+        return false;
+    }
+
+    int findSlot(int index, uint64 key) const
+    {
+        if (!active || key == 0) return -1;
+        const auto & slotkeys = active->keys;
+        if (index >= 0 && index < (int) slotkeys.size() && slotkeys[(size_t) index] == key) return index;
+
+        for (size_t slot = 0; slot < slotkeys.size(); ++slot) {
+            if (slotkeys[slot] == key) return (int) slot;
+        }
+        return -1;
+    }
+
+    // the destination the last compiled routing had for the same peer
+    const Destination * findPreviousDestination(uint64 key) const
+    {
+        if (key == 0) return nullptr;
+        for (auto & dest : destinations) {
+            if (keys[(size_t) dest.index] == key) return &dest;
+        }
+        return nullptr;
+    }
+
+    const float * mixBus(const Plan & plan, const Bus & bus, float * scratchtile, const float * zeros, int start, int len, int numSamples) const
+    {
+        const auto & src = plan.sources[(size_t) bus.source];
+        bool first = true;
+
+        for (int t = 0; t < bus.numTerms; ++t) {
+            const auto & term = plan.terms[(size_t) (bus.firstTerm + t)];
+            if (term.channel >= src.numChannels) continue;
+            const float * in = src.channels[term.channel] + start;
+
+            if (term.startGain == term.endGain) {
+                // a single source channel at unity needs no mixing at all
+                if (bus.numTerms == 1 && term.endGain == 1.0f) return in;
+
+                if (first) FloatVectorOperations::copyWithMultiply(scratchtile, in, term.endGain, len);
+                else FloatVectorOperations::addWithMultiply(scratchtile, in, term.endGain, len);
+            }
+            else {
+                const float increment = (term.endGain - term.startGain) / numSamples;
+                float gain = term.startGain + increment * start;
+                for (int i = 0; i < len; ++i) {
+                    scratchtile[i] = (first ? 0.0f : scratchtile[i]) + in[i] * gain;
+                    gain += increment;
+                }
+            }
+            first = false;
+        }
+
+        return first ? zeros : scratchtile;
+    }
+
+    // lay out the dense matrix of the destination being built, ramping from
+    // what the last compiled routing had for the same route
+    void finishDestination()
+    {
+        if (building < 0) return;
+
+        auto & dest = newDestinations[(size_t) building];
+        dest.numInputs = (int) newInputs.size() - dest.firstInput;
+        dest.firstGain = (int) newGains.size();
+        newGains.resize(newGains.size() + (size_t) (dest.numChannels * dest.numInputs), 0.0f);
+
+        for (auto & route : staging) {
+            newGains[(size_t) (dest.firstGain + route.channel * dest.numInputs + route.input)] += route.gain;
+        }
+        staging.clear();
+
+        newStartGains.resize(newGains.size());
+        const Destination * prev = findPreviousDestination(newKeys[(size_t) dest.index]);
+
+        for (int n = 0; n < dest.numInputs; ++n) {
+            const auto & input = newInputs[(size_t) (dest.firstInput + n)];
+            const uint64 sourcekey = newKeys[(size_t) input.source];
+            int prevn = -1;
+            for (int pn = 0; prev && sourcekey != 0 && pn < prev->numInputs; ++pn) {
+                const auto & pinput = inputs[(size_t) (prev->firstInput + pn)];
+                if (keys[(size_t) pinput.source] == sourcekey && pinput.channel == input.channel) {
+                    prevn = pn;
+                    break;
+                }
+            }
+
+            for (int ch = 0; ch < dest.numChannels; ++ch) {
+                const size_t gi = (size_t) (dest.firstGain + ch * dest.numInputs + n);
+                // new routes start right away, as they always did
+                newStartGains[gi] = prevn >= 0 && ch < prev->numChannels
+                    ? gains[(size_t) (prev->firstGain + ch * prev->numInputs + prevn)]
+                    : newGains[gi];
+            }
+        }
+
+        building = -1;
+    }
+
+    // turn the matrices into buses and rows
+    void compile(Plan & plan) const
+    {
+        plan.channelsPerOutput = buildChannels;
+        plan.keys = keys;
+        plan.destinationSlots.assign((size_t) buildDestinations, -1);
+        for (size_t i = 0; i < destinations.size(); ++i) {
+            plan.destinationSlots[(size_t) destinations[i].index] = (int) i;
+        }
+        plan.sources.assign((size_t) buildSources, Source());
+        plan.output.setSize(buildDestinations * buildChannels, buildSamples, false, false, true);
+        plan.buses.clear();
+        plan.terms.clear();
+        plan.rows.clear();
+        plan.rowBuses.clear();
+        plan.channelTotals.resize((size_t) buildChannels);
+        for (auto & total : plan.channelTotals) {
+            total.buses.clear();
+            total.needed = false;
+        }
+        plan.ramping = false;
+
+        for (auto & dest : destinations) {
+            for (int ch = 0; ch < dest.numChannels; ++ch) {
+                Row row;
+                row.output = dest.index * buildChannels + ch;
+                row.channel = ch;
+                row.minus = false;
+                row.firstBus = (int) plan.rowBuses.size();
+
+                const float * endgains = gains.data() + dest.firstGain + ch * dest.numInputs;
+                const float * begingains = startGains.data() + dest.firstGain + ch * dest.numInputs;
+
+                // one bus per source, from all of its channels in this row
+                for (int n = 0; n < dest.numInputs; ++n) {
+                    const int source = inputs[(size_t) (dest.firstInput + n)].source;
+
+                    bool seen = false;
+                    for (int pn = 0; pn < n && !seen; ++pn) {
+                        seen = inputs[(size_t) (dest.firstInput + pn)].source == source;
+                    }
+                    if (seen) continue;
+
+                    const int firstterm = (int) plan.terms.size();
+                    for (int m = n; m < dest.numInputs; ++m) {
+                        const auto & input = inputs[(size_t) (dest.firstInput + m)];
+                        if (input.source != source || (endgains[m] == 0.0f && begingains[m] == 0.0f)) continue;
+                        plan.terms.push_back({ input.channel, begingains[m], endgains[m] });
+                        plan.ramping = plan.ramping || begingains[m] != endgains[m];
+                    }
+                    const int numterms = (int) plan.terms.size() - firstterm;
+                    if (numterms == 0) continue;
+
+                    const int bus = findOrAddBus(plan, source, firstterm, numterms);
+                    plan.rowBuses.push_back(bus);
+
+                    auto & total = plan.channelTotals[(size_t) ch].buses;
+                    if (std::find(total.begin(), total.end(), bus) == total.end()) {
+                        total.push_back(bus);
+                    }
+                }
+
+                row.numBuses = (int) plan.rowBuses.size() - row.firstBus;
+                plan.rows.push_back(row);
+            }
+        }
+
+        // rows that get most of their channel's buses subtract the others from the total instead
+        std::vector<bool> busUsed (plan.buses.size());
+        for (auto & row : plan.rows) {
+            const auto & total = plan.channelTotals[(size_t) row.channel].buses;
+            // adding the total is one more pass, and it has to be made once per block
+            const int missing = (int) total.size() - row.numBuses;
+            if (missing + 2 >= row.numBuses) continue;
+
+            std::fill(busUsed.begin(), busUsed.end(), false);
+            for (int n = 0; n < row.numBuses; ++n) {
+                busUsed[(size_t) plan.rowBuses[(size_t) (row.firstBus + n)]] = true;
+            }
+            int n = 0;
+            for (auto b : total) {
+                if (!busUsed[(size_t) b]) plan.rowBuses[(size_t) (row.firstBus + n++)] = b;
+            }
+            row.numBuses = n;
+            row.minus = true;
+            plan.channelTotals[(size_t) row.channel].needed = true;
+        }
+
+        plan.busPointers.resize(plan.buses.size());
+        plan.scratch.assign(((size_t) 1 + (size_t) buildChannels + plan.buses.size()) * tileSize, 0.0f);
+    }
+
+    // the terms were just appended, they are dropped again if an equal bus exists
+    static int findOrAddBus(Plan & plan, int source, int firstterm, int numterms)
+    {
+        for (size_t b = 0; b < plan.buses.size(); ++b) {
+            const auto & bus = plan.buses[b];
+            if (bus.source != source || bus.numTerms != numterms) continue;
+
+            bool same = true;
+            for (int t = 0; t < numterms && same; ++t) {
+                const auto & a = plan.terms[(size_t) (bus.firstTerm + t)];
+                const auto & o = plan.terms[(size_t) (firstterm + t)];
+                same = a.channel == o.channel && a.startGain == o.startGain && a.endGain == o.endGain;
+            }
+            if (same) {
+                plan.terms.resize((size_t) firstterm);
+                return (int) b;
+            }
+        }
+
+        plan.buses.push_back({ source, firstterm, numterms });
+        return (int) plan.buses.size() - 1;
+    }
+
+    // audio thread
+    Plan * active = nullptr;
+
+    // set by prepare(), read by the updates
+    std::atomic<int> maxDestinations { 0 };
+    std::atomic<int> maxSources { 0 };
+    std::atomic<int> maxChannels { 0 };
+    std::atomic<int> maxSamples { 0 };
+    std::atomic<bool> layoutChanged { false };
+
+    TripleBuffer<Plan> plans;
+
+    // the updating thread: the routing as it was last compiled
+    std::vector<Destination> destinations;
+    std::vector<Input> inputs;
+    std::vector<float> gains;
+    std::vector<float> startGains;
+    std::vector<uint64> keys;
+
+    // the one being set
+    std::vector<Destination> newDestinations;
+    std::vector<Input> newInputs;
+    std::vector<float> newGains;
+    std::vector<float> newStartGains;
+    std::vector<uint64> newKeys;
+    std::vector<Route> staging;
+    int building = -1;
+    int buildDestinations = 0;
+    int buildSources = 0;
+    int buildChannels = 0;
+    int buildSamples = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SendMatrixMixer)
+};
+
+}
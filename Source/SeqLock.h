@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace SonoAudio {
+
+/*
+ Keeps a small value of T that one thread writes and any number of threads read,
+ without locks. A reader copies the value and tries again if a write happened in
+ the meantime, so it always gets a whole one. The copy goes through atomic words,
+ T has to be trivially copyable. Only one thread may write at a time.
+ */
+template <typename T>
+class SeqLock
+{
+    static_assert (std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+
+public:
+    SeqLock() { store (T()); }
+
+    void store (const T & value)
+    {
+        uint32_t buf[numWords] = {};
+        std::memcpy (buf, &value, sizeof (T));
+
+        const auto seq = sequence.load (std::memory_order_relaxed);
+        sequence.store (seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+
+        for (int i = 0; i < numWords; ++i) {
+            words[i].store (buf[i], std::memory_order_relaxed);
+        }
+
+        sequence.store (seq + 2, std::memory_order_release);
+    }
+
+    T load() const
+    {
+        uint32_t buf[numWords];
+
+        for (;;) {
+            const auto seq = sequence.load (std::memory_order_acquire);
+            if (seq & 1) continue;
+
+            for (int i = 0; i < numWords; ++i) {
+                buf[i] = words[i].load (std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence (std::memory_order_acquire);
+            if (sequence.load (std::memory_order_relaxed) == seq) break;
+        }
+
+        T value;
+        std::memcpy (&value, buf, sizeof (T));
+        return value;
+    }
+
+private:
+    static constexpr int numWords = (int) ((sizeof (T) + sizeof (uint32_t) - 1) / sizeof (uint32_t));
+
+    std::atomic<uint32_t> sequence { 0 };
+    std::atomic<uint32_t> words[numWords];
+};
+
+}
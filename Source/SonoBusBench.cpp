@@ -0,0 +1,2590 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2020 Jesse Chappell
+
+/*
+ Headless benchmarks for the audio and network code, built as the
+ SonoBusBench target (configure with -DSONOBUS_BUILD_BENCH=ON).
+
+   SonoBusBench [scenario...] [options]
+
+ Scenarios (default: process):
+
+   process     SonobusAudioProcessor::processBlock() with N synthetic peers,
+               each one a local aoo source sending to the processor over
+               loopback UDP. Sweeps block sizes, peer channel counts, codecs
+               and effects, and reports the time per block. Runs in real time,
+               so the network threads and jitter buffers behave like they do
+               in a session.
+   snapshot    the peer snapshot processBlock() reads without the core lock,
+               under churn: one thread keeps connecting and removing peers
+               (from a pool of 8 streaming synthetic ones) while
+               processBlock() runs back to back. Reports the blocks, the
+               peer changes, the longest block and any block with output
+               that isn't finite. Meant for a build with -fsanitize=address
+               or thread, which catch a peer freed while a block used it.
+   resampler   aoo::dynamic_resampler for all quality settings, stereo and
+               8 channels, at ratios near 1.0 and at 44.1k -> 48k.
+   sendmatrix  the cross-routing of peers to each other (SendMatrixMixer)
+               against the loop processBlock() used before, one addFrom()
+               per routed channel pair, for everyone routed to everyone.
+   multifx     the linked compressor and the EQ of a channel group with 4 to
+               16 channels (MultichannelEffects.h) against what it would take
+               with the Faust versions, stereo compressors and one EQ per
+               channel.
+   faust       the scalar Faust kernels (compressor, expander, EQ, reverb)
+               against the vector mode builds, at 32 to 256 sample blocks,
+               and how far the vector outputs are from the scalar ones. Both
+               run in place, like the effects run them; the vector outputs
+               are also checked against the vector kernel run with separate
+               input and output buffers. Needs a build configured with
+               -DSONOBUS_FAUST_VECTOR=ON for the vector side, where it fails
+               (exit code 2) if a vector output is further than 1e-4 from
+               the scalar one, or the in place run differs from the
+               separate buffers one at all. That build's ctest runs it.
+   serialize   per frame cost of writing the aoo data messages.
+   format      an aoo source with 1 to 128 sinks changing its format over
+               and over: whether every sink got every new format, and the
+               time the send() that sends it takes.
+   jitter      the sink's jitter estimator fed with simulated arrival times:
+               cost, and how many of the following blocks a buffer sized
+               from it would have caught.
+   netsim      an aoo source and sink connected through a NetworkImpairment
+               in both directions, driven by a virtual clock, so the results
+               are the same on every run. Reports underruns, added latency,
+               losses, resends and the sink CPU time per block. With any of
+               the --max options it also fails (exit code 2) if a
+               configuration goes past them, which is what the ctest
+               targets run.
+   pair        two SonobusAudioProcessors connected to each other over
+               loopback UDP, each with the --netsim impairment (default:
+               the wifi preset) on what it receives, both run in real time
+               from one thread, one pair per --buffers size. Reports for
+               each direction the packets received, dropped (what the
+               jitter buffer had to conceal) and resent, the network losses
+               and the latency the receiver estimates. With --max-lost and
+               --max-latency it fails like netsim does, and it always fails
+               if no audio gets through.
+   server      the aoo connection server with simulated clients over
+               loopback TCP: how long logging in and joining a group takes
+               with N clients connecting at once, whether every client was
+               told about every peer in its group, ping and UDP probe round
+               trips under load, and how long dropping all of them takes.
+               The largest default is 10k users joining 1k groups. Linux only.
+   mcu         the server's mix-minus with N synthetic participants in one
+               group, each an aoo source sending a mono tone and an aoo sink
+               receiving its mix over loopback UDP, driven by a virtual clock.
+               Half of the listeners set a gain and pan for one talker.
+               Reports the time to decode, mix and encode one block for the
+               whole group, and how many participants one core could mix in
+               real time. Linux only.
+   sendmmsg    one send pass of the send thread to 1 to 256 peers over
+               loopback UDP, every peer getting one packet: a write() per
+               packet against the packets queued and sent with sendmmsg(),
+               the way doSendData() sends them. On loopback the kernel
+               delivers every packet inside the sending call, so this is
+               the least batching saves. Linux only.
+   dispatch    finding the aoo sink or source a received packet is for among
+               4 to 256 peers, each with the sink, source, latency and echo
+               objects the processor makes for it: the peer index
+               dispatchAooPacket() uses against scanning every peer and
+               asking each object for its id. Includes the latency and echo
+               ids and ids no peer has, and checks that both find the same.
+   all         all of the above
+
+ Options:
+
+   --seconds <s>        measured time per configuration (process: 3, netsim: 60,
+                        mcu: 10 of virtual time)
+   --peers <list>       number of peers for process, e.g. 1,4,8 (4)
+   --blocks <list>      block sizes for process (32,64,128,256,512,1024)
+   --channels <list>    channels each peer sends for process (1,2)
+   --codecs <list>      pcm and/or opus for process (pcm,opus)
+   --effects <list>     off and/or on for process (off,on)
+   --buffers <list>     sink buffer sizes in ms for netsim (10,20,40)
+   --netsim <spec>      impairment for netsim (replaces the presets) and for
+                        the packets the processor receives in process, see
+                        NetworkImpairment::parseSettings()
+   --max-underruns <n>  netsim fails if a configuration has more underruns
+   --max-lost <n>       netsim and pair fail with more blocks lost for good
+                        (after the resends; for pair the dropped packets)
+   --max-latency <ms>   netsim and pair fail with a longer latency than this
+   --clients <list>     simulated clients for server (100,1000,10000), each
+                        one needs two open files
+   --threads <list>     server threads for server, 0 is the single threaded
+                        loop the app uses (0,<number of cores>)
+   --groupsize <n>      clients per group for server (10)
+   --watchers <n>       clients that watch the public group list for server,
+                        if > 0 all groups are public (0)
+   --participants <list> group sizes for mcu (4,16,64); the codecs the
+                        participants send with come from --codecs
+ */
+
+#include "JuceHeader.h"
+
+#include "SonobusPluginProcessor.h"
+#include "NetworkImpairment.h"
+
+#include "aoo/aoo.hpp"
+#include "aoo/aoo_pcm.h"
+#include "aoo/aoo_opus.h"
+
+// internals that are benchmarked on their own
+#include "src/common.hpp"
+#include "src/source.hpp"
+#include "src/sink.hpp"
+#include "src/SLIP.hpp"
+#include "src/mcu.hpp"
+
+#include "aoo/aoo_net.hpp"
+#include "oscpack/osc/OscOutboundPacketStream.h"
+#include "oscpack/osc/OscReceivedElements.h"
+
+#if JUCE_LINUX
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+using namespace SonoAudio;
+
+namespace {
+
+const double benchSampleRate = 48000.0;
+
+double getSeconds()
+{
+    return Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks());
+}
+
+Array<int> parseIntList(const String & list)
+{
+    Array<int> ret;
+    for (auto & token : StringArray::fromTokens(list, ",", "")) {
+        if (token.trim().isNotEmpty()) ret.add(token.trim().getIntValue());
+    }
+    return ret;
+}
+
+// collects one duration per block, in microseconds
+class TimingStats
+{
+public:
+    void clear() { values.clear(); }
+    void reserve(size_t count) { values.reserve(count); }
+    void add(double us) { values.push_back(us); }
+    int getCount() const { return (int) values.size(); }
+
+    double getMean() const
+    {
+        if (values.empty()) return 0.0;
+        double sum = 0.0;
+        for (auto v : values) sum += v;
+        return sum / values.size();
+    }
+
+    double getPercentile(double percentile)
+    {
+        if (values.empty()) return 0.0;
+        auto index = jmin(values.size() - 1, (size_t) (percentile * 0.01 * values.size()));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+    double getMax() const
+    {
+        return values.empty() ? 0.0 : *std::max_element(values.begin(), values.end());
+    }
+
+private:
+    std::vector<double> values;
+};
+
+struct BenchOptions
+{
+    StringArray scenarios;
+    double seconds = 0.0; // 0: scenario default
+    Array<int> peerCounts { 4 };
+    Array<int> blockSizes { 32, 64, 128, 256, 512, 1024 };
+    Array<int> channelCounts { 1, 2 };
+    StringArray codecs { "pcm", "opus" };
+    StringArray effects { "off", "on" };
+    Array<int> bufferSizes { 10, 20, 40 };
+    String netsim;
+    // netsim fails past these, < 0 is no limit
+    int maxUnderruns = -1;
+    int maxLost = -1;
+    double maxLatencyMs = -1.0;
+    Array<int> clientCounts { 100, 1000, 10000 };
+    Array<int> serverThreads { 0, jmax(1, SystemStats::getNumCpus()) };
+    int groupSize = 10;
+    int numWatchers = 0;
+    Array<int> participantCounts { 4, 16, 64 };
+
+    bool parse(int argc, char * argv[])
+    {
+        for (int i = 1; i < argc; ++i) {
+            String arg (argv[i]);
+
+            if (!arg.startsWith("--")) {
+                scenarios.add(arg);
+                continue;
+            }
+            if (i + 1 >= argc) return false;
+            String value (argv[++i]);
+
+            if (arg == "--seconds") seconds = value.getDoubleValue();
+            else if (arg == "--peers") peerCounts = parseIntList(value);
+            else if (arg == "--blocks") blockSizes = parseIntList(value);
+            else if (arg == "--channels") channelCounts = parseIntList(value);
+            else if (arg == "--codecs") codecs = StringArray::fromTokens(value, ",", "");
+            else if (arg == "--effects") effects = StringArray::fromTokens(value, ",", "");
+            else if (arg == "--buffers") bufferSizes = parseIntList(value);
+            else if (arg == "--netsim") netsim = value;
+            else if (arg == "--max-underruns") maxUnderruns = value.getIntValue();
+            else if (arg == "--max-lost") maxLost = value.getIntValue();
+            else if (arg == "--max-latency") maxLatencyMs = value.getDoubleValue();
+            else if (arg == "--clients") clientCounts = parseIntList(value);
+            else if (arg == "--threads") serverThreads = parseIntList(value);
+            else if (arg == "--groupsize") groupSize = jmax(1, value.getIntValue());
+            else if (arg == "--watchers") numWatchers = jmax(0, value.getIntValue());
+            else if (arg == "--participants") participantCounts = parseIntList(value);
+            else return false;
+        }
+
+        if (scenarios.isEmpty()) scenarios.add("process");
+        if (scenarios.contains("all")) {
+            scenarios = StringArray { "process", "snapshot", "resampler", "sendmatrix", "multifx", "faust", "serialize", "format", "jitter", "netsim", "pair", "server", "mcu", "sendmmsg", "dispatch" };
+        }
+        return true;
+    }
+};
+
+void printUsage()
+{
+    std::printf("usage: SonoBusBench [process|snapshot|resampler|sendmatrix|multifx|faust|serialize|format|jitter|netsim|pair|server|mcu|sendmmsg|dispatch|all]... [options]\n"
+                "  --seconds <s>  --peers <list>  --blocks <list>  --channels <list>\n"
+                "  --codecs pcm,opus  --effects off,on  --buffers <list ms>  --netsim <spec>\n"
+                "  --max-underruns <n>  --max-lost <n>  --max-latency <ms>\n"
+                "  --clients <list>  --threads <list>  --groupsize <n>  --watchers <n>\n"
+                "  --participants <list>\n");
+}
+
+void makeFormat(aoo_format_storage & storage, bool opus, int channels, int blocksize)
+{
+    zerostruct(storage);
+    if (opus) {
+        auto fmt = (aoo_format_opus *) &storage;
+        fmt->header.codec = AOO_CODEC_OPUS;
+        fmt->header.blocksize = blocksize;
+        fmt->header.samplerate = (int32_t) benchSampleRate;
+        fmt->header.nchannels = channels;
+        fmt->bitrate = 96000 * channels;
+        fmt->complexity = 10;
+        fmt->signal_type = OPUS_SIGNAL_MUSIC;
+        fmt->application_type = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
+    }
+    else {
+        auto fmt = (aoo_format_pcm *) &storage;
+        fmt->header.codec = AOO_CODEC_PCM;
+        fmt->header.blocksize = blocksize;
+        fmt->header.samplerate = (int32_t) benchSampleRate;
+        fmt->header.nchannels = channels;
+        fmt->bitdepth = AOO_PCM_INT16;
+    }
+}
+
+
+//==============================================================================
+// process: processBlock with synthetic peers
+
+// A remote peer as far as the processor can tell: an aoo source (id 0, which is
+// what the processor invites first) that answers invitations and streams a sine.
+class SyntheticPeer
+{
+public:
+    SyntheticPeer(int processorPort_, int channels_, bool opus, int index)
+    : processorPort(processorPort_), channels(channels_)
+    {
+        socket = std::make_unique<DatagramSocket>(false);
+        socket->bindToPort(0, "127.0.0.1");
+
+        source.reset(aoo::isource::create(0));
+        source->setup((int32_t) benchSampleRate, blocksize, channels);
+
+        aoo_format_storage fmt;
+        makeFormat(fmt, opus, channels, blocksize);
+        source->set_format(fmt.header);
+        source->set_buffersize(20);
+        source->start();
+
+        buffer.setSize(channels, blocksize);
+        frequency = 220.0 * (1 + index % 8);
+    }
+
+    int getPort() const { return socket->getBoundPort(); }
+
+    // from the driver thread only
+    void service(double now)
+    {
+        char buf[AOO_MAXPACKETSIZE];
+        while (socket->waitUntilReady(true, 0) == 1) {
+            int nbytes = socket->read(buf, sizeof(buf), false);
+            if (nbytes <= 0) break;
+
+            int32_t type, id;
+            if (aoo_parse_pattern(buf, nbytes, &type, &id) > 0 && type == AOO_TYPE_SOURCE) {
+                source->handle_message(buf, nbytes, this, send);
+            }
+            // everything else (the processor's audio, its pings and peer info) is dropped
+        }
+
+        source->handle_events(handleEvents, this);
+
+        if (startTime < 0.0) startTime = now;
+        const int64 due = (int64) ((now - startTime) * benchSampleRate / blocksize);
+        while (blocksProcessed < due) {
+            for (int ch = 0; ch < channels; ++ch) {
+                auto data = buffer.getWritePointer(ch);
+                for (int i = 0; i < blocksize; ++i) {
+                    data[i] = 0.2f * (float) std::sin(phase + i * frequency * MathConstants<double>::twoPi / benchSampleRate + ch);
+                }
+            }
+            phase = std::fmod(phase + blocksize * frequency * MathConstants<double>::twoPi / benchSampleRate, MathConstants<double>::twoPi);
+
+            source->process((const aoo_sample **) buffer.getArrayOfReadPointers(), blocksize, aoo_osctime_get());
+            ++blocksProcessed;
+        }
+        source->send();
+    }
+
+private:
+    static int32_t send(void * user, const char * data, int32_t n)
+    {
+        auto peer = static_cast<SyntheticPeer*>(user);
+        return peer->socket->write("127.0.0.1", peer->processorPort, data, n);
+    }
+
+    static int32_t handleEvents(void * user, const aoo_event ** events, int32_t n)
+    {
+        auto peer = static_cast<SyntheticPeer*>(user);
+        for (int i = 0; i < n; ++i) {
+            auto e = (const aoo_sink_event *) events[i];
+            if (events[i]->type == AOO_INVITE_EVENT) {
+                peer->source->add_sink(e->endpoint, e->id, send);
+            }
+            else if (events[i]->type == AOO_UNINVITE_EVENT) {
+                peer->source->remove_sink(e->endpoint, e->id);
+            }
+        }
+        return 1;
+    }
+
+    static const int blocksize = 240; // a valid opus frame size
+
+    std::unique_ptr<DatagramSocket> socket;
+    aoo::isource::pointer source;
+    int processorPort;
+    int channels;
+    AudioBuffer<float> buffer;
+    double frequency = 440.0;
+    double phase = 0.0;
+    double startTime = -1.0;
+    int64 blocksProcessed = 0;
+};
+
+class PeerDriver : public Thread
+{
+public:
+    PeerDriver() : Thread("SonoBusBenchPeers") {}
+    ~PeerDriver() { stopThread(1000); }
+
+    void run() override
+    {
+        while (!threadShouldExit()) {
+            const double now = getSeconds();
+            for (auto peer : peers) {
+                peer->service(now);
+            }
+            Thread::sleep(1);
+        }
+    }
+
+    OwnedArray<SyntheticPeer> peers;
+};
+
+void setEffects(SonobusAudioProcessor & processor, bool enabled)
+{
+    CompressorParams comp;
+    comp.enabled = enabled;
+    comp.thresholdDb = -24.0f;
+    comp.ratio = 4.0f;
+
+    ParametricEqParams eq;
+    eq.enabled = enabled;
+    eq.lowShelfGain = -3.0f;
+    eq.para1Gain = 2.0f;
+    eq.para2Gain = -2.0f;
+    eq.highShelfGain = 3.0f;
+
+    for (int i = 0; i < processor.getNumberRemotePeers(); ++i) {
+        processor.setRemotePeerCompressorParams(i, 0, comp);
+        processor.setRemotePeerEqParams(i, 0, eq);
+    }
+    processor.setInputCompressorParams(0, comp);
+    processor.setInputEqParams(0, eq);
+
+    processor.getValueTreeState().getParameter(SonobusAudioProcessor::paramMainReverbEnabled)->setValueNotifyingHost(enabled ? 1.0f : 0.0f);
+}
+
+// calls processBlock in real time for the given duration, returns the time each call took
+void runBlocks(SonobusAudioProcessor & processor, AudioBuffer<float> & buffer, int blocksize, double seconds, TimingStats * stats)
+{
+    MidiBuffer midi;
+    const double period = blocksize / benchSampleRate;
+    const int numblocks = (int) (seconds / period);
+    const int numinputs = processor.getTotalNumInputChannels();
+    double next = getSeconds();
+    double phase = 0.0;
+
+    for (int n = 0; n < numblocks; ++n) {
+        // wait for the next block, sleep for the most part and spin for the rest
+        double now;
+        while ((now = getSeconds()) < next) {
+            if (next - now > 0.002) Thread::sleep(1);
+        }
+        if (now > next + 10 * period) {
+            next = now; // fell behind, don't try to catch up
+        }
+        next += period;
+
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch) {
+            auto data = buffer.getWritePointer(ch);
+            for (int i = 0; i < blocksize; ++i) {
+                data[i] = ch < numinputs ? 0.1f * (float) std::sin(phase + i * 0.05) : 0.0f;
+            }
+        }
+        phase += blocksize * 0.05;
+
+        const auto start = Time::getHighResolutionTicks();
+        processor.processBlock(buffer, midi);
+        const auto end = Time::getHighResolutionTicks();
+
+        if (stats) stats->add(Time::highResolutionTicksToSeconds(end - start) * 1e6);
+    }
+}
+
+void runProcessScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 3.0;
+
+    std::printf("\n== processBlock (%.0f Hz, %.1f s per configuration) ==\n", benchSampleRate, seconds);
+    std::printf("%5s %5s %3s %4s %6s %9s %9s %9s %7s %7s %6s\n",
+                "peers", "codec", "ch", "fx", "block", "mean(us)", "p99(us)", "max(us)", "rtf", "p99rtf", "recv");
+
+    for (auto numpeers : opts.peerCounts) {
+        for (auto & codec : opts.codecs) {
+            for (auto channels : opts.channelCounts) {
+
+                auto processor = std::make_unique<SonobusAudioProcessor>();
+
+                if (opts.netsim.isNotEmpty()) {
+                    NetworkImpairment::Settings settings;
+                    if (NetworkImpairment::parseSettings(opts.netsim, settings)) {
+                        processor->setReceiveImpairment(settings);
+                    }
+                }
+
+                const int firstblock = opts.blockSizes.isEmpty() ? 256 : opts.blockSizes.getFirst();
+                processor->setRateAndBufferSizeDetails(benchSampleRate, firstblock);
+                processor->prepareToPlay(benchSampleRate, firstblock);
+
+                PeerDriver driver;
+                for (int i = 0; i < numpeers; ++i) {
+                    auto peer = driver.peers.add(new SyntheticPeer(processor->getUdpLocalPort(), channels, codec == "opus", i));
+                    processor->connectRemotePeer("127.0.0.1", peer->getPort(), "bench" + String(i), "", true);
+                }
+                for (int i = 0; i < processor->getNumberRemotePeers(); ++i) {
+                    processor->setRemotePeerAutoresizeBufferMode(i, SonobusAudioProcessor::AutoNetBufferModeOff);
+                    processor->setRemotePeerBufferTime(i, 20.0f);
+                }
+                driver.startThread();
+
+                for (auto & fx : opts.effects) {
+                    for (auto blocksize : opts.blockSizes) {
+                        const int numchannels = jmax(processor->getTotalNumInputChannels(), processor->getTotalNumOutputChannels());
+                        AudioBuffer<float> buffer (numchannels, blocksize);
+
+                        processor->setRateAndBufferSizeDetails(benchSampleRate, blocksize);
+                        processor->prepareToPlay(benchSampleRate, blocksize);
+                        setEffects(*processor, fx == "on");
+
+                        // connect, settle the buffers and get past the unmute after prepareToPlay
+                        runBlocks(*processor, buffer, blocksize, 1.5, nullptr);
+
+                        for (int i = 0; i < processor->getNumberRemotePeers(); ++i) {
+                            processor->resetRemotePeerPacketStats(i);
+                        }
+
+                        TimingStats stats;
+                        stats.reserve((size_t) (seconds * benchSampleRate / blocksize) + 1);
+                        runBlocks(*processor, buffer, blocksize, seconds, &stats);
+
+                        int receiving = 0;
+                        for (int i = 0; i < processor->getNumberRemotePeers(); ++i) {
+                            if (processor->getRemotePeerPacketsReceived(i) > 0) ++receiving;
+                        }
+
+                        const double periodus = 1e6 * blocksize / benchSampleRate;
+                        const double p99 = stats.getPercentile(99.0);
+                        std::printf("%5d %5s %3d %4s %6d %9.1f %9.1f %9.1f %7.4f %7.4f %3d/%-2d\n",
+                                    numpeers, codec.toRawUTF8(), channels, fx.toRawUTF8(), blocksize,
+                                    stats.getMean(), p99, stats.getMax(),
+                                    stats.getMean() / periodus, p99 / periodus,
+                                    receiving, numpeers);
+                        std::fflush(stdout);
+                    }
+                }
+
+                driver.stopThread(1000);
+                processor->releaseResources();
+            }
+        }
+    }
+}
+
+void runSnapshotScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 10.0;
+    const int blocksize = 64;
+    const int poolsize = 8;
+
+    std::printf("\n== processBlock back to back while peers come and go (%.1f s) ==\n", seconds);
+    std::printf("%8s %8s %8s %9s %9s %9s\n", "blocks", "added", "removed", "mean(us)", "max(us)", "nonfinite");
+
+    auto processor = std::make_unique<SonobusAudioProcessor>();
+    processor->setRateAndBufferSizeDetails(benchSampleRate, blocksize);
+    processor->prepareToPlay(benchSampleRate, blocksize);
+
+    PeerDriver driver;
+    Array<int> ports;
+    for (int i = 0; i < poolsize; ++i) {
+        auto peer = driver.peers.add(new SyntheticPeer(processor->getUdpLocalPort(), 2, false, i));
+        ports.add(peer->getPort());
+    }
+    driver.startThread();
+
+    std::atomic<bool> done { false };
+    int64 added = 0, removed = 0;
+
+    // every change publishes a new snapshot, every removal retires peers
+    std::thread churn ([&] {
+        Random random (1);
+        while (!done.load()) {
+            const int count = processor->getNumberRemotePeers();
+            if (count < poolsize && (count == 0 || random.nextBool())) {
+                processor->connectRemotePeer("127.0.0.1", ports[random.nextInt(poolsize)], "churn", "", true);
+            }
+            else {
+                processor->removeRemotePeer(random.nextInt(count));
+            }
+
+            // nothing else adds or removes them here
+            const int newcount = processor->getNumberRemotePeers();
+            if (newcount > count) added += newcount - count;
+            else removed += count - newcount;
+
+            Thread::sleep(random.nextInt(3));
+        }
+    });
+
+    const int numchannels = jmax(processor->getTotalNumInputChannels(), processor->getTotalNumOutputChannels());
+    AudioBuffer<float> buffer (numchannels, blocksize);
+    MidiBuffer midi;
+    TimingStats stats;
+    int64 nonfinite = 0;
+    double phase = 0.0;
+    const double end = getSeconds() + seconds;
+
+    while (getSeconds() < end) {
+        for (int ch = 0; ch < numchannels; ++ch) {
+            auto data = buffer.getWritePointer(ch);
+            for (int i = 0; i < blocksize; ++i) data[i] = 0.1f * (float) std::sin(phase + i * 0.05);
+        }
+        phase += blocksize * 0.05;
+
+        const auto start = Time::getHighResolutionTicks();
+        processor->processBlock(buffer, midi);
+        stats.add(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6);
+
+        bool finite = true;
+        for (int ch = 0; ch < numchannels && finite; ++ch) {
+            auto data = buffer.getReadPointer(ch);
+            for (int i = 0; i < blocksize && finite; ++i) finite = std::isfinite(data[i]);
+        }
+        if (!finite) ++nonfinite;
+    }
+
+    done = true;
+    churn.join();
+    processor->removeAllRemotePeers();
+    driver.stopThread(1000);
+    processor->releaseResources();
+
+    std::printf("%8d %8lld %8lld %9.1f %9.1f %9lld\n", stats.getCount(), (long long) added, (long long) removed,
+                stats.getMean(), stats.getMax(), (long long) nonfinite);
+    std::fflush(stdout);
+}
+
+
+//==============================================================================
+// resampler
+
+void runResamplerScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 2.0;
+    const int blocksize = 256;
+    const char * qualitynames[] = { "linear", "medium", "high" };
+
+    struct RatioCase { const char * name; int srfrom; int srto; double drift; };
+    const RatioCase cases[] = {
+        { "48k*1.0001", 48000, 48000, 1.0001 },
+        { "48k*0.9999", 48000, 48000, 0.9999 },
+        { "44.1k->48k", 44100, 48000, 1.0 },
+    };
+
+    std::printf("\n== dynamic_resampler (%d frame blocks, %.1f s of audio each) ==\n", blocksize, seconds);
+    std::printf("%-7s %3s %-11s %12s %12s\n", "quality", "ch", "ratio", "ns/frame", "x realtime");
+
+    for (int quality = AOO_RESAMPLE_LINEAR; quality <= AOO_RESAMPLE_HIGH; ++quality) {
+        for (int nchannels : { 2, 8 }) {
+            for (auto & rc : cases) {
+                aoo::dynamic_resampler resampler;
+                resampler.setup(blocksize, blocksize, rc.srfrom, rc.srto, nchannels, quality);
+                resampler.update(rc.srfrom, rc.srto * rc.drift);
+
+                std::vector<aoo_sample> in ((size_t) (blocksize * nchannels)), out ((size_t) (blocksize * nchannels));
+                for (int i = 0; i < blocksize; ++i) {
+                    for (int ch = 0; ch < nchannels; ++ch) {
+                        in[(size_t) (i * nchannels + ch)] = (aoo_sample) std::sin(i * 0.1 + ch);
+                    }
+                }
+
+                const int64 totalframes = (int64) (seconds * rc.srto);
+                int64 outframes = 0;
+                const auto start = Time::getHighResolutionTicks();
+                while (outframes < totalframes) {
+                    while (resampler.write_available() >= blocksize * nchannels) {
+                        resampler.write(in.data(), blocksize * nchannels);
+                    }
+                    while (resampler.read_available() >= blocksize * nchannels) {
+                        resampler.read(out.data(), blocksize * nchannels);
+                        outframes += blocksize;
+                    }
+                }
+                const double elapsed = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start);
+
+                std::printf("%-7s %3d %-11s %12.2f %12.1f\n", qualitynames[quality], nchannels, rc.name,
+                            elapsed * 1e9 / outframes, (outframes / (double) rc.srto) / elapsed);
+            }
+        }
+    }
+}
+
+
+//==============================================================================
+// send matrix
+
+void runSendMatrixScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 1.0;
+    const int nchannels = 2;
+
+    std::printf("\n== cross-routing, every peer to every other one, stereo, hard panned ==\n");
+    std::printf("%5s %6s %14s %14s %8s\n", "peers", "block", "addFrom us", "mixer us", "speedup");
+
+    for (int numpeers : { 4, 8, 16, 32 }) {
+        for (int blocksize : { 64, 256, 1024 }) {
+            Random random (numpeers * 1000 + blocksize);
+            OwnedArray<AudioBuffer<float>> peerbuffers;
+            for (int j = 0; j < numpeers; ++j) {
+                auto buf = peerbuffers.add(new AudioBuffer<float>(nchannels, blocksize));
+                for (int ch = 0; ch < nchannels; ++ch) {
+                    for (int i = 0; i < blocksize; ++i) buf->setSample(ch, i, random.nextFloat() * 2.0f - 1.0f);
+                }
+            }
+            AudioBuffer<float> sendmix (nchannels, blocksize), work (nchannels, blocksize);
+            sendmix.clear();
+
+            // the stereo pan law processBlock() uses, the left channel hard left and the right one hard right
+            auto pangain = [] (int channel, float pan) {
+                return channel == 0 ? (pan >= 0.0f ? (1.0f - pan) : 1.0f) : (pan >= 0.0f ? 1.0f : (1.0f + pan));
+            };
+            const float pans[2] = { -1.0f, 1.0f };
+
+            SendMatrixMixer mixer;
+            mixer.prepare(numpeers, numpeers, nchannels, blocksize);
+            mixer.beginUpdate();
+            for (int i = 0; i < numpeers; ++i) {
+                mixer.setKey(i, (uint64) i + 1);
+            }
+            for (int i = 0; i < numpeers; ++i) {
+                mixer.addDestination(i, nchannels);
+                for (int j = 0; j < numpeers; ++j) {
+                    if (j == i) continue;
+                    for (int channel = 0; channel < nchannels; ++channel) {
+                        for (int ch = 0; ch < nchannels; ++ch) mixer.setGain(channel, j, ch, pangain(channel, pans[ch]));
+                    }
+                }
+            }
+            mixer.endUpdate();
+            // what the audio thread does at the start of a block
+            mixer.usePublishedPlan();
+            for (int j = 0; j < numpeers; ++j) {
+                mixer.setSource(j, (uint64) j + 1, peerbuffers[j]->getArrayOfReadPointers(), nchannels);
+            }
+
+            const int iterations = jmax(10, (int) (seconds * benchSampleRate / blocksize));
+            float checksum = 0.0f;
+
+            auto start = Time::getHighResolutionTicks();
+            for (int it = 0; it < iterations; ++it) {
+                for (int i = 0; i < numpeers; ++i) {
+                    work.clear();
+                    for (int channel = 0; channel < nchannels; ++channel) work.addFrom(channel, 0, sendmix, channel, 0, blocksize);
+                    for (int j = 0; j < numpeers; ++j) {
+                        if (j == i) continue;
+                        for (int channel = 0; channel < nchannels; ++channel) {
+                            for (int ch = 0; ch < nchannels; ++ch) {
+                                work.addFrom(channel, 0, *peerbuffers[j], ch, 0, blocksize, pangain(channel, pans[ch]));
+                            }
+                        }
+                    }
+                    checksum += work.getSample(0, 0);
+                }
+            }
+            const double loopus = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6 / iterations;
+
+            start = Time::getHighResolutionTicks();
+            for (int it = 0; it < iterations; ++it) {
+                mixer.process(sendmix.getArrayOfReadPointers(), nchannels, blocksize);
+                checksum += mixer.getOutput(0, 1)[0][0];
+            }
+            const double mixerus = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6 / iterations;
+
+            std::printf("%5d %6d %14.2f %14.2f %7.1fx%s\n", numpeers, blocksize, loopus, mixerus, loopus / mixerus,
+                        checksum == 12345.0f ? " " : ""); // so nothing gets optimized away
+        }
+    }
+}
+
+
+//==============================================================================
+// multichannel effects
+
+void runMultichannelEffectsScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 1.0;
+
+    std::printf("\n== channel group compressor and EQ, Faust (stereo compressors, mono EQs) vs multichannel ==\n");
+    std::printf("%8s %6s %14s %14s %8s %14s %14s %8s\n", "channels", "block",
+                "faust comp us", "multi comp us", "speedup", "faust eq us", "multi eq us", "speedup");
+
+    for (int nchannels : { 4, 6, 8, 16 }) {
+        for (int blocksize : { 64, 256, 1024 }) {
+            Random random (nchannels * 1000 + blocksize);
+            AudioBuffer<float> input (nchannels, blocksize), buffer (nchannels, blocksize);
+            for (int ch = 0; ch < nchannels; ++ch) {
+                for (int i = 0; i < blocksize; ++i) input.setSample(ch, i, random.nextFloat() * 2.0f - 1.0f);
+            }
+
+            CompressorParams cparams;
+            cparams.thresholdDb = -20.0f;
+            cparams.ratio = 4.0f;
+            ParametricEqParams eqparams;
+            eqparams.lowShelfGain = 3.0f;
+            eqparams.para1Gain = -4.0f;
+            eqparams.para2Gain = 2.0f;
+            eqparams.highShelfGain = -3.0f;
+
+            OwnedArray<faustCompressor> compressors;
+            OwnedArray<MapUI> compressorControls;
+            for (int j = 0; j < nchannels / 2; ++j) {
+                auto comp = compressors.add(new faustCompressor());
+                auto control = compressorControls.add(new MapUI());
+                comp->init((int) benchSampleRate);
+                comp->buildUserInterface(control);
+                control->setParamValue("/compressor/threshold", cparams.thresholdDb);
+                control->setParamValue("/compressor/ratio", cparams.ratio);
+            }
+            OwnedArray<faustParametricEQ> eqs;
+            OwnedArray<MapUI> eqControls;
+            for (int j = 0; j < nchannels; ++j) {
+                auto eq = eqs.add(new faustParametricEQ());
+                auto control = eqControls.add(new MapUI());
+                eq->init((int) benchSampleRate);
+                eq->buildUserInterface(control);
+                control->setParamValue("/parametric_eq/low_shelf/gain", eqparams.lowShelfGain);
+                control->setParamValue("/parametric_eq/para1/peak_gain", eqparams.para1Gain);
+                control->setParamValue("/parametric_eq/para2/peak_gain", eqparams.para2Gain);
+                control->setParamValue("/parametric_eq/high_shelf/gain", eqparams.highShelfGain);
+            }
+
+            MultichannelCompressor multicomp;
+            multicomp.init(benchSampleRate);
+            multicomp.setParameters(cparams.thresholdDb, cparams.ratio, 3.0f, 0.002f, 0.5f, 0.0f);
+            MultichannelParametricEQ multieq;
+            multieq.init(benchSampleRate);
+            multieq.setParameters(eqparams);
+
+            const int iterations = jmax(10, (int) (seconds * benchSampleRate / blocksize));
+            float checksum = 0.0f;
+            float * bufs[16];
+            for (int ch = 0; ch < nchannels; ++ch) bufs[ch] = buffer.getWritePointer(ch);
+
+            // the input is copied in every time (both sides pay for it), the EQ boosts would pile up otherwise
+            auto timeIt = [&] (std::function<void()> fn) {
+                auto start = Time::getHighResolutionTicks();
+                for (int it = 0; it < iterations; ++it) {
+                    buffer.makeCopyOf(input, true);
+                    fn();
+                    checksum += bufs[0][0];
+                }
+                return Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6 / iterations;
+            };
+
+            const double faustcompus = timeIt([&] {
+                for (int j = 0; j < compressors.size(); ++j) {
+                    float * pair[2] = { bufs[2*j], bufs[2*j + 1] };
+                    compressors[j]->compute(blocksize, pair, pair);
+                }
+            });
+            const double multicompus = timeIt([&] { multicomp.compute(blocksize, bufs, nchannels); });
+            const double fausteqsus = timeIt([&] {
+                for (int j = 0; j < nchannels; ++j) eqs[j]->compute(blocksize, &bufs[j], &bufs[j]);
+            });
+            const double multiequs = timeIt([&] { multieq.compute(blocksize, bufs, nchannels); });
+
+            std::printf("%8d %6d %14.2f %14.2f %7.1fx %14.2f %14.2f %7.1fx%s\n", nchannels, blocksize,
+                        faustcompus, multicompus, faustcompus / multicompus,
+                        fausteqsus, multiequs, fausteqsus / multiequs,
+                        checksum == 12345.0f ? " " : ""); // so nothing gets optimized away
+        }
+    }
+}
+
+
+//==============================================================================
+// faust kernels
+
+// runs a kernel over the whole signal, one block at a time, 'passes' times, starting
+// from the same input every time, in place like the effects do or from a separate input.
+// Returns the time per block in microseconds, 'output' gets the result of the last pass.
+template <class Kernel>
+double runFaustKernel(Kernel & dsp, const AudioBuffer<float> & input, AudioBuffer<float> & output, int blocksize, int passes, bool inplace = true)
+{
+    const int nchannels = jmax(dsp.getNumInputs(), dsp.getNumOutputs());
+    AudioBuffer<float> source;
+    float * ins[2];
+    float * outs[2];
+    int64 ticks = 0;
+    int blocks = 0;
+
+    for (int pass = 0; pass < passes; ++pass) {
+        output.makeCopyOf(input, true);
+        source.makeCopyOf(input, true);
+        auto & from = inplace ? output : source;
+        dsp.instanceClear();
+
+        auto start = Time::getHighResolutionTicks();
+        for (int pos = 0; pos + blocksize <= output.getNumSamples(); pos += blocksize, ++blocks) {
+            for (int ch = 0; ch < nchannels; ++ch) {
+                ins[ch] = from.getWritePointer(ch, pos);
+                outs[ch] = output.getWritePointer(ch, pos);
+            }
+            dsp.compute(blocksize, ins, outs);
+        }
+        ticks += Time::getHighResolutionTicks() - start;
+    }
+    return Time::highResolutionTicksToSeconds(ticks) * 1e6 / jmax(1, blocks);
+}
+
+// how far a vector kernel's output may be from the scalar one's, they are the
+// same operations but the compiler may order or fuse them differently
+const float faustMaxDiff = 1e-4f;
+
+// Vector is the kernel as the effects use it, VectorRaw the generated class on its own,
+// which is run from a separate input to check that Vector is really safe in place.
+// Returns false if the vector output is off
+template <class Scalar, class Vector, class VectorRaw>
+bool compareFaustKernels(const char * name, const std::function<void(MapUI &)> & setup, const AudioBuffer<float> & input,
+                         int blocksize, int passes)
+{
+    AudioBuffer<float> scalarout, vectorout, rawout;
+
+    Scalar scalar;
+    MapUI scalarcontrol;
+    scalar.init((int) benchSampleRate);
+    scalar.buildUserInterface(&scalarcontrol);
+    setup(scalarcontrol);
+    const double scalarus = runFaustKernel(scalar, input, scalarout, blocksize, passes);
+
+    if (std::is_same<Scalar, Vector>::value) {
+        std::printf("%10s %6d %12.2f %12s\n", name, blocksize, scalarus, "-");
+        return true;
+    }
+
+    Vector vector;
+    MapUI vectorcontrol;
+    vector.init((int) benchSampleRate);
+    vector.buildUserInterface(&vectorcontrol);
+    setup(vectorcontrol);
+    const double vectorus = runFaustKernel(vector, input, vectorout, blocksize, passes);
+
+    VectorRaw raw;
+    MapUI rawcontrol;
+    raw.init((int) benchSampleRate);
+    raw.buildUserInterface(&rawcontrol);
+    setup(rawcontrol);
+    runFaustKernel(raw, input, rawout, blocksize, 1, false);
+
+    float maxdiff = 0.0f, inplacediff = 0.0f;
+    bool finite = true;
+    for (int ch = 0; ch < scalar.getNumOutputs(); ++ch) {
+        for (int i = 0; i < input.getNumSamples(); ++i) {
+            maxdiff = jmax(maxdiff, std::abs(scalarout.getSample(ch, i) - vectorout.getSample(ch, i)));
+            inplacediff = jmax(inplacediff, std::abs(rawout.getSample(ch, i) - vectorout.getSample(ch, i)));
+            finite = finite && std::isfinite(vectorout.getSample(ch, i)) && std::isfinite(rawout.getSample(ch, i));
+        }
+    }
+
+    std::printf("%10s %6d %12.2f %12.2f %7.2fx %12.2g %12.2g\n", name, blocksize, scalarus, vectorus, scalarus / vectorus, maxdiff, inplacediff);
+
+    const bool passed = finite && maxdiff <= faustMaxDiff && inplacediff == 0.0f;
+    if (!passed) {
+        std::printf("FAIL %s %d: vector off the scalar output by %g (at most %g), in place off by %g%s\n",
+                    name, blocksize, maxdiff, faustMaxDiff, inplacediff, finite ? "" : ", not finite");
+    }
+    return passed;
+}
+
+// returns false if a vector kernel doesn't match the scalar one
+bool runFaustScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 1.0;
+
+    // one second of noise, alternating loud and quiet every 100 ms so the dynamics have something to do
+    AudioBuffer<float> input (2, (int) benchSampleRate);
+    Random random (1);
+    for (int ch = 0; ch < 2; ++ch) {
+        for (int i = 0; i < input.getNumSamples(); ++i) {
+            const float level = (i / 4800) % 2 ? 0.9f : 0.05f;
+            input.setSample(ch, i, level * (random.nextFloat() * 2.0f - 1.0f));
+        }
+    }
+    const int passes = jmax(1, roundToInt(seconds));
+
+    // the effects' kernels (CompressorKernel etc.) are the vector ones in a vector build
+#if SONOBUS_FAUST_VECTOR
+    using CompressorRaw = faustCompressorVec;
+    using ExpanderRaw = faustExpanderVec;
+    using ParametricEQRaw = faustParametricEQVec;
+    using ReverbRaw = zitaRevVec;
+    std::printf("\n== faust kernels, scalar vs vector mode (-vs %d), in place ==\n", (int) SONOBUS_FAUST_VECTOR_SIZE);
+#else
+    using CompressorRaw = faustCompressor;
+    using ExpanderRaw = faustExpander;
+    using ParametricEQRaw = faustParametricEQ;
+    using ReverbRaw = zitaRev;
+    std::printf("\n== faust kernels, scalar only (configure with -DSONOBUS_FAUST_VECTOR=ON for the vector builds) ==\n");
+#endif
+    // max diff: vector against scalar, in place diff: in place against the raw vector kernel with separate buffers
+    std::printf("%10s %6s %12s %12s %8s %12s %12s\n", "kernel", "block", "scalar us", "vector us", "speedup", "max diff", "inplace diff");
+
+    bool passed = true;
+    for (int blocksize : { 32, 64, 128, 256 }) {
+        passed = compareFaustKernels<faustCompressor, CompressorKernel, CompressorRaw>("compressor", [] (MapUI & control) {
+            control.setParamValue("/compressor/threshold", -20.0f);
+            control.setParamValue("/compressor/ratio", 4.0f);
+        }, input, blocksize, passes) && passed;
+
+        passed = compareFaustKernels<faustExpander, ExpanderKernel, ExpanderRaw>("expander", [] (MapUI & control) {
+            control.setParamValue("/expander/threshold", -30.0f);
+            control.setParamValue("/expander/ratio", 4.0f);
+        }, input, blocksize, passes) && passed;
+
+        passed = compareFaustKernels<faustParametricEQ, ParametricEQKernel, ParametricEQRaw>("eq", [] (MapUI & control) {
+            control.setParamValue("/parametric_eq/low_shelf/gain", 3.0f);
+            control.setParamValue("/parametric_eq/para1/peak_gain", -4.0f);
+            control.setParamValue("/parametric_eq/para2/peak_gain", 2.0f);
+            control.setParamValue("/parametric_eq/high_shelf/gain", -3.0f);
+        }, input, blocksize, passes) && passed;
+
+        passed = compareFaustKernels<zitaRev, ReverbKernel, ReverbRaw>("reverb", [] (MapUI &) {}, input, blocksize, passes) && passed;
+    }
+
+    return passed;
+}
+
+
+//==============================================================================
+// serialize
+
+struct ByteCounter
+{
+    int64 bytes = 0;
+    int64 checksum = 0;
+
+    static int32_t count(void * user, const char * data, int32_t n)
+    {
+        auto counter = static_cast<ByteCounter*>(user);
+        counter->bytes += n;
+        counter->checksum += data[n / 2]; // so nothing gets optimized away
+        return n;
+    }
+};
+
+void runSerializeScenario(const BenchOptions & opts)
+{
+    const int iterations = 2000000;
+
+    std::printf("\n== data message serialization (%d frames each) ==\n", iterations);
+    std::printf("%-22s %8s %12s\n", "method", "payload", "ns/frame");
+
+    for (int payload : { 64, 512, 1400 }) {
+        std::vector<char> data ((size_t) payload, 1);
+
+        aoo::data_packet d;
+        d.sequence = 0;
+        d.samplerate = benchSampleRate;
+        d.channel = 0;
+        d.totalsize = payload;
+        d.nframes = 1;
+        d.framenum = 0;
+        d.data = data.data();
+        d.size = payload;
+
+        ByteCounter counter;
+        aoo::sink_desc sink (&counter, ByteCounter::count, 3);
+        sink.update_data_template(1, 12345);
+
+        auto measure = [&](const char * name, std::function<void()> fn) {
+            const auto start = Time::getHighResolutionTicks();
+            for (int i = 0; i < iterations; ++i) {
+                d.sequence = i;
+                fn();
+            }
+            const double elapsed = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start);
+            std::printf("%-22s %8d %12.1f\n", name, payload, elapsed * 1e9 / iterations);
+        };
+
+        measure("full message", [&] { sink.endpoint::send_data(1, 12345, d); });
+        measure("sink template", [&] { sink.send_data(1, 12345, d); });
+        measure("compact", [&] { sink.send_data_compact(1, 12345, d, false); });
+    }
+}
+
+
+//==============================================================================
+// format
+
+// an aoo sink behind its own endpoint, the messages for it are delivered by hand
+struct FormatSink
+{
+    aoo::isink::pointer sink;
+    std::vector<std::vector<char>> inbox;
+    int64 events = 0;
+
+    static int32_t send(void * user, const char * data, int32_t n)
+    {
+        static_cast<FormatSink*>(user)->inbox.emplace_back(data, data + n);
+        return n;
+    }
+
+    static int32_t handleEvents(void * user, const aoo_event ** events, int32_t n)
+    {
+        auto fsink = static_cast<FormatSink*>(user);
+        for (int i = 0; i < n; ++i) {
+            if (events[i]->type == AOO_SOURCE_FORMAT_EVENT) fsink->events++;
+        }
+        return 1;
+    }
+};
+
+void runFormatScenario(const BenchOptions &)
+{
+    const int changes = 200;
+    const int blocksizes[] = { 64, 128, 256 };
+    int sourceEndpoint = 0; // only its address is used
+
+    std::printf("\n== format changes sent to several sinks (%d changes each) ==\n", changes);
+    std::printf("%6s %10s %10s %10s %10s\n", "sinks", "expected", "received", "wrong", "us/change");
+
+    for (int numsinks : { 1, 2, 8, 32, 128 }) {
+        aoo::isource::pointer source (aoo::isource::create(1));
+        source->setup((int32_t) benchSampleRate, blocksizes[0], 2);
+
+        std::vector<std::unique_ptr<FormatSink>> sinks;
+        for (int i = 0; i < numsinks; ++i) {
+            auto fsink = std::make_unique<FormatSink>();
+            fsink->sink.reset(aoo::isink::create(1));
+            fsink->sink->setup((int32_t) benchSampleRate, blocksizes[0], 2);
+            source->add_sink(fsink.get(), 1, FormatSink::send);
+            sinks.push_back(std::move(fsink));
+        }
+        source->start();
+
+        TimingStats sendtimes;
+        int64 wrong = 0;
+
+        for (int change = 0; change < changes; ++change) {
+            const int blocksize = blocksizes[change % numElementsInArray(blocksizes)];
+            aoo_format_storage fmt;
+            makeFormat(fmt, false, 2, blocksize);
+            source->set_format(fmt.header);
+
+            // every sink gets the new format from this one send()
+            const auto start = Time::getHighResolutionTicks();
+            source->send();
+            sendtimes.add(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6);
+
+            for (auto & fsink : sinks) {
+                for (auto & msg : fsink->inbox) {
+                    fsink->sink->handle_message(msg.data(), (int32_t) msg.size(), &sourceEndpoint,
+                                                [](void *, const char *, int32_t n) -> int32_t { return n; });
+                }
+                fsink->inbox.clear();
+                fsink->sink->handle_events(FormatSink::handleEvents, fsink.get());
+
+                aoo_format_storage got;
+                if (fsink->sink->get_source_format(&sourceEndpoint, 1, got) <= 0
+                    || got.header.blocksize != blocksize || got.header.nchannels != 2) {
+                    ++wrong;
+                }
+            }
+        }
+
+        int64 received = 0;
+        for (auto & fsink : sinks) received += fsink->events;
+
+        std::printf("%6d %10lld %10lld %10lld %10.2f\n", numsinks,
+                    (long long) changes * numsinks, (long long) received, (long long) wrong, sendtimes.getMean());
+        std::fflush(stdout);
+    }
+}
+
+
+//==============================================================================
+// jitter
+
+struct NetworkPreset
+{
+    const char * name;
+    const char * spec;
+};
+
+const NetworkPreset networkPresets[] = {
+    { "clean",   "" },
+    { "wifi",    "delay=4,jitter=3,dist=exp,loss=0.002" },
+    { "jittery", "delay=20,jitter=3,dist=pareto" },
+    { "burst",   "delay=20,jitter=2,p=0.01,r=0.3,lossbad=0.7" },
+    { "reorder", "delay=15,jitter=2,reorder=0.02,reorderms=8,dup=0.01" },
+    { "capped",  "delay=10,jitter=1,kbps=2000,queuems=30" },
+};
+
+Array<NetworkPreset> getPresets(const BenchOptions & opts, bool withclean)
+{
+    Array<NetworkPreset> presets;
+    if (opts.netsim.isNotEmpty()) {
+        presets.add({ "custom", opts.netsim.toRawUTF8() });
+    }
+    else {
+        for (auto & preset : networkPresets) {
+            if (withclean || String(preset.spec).isNotEmpty()) presets.add(preset);
+        }
+    }
+    return presets;
+}
+
+void runJitterScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 60.0;
+    const int blocksize = 128;
+    const double period = blocksize / benchSampleRate;
+    const float percentile = AOO_JITTER_PERCENTILE;
+
+    std::printf("\n== jitter estimator (%d frame blocks, p%.1f, %.0f s simulated) ==\n", blocksize, percentile, seconds);
+    std::printf("%-8s %9s %9s %9s %10s %10s\n", "network", "add(ns)", "stats(us)", "buf(ms)", "covered%", "target%");
+
+    for (auto & preset : getPresets(opts, false)) {
+        NetworkImpairment::Settings settings;
+        NetworkImpairment::parseSettings(preset.spec, settings);
+        NetworkImpairment network (settings);
+
+        aoo::jitter_estimator estimator;
+        estimator.reset();
+
+        TimingStats statstimes;
+        std::vector<std::pair<int32_t, double>> arrivals;
+        int64 covered = 0, checked = 0;
+        double bufsum = 0.0;
+        int bufcount = 0;
+        double bufferms = -1.0; // from the last estimate, < 0 until there is one
+        double earliest = 1e9;
+        int32_t lastseq = -1;
+        const int32_t numblocks = (int32_t) (seconds / period);
+        const int32_t statsinterval = (int32_t) (1.0 / period);
+        char dummy[512] = {};
+
+        for (int32_t seq = 0; seq < numblocks; ++seq) {
+            const double now = seq * period;
+            network.push(dummy, sizeof(dummy), (void*) (pointer_sized_int) seq, now);
+
+            double due;
+            while ((due = network.getNextDueTime()) >= 0.0 && due <= now) {
+                network.popDue(due, [&](const char *, int, void * tag) {
+                    const auto arrived = (int32_t) (pointer_sized_int) tag;
+
+                    estimator.add(arrived, due, period);
+                    arrivals.emplace_back(arrived, due);
+
+                    if (arrived > lastseq) {
+                        // would a buffer of that size have had it in time?
+                        const double offset = due - arrived * period;
+                        earliest = jmin(earliest, offset);
+                        if (bufferms >= 0.0) {
+                            ++checked;
+                            if ((offset - earliest) * 1e3 <= bufferms) ++covered;
+                        }
+                        lastseq = arrived;
+                    }
+                });
+            }
+
+            if (seq > 0 && seq % statsinterval == 0) {
+                aoo_jitter_stats stats;
+                const auto start = Time::getHighResolutionTicks();
+                estimator.get_stats(percentile, stats);
+                statstimes.add(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6);
+
+                // what the statistical netbuf mode asks for
+                bufferms = stats.delay_ms + stats.block_ms;
+                bufsum += bufferms;
+                ++bufcount;
+            }
+        }
+
+        // the same arrivals again in a tight loop, a single add() is too short to time on its own
+        aoo::jitter_estimator replay;
+        replay.reset();
+        const auto start = Time::getHighResolutionTicks();
+        for (auto & arrival : arrivals) {
+            replay.add(arrival.first, arrival.second, period);
+        }
+        const double addns = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e9 / jmax((size_t) 1, arrivals.size());
+
+        std::printf("%-8s %9.1f %9.1f %9.2f %10.3f %10.1f\n", preset.name,
+                    addns, statstimes.getMean(),
+                    bufcount > 0 ? bufsum / bufcount : 0.0,
+                    checked > 0 ? 100.0 * covered / checked : 0.0, percentile);
+    }
+}
+
+
+//==============================================================================
+// netsim
+
+// one direction of the simulated network, also the aoo endpoint on the other side
+struct SimLink
+{
+    NetworkImpairment network;
+    double now = 0.0;
+
+    static int32_t send(void * user, const char * data, int32_t n)
+    {
+        auto link = static_cast<SimLink*>(user);
+        link->network.push(data, n, nullptr, link->now);
+        return n;
+    }
+};
+
+struct SimCounts
+{
+    int64 lost = 0;
+    int64 resent = 0;
+    int64 reordered = 0;
+    int64 gaps = 0;
+    int64 stops = 0;
+
+    static int32_t handleEvents(void * user, const aoo_event ** events, int32_t n)
+    {
+        auto counts = static_cast<SimCounts*>(user);
+        for (int i = 0; i < n; ++i) {
+            auto e = (const aoo_block_lost_event *) events[i];
+            switch (events[i]->type) {
+                case AOO_BLOCK_LOST_EVENT: counts->lost += e->count; break;
+                case AOO_BLOCK_RESENT_EVENT: counts->resent += e->count; break;
+                case AOO_BLOCK_REORDERED_EVENT: counts->reordered += e->count; break;
+                case AOO_BLOCK_GAP_EVENT: counts->gaps += e->count; break;
+                case AOO_SOURCE_STATE_EVENT:
+                    if (((const aoo_source_state_event *) events[i])->state == AOO_SOURCE_STATE_STOP) counts->stops++;
+                    break;
+                default: break;
+            }
+        }
+        return 1;
+    }
+};
+
+// returns false if a configuration went past the limits in opts
+bool runNetsimScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 60.0;
+    const int blocksize = 128;
+    const int channels = 2;
+    const double period = blocksize / benchSampleRate;
+    const int clickinterval = (int) benchSampleRate / 2; // longer than any latency we expect
+    const double epoch = 3.9e9; // fixed NTP time, so every run is the same
+    const int64 warmupblocks = (int64) (2.0 / period); // the stream starting up isn't counted
+
+    std::printf("\n== simulated network, source -> sink (PCM %d ch, %d frame blocks, %.0f s virtual time) ==\n", channels, blocksize, seconds);
+    std::printf("%-8s %5s %7s %7s %7s %7s %8s %8s %8s %8s %8s\n",
+                "network", "buf", "netlost", "lost", "resent", "underrn", "lat(ms)", "latmax", "cpu(us)", "cpu p99", "cpu max");
+
+    bool passed = true;
+
+    for (auto & preset : getPresets(opts, true)) {
+        for (auto bufferms : opts.bufferSizes) {
+            NetworkImpairment::Settings settings;
+            NetworkImpairment::parseSettings(preset.spec, settings);
+
+            SimLink tosink, tosource;
+            tosink.network.setSettings(settings);
+            settings.seed += 1;
+            tosource.network.setSettings(settings);
+
+            aoo::isource::pointer source (aoo::isource::create(1));
+            aoo::isink::pointer sink (aoo::isink::create(1));
+
+            source->setup((int32_t) benchSampleRate, blocksize, channels);
+            aoo_format_storage fmt;
+            makeFormat(fmt, false, channels, blocksize);
+            source->set_format(fmt.header);
+            source->set_buffersize(20);
+
+            sink->setup((int32_t) benchSampleRate, blocksize, channels);
+            sink->set_buffersize(bufferms);
+
+            source->add_sink(&tosink, 1, SimLink::send);
+            source->start();
+
+            AudioBuffer<float> inbuf (channels, blocksize), outbuf (channels, blocksize);
+            SimCounts counts;
+            TimingStats cpu;
+            Array<double> latencies;
+            int64 underruns = 0;
+            bool started = false;
+
+            const int64 numblocks = (int64) (seconds / period);
+            cpu.reserve((size_t) numblocks);
+
+            for (int64 block = 0; block < numblocks + warmupblocks; ++block) {
+                const double now = block * period;
+                const bool measuring = block >= warmupblocks;
+                const uint64_t tt = aoo_osctime_fromseconds(epoch + now);
+                tosink.now = tosource.now = now;
+
+                // quiet sine with a click every clickinterval samples
+                for (int ch = 0; ch < channels; ++ch) {
+                    auto data = inbuf.getWritePointer(ch);
+                    for (int i = 0; i < blocksize; ++i) {
+                        const int64 pos = block * blocksize + i;
+                        data[i] = pos % clickinterval == 0 ? 1.0f : 0.1f * (float) std::sin(pos * 0.06);
+                    }
+                }
+
+                source->process((const aoo_sample **) inbuf.getArrayOfReadPointers(), blocksize, tt);
+                source->send();
+
+                tosink.network.popDue(now, [&](const char * data, int size, void *) {
+                    sink->handle_message(data, size, &tosource, SimLink::send);
+                });
+
+                const auto start = Time::getHighResolutionTicks();
+                const bool gotaudio = sink->process((aoo_sample **) outbuf.getArrayOfWritePointers(), blocksize, tt) != 0;
+                if (measuring) cpu.add(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6);
+
+                sink->send();
+                tosource.network.popDue(now, [&](const char * data, int size, void *) {
+                    source->handle_message(data, size, &tosink, SimLink::send);
+                });
+
+                sink->handle_events(SimCounts::handleEvents, &counts);
+                source->handle_events([](void *, const aoo_event **, int32_t) -> int32_t { return 1; }, nullptr);
+
+                if (block == warmupblocks - 1) {
+                    counts = SimCounts();
+                    tosink.network.resetStats();
+                }
+                if (!measuring) {
+                    started = started || gotaudio;
+                }
+                else if (gotaudio) {
+                    started = true;
+                    auto data = outbuf.getReadPointer(0);
+                    for (int i = 0; i < blocksize; ++i) {
+                        if (std::abs(data[i]) > 0.5f) {
+                            const int64 pos = block * blocksize + i;
+                            latencies.add(1e3 * (pos % clickinterval) / benchSampleRate);
+                        }
+                    }
+                }
+                else if (started) {
+                    ++underruns;
+                }
+            }
+
+            double latsum = 0.0, latmax = 0.0;
+            for (auto lat : latencies) {
+                latsum += lat;
+                latmax = jmax(latmax, lat);
+            }
+            const auto & netstats = tosink.network.getStats();
+
+            std::printf("%-8s %5d %7lld %7lld %7lld %7lld %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+                        preset.name, bufferms,
+                        (long long) (netstats.lost + netstats.queueDropped),
+                        (long long) counts.lost, (long long) counts.resent, (long long) underruns,
+                        latencies.isEmpty() ? 0.0 : latsum / latencies.size(), latmax,
+                        cpu.getMean(), cpu.getPercentile(99.0), cpu.getMax());
+
+            // no audio at all is as bad as it gets
+            if (opts.maxUnderruns >= 0 && (underruns > opts.maxUnderruns || !started)) {
+                std::printf("FAIL %s %d ms: %lld underruns%s, at most %d\n", preset.name, bufferms, (long long) underruns,
+                            started ? "" : " (never started)", opts.maxUnderruns);
+                passed = false;
+            }
+            if (opts.maxLost >= 0 && counts.lost > opts.maxLost) {
+                std::printf("FAIL %s %d ms: %lld blocks lost, at most %d\n", preset.name, bufferms, (long long) counts.lost, opts.maxLost);
+                passed = false;
+            }
+            if (opts.maxLatencyMs >= 0.0 && (latmax > opts.maxLatencyMs || latencies.isEmpty())) {
+                std::printf("FAIL %s %d ms: latency up to %.2f ms%s, at most %.2f\n", preset.name, bufferms, latmax,
+                            latencies.isEmpty() ? " (nothing measured)" : "", opts.maxLatencyMs);
+                passed = false;
+            }
+            std::fflush(stdout);
+        }
+    }
+
+    return passed;
+}
+
+//==============================================================================
+// pair: two processors
+
+// returns false if a direction went past the limits in opts or got no audio
+bool runPairScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 10.0;
+    const int blocksize = 128;
+    const double period = blocksize / benchSampleRate;
+    const String spec = opts.netsim.isNotEmpty() ? opts.netsim : String(networkPresets[1].spec);
+
+    std::printf("\n== two processors over loopback, each receiving through \"%s\" (%d frame blocks, %.0f s) ==\n",
+                spec.toRawUTF8(), blocksize, seconds);
+    std::printf("%5s %4s %9s %8s %8s %8s %8s\n", "buf", "dir", "received", "dropped", "resent", "netlost", "lat(ms)");
+
+    bool passed = true;
+
+    for (auto bufferms : opts.bufferSizes) {
+        OwnedArray<SonobusAudioProcessor> processors;
+        OwnedArray<AudioBuffer<float>> buffers;
+
+        for (int i = 0; i < 2; ++i) {
+            auto processor = processors.add(new SonobusAudioProcessor());
+
+            NetworkImpairment::Settings settings;
+            NetworkImpairment::parseSettings(spec, settings);
+            settings.seed += i; // not the same losses both ways
+            processor->setReceiveImpairment(settings);
+
+            processor->setRateAndBufferSizeDetails(benchSampleRate, blocksize);
+            processor->prepareToPlay(benchSampleRate, blocksize);
+
+            const int numchannels = jmax(processor->getTotalNumInputChannels(), processor->getTotalNumOutputChannels());
+            buffers.add(new AudioBuffer<float>(numchannels, blocksize));
+        }
+
+        // the second one connects back on its own
+        processors[0]->connectRemotePeer("127.0.0.1", processors[1]->getUdpLocalPort(), "pair1", "", true);
+
+        MidiBuffer midi;
+        double phase = 0.0;
+        auto runFor = [&] (double duration) {
+            const int numblocks = (int) (duration / period);
+            double next = getSeconds();
+
+            for (int n = 0; n < numblocks; ++n) {
+                double now;
+                while ((now = getSeconds()) < next) {
+                    if (next - now > 0.002) Thread::sleep(1);
+                }
+                if (now > next + 10 * period) {
+                    next = now; // fell behind, don't try to catch up
+                }
+                next += period;
+
+                for (int i = 0; i < 2; ++i) {
+                    auto & buffer = *buffers[i];
+                    const int numinputs = processors[i]->getTotalNumInputChannels();
+                    for (int ch = 0; ch < buffer.getNumChannels(); ++ch) {
+                        auto data = buffer.getWritePointer(ch);
+                        for (int s = 0; s < blocksize; ++s) {
+                            data[s] = ch < numinputs ? 0.1f * (float) std::sin(phase + s * 0.05 * (i + 1)) : 0.0f;
+                        }
+                    }
+                    processors[i]->processBlock(buffer, midi);
+                }
+                phase += blocksize * 0.05;
+            }
+        };
+
+        // connect, then set the buffers and let them settle
+        runFor(2.0);
+        for (auto processor : processors) {
+            for (int i = 0; i < processor->getNumberRemotePeers(); ++i) {
+                processor->setRemotePeerAutoresizeBufferMode(i, SonobusAudioProcessor::AutoNetBufferModeOff);
+                processor->setRemotePeerBufferTime(i, (float) bufferms);
+            }
+        }
+        runFor(2.0);
+
+        NetworkImpairment::Stats netstart[2];
+        for (int i = 0; i < 2; ++i) {
+            netstart[i] = processors[i]->getReceiveImpairmentStats();
+            if (processors[i]->getNumberRemotePeers() > 0) processors[i]->resetRemotePeerPacketStats(0);
+        }
+
+        runFor(seconds);
+
+        for (int i = 0; i < 2; ++i) {
+            auto & processor = *processors[i];
+            const char * dir = i == 0 ? "1>0" : "0>1";
+
+            const auto netstats = processor.getReceiveImpairmentStats();
+            const int64 netlost = netstats.lost + netstats.queueDropped - netstart[i].lost - netstart[i].queueDropped;
+
+            const bool connected = processor.getNumberRemotePeers() == 1;
+            const int64 received = connected ? processor.getRemotePeerPacketsReceived(0) : 0;
+            const int64 dropped = connected ? processor.getRemotePeerPacketsDropped(0) : 0;
+            const int64 resent = connected ? processor.getRemotePeerPacketsResent(0) : 0;
+
+            SonobusAudioProcessor::LatencyInfo latency;
+            const bool haslatency = connected && processor.getRemotePeerLatencyInfo(0, latency) && latency.isreal;
+
+            std::printf("%5d %4s %9lld %8lld %8lld %8lld %8.2f\n", bufferms, dir, (long long) received, (long long) dropped,
+                        (long long) resent, (long long) netlost, haslatency ? latency.incomingMs : 0.0f);
+
+            if (received == 0) {
+                std::printf("FAIL %d ms %s: no audio got through%s\n", bufferms, dir, connected ? "" : " (not connected)");
+                passed = false;
+            }
+            if (opts.maxLost >= 0 && dropped > opts.maxLost) {
+                std::printf("FAIL %d ms %s: %lld packets dropped, at most %d\n", bufferms, dir, (long long) dropped, opts.maxLost);
+                passed = false;
+            }
+            if (opts.maxLatencyMs >= 0.0 && (!haslatency || latency.incomingMs > opts.maxLatencyMs)) {
+                std::printf("FAIL %d ms %s: latency %.2f ms%s, at most %.2f\n", bufferms, dir, haslatency ? latency.incomingMs : 0.0f,
+                            haslatency ? "" : " (no estimate)", opts.maxLatencyMs);
+                passed = false;
+            }
+            std::fflush(stdout);
+        }
+
+        for (auto processor : processors) {
+            processor->removeAllRemotePeers();
+            processor->releaseResources();
+        }
+    }
+
+    return passed;
+}
+
+
+//==============================================================================
+// sendmmsg: batched against per packet sends
+
+#if JUCE_LINUX
+
+// SEND_BATCH_MAX_PACKETS in the processor
+const int benchSendBatch = 64;
+
+// the processor's SendPacketQueue: copies the packets, sends them when full or flushed
+struct BenchSendQueue
+{
+    BenchSendQueue(int socket_) : socket(socket_)
+    {
+        data.calloc((size_t) benchSendBatch * AOO_MAXPACKETSIZE);
+        zeromem(msgs, sizeof(msgs));
+        for (int i = 0; i < benchSendBatch; ++i) {
+            iovecs[i].iov_base = data.get() + i * AOO_MAXPACKETSIZE;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    void add(const sockaddr_in & addr, const char * pdata, int size)
+    {
+        if (count >= benchSendBatch) flush();
+
+        memcpy(iovecs[count].iov_base, pdata, (size_t) size);
+        iovecs[count].iov_len = (size_t) size;
+        msgs[count].msg_hdr.msg_name = (void *) &addr;
+        msgs[count].msg_hdr.msg_namelen = sizeof(addr);
+        ++count;
+    }
+
+    void flush()
+    {
+        int done = 0;
+        while (done < count) {
+            int ret = ::sendmmsg(socket, msgs + done, (unsigned int) (count - done), 0);
+            ++syscalls;
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                ++done;
+                continue;
+            }
+            done += ret;
+        }
+        count = 0;
+    }
+
+    int socket;
+    int count = 0;
+    int64 syscalls = 0;
+
+    HeapBlock<char> data;
+    struct mmsghdr msgs[benchSendBatch];
+    struct iovec iovecs[benchSendBatch];
+};
+
+// reads everything the peers got, returns the number of packets
+int64 drainBenchPeers(const std::vector<int> & sockets)
+{
+    char buf[AOO_MAXPACKETSIZE];
+    int64 received = 0;
+    for (auto sock : sockets) {
+        while (::recv(sock, buf, sizeof(buf), 0) > 0) ++received;
+    }
+    return received;
+}
+
+void runSendmmsgScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 1.0;
+
+    std::printf("\n== one send pass, one packet per peer over loopback UDP, write() per packet vs sendmmsg() ==\n");
+    std::printf("%5s %6s %14s %10s %14s %10s %8s %6s\n", "peers", "bytes",
+                "write us", "syscalls", "sendmmsg us", "syscalls", "speedup", "lost");
+
+    for (int numpeers : { 1, 4, 16, 64, 256 }) {
+        // the peers, each on its own port
+        std::vector<int> sockets;
+        std::vector<sockaddr_in> addrs;
+        OwnedArray<DatagramSocket::RemoteAddrInfo> tokens;
+
+        for (int i = 0; i < numpeers; ++i) {
+            int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+            int rcvbuf = 1 << 20;
+            ::setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+            sockaddr_in addr;
+            zerostruct(addr);
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t addrlen = sizeof(addr);
+            if (sock < 0 || ::bind(sock, (sockaddr *) &addr, sizeof(addr)) < 0
+                || ::getsockname(sock, (sockaddr *) &addr, &addrlen) < 0) {
+                std::printf("can't open peer socket: %s\n", strerror(errno));
+                if (sock >= 0) ::close(sock);
+                break;
+            }
+            ::fcntl(sock, F_SETFL, ::fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+            sockets.push_back(sock);
+            addrs.push_back(addr);
+            // what an endpoint of the processor writes to
+            tokens.add(new DatagramSocket::RemoteAddrInfo("127.0.0.1", ntohs(addr.sin_port)));
+        }
+
+        if ((int) sockets.size() == numpeers) {
+            DatagramSocket sender;
+            sender.bindToPort(0);
+            BenchSendQueue queue (sender.getRawSocketHandle());
+
+            // an opus and a 16 bit stereo pcm block of 256 samples
+            for (int packetsize : { 300, 1100 }) {
+                HeapBlock<char> packet (packetsize, true);
+                const int passes = jmax(20, (int) (seconds * benchSampleRate / 256));
+                double writeus = 0.0, sendmmsgus = 0.0;
+                int64 sent = 0, received = 0;
+                const int64 syscallsbefore = queue.syscalls;
+
+                for (int pass = 0; pass < passes; ++pass) {
+                    auto start = Time::getHighResolutionTicks();
+                    for (int i = 0; i < numpeers; ++i) {
+                        sender.write(*tokens[i], packet.get(), packetsize);
+                    }
+                    writeus += Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6;
+                    sent += numpeers;
+                    received += drainBenchPeers(sockets);
+
+                    start = Time::getHighResolutionTicks();
+                    for (int i = 0; i < numpeers; ++i) {
+                        queue.add(addrs[(size_t) i], packet.get(), packetsize);
+                    }
+                    queue.flush();
+                    sendmmsgus += Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6;
+                    sent += numpeers;
+                    received += drainBenchPeers(sockets);
+                }
+
+                writeus /= passes;
+                sendmmsgus /= passes;
+                std::printf("%5d %6d %14.2f %10d %14.2f %10.1f %7.1fx %6lld\n", numpeers, packetsize,
+                            writeus, numpeers, sendmmsgus, (queue.syscalls - syscallsbefore) / (double) passes,
+                            writeus / sendmmsgus, (long long) (sent - received));
+                std::fflush(stdout);
+            }
+        }
+
+        for (auto sock : sockets) ::close(sock);
+    }
+}
+
+#else
+
+void runSendmmsgScenario(const BenchOptions &)
+{
+    std::printf("\n== sendmmsg: only on Linux ==\n");
+}
+
+#endif
+
+
+//==============================================================================
+// dispatch: peer index against a scan
+
+// LATENCY_ID_OFFSET and ECHO_ID_OFFSET in the processor
+const int32_t benchLatencyIdOffset = 20000;
+const int32_t benchEchoIdOffset = 40000;
+
+// the aoo objects the processor keeps for a peer, with the ids it gives them
+struct DispatchPeer
+{
+    DispatchPeer(int32_t id) : ourId(id)
+    {
+        sink.reset(aoo::isink::create(id));
+        source.reset(aoo::isource::create(id));
+        latencysink.reset(aoo::isink::create(id + benchLatencyIdOffset));
+        latencysource.reset(aoo::isource::create(id + benchLatencyIdOffset));
+        echosink.reset(aoo::isink::create(id + benchEchoIdOffset));
+        echosource.reset(aoo::isource::create(id + benchEchoIdOffset));
+    }
+
+    int32_t ourId;
+    aoo::isink::pointer sink, latencysink, echosink;
+    aoo::isource::pointer source, latencysource, echosource;
+};
+
+// what dispatchAooPacket() did before the index
+void * scanDispatchPeers(const OwnedArray<DispatchPeer> & peers, int32_t type, int32_t id)
+{
+    int32_t objid;
+    for (auto peer : peers) {
+        if (type == AOO_TYPE_SINK) {
+            if (peer->sink->get_id(objid) && objid == id) return peer->sink.get();
+            if (peer->echosink->get_id(objid) && objid == id) return peer->echosink.get();
+            if (peer->latencysink->get_id(objid) && objid == id) return peer->latencysink.get();
+        }
+        else {
+            if (peer->source->get_id(objid) && objid == id) return peer->source.get();
+            if (peer->echosource->get_id(objid) && objid == id) return peer->echosource.get();
+            if (peer->latencysource->get_id(objid) && objid == id) return peer->latencysource.get();
+        }
+    }
+    return nullptr;
+}
+
+// what it does now, ids past the index still get the scan
+void * indexDispatchPeers(DispatchPeer * const * index, const OwnedArray<DispatchPeer> & peers, int32_t type, int32_t id)
+{
+    auto baseid = id >= benchEchoIdOffset ? id - benchEchoIdOffset : id >= benchLatencyIdOffset ? id - benchLatencyIdOffset : id;
+    if (!isPositiveAndBelow(baseid, MAX_PEER_DISPATCH_IDS)) {
+        return scanDispatchPeers(peers, type, id);
+    }
+
+    auto peer = index[baseid];
+    if (!peer) return nullptr;
+
+    const bool sink = type == AOO_TYPE_SINK;
+    if (id == peer->ourId) return sink ? (void *) peer->sink.get() : (void *) peer->source.get();
+    if (id == peer->ourId + benchEchoIdOffset) return sink ? (void *) peer->echosink.get() : (void *) peer->echosource.get();
+    if (id == peer->ourId + benchLatencyIdOffset) return sink ? (void *) peer->latencysink.get() : (void *) peer->latencysource.get();
+    return nullptr;
+}
+
+void runDispatchScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 1.0;
+
+    std::printf("\n== finding the sink or source of a received packet, peer index vs scan ==\n");
+    std::printf("%5s %8s %10s %10s %8s %10s %10s\n", "peers", "ids", "scan ns", "index ns", "speedup", "unindexed", "mismatch");
+
+    for (int numpeers : { 4, 16, 64, 256 }) {
+        // ids are handed out from 1 like the processor does, so the 256th is past the index
+        OwnedArray<DispatchPeer> peers;
+        DispatchPeer * index[MAX_PEER_DISPATCH_IDS] = {};
+        for (int i = 0; i < numpeers; ++i) {
+            auto peer = peers.add(new DispatchPeer(i + 1));
+            if (isPositiveAndBelow(peer->ourId, MAX_PEER_DISPATCH_IDS)) index[peer->ourId] = peer;
+        }
+
+        // every object of every peer, and a few that nobody has
+        struct Lookup { int32_t type; int32_t id; };
+        std::vector<Lookup> lookups;
+        for (auto type : { AOO_TYPE_SINK, AOO_TYPE_SOURCE }) {
+            for (int i = 1; i <= numpeers + 2; ++i) {
+                for (auto offset : { 0, benchLatencyIdOffset, benchEchoIdOffset }) {
+                    lookups.push_back({ type, i + offset });
+                }
+            }
+            lookups.push_back({ type, MAX_PEER_DISPATCH_IDS + 100 });
+        }
+        Random random (numpeers);
+        for (int i = (int) lookups.size() - 1; i > 0; --i) {
+            std::swap(lookups[(size_t) i], lookups[(size_t) random.nextInt(i + 1)]);
+        }
+
+        int64 mismatches = 0, unindexed = 0;
+        for (auto & lookup : lookups) {
+            if (scanDispatchPeers(peers, lookup.type, lookup.id) != indexDispatchPeers(index, peers, lookup.type, lookup.id)) ++mismatches;
+            const int32_t id = lookup.id;
+            auto baseid = id >= benchEchoIdOffset ? id - benchEchoIdOffset : id >= benchLatencyIdOffset ? id - benchLatencyIdOffset : id;
+            if (!isPositiveAndBelow(baseid, MAX_PEER_DISPATCH_IDS)) ++unindexed;
+        }
+
+        // the scan gets as many rounds as fit in the time, the index the same number
+        size_t checksum = 0;
+        int rounds = 0;
+        auto start = Time::getHighResolutionTicks();
+        double elapsed = 0.0;
+        do {
+            for (auto & lookup : lookups) checksum += (size_t) scanDispatchPeers(peers, lookup.type, lookup.id);
+            ++rounds;
+            elapsed = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start);
+        } while (elapsed < seconds * 0.5);
+        const double scanns = elapsed * 1e9 / ((double) rounds * lookups.size());
+
+        start = Time::getHighResolutionTicks();
+        for (int round = 0; round < rounds; ++round) {
+            for (auto & lookup : lookups) checksum += (size_t) indexDispatchPeers(index, peers, lookup.type, lookup.id);
+        }
+        const double indexns = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e9 / ((double) rounds * lookups.size());
+
+        std::printf("%5d %8d %10.1f %10.1f %7.1fx %10lld %10lld%s\n", numpeers, (int) lookups.size(), scanns, indexns,
+                    scanns / indexns, (long long) unindexed, (long long) mismatches,
+                    checksum == 12345 ? " " : ""); // so nothing gets optimized away
+        std::fflush(stdout);
+    }
+}
+
+//==============================================================================
+// server
+
+#if JUCE_LINUX
+
+const int benchServerPort = 20999;
+const int benchProbeSockets = 32;
+const double benchProbeInterval = 0.01; // per socket
+
+#define BENCH_SERVER_MSG(x) AOO_MSG_DOMAIN AOONET_MSG_SERVER x
+#define BENCH_CLIENT_MSG(x) AOO_MSG_DOMAIN AOONET_MSG_CLIENT x
+
+// an app as far as the server can tell: logs in, joins a group and pings
+struct SimClient
+{
+    enum State { Connecting, LoggingIn, LoggedIn, Joining, Joined, Failed };
+
+    int socket = -1;
+    int index = 0;
+    State state = Connecting;
+    double requestTime = 0.0;
+    bool pingPending = false;
+    int peersJoined = 0;
+    aoo::SLIP sendbuffer;
+    aoo::SLIP recvbuffer;
+};
+
+// a UDP socket asking the server for its public address
+struct SimProbe
+{
+    int socket = -1;
+    double sentTime = 0.0;
+    bool pending = false;
+};
+
+class SimClientDriver
+{
+public:
+    SimClientDriver(int numClients_, int groupSize_, int numWatchers_)
+        : numClients(numClients_), groupSize(groupSize_), numWatchers(numWatchers_)
+    {
+        epollfd = epoll_create1(0);
+    }
+
+    ~SimClientDriver()
+    {
+        closeClients();
+        for (auto & probe : probes) ::close(probe.socket);
+        ::close(epollfd);
+    }
+
+    void connectClients()
+    {
+        sockaddr_in sa = getServerAddress();
+
+        for (int i = 0; i < numClients; ++i) {
+            auto client = std::make_unique<SimClient>();
+            client->index = i;
+            client->sendbuffer.setup(4096);
+            client->recvbuffer.setup(8192);
+            client->socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            client->requestTime = getSeconds();
+
+            if (client->socket < 0
+                || (::connect(client->socket, (sockaddr *) &sa, sizeof(sa)) < 0 && errno != EINPROGRESS)) {
+                client->state = SimClient::Failed;
+            }
+            else {
+                epoll_event ev;
+                ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+                ev.data.u64 = (uint64) i;
+                epoll_ctl(epollfd, EPOLL_CTL_ADD, client->socket, &ev);
+            }
+            clients.push_back(std::move(client));
+        }
+    }
+
+    void joinGroups()
+    {
+        const double now = getSeconds();
+        for (auto & client : clients) {
+            if (client->state != SimClient::LoggedIn) continue;
+
+            char buf[256];
+            if (client->index < numWatchers) {
+                osc::OutboundPacketStream msg(buf, sizeof(buf));
+                msg << osc::BeginMessage(BENCH_SERVER_MSG(AOONET_MSG_GROUP AOONET_MSG_PUBLIC))
+                    << true << osc::EndMessage;
+                sendMessage(*client, msg);
+            }
+
+            osc::OutboundPacketStream msg(buf, sizeof(buf));
+            msg << osc::BeginMessage(BENCH_SERVER_MSG(AOONET_MSG_GROUP AOONET_MSG_JOIN))
+                << getGroupName(client->index).toRawUTF8() << "" << (numWatchers > 0) << osc::EndMessage;
+            client->requestTime = now;
+            client->state = SimClient::Joining;
+            sendMessage(*client, msg);
+        }
+    }
+
+    void openProbes()
+    {
+        for (int i = 0; i < benchProbeSockets; ++i) {
+            SimProbe probe;
+            probe.socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+            if (probe.socket < 0) continue;
+
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.u64 = probeTag | (uint64) probes.size();
+            epoll_ctl(epollfd, EPOLL_CTL_ADD, probe.socket, &ev);
+            probes.push_back(probe);
+        }
+    }
+
+    // every client pings once a second and every probe socket asks for its
+    // address every benchProbeInterval, all of them staggered
+    void runLoad(double seconds)
+    {
+        const double start = getSeconds();
+        int64 pings = 0;
+        int64 requests = 0;
+        sockaddr_in sa = getServerAddress();
+
+        while (true) {
+            const double now = getSeconds();
+            if (now - start >= seconds) break;
+
+            while (start + (double) pings / numClients <= now) {
+                auto & client = *clients[(size_t) (pings % numClients)];
+                ++pings;
+                if (client.state != SimClient::Joined) continue;
+
+                if (client.pingPending) ++lostPings;
+                char buf[64];
+                osc::OutboundPacketStream msg(buf, sizeof(buf));
+                msg << osc::BeginMessage(BENCH_SERVER_MSG(AOONET_MSG_PING)) << osc::EndMessage;
+                client.requestTime = now;
+                client.pingPending = true;
+                sendMessage(client, msg);
+            }
+
+            while (!probes.empty() && start + requests * benchProbeInterval / probes.size() <= now) {
+                auto & probe = probes[(size_t) (requests % (int64) probes.size())];
+                ++requests;
+
+                if (probe.pending) ++lostProbes;
+                char buf[64];
+                osc::OutboundPacketStream msg(buf, sizeof(buf));
+                msg << osc::BeginMessage(BENCH_SERVER_MSG(AOONET_MSG_REQUEST)) << osc::EndMessage;
+                probe.sentTime = now;
+                probe.pending = true;
+                ::sendto(probe.socket, msg.Data(), msg.Size(), 0, (sockaddr *) &sa, sizeof(sa));
+            }
+
+            poll(1);
+        }
+    }
+
+    // returns false on timeout
+    bool pollUntil(std::function<bool()> done, double timeout)
+    {
+        const double start = getSeconds();
+        while (!done()) {
+            if (getSeconds() - start > timeout) return false;
+            poll(5);
+        }
+        return true;
+    }
+
+    void closeClients()
+    {
+        for (auto & client : clients) {
+            if (client->socket >= 0) ::close(client->socket);
+            client->socket = -1;
+        }
+    }
+
+    int countState(SimClient::State state) const
+    {
+        int count = 0;
+        for (auto & client : clients) {
+            if (client->state == state) ++count;
+        }
+        return count;
+    }
+
+    // clients that haven't been told about all the other members of their group
+    int countMissingPeers() const
+    {
+        int count = 0;
+        for (auto & client : clients) {
+            if (client->state == SimClient::Joined && client->peersJoined != getExpectedPeers(client->index)) ++count;
+        }
+        return count;
+    }
+
+    bool allPeersJoined() const
+    {
+        for (auto & client : clients) {
+            if (client->state == SimClient::Joining) return false;
+            if (client->state == SimClient::Joined && client->peersJoined < getExpectedPeers(client->index)) return false;
+        }
+        return true;
+    }
+
+    TimingStats loginTimes, joinTimes, pingTimes, probeTimes; // ms
+    int64 lostPings = 0;
+    int64 lostProbes = 0;
+
+private:
+    static const uint64 probeTag = 1ull << 32;
+
+    static sockaddr_in getServerAddress()
+    {
+        sockaddr_in sa;
+        zerostruct(sa);
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(benchServerPort);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return sa;
+    }
+
+    String getGroupName(int index) const { return "group" + String(index / groupSize); }
+
+    int getExpectedPeers(int index) const
+    {
+        const int first = (index / groupSize) * groupSize;
+        return jmin(groupSize, numClients - first) - 1;
+    }
+
+    void sendMessage(SimClient & client, const osc::OutboundPacketStream & msg)
+    {
+        uint8_t buf[512];
+        client.sendbuffer.write_packet((const uint8_t *) msg.Data(), (int32_t) msg.Size());
+        auto size = client.sendbuffer.read_bytes(buf, sizeof(buf));
+        // the messages are tiny, if the socket can't take one something is wrong
+        if (::send(client.socket, buf, (size_t) size, MSG_NOSIGNAL) != size) {
+            client.state = SimClient::Failed;
+        }
+    }
+
+    void poll(int timeoutms)
+    {
+        epoll_event events[256];
+        const int count = epoll_wait(epollfd, events, 256, timeoutms);
+        const double now = getSeconds();
+
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.u64 & probeTag) {
+                receiveProbe(probes[(size_t) (events[i].data.u64 & ~probeTag)], now);
+                continue;
+            }
+
+            auto & client = *clients[(size_t) events[i].data.u64];
+            if (client.state == SimClient::Failed) continue;
+
+            if (client.state == SimClient::Connecting && (events[i].events & (EPOLLOUT | EPOLLERR))) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(client.socket, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                    client.state = SimClient::Failed;
+                    continue;
+                }
+
+                char buf[256];
+                osc::OutboundPacketStream msg(buf, sizeof(buf));
+                msg << osc::BeginMessage(BENCH_SERVER_MSG(AOONET_MSG_LOGIN))
+                    << ("user" + String(client.index)).toRawUTF8() << ""
+                    << "127.0.0.1" << (int32_t) (30000 + client.index % 30000)
+                    << "127.0.0.1" << (int32_t) (30000 + client.index % 30000)
+                    << (int64_t) (client.index + 1) << osc::EndMessage;
+                client.state = SimClient::LoggingIn;
+                sendMessage(client, msg);
+            }
+
+            if (events[i].events & EPOLLIN) {
+                receive(client, now);
+            }
+        }
+    }
+
+    void receive(SimClient & client, double now)
+    {
+        char buf[4096];
+        while (true) {
+            auto result = ::recv(client.socket, buf, sizeof(buf), 0);
+            if (result > 0) {
+                client.recvbuffer.write_bytes((const uint8_t *) buf, (int32_t) result);
+
+                uint8_t packet[AOO_MAXPACKETSIZE];
+                int32_t size;
+                while ((size = client.recvbuffer.read_packet(packet, sizeof(packet))) > 0) {
+                    try {
+                        osc::ReceivedPacket p ((const char *) packet, size);
+                        if (p.IsMessage()) handleReply(client, osc::ReceivedMessage(p), now);
+                    }
+                    catch (const osc::Exception &) {
+                    }
+                }
+            }
+            else {
+                if (result == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    client.state = SimClient::Failed;
+                }
+                return;
+            }
+        }
+    }
+
+    void handleReply(SimClient & client, const osc::ReceivedMessage & msg, double now)
+    {
+        const char * pattern = msg.AddressPattern();
+        auto it = msg.ArgumentsBegin();
+
+        if (!strcmp(pattern, BENCH_CLIENT_MSG(AOONET_MSG_LOGIN))) {
+            if ((it++)->AsInt32() == 1) {
+                loginTimes.add((now - client.requestTime) * 1e3);
+                client.state = SimClient::LoggedIn;
+            }
+            else client.state = SimClient::Failed;
+        }
+        else if (!strcmp(pattern, BENCH_CLIENT_MSG(AOONET_MSG_GROUP AOONET_MSG_JOIN))) {
+            ++it; // group name
+            if ((it++)->AsInt32() == 1) {
+                joinTimes.add((now - client.requestTime) * 1e3);
+                client.state = SimClient::Joined;
+            }
+            else client.state = SimClient::Failed;
+        }
+        else if (!strcmp(pattern, BENCH_CLIENT_MSG(AOONET_MSG_PEER AOONET_MSG_JOIN))) {
+            ++client.peersJoined;
+        }
+        else if (!strcmp(pattern, BENCH_CLIENT_MSG(AOONET_MSG_PING))) {
+            if (client.pingPending) {
+                pingTimes.add((now - client.requestTime) * 1e3);
+                client.pingPending = false;
+            }
+        }
+    }
+
+    void receiveProbe(SimProbe & probe, double now)
+    {
+        char buf[512];
+        while (::recv(probe.socket, buf, sizeof(buf), 0) > 0) {
+            if (probe.pending) {
+                probeTimes.add((now - probe.sentTime) * 1e3);
+                probe.pending = false;
+            }
+        }
+    }
+
+    const int numClients;
+    const int groupSize;
+    const int numWatchers;
+    int epollfd = -1;
+    std::vector<std::unique_ptr<SimClient>> clients;
+    std::vector<SimProbe> probes;
+};
+
+void runServerScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 10.0;
+
+    // both ends of every connection are in this process
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    std::printf("\n== connection server, simulated clients over loopback (groups of %d, %d watchers, %.0f s of pings) ==\n",
+                opts.groupSize, opts.numWatchers, seconds);
+    std::printf("%7s %4s %8s %8s %8s %8s %8s %7s %8s %8s %8s %8s %8s %6s\n",
+                "clients", "thr", "login/s", "login99", "loginmax", "join99", "joinmax", "nopeer",
+                "ping(ms)", "ping p99", "probe", "probe99", "close", "failed");
+
+    for (auto numClients : opts.clientCounts) {
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t) numClients * 2 + 256) {
+            std::printf("%7d  skipped, needs an open file limit of at least %d\n", numClients, numClients * 2 + 256);
+            continue;
+        }
+
+        for (auto numThreads : opts.serverThreads) {
+            int32_t err = 0;
+            aoo::net::iserver::pointer server (aoo::net::iserver::create(benchServerPort, &err, numThreads));
+            if (!server) {
+                std::printf("couldn't start the server on port %d (%d)\n", benchServerPort, (int) err);
+                return;
+            }
+            std::thread serverThread ([&]() { server->run(); });
+
+            SimClientDriver driver (numClients, opts.groupSize, opts.numWatchers);
+
+            // everybody connects and logs in at once
+            const double start = getSeconds();
+            driver.connectClients();
+            driver.pollUntil([&]() { return driver.countState(SimClient::Connecting) + driver.countState(SimClient::LoggingIn) == 0; }, 30.0);
+            const double logintime = getSeconds() - start;
+
+            driver.joinGroups();
+            driver.pollUntil([&]() { return driver.allPeersJoined(); }, 30.0);
+
+            driver.openProbes();
+            driver.runLoad(seconds);
+
+            // everybody goes away at once, wait for the server to drop them
+            const int failed = driver.countState(SimClient::Failed);
+            driver.closeClients();
+            const double closestart = getSeconds();
+            while ((server->get_user_count() > 0 || server->get_group_count() > 0) && getSeconds() - closestart < 30.0) {
+                Thread::sleep(1);
+            }
+            const double closetime = getSeconds() - closestart;
+
+            std::printf("%7d %4d %8.0f %8.2f %8.2f %8.2f %8.2f %7d %8.3f %8.3f %8.3f %8.3f %8.1f %6d\n",
+                        numClients, numThreads,
+                        driver.loginTimes.getCount() / jmax(1e-9, logintime),
+                        driver.loginTimes.getPercentile(99.0), driver.loginTimes.getMax(),
+                        driver.joinTimes.getPercentile(99.0), driver.joinTimes.getMax(),
+                        driver.countMissingPeers(),
+                        driver.pingTimes.getMean(), driver.pingTimes.getPercentile(99.0),
+                        driver.probeTimes.getMean(), driver.probeTimes.getPercentile(99.0),
+                        closetime * 1e3, failed);
+            if (driver.lostPings > 0 || driver.lostProbes > 0) {
+                std::printf("        late or lost: %lld pings, %lld probes\n", (long long) driver.lostPings, (long long) driver.lostProbes);
+            }
+            std::fflush(stdout);
+
+            server->quit();
+            serverThread.join();
+        }
+    }
+}
+
+#else
+
+void runServerScenario(const BenchOptions &)
+{
+    std::printf("\n== connection server: only on Linux ==\n");
+}
+
+#endif
+
+
+//==============================================================================
+// mcu: the server's mix-minus with synthetic participants
+
+#if JUCE_LINUX
+
+// a client as far as the MCU can tell: an aoo source sending a mono tone up and
+// an aoo sink inviting its mix, on its own loopback UDP socket. The upstream goes
+// straight into aoo::net::mcu::handle_message(), the mixes come back over UDP.
+class SimMcuClient
+{
+public:
+    SimMcuClient(aoo::net::mcu & mcu_, const std::string & group, int index, bool opus)
+    : mcu(mcu_), user("user" + std::to_string(index))
+    {
+        socket = ::socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in sa;
+        zerostruct(sa);
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ::bind(socket, (sockaddr *) &sa, sizeof(sa));
+        socklen_t salen = sizeof(sa);
+        getsockname(socket, (sockaddr *) &sa, &salen);
+        fcntl(socket, F_SETFL, O_NONBLOCK);
+        // a generous receive buffer, the mixes of a block all arrive at once
+        int bufsize = 1 << 20;
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+        address = aoo::net::ip_address((sockaddr *) &sa, salen);
+
+        id = mcu.add_participant(group, user, address);
+
+        source.reset(aoo::isource::create(1));
+        source->setup((int32_t) benchSampleRate, AOO_MCU_BLOCKSIZE, 1);
+        aoo_format_storage fmt;
+        makeFormat(fmt, opus, 1, AOO_MCU_BLOCKSIZE);
+        source->set_format(fmt.header);
+        source->set_buffersize(20);
+        source->add_sink(this, id, send);
+        source->start();
+
+        sink.reset(aoo::isink::create(1));
+        sink->setup((int32_t) benchSampleRate, AOO_MCU_BLOCKSIZE, AOO_MCU_CHANNELS);
+        sink->set_buffersize(20);
+        sink->invite_source(this, id, send);
+
+        input.setSize(1, AOO_MCU_BLOCKSIZE);
+        output.setSize(AOO_MCU_CHANNELS, AOO_MCU_BLOCKSIZE);
+        frequency = 220.0 * (1 + index % 8);
+    }
+
+    ~SimMcuClient()
+    {
+        ::close(socket);
+    }
+
+    const std::string & getUser() const { return user; }
+
+    void sendBlock(int64 block, uint64_t tt)
+    {
+        auto data = input.getWritePointer(0);
+        for (int i = 0; i < AOO_MCU_BLOCKSIZE; ++i) {
+            const int64 pos = block * AOO_MCU_BLOCKSIZE + i;
+            data[i] = 0.1f * (float) std::sin(MathConstants<double>::twoPi * frequency * pos / benchSampleRate);
+        }
+        source->process((const aoo_sample **) input.getArrayOfReadPointers(), AOO_MCU_BLOCKSIZE, tt);
+        source->send();
+    }
+
+    // returns true if the mix had any sound
+    bool receiveBlock(uint64_t tt)
+    {
+        char buf[AOO_MAXPACKETSIZE];
+        while (true) {
+            auto n = (int32_t) ::recv(socket, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            int32_t type, sid;
+            if (aoo_parse_pattern(buf, n, &type, &sid)) {
+                if (type == AOO_TYPE_SINK) sink->handle_message(buf, n, this, send);
+                else if (type == AOO_TYPE_SOURCE) source->handle_message(buf, n, this, send);
+            }
+        }
+
+        output.clear();
+        bool gotaudio = sink->process((aoo_sample **) output.getArrayOfWritePointers(), AOO_MCU_BLOCKSIZE, tt) != 0;
+        sink->send();
+
+        auto ignore = [](void *, const aoo_event **, int32_t) -> int32_t { return 1; };
+        sink->handle_events(ignore, nullptr);
+        source->handle_events(ignore, nullptr);
+
+        return gotaudio && output.getMagnitude(0, AOO_MCU_BLOCKSIZE) > 0.0f;
+    }
+
+private:
+    static int32_t send(void * user, const char * data, int32_t n)
+    {
+        auto client = static_cast<SimMcuClient*>(user);
+        int32_t type, id;
+        if (aoo_parse_pattern(data, n, &type, &id)) {
+            client->mcu.handle_message(data, n, type, id, client->address);
+        }
+        return n;
+    }
+
+    aoo::net::mcu & mcu;
+    std::string user;
+    int socket = -1;
+    aoo::net::ip_address address;
+    int32_t id = 0;
+    aoo::isource::pointer source;
+    aoo::isink::pointer sink;
+    AudioBuffer<float> input, output;
+    double frequency = 220.0;
+};
+
+void runMcuScenario(const BenchOptions & opts)
+{
+    const double seconds = opts.seconds > 0.0 ? opts.seconds : 10.0;
+    const double period = AOO_MCU_BLOCKSIZE / benchSampleRate;
+    const double epoch = 3.9e9; // fixed NTP time, so every run is the same
+    const int64 warmupblocks = (int64) (1.0 / period); // joining and the jitter buffers filling up
+
+    std::printf("\n== MCU mix-minus, one group, mono upstreams (%d frame blocks, %.0f s virtual time) ==\n",
+                AOO_MCU_BLOCKSIZE, seconds);
+    std::printf("%6s %6s %10s %10s %10s %9s %8s\n",
+                "parts", "codec", "mix(us)", "mix p99", "mix max", "per core", "silent");
+
+    for (auto numParticipants : opts.participantCounts) {
+        for (auto & codec : opts.codecs) {
+            const std::string group = "bench";
+            int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+            fcntl(sock, F_SETFL, O_NONBLOCK);
+
+            // process() is called from here, like the server thread would
+            aoo::net::mcu mcu (sock, false);
+
+            std::vector<std::unique_ptr<SimMcuClient>> clients;
+            for (int i = 0; i < numParticipants; ++i) {
+                clients.push_back(std::make_unique<SimMcuClient>(mcu, group, i, codec == "opus"));
+            }
+            // every other listener turns one talker down and to the left
+            for (int i = 0; i + 1 < numParticipants; i += 2) {
+                mcu.set_gain(group, clients[i]->getUser(), clients[i + 1]->getUser(), 0.5f, -0.5f);
+            }
+
+            TimingStats mix;
+            int64 silent = 0;
+            const int64 numblocks = (int64) (seconds / period);
+            mix.reserve((size_t) numblocks);
+
+            for (int64 block = 0; block < numblocks + warmupblocks; ++block) {
+                const bool measuring = block >= warmupblocks;
+                const uint64_t tt = aoo_osctime_fromseconds(epoch + block * period);
+
+                for (auto & client : clients) {
+                    client->sendBlock(block, tt);
+                }
+
+                const auto start = Time::getHighResolutionTicks();
+                mcu.process(tt);
+                if (measuring) mix.add(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1e6);
+
+                for (auto & client : clients) {
+                    if (!client->receiveBlock(tt) && measuring && numParticipants > 1) {
+                        ++silent;
+                    }
+                }
+            }
+
+            // participants one core could keep up with, if the cost grows linearly
+            const double percore = numParticipants * period * 1e6 / jmax(1e-9, mix.getMean());
+
+            std::printf("%6d %6s %10.1f %10.1f %10.1f %9.0f %8lld\n",
+                        numParticipants, codec.toRawUTF8(),
+                        mix.getMean(), mix.getPercentile(99.0), mix.getMax(),
+                        percore, (long long) silent);
+            std::fflush(stdout);
+
+            clients.clear();
+            ::close(sock);
+        }
+    }
+}
+
+#else
+
+void runMcuScenario(const BenchOptions &)
+{
+    std::printf("\n== MCU mix-minus: only on Linux ==\n");
+}
+
+#endif
+
+} // namespace
+
+
+int main (int argc, char * argv[])
+{
+    BenchOptions opts;
+    if (!opts.parse(argc, argv)) {
+        printUsage();
+        return 1;
+    }
+
+    ScopedJuceInitialiser_GUI juceInit;
+    aoo_initialize();
+
+    bool passed = true;
+    for (auto & scenario : opts.scenarios) {
+        if (scenario == "process") runProcessScenario(opts);
+        else if (scenario == "snapshot") runSnapshotScenario(opts);
+        else if (scenario == "resampler") runResamplerScenario(opts);
+        else if (scenario == "sendmatrix") runSendMatrixScenario(opts);
+        else if (scenario == "multifx") runMultichannelEffectsScenario(opts);
+        else if (scenario == "faust") passed = runFaustScenario(opts) && passed;
+        else if (scenario == "serialize") runSerializeScenario(opts);
+        else if (scenario == "format") runFormatScenario(opts);
+        else if (scenario == "jitter") runJitterScenario(opts);
+        else if (scenario == "netsim") passed = runNetsimScenario(opts) && passed;
+        else if (scenario == "pair") passed = runPairScenario(opts) && passed;
+        else if (scenario == "server") runServerScenario(opts);
+        else if (scenario == "mcu") runMcuScenario(opts);
+        else if (scenario == "sendmmsg") runSendmmsgScenario(opts);
+        else if (scenario == "dispatch") runDispatchScenario(opts);
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    return passed ? 0 : 2;
+}
@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2020 Jesse Chappell
+
+/*
+ Headless aoo connection server, the same one the app runs when hosting a
+ server, but on its own. Built as the SonoBusServer target (configure with
+ -DSONOBUS_BUILD_SERVER=ON), it only needs the aoo library.
+
+   SonoBusServer [--port <port>] [--threads <n>] [--relay] [--mcu] [--verbose]
+
+   --port      TCP and UDP port (10999)
+   --threads   threads for the client connections and UDP probes, 0 runs
+               everything on one thread (default: number of cores).
+               Only Linux uses more than one.
+   --relay     let the clients publish their stream once to the server,
+               which forwards it to the other group members
+   --mcu       let the clients get a single mix of the other group members
+               from the server instead of one stream per member
+   --verbose   print user and group events, and the counts every minute
+
+ Stops on SIGINT or SIGTERM.
+ */
+
+#include "aoo/aoo.h"
+#include "aoo/aoo_net.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+aoo::net::iserver * gServer = nullptr;
+std::atomic<bool> gQuit { false };
+
+void handleSignal(int)
+{
+    gQuit = true;
+    // only sets a flag and writes to the wait pipe
+    if (gServer) gServer->quit();
+}
+
+int32_t handleServerEvents(void *, const aoo_event ** events, int32_t n)
+{
+    for (int i = 0; i < n; ++i) {
+        switch (events[i]->type) {
+            case AOONET_SERVER_USER_JOIN_EVENT:
+            case AOONET_SERVER_USER_LEAVE_EVENT: {
+                auto e = (const aoonet_server_user_event *) events[i];
+                std::printf("user %s %s\n", e->name,
+                            e->type == AOONET_SERVER_USER_JOIN_EVENT ? "joined" : "left");
+                break;
+            }
+            case AOONET_SERVER_GROUP_JOIN_EVENT:
+            case AOONET_SERVER_GROUP_LEAVE_EVENT: {
+                auto e = (const aoonet_server_group_event *) events[i];
+                std::printf("user %s %s group %s\n", e->user,
+                            e->type == AOONET_SERVER_GROUP_JOIN_EVENT ? "joined" : "left", e->group);
+                break;
+            }
+            case AOONET_SERVER_ERROR_EVENT: {
+                auto e = (const aoonet_server_event *) events[i];
+                std::printf("error: %s\n", e->errormsg ? e->errormsg : "");
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    std::fflush(stdout);
+    return 1;
+}
+
+// every client needs a descriptor, the default soft limit is often 1024
+void raiseDescriptorLimit()
+{
+#ifndef _WIN32
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            std::fprintf(stderr, "couldn't raise the open file limit\n");
+        }
+    }
+#endif
+}
+
+void printUsage()
+{
+    std::printf("usage: SonoBusServer [--port <port>] [--threads <n>] [--relay] [--mcu] [--verbose]\n");
+}
+
+} // namespace
+
+
+int main (int argc, char * argv[])
+{
+    int port = 10999;
+    int threads = (int) std::thread::hardware_concurrency();
+    bool verbose = false;
+    bool relay = false;
+    bool mcu = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--verbose")) {
+            verbose = true;
+        }
+        else if (!std::strcmp(argv[i], "--relay")) {
+            relay = true;
+        }
+        else if (!std::strcmp(argv[i], "--mcu")) {
+            mcu = true;
+        }
+        else if (!std::strcmp(argv[i], "--port") && i + 1 < argc) {
+            port = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        }
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+
+#ifdef _WIN32
+    WSADATA wsadata;
+    WSAStartup(MAKEWORD(2, 2), &wsadata);
+#else
+    // a client that disappears mid send must not take the server down
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    raiseDescriptorLimit();
+    aoo_initialize();
+
+    int32_t err = 0;
+    aoo::net::iserver::pointer server (aoo::net::iserver::create(port, &err, threads));
+    if (!server) {
+        std::fprintf(stderr, "couldn't start the server on port %d (%d)\n", port, (int) err);
+        return 1;
+    }
+
+    server->set_relay(relay);
+    server->set_mcu(mcu);
+
+    gServer = server.get();
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    std::printf("listening on port %d with %d thread(s)%s%s\n", port, threads,
+                relay ? ", relay enabled" : "", mcu ? ", MCU enabled" : "");
+    std::fflush(stdout);
+
+    // events and stats, run() blocks until quit() is called
+    std::thread eventThread ([&]() {
+        auto lastReport = std::chrono::steady_clock::now();
+        while (!gQuit) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            if (!verbose) {
+                // still drain the queue
+                server->handle_events([](void *, const aoo_event **, int32_t) -> int32_t { return 1; }, nullptr);
+                continue;
+            }
+
+            server->handle_events(handleServerEvents, nullptr);
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastReport >= std::chrono::minutes(1)) {
+                std::printf("%d users, %d groups, %d relay streams, %d MCU participants\n",
+                            (int) server->get_user_count(), (int) server->get_group_count(),
+                            (int) server->get_relay_stream_count(),
+                            (int) server->get_mcu_participant_count());
+                std::fflush(stdout);
+                lastReport = now;
+            }
+        }
+    });
+
+    server->run();
+
+    gQuit = true;
+    eventThread.join();
+    gServer = nullptr;
+    server.reset();
+
+    aoo_terminate();
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return 0;
+}
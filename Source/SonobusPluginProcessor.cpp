@@ -22,6 +22,7 @@
 
 #include "LatencyMeasurer.h"
 #include "Metronome.h"
+#include "SeqLock.h"
 
 using namespace SonoAudio;
 
@@ -40,6 +41,13 @@ typedef int socklen_t;
 #define MAX_DELAY_SAMPLES 192000
 #define SENDBUFSIZE_SCALAR 2.0f
 #define PEER_PING_INTERVAL_MS 2000.0
+#define PEER_REBALANCE_INTERVAL_MS 250.0
+#define MAX_DECODE_THREADS 4
+#define SINKS_PER_DECODE_THREAD 4
+#define EVENT_POLL_INTERVAL_MS 20
+#define EVENT_IDLE_WAIT_MS 250
+// how often the event thread looks for events queued from the audio thread
+#define EVENT_AUDIO_POLL_INTERVAL_MS 5
 
 String SonobusAudioProcessor::paramInGain     ("ingain");
 String SonobusAudioProcessor::paramDry     ("dry");
@@ -109,7 +117,10 @@ static String langOverrideCodeKey("langOverrideCode");
 static String lastWindowWidthKey("lastWindowWidth");
 static String lastWindowHeightKey("lastWindowHeight");
 static String autoresizeDropRateThreshKey("autoDropRateThreshNew");
+static String statNetBufPercentileKey("statNetBufPercentile");
 static String reconnectServerLossKey("reconnServLoss");
+static String relayGroupsKey("relayGroups");
+static String mcuGroupsKey("mcuGroups");
 
 static String compressorStateKey("CompressorState");
 static String expanderStateKey("ExpanderState");
@@ -158,6 +169,22 @@ static String peerOrderPriorityKey("orderpriority");
 
 #define UDP_OVERHEAD_BYTES 0 // 28
 
+// max number of datagrams drained from the udp socket per recv thread wakeup
+#define RECV_BATCH_MAX_PACKETS 32
+
+// max number of datagrams queued by the send thread before flushing
+#define SEND_BATCH_MAX_PACKETS 64
+
+#if JUCE_LINUX
+// use recvmmsg() to read many datagrams with one syscall
+#define SONOBUS_BATCHED_RECV 1
+// use sendmmsg() to write the datagrams queued during one send pass with one syscall
+#define SONOBUS_BATCHED_SEND 1
+#else
+#define SONOBUS_BATCHED_RECV 0
+#define SONOBUS_BATCHED_SEND 0
+#endif
+
 // get sockaddr, IPv4 or IPv6:
 static void *get_in_addr(struct sockaddr *sa)
 {
@@ -191,9 +218,74 @@ static addrinfo* getAddressInfo (bool isDatagram, const String& hostName, int po
     return nullptr;
 }
 
+// the sockaddr of a numeric v4 or v6 host without resolving it, false if it isn't numeric
+static bool getNumericSockaddr (const String& hostName, int portNumber, struct sockaddr_storage & ss)
+{
+    zerostruct (ss);
+
+    auto sin = (struct sockaddr_in *) &ss;
+    if (inet_pton (AF_INET, hostName.toRawUTF8(), &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons ((uint16_t) portNumber);
+        return true;
+    }
+
+    auto sin6 = (struct sockaddr_in6 *) &ss;
+    if (inet_pton (AF_INET6, hostName.toRawUTF8(), &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons ((uint16_t) portNumber);
+        return true;
+    }
+
+    return false;
+}
+
+// binary endpoint address (v4 or v6), used as the endpoint table key
+struct EndpointKey {
+    uint16_t family = AF_UNSPEC;
+    uint16_t port = 0; // network byte order
+    uint8_t  addr[16] = {};
+
+    bool operator== (const EndpointKey & other) const noexcept {
+        return family == other.family && port == other.port && memcmp(addr, other.addr, sizeof(addr)) == 0;
+    }
+
+    uint32_t hash() const noexcept {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        auto mix = [&h](const uint8_t * p, size_t n) {
+            for (size_t i=0; i < n; ++i) { h ^= p[i]; h *= 16777619u; }
+        };
+        mix((const uint8_t *) &family, sizeof(family));
+        mix((const uint8_t *) &port, sizeof(port));
+        mix(addr, family == AF_INET ? 4 : sizeof(addr));
+        return h;
+    }
+
+    static bool fromSockaddr(const struct sockaddr * sa, EndpointKey & key) {
+        if (sa->sa_family == AF_INET) {
+            auto sin = (const struct sockaddr_in *) sa;
+            key.family = AF_INET;
+            key.port = sin->sin_port;
+            zeromem(key.addr, sizeof(key.addr));
+            memcpy(key.addr, &sin->sin_addr, 4);
+            return true;
+        }
+        else if (sa->sa_family == AF_INET6) {
+            auto sin6 = (const struct sockaddr_in6 *) sa;
+            key.family = AF_INET6;
+            key.port = sin6->sin6_port;
+            memcpy(key.addr, &sin6->sin6_addr, 16);
+            return true;
+        }
+        return false;
+    }
+};
+
 struct SonobusAudioProcessor::EndpointState {
     EndpointState(String ipaddr_="", int port_=0) : ipaddr(ipaddr_), port(port_) {
-        rawaddr.sa_family = AF_UNSPEC;
+        zerostruct(rawaddr);
+        rawaddr.ss_family = AF_UNSPEC;
     }
     
 
@@ -203,35 +295,108 @@ struct SonobusAudioProcessor::EndpointState {
     std::unique_ptr<DatagramSocket::RemoteAddrInfo> peer;
     String ipaddr;
     int port = 0;
+
+    // binary address key, valid if hasKey is true (never changes after it is published)
+    EndpointKey key;
+    bool hasKey = false;
+
+    // peer using this endpoint, for receive dispatch (maintained by rebuildPeerDispatchIndex)
+    RemotePeer * dispatchPeer = nullptr;
     
     
     struct sockaddr * getRawAddr() {
-        if (rawaddr.sa_family == AF_UNSPEC) {
+        if (rawaddr.ss_family == AF_UNSPEC) {
             struct addrinfo * info = getAddressInfo(true, ipaddr, port);
             if (info) {
-                memcpy(&rawaddr, info->ai_addr, info->ai_addrlen);
+                memcpy(&rawaddr, info->ai_addr, jmin((size_t) info->ai_addrlen, sizeof(rawaddr)));
 
                 freeaddrinfo(info);
             }
         }
-        return &rawaddr;
+        return (struct sockaddr *) &rawaddr;
+    }
+
+    void setRawAddr(const struct sockaddr * sa) {
+        memcpy(&rawaddr, sa, sa->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
     }
     
     
     // runtime state
     int64_t sentBytes = 0;
     int64_t recvBytes = 0;
+    int64_t sentPackets = 0;
+    int64_t recvPackets = 0;
     
 private:
-    struct sockaddr rawaddr;
+    struct sockaddr_storage rawaddr;
     
 };
 
+// open addressing hash table of endpoints keyed by binary address.
+// lookups are lock-free, inserts happen with mEndpointsLock held. Slots are only ever
+// filled (endpoints are not removed until cleanupAoo), and when the table gets too full
+// a larger copy is built and published, the old one stays alive until cleanupAoo
+// because readers may still be walking it.
+struct SonobusAudioProcessor::EndpointTable {
+    EndpointTable(int capacity_) : capacity(capacity_), mask(capacity_ - 1) {
+        jassert (isPowerOfTwo(capacity));
+        slots.reset(new std::atomic<EndpointState*>[(size_t) capacity]);
+        for (int i=0; i < capacity; ++i) {
+            slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    EndpointState * find(const EndpointKey & key) const noexcept {
+        for (uint32_t i = key.hash() & mask, n = 0; n < (uint32_t) capacity; i = (i + 1) & mask, ++n) {
+            auto ep = slots[i].load(std::memory_order_acquire);
+            if (!ep) return nullptr;
+            if (ep->key == key) return ep;
+        }
+        return nullptr;
+    }
+
+    // call with mEndpointsLock held
+    bool insert(EndpointState * endpoint) noexcept {
+        if ((count + 1) * 2 > capacity) return false;
+
+        for (uint32_t i = endpoint->key.hash() & mask; ; i = (i + 1) & mask) {
+            if (!slots[i].load(std::memory_order_relaxed)) {
+                slots[i].store(endpoint, std::memory_order_release);
+                ++count;
+                return true;
+            }
+        }
+    }
+
+    const int capacity;
+    const uint32_t mask;
+    int count = 0;
+    std::unique_ptr<std::atomic<EndpointState*>[]> slots;
+};
+
+#define ENDPOINT_TABLE_INITIAL_SIZE 64
 
 
 
 #define LATENCY_ID_OFFSET 20000
 #define ECHO_ID_OFFSET    40000
+// our source publishing to the server's stream relay, outside of the peer id range
+#define RELAY_SOURCE_ID   60000
+// our source and sink on the server's MCU
+#define MCU_ID            60001
+
+#define RELAY_INVITE_INTERVAL_MS 2000.0
+#define RELAY_FORMAT_TIMEOUT_MS 3000.0 // invited the relayed stream but no format yet
+#define RELAY_RECV_TIMEOUT_MS   6000.0 // nothing from the relay for this long
+
+#define MCU_INVITE_INTERVAL_MS 2000.0 // until the mix arrives
+
+enum {
+    RelayOff = 0,
+    RelayPending, // invited the relayed stream, waiting for its format
+    RelayActive, // receiving it through the relay, the direct source is uninvited
+    RelayFailed // gave up on it, back on the direct connection
+};
 
 enum {
     RemoteNetTypeUnknown = 0,
@@ -267,6 +432,8 @@ struct SonobusAudioProcessor::RemotePeer {
 
     EndpointState * endpoint = 0;
     int32_t ourId = AOO_ID_NONE;
+    // unlike ourId never reused, the send mixer finds the peer by it
+    uint64 sendMixKey = 0;
     int32_t remoteSinkId = AOO_ID_NONE;
     int32_t remoteSourceId = AOO_ID_NONE;
     aoo::isink::pointer oursink;
@@ -287,6 +454,7 @@ struct SonobusAudioProcessor::RemotePeer {
     AutoNetBufferMode  autosizeBufferMode = AutoNetBufferModeAutoFull;
     bool sendActive = false;
     bool recvActive = false;
+    Atomic<bool> sharingEncoder { false }; // our source gets encoded blocks from another peer's source
     bool sendAllow = true;
     bool recvAllow = true;
     bool recvAllowCache = false; // used for recvmute all state
@@ -317,9 +485,20 @@ struct SonobusAudioProcessor::RemotePeer {
     int64_t lastDropCount = 0;
     double lastNetBufDecrTime = 0;
     float netBufAutoBaseline = 0.0f;
+    // Statistical mode: smoothed target and last arrival stats from the sink
+    float statNetBufTargetMs = 0.0f;
+    double lastStatNetBufChangeTime = 0;
+    aoo_jitter_stats jitterStats = {};
+    // the last jitterStats, for anyone but the send thread
+    SonoAudio::SeqLock<aoo_jitter_stats> publishedJitterStats;
     bool autoNetbufInitCompleted = false;
     bool latencyMatched = false;
     bool resetSafetyMuted = true;
+    // results of processPeerReceive() for the final mix
+    float _mixGain = 0.0f;
+    bool _mixSkip = true;
+    // any of the channel groups soloed, resolved with the mix plan
+    bool anySubSoloed = false;
     float pingTime = 0.0f; // ms
     double lastSendPingTimeMs = -1;
     bool   gotNewStylePing = false;
@@ -362,17 +541,134 @@ struct SonobusAudioProcessor::RemotePeer {
     bool hasRemoteInfo = false;
     bool blockedUs = false;
 
+    // stream relay, see updateRelayedPeers()
+    int relayState = RelayOff;
+    int32_t relayStreamId = AOO_ID_NONE;
+    double relayStateChangeMs = 0;
+    double lastRelayInviteMs = 0;
+    double lastRelayRecvMs = 0;
+
+    // the server's MCU mixes them for us, see updateMcuPeers()
+    bool mcuMixed = false;
+    float mcuSentGain = -1.0f;
+    float mcuSentPan = 0.0f;
+
     std::unique_ptr<AudioFormatWriter::ThreadedWriter> fileWriter;
 
     ReadWriteLock    sinkLock;
 };
 
+struct SonobusAudioProcessor::PeerSnapshot {
+    Array<RemotePeer*> peers;
+};
+
+struct SonobusAudioProcessor::RetiredPeers {
+    std::unique_ptr<PeerSnapshot> snapshot;
+    OwnedArray<RemotePeer> peers;
+    // value of mPeerReadsStarted when retired, free once mPeerReadsDone has caught up to it
+    uint64 readsStarted = 0;
+};
+
+
+
+#if SONOBUS_BATCHED_SEND
+// datagrams queued by the send thread during doSendData(), flushed with sendmmsg()
+struct SonobusAudioProcessor::SendPacketQueue {
+    SendPacketQueue() {
+        data.calloc(SEND_BATCH_MAX_PACKETS * AOO_MAXPACKETSIZE);
+        zeromem(msgs, sizeof(msgs));
+        zeromem(endpoints, sizeof(endpoints));
+        for (int i=0; i < SEND_BATCH_MAX_PACKETS; ++i) {
+            iovecs[i].iov_base = data.get() + i * AOO_MAXPACKETSIZE;
+            iovecs[i].iov_len = 0;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    // returns false if the endpoint can't be queued, caller should send directly
+    bool add(EndpointState * endpoint, const char * pdata, int32_t size) {
+        if (size > AOO_MAXPACKETSIZE || !endpoint->peer) return false;
+
+        auto info = static_cast<struct addrinfo*>(endpoint->peer->getAddrInfo());
+        if (info == nullptr) return false;
+
+        if (count >= SEND_BATCH_MAX_PACKETS) {
+            flush();
+        }
+
+        memcpy(iovecs[count].iov_base, pdata, (size_t) size);
+        iovecs[count].iov_len = (size_t) size;
+        msgs[count].msg_hdr.msg_name = info->ai_addr;
+        msgs[count].msg_hdr.msg_namelen = (socklen_t) info->ai_addrlen;
+        endpoints[count] = endpoint;
+        ++count;
+        return true;
+    }
+
+    void flush() {
+        int done = 0;
+        while (done < count) {
+            int ret = sendmmsg(socket->getRawSocketHandle(), msgs + done, (unsigned int) (count - done), 0);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                // skip the one that failed, same as a failed single write
+                DBG("Error sending bytes to endpoint " << endpoints[done]->ipaddr << " : " << errno);
+                ++done;
+                continue;
+            }
+
+            for (int i=done; i < done + ret; ++i) {
+                // include UDP overhead
+                endpoints[i]->sentBytes += msgs[i].msg_len + UDP_OVERHEAD_BYTES;
+                endpoints[i]->sentPackets += 1;
+            }
+            done += ret;
+            ++flushCount;
+        }
+        count = 0;
+    }
+
+    DatagramSocket * socket = nullptr;
+    int count = 0;
+    int64_t flushCount = 0;
+
+    HeapBlock<char> data;
+    struct mmsghdr msgs[SEND_BATCH_MAX_PACKETS];
+    struct iovec iovecs[SEND_BATCH_MAX_PACKETS];
+    EndpointState * endpoints[SEND_BATCH_MAX_PACKETS];
+};
+
+// set only on the send thread while inside doSendData()
+static thread_local SonobusAudioProcessor::SendPacketQueue * tSendQueue = nullptr;
 
+struct ScopedSendQueue
+{
+    ScopedSendQueue(SonobusAudioProcessor::SendPacketQueue * queue) : sendqueue(queue) {
+        tSendQueue = sendqueue;
+    }
+    ~ScopedSendQueue() {
+        tSendQueue = nullptr;
+        if (sendqueue) sendqueue->flush();
+    }
+    SonobusAudioProcessor::SendPacketQueue * sendqueue;
+};
+#else
+struct SonobusAudioProcessor::SendPacketQueue {};
+#endif
 
 static int32_t endpoint_send(void *e, const char *data, int32_t size)
 {
     SonobusAudioProcessor::EndpointState * endpoint = static_cast<SonobusAudioProcessor::EndpointState*>(e);
     int result = -1;
+
+#if SONOBUS_BATCHED_SEND
+    if (tSendQueue && tSendQueue->add(endpoint, data, size)) {
+        // accounting is done when the queue is flushed
+        return size;
+    }
+#endif
+
     if (endpoint->peer) {
         result = endpoint->owner->write(*(endpoint->peer), data, size);
     } else {
@@ -382,6 +678,7 @@ static int32_t endpoint_send(void *e, const char *data, int32_t size)
     if (result > 0) {
         // include UDP overhead
         endpoint->sentBytes += result + UDP_OVERHEAD_BYTES;
+        endpoint->sentPackets += 1;
     }
     else if (result < 0) {
         DBG("Error sending bytes to endpoint " << endpoint->ipaddr);
@@ -402,6 +699,7 @@ static int32_t client_send(void *e, const char *data, int32_t size, void *raddr)
     
     if (result > 0) {
         endpoint->sentBytes += result + UDP_OVERHEAD_BYTES;
+        endpoint->sentPackets += 1;
     }
     
     return result;
@@ -409,6 +707,48 @@ static int32_t client_send(void *e, const char *data, int32_t size, void *raddr)
 
 
 
+// preallocated storage for a batch of received datagrams, only used by the recv thread
+struct SonobusAudioProcessor::RecvPacketArena {
+    RecvPacketArena() {
+        data.calloc(RECV_BATCH_MAX_PACKETS * AOO_MAXPACKETSIZE);
+        zeromem(sizes, sizeof(sizes));
+        zeromem(endpoints, sizeof(endpoints));
+#if SONOBUS_BATCHED_RECV
+        zeromem(msgs, sizeof(msgs));
+        for (int i=0; i < RECV_BATCH_MAX_PACKETS; ++i) {
+            iovecs[i].iov_base = getPacket(i);
+            iovecs[i].iov_len = AOO_MAXPACKETSIZE;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+        }
+#endif
+    }
+
+    char * getPacket(int index) { return data.get() + index * AOO_MAXPACKETSIZE; }
+
+#if SONOBUS_BATCHED_RECV
+    // recvmmsg overwrites these on each call
+    void resetHeaders() {
+        for (int i=0; i < RECV_BATCH_MAX_PACKETS; ++i) {
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            msgs[i].msg_hdr.msg_controllen = 0;
+            msgs[i].msg_hdr.msg_flags = 0;
+            msgs[i].msg_len = 0;
+        }
+    }
+
+    struct mmsghdr msgs[RECV_BATCH_MAX_PACKETS];
+    struct iovec iovecs[RECV_BATCH_MAX_PACKETS];
+#endif
+
+    struct sockaddr_storage addrs[RECV_BATCH_MAX_PACKETS];
+    HeapBlock<char> data;
+    int sizes[RECV_BATCH_MAX_PACKETS];
+    EndpointState * endpoints[RECV_BATCH_MAX_PACKETS];
+};
+
+
 class SonobusAudioProcessor::SendThread : public juce::Thread
 {
 public:
@@ -455,9 +795,13 @@ public:
 
         while (!threadShouldExit()) {
          
-            if (_processor.mUdpSocket->waitUntilReady(true, 20) == 1) {
+            if (_processor.mUdpSocket->waitUntilReady(true, _processor.getImpairmentWaitMs(20)) == 1) {
                 _processor.doReceiveData();
             }
+
+            if (_processor.mRecvImpairmentActive.get()) {
+                _processor.releaseImpairedPackets();
+            }
         }
 
         DBG("Recv thread finishing");        
@@ -467,6 +811,42 @@ public:
     
 };
 
+class SonobusAudioProcessor::DecodeThread : public juce::Thread
+{
+public:
+    DecodeThread(SonobusAudioProcessor & processor, int index) : Thread("SonoBusDecodeThread") , _processor(processor), _index(index)
+    {}
+    
+    void run() override {
+
+        setPriority(Thread::Priority::highest);
+
+        while (!threadShouldExit()) {
+            // the recv thread notifies us when it got new audio data
+            _waitable.wait(20);
+
+            if (_index < _processor.mActiveDecodeThreads.get()) {
+                _processor.doDecodeData(_index);
+            }
+        }
+
+        DBG("Decode thread finishing");
+    }
+    
+    SonobusAudioProcessor & _processor;
+    int _index;
+    WaitableEvent _waitable;
+};
+
+// set on the audio thread and the worker threads helping it, which must not signal the event thread
+static thread_local bool tRealtimeThread = false;
+
+static void gAooEventNotify(void * user, int32_t id)
+{
+    // may be the audio thread
+    static_cast<SonobusAudioProcessor*>(user)->notifyEventQueued(id, tRealtimeThread);
+}
+
 class SonobusAudioProcessor::EventThread : public juce::Thread
 {
 public:
@@ -477,9 +857,22 @@ public:
 
         while (!threadShouldExit()) {
          
-            Thread::sleep(20);
+            // our sources and sinks wake us up when they queue an event, but the
+            // aoo client and server still have to be polled
+            const bool poll = _processor.mAooClient || _processor.mAooServer;
+            const int timeout = poll ? EVENT_POLL_INTERVAL_MS : EVENT_IDLE_WAIT_MS;
+
+            // the audio thread can't wake us, it only leaves mEventPendingFromAudio set
+            for (int waited = 0; waited < timeout && !threadShouldExit(); waited += EVENT_AUDIO_POLL_INTERVAL_MS) {
+                if (_processor.mEventWaitable.wait(EVENT_AUDIO_POLL_INTERVAL_MS)
+                    || _processor.mEventPendingFromAudio.exchange(false)) {
+                    break;
+                }
+            }
             
             _processor.handleEvents();                       
+
+            _processor.reclaimRetiredPeers();
         }
         
         DBG("Event thread finishing");
@@ -664,7 +1057,7 @@ mState (*this, &mUndoManager, "SonoBusAoO",
     std::make_unique<AudioParameterBool>(ParameterID(paramMainInMute, 1), TRANS ("Main In Mute"), mMainInMute.get()),
     std::make_unique<AudioParameterBool>(ParameterID(paramMainMonitorSolo, 1), TRANS ("Main Monitor Solo"), mMainMonitorSolo.get()),
 
-    std::make_unique<AudioParameterChoice>(ParameterID(paramDefaultAutoNetbuf, 1), TRANS ("Def Auto Net Buffer Mode"), StringArray({ "Off", "Auto-Increase", "Auto-Full", "Initial-Auto"}), defaultAutoNetbufMode),
+    std::make_unique<AudioParameterChoice>(ParameterID(paramDefaultAutoNetbuf, 1), TRANS ("Def Auto Net Buffer Mode"), StringArray({ "Off", "Auto-Increase", "Auto-Full", "Initial-Auto", "Statistical"}), defaultAutoNetbufMode),
 
     std::make_unique<AudioParameterInt>(ParameterID(paramDefaultSendQual, 1), TRANS ("Def Send Format"), 0, 14, mDefaultAudioFormatIndex),
     std::make_unique<AudioParameterBool>(ParameterID(paramDynamicResampling, 1), TRANS ("Dynamic Resampling"), mDynamicResampling.get()),
@@ -689,6 +1082,9 @@ mState (*this, &mUndoManager, "SonoBusAoO",
 
 })
 {
+    // the audio thread always has a (possibly empty) peer snapshot to read
+    mPeerSnapshot = new PeerSnapshot();
+
     mState.addParameterListener (paramInGain, this);
     mState.addParameterListener (paramDry, this);
     mState.addParameterListener (paramWet, this);
@@ -851,6 +1247,8 @@ SonobusAudioProcessor::~SonobusAudioProcessor()
     mTransportSource.removeChangeListener(this);
 
     cleanupAoo();
+
+    delete mPeerSnapshot.exchange(nullptr);
 }
 
 void SonobusAudioProcessor::moveOldMisplacedFiles()
@@ -910,6 +1308,15 @@ void SonobusAudioProcessor::initializeAoo(int udpPort)
     //mAooSink.reset(aoo::isink::create(1));
 
     mAooDummySource.reset(aoo::isource::create(0));
+    mAooDummySource->set_event_notify(gAooEventNotify, this);
+
+    mRelaySource.reset(aoo::isource::create(RELAY_SOURCE_ID));
+    mRelaySource->set_event_notify(gAooEventNotify, this);
+
+    mMcuSource.reset(aoo::isource::create(MCU_ID));
+    mMcuSource->set_event_notify(gAooEventNotify, this);
+    mMcuSink.reset(aoo::isink::create(MCU_ID));
+    mMcuSink->set_event_notify(gAooEventNotify, this);
 
 
 
@@ -923,6 +1330,22 @@ void SonobusAudioProcessor::initializeAoo(int udpPort)
 
     
     mUdpSocket = std::make_unique<DatagramSocket>();
+    mRecvArena = std::make_unique<RecvPacketArena>();
+
+    // e.g. SONOBUS_NETSIM="delay=30,jitter=8,dist=pareto,p=0.01,r=0.4,lossbad=0.7"
+    auto netsim = SystemStats::getEnvironmentVariable("SONOBUS_NETSIM", "");
+    if (netsim.isNotEmpty()) {
+        SonoAudio::NetworkImpairment::Settings simsettings;
+        if (SonoAudio::NetworkImpairment::parseSettings(netsim, simsettings)) {
+            setReceiveImpairment(simsettings);
+        } else {
+            DBG("Invalid SONOBUS_NETSIM setting: " << netsim);
+        }
+    }
+#if SONOBUS_BATCHED_SEND
+    mSendQueue = std::make_unique<SendPacketQueue>();
+    mSendQueue->socket = mUdpSocket.get();
+#endif
     mUdpSocket->setSendBufferSize(1048576);
     mUdpSocket->setReceiveBufferSize(1048576);
 
@@ -1008,6 +1431,12 @@ void SonobusAudioProcessor::initializeAoo(int udpPort)
     mRecvThread = std::make_unique<RecvThread>(*this);
     mEventThread = std::make_unique<EventThread>(*this);
 
+    // leave a couple of cores for the audio, send and recv threads
+    int numDecodeThreads = jlimit(1, MAX_DECODE_THREADS, SystemStats::getNumCpus() - 2);
+    for (int i=0; i < numDecodeThreads; ++i) {
+        mDecodeThreads.add(new DecodeThread(*this, i));
+    }
+
     if (mAooClient) {
         mClientThread = std::make_unique<ClientThread>(*this);
     }
@@ -1019,6 +1448,9 @@ void SonobusAudioProcessor::initializeAoo(int udpPort)
     // do not use startRealtimeThread() call because it triggers the whole process to be realtime, which we don't want
     mSendThread->startThread(Thread::Priority::highest);
     mRecvThread->startThread(Thread::Priority::highest);
+    for (auto thread : mDecodeThreads) {
+        thread->startThread(Thread::Priority::highest);
+    }
 #else
     if (!mSendThread->startRealtimeThread({ rtprio, estWorkDurationMs }))
     {
@@ -1031,6 +1463,14 @@ void SonobusAudioProcessor::initializeAoo(int udpPort)
         DBG("Recv thread failed to start realtime: trying regular");
         mRecvThread->startThread(Thread::Priority::highest);
     }
+
+    for (auto thread : mDecodeThreads) {
+        if (!thread->startRealtimeThread({ rtprio, estWorkDurationMs }))
+        {
+            DBG("Decode thread failed to start realtime: trying regular");
+            thread->startThread(Thread::Priority::highest);
+        }
+    }
 #endif
 
     mEventThread->startThread(Thread::Priority::normal);
@@ -1047,9 +1487,20 @@ void SonobusAudioProcessor::cleanupAoo()
     
     DBG("waiting on recv thread to die");
     mRecvThread->stopThread(400);
+    DBG("waiting on decode threads to die");
+    for (auto thread : mDecodeThreads) {
+        thread->signalThreadShouldExit();
+    }
+    for (auto thread : mDecodeThreads) {
+        thread->stopThread(400);
+    }
+    mDecodeThreads.clear();
+    mActiveDecodeThreads = 0;
     DBG("waiting on send thread to die");
     mSendThread->stopThread(400);
     DBG("waiting on event thread to die");
+    mEventThread->signalThreadShouldExit();
+    mEventWaitable.signal();
     mEventThread->stopThread(400);
 
     if (mAooClient) {
@@ -1067,12 +1518,49 @@ void SonobusAudioProcessor::cleanupAoo()
         mUdpSocket.reset();
         
         mAooDummySource.reset();
+
+        // the audio thread only looks at the relay source and the MCU while it has a peer snapshot
+        mRelaySourceActive = false;
+        mRelayEndpoint = nullptr;
+        mMcuActive = false;
+        mMcuEndpoint = nullptr;
+        waitForPeerSnapshotReaders();
+        mRelaySource.reset();
+        mMcuSource.reset();
+        mMcuSink.reset();
+        {
+            const ScopedLock rl (mRelayLock);
+            mRelayStreams.clear();
+        }
+        {
+            const ScopedLock ml (mMcuLock);
+            mMcuParticipants.clear();
+        }
         
-        mRemotePeers.clear();
-        
+        OwnedArray<RemotePeer> removed;
+        for (auto peer : mRemotePeers) {
+            removed.add(peer);
+        }
+        mRemotePeers.clearQuick(false);
+        rebuildPeerDispatchIndex();
+        publishPeerSnapshot();
+        retireRemotePeers(removed);
+
+        {
+            // the held back packets point at the endpoints
+            const ScopedLock sl (mRecvImpairmentLock);
+            if (mRecvImpairment) mRecvImpairment->clear();
+        }
+
+        mEndpointTable = nullptr;
+        mEndpointTables.clear();
         mEndpoints.clear();
     }
 
+    // the event thread is gone, so free the retired peers here once the audio thread is done with them
+    waitForPeerSnapshotReaders();
+    reclaimRetiredPeers();
+
     stopAooServer();    
 }
 
@@ -1397,6 +1885,34 @@ void SonobusAudioProcessor::setDefaultAutoresizeBufferMode(AutoNetBufferMode fla
 }
 
 
+void SonobusAudioProcessor::setParallelPeerProcessing(bool flag)
+{
+    if (flag == mParallelPeerProcessing.get()) return;
+
+    if (flag) {
+        // the audio thread does its share too
+        int numworkers = jlimit(1, 8, SystemStats::getNumCpus() - 1);
+        mWorkerPool.start(numworkers);
+        mParallelPeerProcessing = true;
+    }
+    else {
+        mParallelPeerProcessing = false;
+        // make sure processBlock isn't using the pool anymore
+        waitForPeerSnapshotReaders();
+        mWorkerPool.stop();
+    }
+}
+
+void SonobusAudioProcessor::setOpusFecLossPercent(int percent)
+{
+    percent = jlimit(0, 100, percent);
+    if (percent != mOpusFecLossPercent.get()) {
+        mOpusFecLossPercent = percent;
+        // reformat all our sources on the send thread
+        mNeedsSampleSetup = true;
+    }
+}
+
 void SonobusAudioProcessor::setRemotePeerAudioCodecFormat(int index, int formatIndex)
 {
     if (formatIndex >= mAudioFormats.size() || index >= mRemotePeers.size()) return;
@@ -1456,6 +1972,10 @@ bool SonobusAudioProcessor::setRequestRemotePeerSendAudioCodecFormat(int index,
         const AudioCodecFormatInfo & info = mAudioFormats.getReference(formatIndex);
 
         if (formatInfoToAooFormat(info, remote->recvChannels, fmt)) {
+            if (remote->relayState == RelayPending || remote->relayState == RelayActive) {
+                // the relayed stream has the sender's default format for everyone
+                fallBackFromRelay(remote, Time::getMillisecondCounterHiRes());
+            }
             remote->oursink->request_source_codec_change(remote->endpoint, remote->remoteSourceId, fmt.header);
 
             remote->reqRemoteSendFormatIndex = formatIndex; 
@@ -1545,7 +2065,7 @@ void SonobusAudioProcessor::setRemotePeerCompressorParams(int index, int changro
 
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         remote->chanGroups[changroup].params.compressorParams = params;
-        remote->chanGroups[changroup].compressorParamsChanged = true;
+        remote->chanGroups[changroup].publishEffectParams();
     }
 }
 
@@ -1575,7 +2095,7 @@ void SonobusAudioProcessor::setRemotePeerExpanderParams(int index, int changroup
 
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         remote->chanGroups[changroup].params.expanderParams = params;
-        remote->chanGroups[changroup].expanderParamsChanged = true;
+        remote->chanGroups[changroup].publishEffectParams();
     }
 }
 
@@ -1601,7 +2121,7 @@ void SonobusAudioProcessor::setRemotePeerEqParams(int index, int changroup, Sono
 
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         remote->chanGroups[changroup].params.eqParams = params;
-        remote->chanGroups[changroup].eqParamsChanged = true;
+        remote->chanGroups[changroup].publishEffectParams();
     }
 }
 
@@ -1772,7 +2292,7 @@ void SonobusAudioProcessor::setInputCompressorParams(int changroup, CompressorPa
 
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         mInputChannelGroups[changroup].params.compressorParams = params;
-        mInputChannelGroups[changroup].compressorParamsChanged = true;
+        mInputChannelGroups[changroup].publishEffectParams();
     }
 }
 
@@ -1792,7 +2312,7 @@ void SonobusAudioProcessor::setInputLimiterParams(int changroup, CompressorParam
 
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         mInputChannelGroups[changroup].params.limiterParams = params;
-        mInputChannelGroups[changroup].limiterParamsChanged = true;
+        mInputChannelGroups[changroup].publishEffectParams();
     }
 }
 
@@ -1832,7 +2352,7 @@ void SonobusAudioProcessor::setInputExpanderParams(int changroup, CompressorPara
 
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         mInputChannelGroups[changroup].params.expanderParams = params;
-        mInputChannelGroups[changroup].expanderParamsChanged = true;
+        mInputChannelGroups[changroup].publishEffectParams();
     }
 }
 
@@ -1849,7 +2369,7 @@ void SonobusAudioProcessor::setInputEqParams(int changroup, ParametricEqParams &
 {
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         mInputChannelGroups[changroup].params.eqParams = params;
-        mInputChannelGroups[changroup].eqParamsChanged = true;
+        mInputChannelGroups[changroup].publishEffectParams();
     }
 }
 
@@ -1868,6 +2388,7 @@ void SonobusAudioProcessor::setInputGroupCount(int count)
     int newcnt = std::max(0, std::min(count, MAX_CHANGROUPS-1));
 
     mInputChannelGroupCount = newcnt;
+    invalidateMixPlan();
 }
 
 void SonobusAudioProcessor::setInputGroupChannelStartAndCount(int changroup, int start, int count)
@@ -1876,6 +2397,8 @@ void SonobusAudioProcessor::setInputGroupChannelStartAndCount(int changroup, int
         mInputChannelGroups[changroup].params.chanStartIndex = start;
         mInputChannelGroups[changroup].params.numChannels = std::max(1, std::min(count, MAX_CHANNELS));
         mInputChannelGroups[changroup].commitMonitorDelayParams();
+        mInputChannelGroups[changroup].prepareMultichannelEffects();
+        invalidateMixPlan();
     }
 }
 
@@ -1894,6 +2417,7 @@ void SonobusAudioProcessor::setInputGroupChannelDestStartAndCount(int changroup,
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         mInputChannelGroups[changroup].params.monDestStartIndex = start;
         mInputChannelGroups[changroup].params.monDestChannels = std::max(1, std::min(count, MAX_CHANNELS));
+        invalidateMixPlan();
     }
 }
 
@@ -1925,6 +2449,8 @@ bool SonobusAudioProcessor::insertInputChannelGroup(int atgroup, int chstart, in
 
         // todo some defaults
         mInputChannelGroups[atgroup].commitMonitorDelayParams(); // need to do this too
+        mInputChannelGroups[atgroup].prepareMultichannelEffects();
+        invalidateMixPlan();
 
         return true;
     }
@@ -1941,6 +2467,7 @@ bool SonobusAudioProcessor::removeInputChannelGroup(int atgroup)
             //mInputChannelGroups[i].chanStartIndex += chcount;
             //mInputChannelGroups[i-1].numChannels = std::max(1, std::min(count, MAX_CHANNELS));
         }
+        invalidateMixPlan();
         return true;
     }
     return false;
@@ -1957,6 +2484,7 @@ bool SonobusAudioProcessor::moveInputChannelGroupTo(int atgroup, int togroup)
     int origgroup = atgroup < togroup ? atgroup : atgroup+1;
     // copy from origgroup to new atgroup
     mInputChannelGroups[togroup].copyParametersFrom(mInputChannelGroups[origgroup]);
+    invalidateMixPlan();
 
     // remove origgroup
     removeInputChannelGroup(origgroup);
@@ -2058,6 +2586,7 @@ void SonobusAudioProcessor::setInputGroupSoloed(int changroup, bool soloed)
 {
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         mInputChannelGroups[changroup].params.soloed = soloed;
+        invalidateMixPlan();
     }
 }
 
@@ -2076,6 +2605,7 @@ void SonobusAudioProcessor::setInputReverbSend(int changroup, float rgain, bool
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         if (input) {
             mInputChannelGroups[changroup].params.inReverbSend = rgain;
+            invalidateMixPlan();
         } else {
             mInputChannelGroups[changroup].params.monReverbSend = rgain;
         }
@@ -2114,14 +2644,14 @@ bool SonobusAudioProcessor::getInputPolarityInvert(int changroup)
 void SonobusAudioProcessor::commitCompressorParams(RemotePeer * peer, int changroup)
 {   
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        peer->chanGroups[changroup].commitCompressorParams();
+        peer->chanGroups[changroup].publishEffectParams();
     }
 }
 
 void SonobusAudioProcessor::commitInputCompressorParams(int changroup)
 {   
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].commitCompressorParams();
+        mInputChannelGroups[changroup].publishEffectParams();
     }
 }
 
@@ -2130,7 +2660,7 @@ void SonobusAudioProcessor::commitInputExpanderParams(int changroup)
    
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
         //mInputCompressorControl.setParamValue("/compressor/Bypass", mInputCompressorParams.enabled ? 0.0f : 1.0f);
-        mInputChannelGroups[changroup].commitExpanderParams();
+        mInputChannelGroups[changroup].publishEffectParams();
     }
 
 }
@@ -2144,7 +2674,7 @@ void SonobusAudioProcessor::commitInputLimiterParams(int changroup)
     //mInputLimiterControl.setParamValue("/limiter/release", mInputLimiterParams.releaseMs * 1e-3);
 
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].commitLimiterParams();
+        mInputChannelGroups[changroup].publishEffectParams();
     }
 
 }
@@ -2153,7 +2683,7 @@ void SonobusAudioProcessor::commitInputLimiterParams(int changroup)
 void SonobusAudioProcessor::commitInputEqParams(int changroup)
 {
     if (changroup >= 0 && changroup < MAX_CHANGROUPS) {
-        mInputChannelGroups[changroup].commitEqParams();
+        mInputChannelGroups[changroup].publishEffectParams();
     }
 }
 
@@ -2188,40 +2718,111 @@ foleys::LevelMeterSource * SonobusAudioProcessor::getRemotePeerSendMeterSource(i
 
 SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::findOrAddRawEndpoint(void * rawaddr)
 {
-    String ipaddr;
-    int port = 0 ;
+    // this is the hot path for received packets, no locks or allocation unless it is a new endpoint
+    const struct sockaddr * sa = (const struct sockaddr *) rawaddr;
+    EndpointKey key;
+
+    if (!EndpointKey::fromSockaddr(sa, key)) {
+        DBG("Error converting raw addr to endpoint key");
+        return nullptr;
+    }
+
+    if (auto table = mEndpointTable.get()) {
+        if (auto endpoint = table->find(key)) {
+            return endpoint;
+        }
+    }
 
     char hostip[INET6_ADDRSTRLEN];
-    if (inet_ntop(AF_INET, get_in_addr((struct sockaddr *)rawaddr), hostip, sizeof(hostip)) == nullptr) {
+    if (inet_ntop(sa->sa_family, get_in_addr((struct sockaddr *)rawaddr), hostip, sizeof(hostip)) == nullptr) {
         DBG("Error converting raw addr to IP");
         return nullptr;
-    } else {
-        ipaddr = hostip;
-        port = ntohs(get_in_port((struct sockaddr *)rawaddr));        
-        return findOrAddEndpoint(ipaddr, port);    
-    }    
+    }
+
+    String ipaddr = hostip;
+    int port = ntohs(get_in_port((struct sockaddr *)rawaddr));
+
+    return addEndpoint(key, sa, ipaddr, port, std::make_unique<DatagramSocket::RemoteAddrInfo>(ipaddr, port));
 }
 
 SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::findOrAddEndpoint(const String & host, int port)
 {
-    const ScopedLock sl (mEndpointsLock);        
-    
-    EndpointState * endpoint = 0;
+    EndpointKey key;
+
+    // a numeric host (what we usually get) can be looked up without resolving it,
+    // the address info is only made for a new endpoint
+    struct sockaddr_storage numeric;
+    if (getNumericSockaddr(host, port, numeric) && EndpointKey::fromSockaddr((const struct sockaddr *) &numeric, key)) {
+        if (auto table = mEndpointTable.get()) {
+            if (auto endpoint = table->find(key)) {
+                return endpoint;
+            }
+        }
+    }
+
+    // key by the address we will actually be sending to
+    auto peerinfo = std::make_unique<DatagramSocket::RemoteAddrInfo>(host, port);
+    auto info = static_cast<struct addrinfo*>(peerinfo->getAddrInfo());
+
+    if (info && EndpointKey::fromSockaddr(info->ai_addr, key)) {
+        if (auto table = mEndpointTable.get()) {
+            if (auto endpoint = table->find(key)) {
+                return endpoint;
+            }
+        }
+
+        return addEndpoint(key, info->ai_addr, host, port, std::move(peerinfo));
+    }
+
+    // could not resolve it, fall back to matching by name
+    const ScopedLock sl (mEndpointsLock);
     
     for (auto ep : mEndpoints) {
-        if (ep->ipaddr == host && ep->port == port) {
-            endpoint = ep;
-            break;
+        if (!ep->hasKey && ep->ipaddr == host && ep->port == port) {
+            return ep;
         }
     }
     
-    if (!endpoint) {
-        // add it as new
-        endpoint = mEndpoints.add(new EndpointState(host, port));
-        endpoint->owner = mUdpSocket.get();
-        endpoint->peer = std::make_unique<DatagramSocket::RemoteAddrInfo>(host, port);
-        DBG("Added new endpoint for " << host << ":" << port);
+    auto endpoint = mEndpoints.add(new EndpointState(host, port));
+    endpoint->owner = mUdpSocket.get();
+    endpoint->peer = std::move(peerinfo);
+    DBG("Added new unresolved endpoint for " << host << ":" << port);
+    return endpoint;
+}
+
+SonobusAudioProcessor::EndpointState * SonobusAudioProcessor::addEndpoint(const EndpointKey & key, const void * rawaddr, const String & host, int port, std::unique_ptr<DatagramSocket::RemoteAddrInfo> peerinfo)
+{
+    const ScopedLock sl (mEndpointsLock);
+
+    auto table = mEndpointTable.get();
+
+    // someone might have beat us to it
+    if (table) {
+        if (auto endpoint = table->find(key)) {
+            return endpoint;
+        }
+    }
+
+    auto endpoint = mEndpoints.add(new EndpointState(host, port));
+    endpoint->owner = mUdpSocket.get();
+    endpoint->peer = std::move(peerinfo);
+    endpoint->key = key;
+    endpoint->hasKey = true;
+    endpoint->setRawAddr((const struct sockaddr *) rawaddr);
+
+    if (!table || !table->insert(endpoint)) {
+        // build a bigger one containing everything, and publish it
+        auto newtable = new EndpointTable(table ? table->capacity * 2 : ENDPOINT_TABLE_INITIAL_SIZE);
+        for (auto ep : mEndpoints) {
+            if (ep->hasKey) {
+                newtable->insert(ep);
+            }
+        }
+        mEndpointTables.add(newtable);
+        mEndpointTable = newtable;
     }
+
+    DBG("Added new endpoint for " << host << ":" << port);
     return endpoint;
 }
 
@@ -2256,14 +2857,45 @@ void SonobusAudioProcessor::updateSafetyMuting(RemotePeer * peer)
 
 }
 
+float SonobusAudioProcessor::getRecvPacketsPerWakeup() const
+{
+    auto wakeups = mRecvWakeupCount.get();
+    return wakeups > 0 ? (float) ((double) mRecvPacketCount.get() / (double) wakeups) : 0.0f;
+}
+
+void SonobusAudioProcessor::resetRecvBatchStats()
+{
+    mRecvWakeupCount = 0;
+    mRecvPacketCount = 0;
+    mRecvMaxPacketsPerWakeup = 0;
+}
+
 void SonobusAudioProcessor::doReceiveData()
 {
-    // receive from udp port, and parse packet
-    char buf[AOO_MAXPACKETSIZE];
-    String senderIP;
-    int senderPort;
-    
-    int nbytes = mUdpSocket->read(buf, AOO_MAXPACKETSIZE, false, senderIP, senderPort);
+    // receive from udp port, and parse packets
+    RecvPacketArena & arena = *mRecvArena;
+    int count = 0;
+
+#if SONOBUS_BATCHED_RECV
+    // drain as many datagrams as are ready (up to the arena size) with one syscall
+    arena.resetHeaders();
+
+    count = recvmmsg(mUdpSocket->getRawSocketHandle(), arena.msgs, RECV_BATCH_MAX_PACKETS, MSG_DONTWAIT, nullptr);
+
+    if (count < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            DBG("Error receiving UDP: " << errno);
+        }
+        return;
+    }
+
+    for (int i=0; i < count; ++i) {
+        arena.sizes[i] = (int) arena.msgs[i].msg_len;
+        arena.endpoints[i] = arena.sizes[i] > 0 ? findOrAddRawEndpoint(&arena.addrs[i]) : nullptr;
+    }
+#else
+    socklen_t addrlen = sizeof(struct sockaddr_storage);
+    int nbytes = (int) ::recvfrom(mUdpSocket->getRawSocketHandle(), arena.getPacket(0), AOO_MAXPACKETSIZE, 0, (struct sockaddr *) &arena.addrs[0], &addrlen);
 
     if (nbytes == 0) return;
     else if (nbytes < 0) {
@@ -2272,129 +2904,429 @@ void SonobusAudioProcessor::doReceiveData()
     }
     
     // find endpoint from sender info
-    EndpointState * endpoint = findOrAddEndpoint(senderIP, senderPort);
-    
-    endpoint->recvBytes += nbytes + UDP_OVERHEAD_BYTES;
-    
-    // parse packet for AOO events
-    
-    int32_t type, id, dummyid;
-    if ((aoo_parse_pattern(buf, nbytes, &type, &id) > 0)
-        || (aoonet_parse_pattern(buf, nbytes, &type) > 0))
-    {
-        {
-            
-            if (type == AOO_TYPE_SINK){
-                // forward OSC packet to matching sink(s)
-                const ScopedReadLock sl (mCoreLock);        
-                
-                for (auto & remote : mRemotePeers) {
-                    if (!remote->oursink) continue;
-                    
-                    if (id == AOO_ID_NONE) {
-                        // this is a compact data message, try them all
-                        if (remote->oursink->handle_message(buf, nbytes, endpoint, endpoint_send)) {
-                            remote->dataPacketsReceived += 1;
-                            if (remote->recvAllow && !remote->recvActive) {
-                                remote->recvActive = true;
-                            }
-                            if (remote->resetSafetyMuted) {
-                                updateSafetyMuting(remote);
-                            }
-                            break;
-                        }
-                    }
-                    
-                    if (id == AOO_ID_WILDCARD || (remote->oursink->get_id(dummyid) && id == dummyid) ) {
-                        if (remote->oursink->handle_message(buf, nbytes, endpoint, endpoint_send)) {
-                            remote->dataPacketsReceived += 1;
-                            if (remote->recvAllow && !remote->recvActive) {
-                                remote->recvActive = true;
-                            }
-                            if (remote->resetSafetyMuted) {
-                                updateSafetyMuting(remote);
-                            }
-                        }
-                        
-                        if (id != AOO_ID_WILDCARD) break;
-                    }
-                    
-                    if (remote->echosink->get_id(dummyid) && id == dummyid) {
-                        remote->echosink->handle_message(buf, nbytes, endpoint, endpoint_send);
-                        break;
-                    }
-                    else if (remote->latencysink->get_id(dummyid) && id == dummyid) {
-                        remote->latencysink->handle_message(buf, nbytes, endpoint, endpoint_send);
-                        break;
-                    }
-                    
-                }
-                
-            } else if (type == AOO_TYPE_SOURCE){
-                // forward OSC packet to matching sources(s)
-                const ScopedReadLock sl (mCoreLock);        
+    arena.sizes[0] = nbytes;
+    arena.endpoints[0] = findOrAddRawEndpoint(&arena.addrs[0]);
+    count = 1;
+#endif
 
-                
-                if (mAooDummySource->get_id(dummyid) && id == dummyid) {
-                    // this is the special one that can accept blind invites
-                    mAooDummySource->handle_message(buf, nbytes, endpoint, endpoint_send);
+    if (count == 0) return;
+
+    mRecvWakeupCount += 1;
+    mRecvPacketCount += count;
+    if (count > mRecvMaxPacketsPerWakeup.get()) {
+        mRecvMaxPacketsPerWakeup = count;
+    }
+
+    if (mRecvImpairmentActive.get()) {
+        // hold them back, releaseImpairedPackets() hands them on when they are due
+        const ScopedLock sl (mRecvImpairmentLock);
+        if (mRecvImpairment) {
+            const double now = Time::getMillisecondCounterHiRes() * 1e-3;
+            for (int i=0; i < count; ++i) {
+                if (arena.endpoints[i] && arena.sizes[i] > 0) {
+                    mRecvImpairment->push(arena.getPacket(i), arena.sizes[i], arena.endpoints[i], now);
                 }
-                else {
-                    for (auto & remote : mRemotePeers) {
-                        if (!remote->oursource) continue;
-                        if (id == AOO_ID_WILDCARD || (remote->oursource->get_id(dummyid) && id == dummyid)) {
-                            remote->oursource->handle_message(buf, nbytes, endpoint, endpoint_send);
-                            if (id != AOO_ID_WILDCARD) break;
-                        }
-                        
-                        if (remote->echosource->get_id(dummyid) && id == dummyid) {
-                            remote->echosource->handle_message(buf, nbytes, endpoint, endpoint_send);
-                            break;
-                        }
-                        else if (remote->latencysource->get_id(dummyid) && id == dummyid) {
-                            remote->latencysource->handle_message(buf, nbytes, endpoint, endpoint_send);
-                            break;
-                        }
-                    }
+            }
+            return;
+        }
+    }
+
+    processReceivedPackets(count);
+}
+
+void SonobusAudioProcessor::releaseImpairedPackets()
+{
+    RecvPacketArena & arena = *mRecvArena;
+    int count = 0;
+
+    const ScopedLock sl (mRecvImpairmentLock);
+    if (!mRecvImpairment) return;
+
+    const double now = Time::getMillisecondCounterHiRes() * 1e-3;
+    mRecvImpairment->popDue(now, [&](const char * data, int size, void * tag) {
+        memcpy(arena.getPacket(count), data, (size_t) size);
+        arena.sizes[count] = size;
+        arena.endpoints[count] = static_cast<EndpointState*>(tag);
+        if (++count == RECV_BATCH_MAX_PACKETS) {
+            processReceivedPackets(count);
+            count = 0;
+        }
+    });
+
+    if (count > 0) {
+        processReceivedPackets(count);
+    }
+}
+
+int SonobusAudioProcessor::getImpairmentWaitMs(int maxms)
+{
+    if (!mRecvImpairmentActive.get()) return maxms;
+
+    const ScopedLock sl (mRecvImpairmentLock);
+    if (!mRecvImpairment) return maxms;
+
+    const double due = mRecvImpairment->getNextDueTime();
+    if (due < 0.0) return maxms;
+
+    const double waitms = due * 1e3 - Time::getMillisecondCounterHiRes();
+    return jlimit(0, maxms, (int) std::ceil(waitms));
+}
+
+void SonobusAudioProcessor::setReceiveImpairment(const SonoAudio::NetworkImpairment::Settings & settings)
+{
+    const ScopedLock sl (mRecvImpairmentLock);
+
+    if (settings.isActive()) {
+        if (!mRecvImpairment) {
+            mRecvImpairment = std::make_unique<SonoAudio::NetworkImpairment>();
+        }
+        mRecvImpairment->setSettings(settings);
+        mRecvImpairmentActive = true;
+    }
+    else {
+        // anything still held back is simply lost
+        mRecvImpairmentActive = false;
+        mRecvImpairment.reset();
+    }
+}
+
+SonoAudio::NetworkImpairment::Stats SonobusAudioProcessor::getReceiveImpairmentStats()
+{
+    const ScopedLock sl (mRecvImpairmentLock);
+    return mRecvImpairment ? mRecvImpairment->getStats() : SonoAudio::NetworkImpairment::Stats();
+}
+
+void SonobusAudioProcessor::processReceivedPackets(int count)
+{
+    RecvPacketArena & arena = *mRecvArena;
+    int32_t types[RECV_BATCH_MAX_PACKETS];
+    int32_t ids[RECV_BATCH_MAX_PACKETS];
+    bool isaoo[RECV_BATCH_MAX_PACKETS];
+    bool sinksource[RECV_BATCH_MAX_PACKETS];
+    bool anyaoo = false;
+
+    // parse packets for AOO patterns
+    for (int i=0; i < count; ++i) {
+        auto endpoint = arena.endpoints[i];
+        const char * buf = arena.getPacket(i);
+        const int32_t nbytes = arena.sizes[i];
+
+        isaoo[i] = false;
+        sinksource[i] = false;
+        types[i] = -1;
+        ids[i] = AOO_ID_NONE;
+
+        if (!endpoint || nbytes <= 0) continue;
+
+        endpoint->recvBytes += nbytes + UDP_OVERHEAD_BYTES;
+        endpoint->recvPackets += 1;
+
+        if ((aoo_parse_pattern(buf, nbytes, &types[i], &ids[i]) > 0)
+            || (aoonet_parse_pattern(buf, nbytes, &types[i]) > 0))
+        {
+            isaoo[i] = anyaoo = true;
+            sinksource[i] = (types[i] == AOO_TYPE_SINK || types[i] == AOO_TYPE_SOURCE);
+        }
+    }
+
+    // dispatch in the order they arrived, a peer or /sb message can add or remove the peer
+    // the stream packets after it are for. each run of sink/source packets is forwarded
+    // under one lock acquisition, everything else is handled without the core lock held,
+    // since these may call out to listeners
+    for (int i=0; i < count; ) {
+        if (sinksource[i]) {
+            const ScopedReadLock sl (mCoreLock);
+
+            for ( ; i < count && sinksource[i]; ++i) {
+                dispatchAooPacket(arena.endpoints[i], arena.getPacket(i), arena.sizes[i], types[i], ids[i]);
+            }
+            continue;
+        }
+
+        if (arena.endpoints[i] && arena.sizes[i] > 0) {
+            dispatchNonAooPacket(arena.endpoints[i], arena.getPacket(i), arena.sizes[i], types[i], isaoo[i]);
+        }
+        ++i;
+    }
+
+    if (anyaoo) {
+        // notify send thread
+        notifySendThread();
+        // and whoever decodes the audio we just got
+        notifyDecodeThreads();
+    }
+}
+
+void SonobusAudioProcessor::rebuildPeerDispatchIndex()
+{
+    // assumes core write lock is held
+    for (auto & peer : mPeerDispatchById) {
+        peer = nullptr;
+    }
+
+    {
+        const ScopedLock sl (mEndpointsLock);
+        for (auto ep : mEndpoints) {
+            ep->dispatchPeer = nullptr;
+        }
+    }
+
+    for (auto peer : mRemotePeers) {
+        if (isPositiveAndBelow(peer->ourId, MAX_PEER_DISPATCH_IDS)) {
+            mPeerDispatchById[peer->ourId] = peer;
+        }
+        if (peer->endpoint && !peer->endpoint->dispatchPeer) {
+            peer->endpoint->dispatchPeer = peer;
+        }
+    }
+}
+
+void SonobusAudioProcessor::publishPeerSnapshot()
+{
+    // assumes core write lock is held
+    auto snapshot = new PeerSnapshot();
+    snapshot->peers.addArray(mRemotePeers.begin(), mRemotePeers.size());
+
+    auto retired = new RetiredPeers();
+    retired->snapshot.reset(mPeerSnapshot.exchange(snapshot));
+    // any audio callback started after this point sees the new snapshot
+    retired->readsStarted = mPeerReadsStarted.get();
+    // the peer indices changed
+    ++mSendRoutingVersion;
+    invalidateMixPlan();
+
+    const ScopedLock sl (mRetiredPeersLock);
+    mRetiredPeers.add(retired);
+}
+
+void SonobusAudioProcessor::retireRemotePeers(OwnedArray<RemotePeer> & peers)
+{
+    // call after the peers have been removed from mRemotePeers and a new snapshot published
+    if (peers.isEmpty()) return;
+
+    // nothing may follow them (or be followed by them) until they are deleted
+    for (auto peer : peers) {
+        detachSharedEncoders(peer);
+    }
+
+    auto retired = new RetiredPeers();
+    while (!peers.isEmpty()) {
+        retired->peers.add(peers.removeAndReturn(0));
+    }
+    retired->readsStarted = mPeerReadsStarted.get();
+
+    const ScopedLock sl (mRetiredPeersLock);
+    mRetiredPeers.add(retired);
+}
+
+void SonobusAudioProcessor::waitForPeerSnapshotReaders()
+{
+    // not from the audio thread! returns once every audio callback that was already
+    // running has finished with its peer snapshot
+    const auto started = mPeerReadsStarted.get();
+    while (mPeerReadsDone.get() < started) {
+        Thread::sleep(1);
+    }
+}
+
+void SonobusAudioProcessor::reclaimRetiredPeers()
+{
+    OwnedArray<RetiredPeers> freeable;
+
+    {
+        const ScopedLock sl (mRetiredPeersLock);
+        const auto done = mPeerReadsDone.get();
+
+        // they were retired in order, so stop at the first one still possibly in use
+        while (!mRetiredPeers.isEmpty() && mRetiredPeers.getUnchecked(0)->readsStarted <= done) {
+            freeable.add(mRetiredPeers.removeAndReturn(0));
+        }
+    }
+
+    // the peers get deleted here, outside of the lock
+}
+
+void SonobusAudioProcessor::dispatchAooPacket(EndpointState * endpoint, const char * buf, int32_t nbytes, int32_t type, int32_t id)
+{
+    // assumes core read lock is already held
+    int32_t dummyid;
+
+    auto gotData = [this](RemotePeer * remote) {
+        remote->dataPacketsReceived += 1;
+        if (remote->recvAllow && !remote->recvActive) {
+            remote->recvActive = true;
+        }
+        if (remote->resetSafetyMuted) {
+            updateSafetyMuting(remote);
+        }
+    };
+
+    // our sinks and sources for a peer are all created with ids derived from its ourId,
+    // so the index gives us the owning peer directly
+    auto baseid = id >= ECHO_ID_OFFSET ? id - ECHO_ID_OFFSET : id >= LATENCY_ID_OFFSET ? id - LATENCY_ID_OFFSET : id;
+    RemotePeer * idpeer = nullptr;
+    bool indexed = false;
+
+    if (id != AOO_ID_NONE && id != AOO_ID_WILDCARD && isPositiveAndBelow(baseid, MAX_PEER_DISPATCH_IDS)) {
+        idpeer = mPeerDispatchById[baseid];
+        indexed = true;
+    }
+
+    if (type == AOO_TYPE_SINK){
+        // forward OSC packet to matching sink(s)
+
+        if (id == MCU_ID) {
+            // the mix of the others, only from the MCU
+            if (mMcuSink && endpoint == mMcuEndpoint.get()) {
+                mMcuSink->handle_message(buf, nbytes, endpoint, endpoint_send);
+            }
+            return;
+        }
+
+        if (id == AOO_ID_NONE) {
+            // this is a compact data message, the sink matches it by (endpoint, salt), and
+            // it can only be for a sink with a source from this endpoint, try that peer's first
+            auto remote = endpoint->dispatchPeer;
+            if (remote && remote->oursink && remote->oursink->handle_message(buf, nbytes, endpoint, endpoint_send)) {
+                gotData(remote);
+                return;
+            }
+
+            // otherwise try them all
+            for (auto & other : mRemotePeers) {
+                if (other == remote || !other->oursink) continue;
+
+                if (other->oursink->handle_message(buf, nbytes, endpoint, endpoint_send)) {
+                    gotData(other);
+                    break;
                 }
+            }
+            return;
+        }
 
-                
-            } else if (type == AOO_TYPE_CLIENT || type == AOO_TYPE_PEER){
-                // forward OSC packet to matching client
+        if (indexed) {
+            if (!idpeer || !idpeer->oursink) return;
 
-                //DBG("Got AOO_CLIENT or PEER data");
+            if (id == idpeer->ourId) {
+                if (idpeer->oursink->handle_message(buf, nbytes, endpoint, endpoint_send)) {
+                    gotData(idpeer);
+                }
+                if (endpoint == mRelayEndpoint.get()) {
+                    // their stream through the relay, see updateRelayedPeers()
+                    idpeer->lastRelayRecvMs = Time::getMillisecondCounterHiRes();
+                }
+            }
+            else if (id == idpeer->ourId + ECHO_ID_OFFSET) {
+                idpeer->echosink->handle_message(buf, nbytes, endpoint, endpoint_send);
+            }
+            else if (id == idpeer->ourId + LATENCY_ID_OFFSET) {
+                idpeer->latencysink->handle_message(buf, nbytes, endpoint, endpoint_send);
+            }
+            return;
+        }
+
+        // wildcard or unindexed id, scan them
+        for (auto & remote : mRemotePeers) {
+            if (!remote->oursink) continue;
 
-                if (mAooClient) {
-                    mAooClient->handle_message(buf, nbytes, endpoint->getRawAddr());
+            if (id == AOO_ID_WILDCARD || (remote->oursink->get_id(dummyid) && id == dummyid) ) {
+                if (remote->oursink->handle_message(buf, nbytes, endpoint, endpoint_send)) {
+                    gotData(remote);
                 }
-                
-                /*
-                 for (int i = 0; i < x->x_numclients; ++i){
-                 if (pd_class(x->x_clients[i].c_obj) == aoo_client_class)
-                 {
-                 t_aoo_client *c = (t_aoo_client *)x->x_clients[i].c_obj;
-                 aoo_client_handle_message(c, buf, nbytes,
-                 ep, (aoo_replyfn)endpoint_send);
-                 break;
-                 }
-                 }
-                 */
-            } else if (type == AOO_TYPE_SERVER){
-                // ignore
-                DBG("Got AOO_SERVER data");
+                if (id != AOO_ID_WILDCARD && endpoint == mRelayEndpoint.get()) {
+                    remote->lastRelayRecvMs = Time::getMillisecondCounterHiRes();
+                }
+
+                if (id != AOO_ID_WILDCARD) break;
+            }
+
+            if (remote->echosink->get_id(dummyid) && id == dummyid) {
+                remote->echosink->handle_message(buf, nbytes, endpoint, endpoint_send);
+                break;
+            }
+            else if (remote->latencysink->get_id(dummyid) && id == dummyid) {
+                remote->latencysink->handle_message(buf, nbytes, endpoint, endpoint_send);
+                break;
+            }
+
+        }
 
-                if (mAooServer) {
-                    // mAooServer->handle_message(buf, nbytes, endpoint);
+    } else if (type == AOO_TYPE_SOURCE){
+        // forward OSC packet to matching sources(s)
+
+        if (mAooDummySource->get_id(dummyid) && id == dummyid) {
+            // this is the special one that can accept blind invites
+            mAooDummySource->handle_message(buf, nbytes, endpoint, endpoint_send);
+        }
+        else if (id == RELAY_SOURCE_ID) {
+            // requests and pings for our published stream, only from the relay
+            if (mRelaySource && endpoint == mRelayEndpoint.get()) {
+                mRelaySource->handle_message(buf, nbytes, endpoint, endpoint_send);
+            }
+        }
+        else if (id == MCU_ID) {
+            // requests and pings for our stream to the MCU
+            if (mMcuSource && endpoint == mMcuEndpoint.get()) {
+                mMcuSource->handle_message(buf, nbytes, endpoint, endpoint_send);
+            }
+        }
+        else if (indexed) {
+            if (!idpeer || !idpeer->oursource) return;
+
+            if (id == idpeer->ourId) {
+                idpeer->oursource->handle_message(buf, nbytes, endpoint, endpoint_send);
+            }
+            else if (id == idpeer->ourId + ECHO_ID_OFFSET) {
+                idpeer->echosource->handle_message(buf, nbytes, endpoint, endpoint_send);
+            }
+            else if (id == idpeer->ourId + LATENCY_ID_OFFSET) {
+                idpeer->latencysource->handle_message(buf, nbytes, endpoint, endpoint_send);
+            }
+        }
+        else {
+            // wildcard or unindexed id, scan them
+            for (auto & remote : mRemotePeers) {
+                if (!remote->oursource) continue;
+                if (id == AOO_ID_WILDCARD || (remote->oursource->get_id(dummyid) && id == dummyid)) {
+                    remote->oursource->handle_message(buf, nbytes, endpoint, endpoint_send);
+                    if (id != AOO_ID_WILDCARD) break;
+                }
+
+                if (remote->echosource->get_id(dummyid) && id == dummyid) {
+                    remote->echosource->handle_message(buf, nbytes, endpoint, endpoint_send);
+                    break;
+                }
+                else if (remote->latencysource->get_id(dummyid) && id == dummyid) {
+                    remote->latencysource->handle_message(buf, nbytes, endpoint, endpoint_send);
+                    break;
                 }
-                
-            } else {
-                DBG("Studio Lite bug: unknown aoo type: " << type);
             }
         }
+    }
+}
 
-        // notify send thread
-        notifySendThread();
+void SonobusAudioProcessor::dispatchNonAooPacket(EndpointState * endpoint, const char * buf, int32_t nbytes, int32_t type, bool isaoo)
+{
+    if (isaoo) {
+        if (type == AOO_TYPE_CLIENT || type == AOO_TYPE_PEER){
+            // forward OSC packet to matching client
+
+            //DBG("Got AOO_CLIENT or PEER data");
 
+            if (mAooClient) {
+                mAooClient->handle_message(buf, nbytes, endpoint->getRawAddr());
+            }
+        } else if (type == AOO_TYPE_SERVER){
+            // ignore
+            DBG("Got AOO_SERVER data");
+
+            if (mAooServer) {
+                // mAooServer->handle_message(buf, nbytes, endpoint);
+            }
+
+        } else {
+            DBG("Studio Lite bug: unknown aoo type: " << type);
+        }
     }
     else if (handleOtherMessage(endpoint, buf, nbytes)) {
 
@@ -2403,7 +3335,6 @@ void SonobusAudioProcessor::doReceiveData()
         // not a valid AoO OSC message
         DBG("Studio Lite: not a valid AOO message!");
     }
-        
 }
 
 // XXX
@@ -3142,11 +4073,26 @@ void SonobusAudioProcessor::doSendData()
 
     auto nowtimems = Time::getMillisecondCounterHiRes();
 
+#if SONOBUS_BATCHED_SEND
+    // everything sent through endpoint_send in this pass gets queued and
+    // goes out with as few sendmmsg calls as possible when this goes out of scope
+    ScopedSendQueue sendqueue (mSendQueue.get());
+#endif
+
     while (didsomething) {
         //mAooSource->send();
         didsomething = 0;
         
         didsomething |= mAooDummySource->send();
+
+        if (mRelaySourceActive.get()) {
+            didsomething |= mRelaySource->send();
+        }
+
+        if (mMcuActive.get()) {
+            didsomething |= mMcuSource->send();
+            didsomething |= mMcuSink->send();
+        }
         
         if (mAooClient) {
             mAooClient->send();
@@ -3182,6 +4128,26 @@ void SonobusAudioProcessor::doSendData()
         }
     }
 
+    if (nowtimems > mLastPeerRebalanceMs + PEER_REBALANCE_INTERVAL_MS) {
+        updateSharedEncoders();
+        updateDecodeThreads();
+        updateStatisticalNetBuffers();
+        updateRelayedPeers(nowtimems);
+        updateMcuPeers(nowtimems);
+        // also picks up changes that didn't invalidate the plan, it's only published if it differs
+        updateMixPlan();
+        mLastPeerRebalanceMs = nowtimems;
+    }
+    else if (mNeedsMixPlanUpdate.get()) {
+        updateMixPlan();
+    }
+
+    // recompile the cross-routing if anything it depends on changed, the audio thread picks it up
+    if (mSendRoutingVersion.get() != mSendMixerVersion || mSendMixer.needsUpdate()) {
+        mSendMixerVersion = mSendRoutingVersion.get();
+        updateSendMixer();
+    }
+
     if (mPendingUnmute.get() && mPendingUnmuteAtStamp < Time::getMillisecondCounter() ) {
         DBG("UNMUTING ALL");
         mState.getParameter(paramMainRecvMute)->setValueNotifyingHost(0.0f);
@@ -3209,6 +4175,164 @@ void SonobusAudioProcessor::doSendData()
 
 }
 
+// called from the send thread with the core read lock held
+void SonobusAudioProcessor::updateSharedEncoders()
+{
+    // peers whose source gets exactly the same audio (same send channels and the same
+    // cross-routed peers) can share a single encoder, if the send format also matches.
+    // the earliest such peer encodes, the later ones just send its encoded blocks.
+    // aoo refuses the pairing if the formats differ, and drops it by itself when
+    // either side changes its format, so we just check again here periodically.
+    
+    // the setters detach peers before changing their send mix, they mustn't be regrouped with the old one
+    const ScopedLock esl (mSharedEncoderLock);
+
+    const bool enabled = mSharedEncoding.get();
+    const int numpeers = mRemotePeers.size();
+
+    for (int i=0; i < numpeers && i < MAX_PEERS; ++i) {
+        auto remote = mRemotePeers.getUnchecked(i);
+        if (!remote->oursource) continue;
+
+        aoo::isource * newleader = nullptr;
+
+        if (enabled && remote->sendActive) {
+            for (int j=0; j < i; ++j) {
+                auto other = mRemotePeers.getUnchecked(j);
+                if (!other->oursource || !other->sendActive || other->sharingEncoder.get()
+                    || other->sendChannels != remote->sendChannels || other->formatIndex != remote->formatIndex) {
+                    continue;
+                }
+
+                bool samerouting = true;
+                for (int k=0; k < numpeers && k < MAX_PEERS; ++k) {
+                    if (mRemoteSendMatrix[k][i] != mRemoteSendMatrix[k][j]) {
+                        samerouting = false;
+                        break;
+                    }
+                }
+
+                if (samerouting) {
+                    newleader = other->oursource.get();
+                    break;
+                }
+            }
+        }
+
+        aoo::isource * curleader = nullptr;
+        remote->oursource->get_encode_leader(curleader);
+
+        if (curleader != newleader) {
+            if (remote->oursource->set_encode_leader(newleader) <= 0) {
+                newleader = nullptr;
+            }
+            DBG("Peer " << i << (newleader ? " now shares an encoder" : " now uses its own encoder"));
+        }
+
+        if (remote->sharingEncoder.get() != (newleader != nullptr)) {
+            remote->sharingEncoder = newleader != nullptr;
+            ++mSendRoutingVersion;
+        }
+    }
+}
+
+// stops the peer's source from following another one's encoder, and any other peer from
+// following it, right away instead of at the next regrouping. call before its send mix changes
+// or it is removed, with the core read lock held
+void SonobusAudioProcessor::detachSharedEncoders(RemotePeer * peer)
+{
+    const ScopedLock esl (mSharedEncoderLock);
+
+    if (!peer->oursource) return;
+
+    auto stopFollowing = [this](RemotePeer * remote) {
+        // mix for it again before it stops taking the leader's blocks
+        if (remote->sharingEncoder.get()) {
+            remote->sharingEncoder = false;
+            ++mSendRoutingVersion;
+        }
+        remote->oursource->set_encode_leader(nullptr);
+    };
+
+    for (auto remote : mRemotePeers) {
+        if (remote == peer || !remote->oursource || !remote->sharingEncoder.get()) continue;
+
+        aoo::isource * leader = nullptr;
+        remote->oursource->get_encode_leader(leader);
+        if (leader == peer->oursource.get()) {
+            stopFollowing(remote);
+        }
+    }
+
+    stopFollowing(peer);
+}
+
+void SonobusAudioProcessor::notifyDecodeThreads()
+{
+    const int active = mActiveDecodeThreads.get();
+    for (int i=0; i < active && i < mDecodeThreads.size(); ++i) {
+        mDecodeThreads.getUnchecked(i)->_waitable.signal();
+    }
+}
+
+// called from the send thread with the core read lock held
+void SonobusAudioProcessor::updateDecodeThreads()
+{
+    int active = 0;
+    const int setting = mDecodeThreadSetting.get();
+
+    if (setting < 0) {
+        int receiving = 0;
+        for (auto & remote : mRemotePeers) {
+            if (remote->oursink && remote->recvActive) {
+                ++receiving;
+            }
+        }
+        active = jlimit(1, MAX_DECODE_THREADS, (receiving + SINKS_PER_DECODE_THREAD - 1) / SINKS_PER_DECODE_THREAD);
+    }
+    else {
+        active = setting;
+    }
+    active = jmin(active, mDecodeThreads.size());
+
+    if (active != mActiveDecodeThreads.get()) {
+        DBG("Using " << active << " decode threads");
+        mActiveDecodeThreads = active;
+    }
+
+    // with no decode threads, the sinks decode in handle_message on the recv thread.
+    // it's cheap enough to just set it again every time
+    for (auto & remote : mRemotePeers) {
+        if (remote->oursink) {
+            remote->oursink->set_deferred_decode(active > 0 ? 1 : 0);
+        }
+    }
+}
+
+void SonobusAudioProcessor::doDecodeData(int workerIndex)
+{
+    const ScopedReadLock sl (mCoreLock);
+
+    // every worker goes through all the sinks, but starting at a different one,
+    // a sink that's already being decoded by another worker is just skipped.
+    const int numpeers = mRemotePeers.size();
+    const int active = jmax(1, mActiveDecodeThreads.get());
+    const int offset = (workerIndex * numpeers) / active;
+
+    bool didsomething = true;
+
+    while (didsomething) {
+        didsomething = false;
+
+        for (int i=0; i < numpeers; ++i) {
+            auto remote = mRemotePeers.getUnchecked((i + offset) % numpeers);
+            if (remote->oursink) {
+                didsomething |= remote->oursink->decode() != 0;
+            }
+        }
+    }
+}
+
 struct ProcessorIdPair
 {
     ProcessorIdPair(SonobusAudioProcessor *proc, int32_t id_) : processor(proc), id(id_) {}
@@ -3241,10 +4365,72 @@ static int32_t gHandleClientEvents(void * user, const aoo_event ** events, int32
 }
 
 
+void SonobusAudioProcessor::notifyEventQueued(int32_t aooId, bool realtime)
+{
+    // our sinks and sources for a peer are all created with ids derived from its ourId
+    auto baseid = aooId >= ECHO_ID_OFFSET ? aooId - ECHO_ID_OFFSET : aooId >= LATENCY_ID_OFFSET ? aooId - LATENCY_ID_OFFSET : aooId;
+
+    if (isPositiveAndBelow(baseid, MAX_PEER_DISPATCH_IDS)) {
+        mPendingEventPeers[baseid >> 5].fetch_or(1u << (baseid & 31));
+    } else {
+        mPendingEventOther = true;
+    }
+
+    // only the first one since the event thread last woke up is timed
+    mEventSignalTicks.compareAndSetBool(Time::getHighResolutionTicks(), 0);
+
+    if (realtime) {
+        // signalling takes a lock, the event thread polls for this instead
+        mEventPendingFromAudio.store(true, std::memory_order_release);
+    } else {
+        mEventWaitable.signal();
+    }
+}
+
+float SonobusAudioProcessor::getEventReactionTimeMs() const
+{
+    auto wakeups = mEventWakeupCount.get();
+    return wakeups > 0 ? (float) (1e3 * Time::highResolutionTicksToSeconds(mEventReactionTicks.get()) / (double) wakeups) : 0.0f;
+}
+
+float SonobusAudioProcessor::getEventMaxReactionTimeMs() const
+{
+    return (float) (1e3 * Time::highResolutionTicksToSeconds(mEventMaxReactionTicks.get()));
+}
+
+void SonobusAudioProcessor::resetEventReactionStats()
+{
+    mEventWakeupCount = 0;
+    mEventReactionTicks = 0;
+    mEventMaxReactionTicks = 0;
+}
+
 void SonobusAudioProcessor::handleEvents()
 {
     const ScopedReadLock sl (mCoreLock);        
     int32_t dummy = 0;
+
+    auto signalticks = mEventSignalTicks.exchange(0);
+    if (signalticks != 0) {
+        auto reaction = Time::getHighResolutionTicks() - signalticks;
+        mEventWakeupCount += 1;
+        mEventReactionTicks += reaction;
+        if (reaction > mEventMaxReactionTicks.get()) {
+            mEventMaxReactionTicks = reaction;
+        }
+    }
+
+    // only visit the objects that told us they have something
+    uint32 pending[MAX_PEER_DISPATCH_IDS / 32];
+    for (int i=0; i < MAX_PEER_DISPATCH_IDS / 32; ++i) {
+        pending[i] = mPendingEventPeers[i].exchange(0);
+    }
+    const bool pendingother = mPendingEventOther.exchange(false);
+
+    auto isPending = [&](int32_t ourId) {
+        if (!isPositiveAndBelow(ourId, MAX_PEER_DISPATCH_IDS)) return pendingother;
+        return (pending[ourId >> 5] & (1u << (ourId & 31))) != 0;
+    };
     
     if (mAooServer /*&& mAooServer->events_available()*/) {
         ProcessorIdPair pp(this, dummy);
@@ -3256,14 +4442,38 @@ void SonobusAudioProcessor::handleEvents()
         mAooClient->handle_events(gHandleClientEvents, &pp);
     }
 
-    
-    if (mAooDummySource->events_available() > 0) {
-        mAooDummySource->get_id(dummy);
-        ProcessorIdPair pp(this, dummy);
-        mAooDummySource->handle_events(gHandleSourceEvents, &pp);
+    
+    if (isPending(0) && mAooDummySource->events_available() > 0) {
+        mAooDummySource->get_id(dummy);
+        ProcessorIdPair pp(this, dummy);
+        mAooDummySource->handle_events(gHandleSourceEvents, &pp);
+    }
+
+    if (isPending(RELAY_SOURCE_ID) && mRelaySource->events_available() > 0) {
+        // only pings from the relay, nothing to do with them
+        mRelaySource->handle_events([](void *, const aoo_event **, int32_t) -> int32_t { return 1; }, nullptr);
+    }
+
+    if (isPending(MCU_ID) && mMcuSource->events_available() > 0) {
+        // only pings from the MCU
+        mMcuSource->handle_events([](void *, const aoo_event **, int32_t) -> int32_t { return 1; }, nullptr);
+    }
+
+    if (isPending(MCU_ID) && mMcuSink->events_available() > 0) {
+        // the mix is up once its format arrives, see updateMcuPeers()
+        mMcuSink->handle_events([](void * user, const aoo_event ** events, int32_t n) -> int32_t {
+            for (int i = 0; i < n; ++i) {
+                if (events[i]->type == AOO_SOURCE_FORMAT_EVENT) {
+                    static_cast<SonobusAudioProcessor*>(user)->mMcuReceiving = true;
+                }
+            }
+            return 1;
+        }, this);
     }
 
     for (auto & remote : mRemotePeers) {
+        if (!isPending(remote->ourId)) continue;
+
         if (remote->oursource) {
             remote->oursource->get_id(dummy);
             ProcessorIdPair pp(this, dummy);
@@ -3528,7 +4738,8 @@ int32_t SonobusAudioProcessor::handleSourceEvents(const aoo_event ** events, int
                         peer->sendActive = false;
                         peer->dataPacketsSent = 0;
 
-                        if (!peer->recvActive) {
+                        // they get us through the MCU
+                        if (!peer->recvActive && !peer->mcuMixed) {
                             peer->connected = false;
                         }
                     }
@@ -3612,6 +4823,12 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
             aoo_source_event *e = (aoo_source_event *)events[i];
             EndpointState * es = (EndpointState *)e->endpoint;
 
+            if (es == mRelayEndpoint.get()) {
+                // the relay accepted our invite, we switch over once its format arrives
+                DBG("Added relayed stream " << e->id << " to our " << sinkId);
+                break;
+            }
+
             RemotePeer * peer = findRemotePeer(es, sinkId);
             if (peer) {
                 // someone has added us, thus accepting our invitation
@@ -3627,7 +4844,10 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
                     
                     peer->oursink->uninvite_source(es, 0, endpoint_send); // get rid of existing bogus one
 
-                    if (peer->recvAllow) {
+                    if (peer->relayState == RelayActive || peer->mcuMixed) {
+                        DBG("Receiving them through the relay or the MCU, not inviting the direct source");
+                    }
+                    else if (peer->recvAllow) {
                         peer->oursink->invite_source(es, peer->remoteSourceId, endpoint_send);
                         //peer->recvActive = true;
                     } else {
@@ -3690,6 +4910,7 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
                             const ScopedWriteLock sl (peer->sinkLock);
 
                             peer->recvChannels = std::min(MAX_PANNERS, f.header.nchannels);
+                            ++mSendRoutingVersion;
 
                             // set up this sink with new channel count
 
@@ -3757,6 +4978,14 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
                         //peer->recvFormatIndex = findFormatIndex(codec, 0, fmt->bitdepth);
                     }
                     
+                    if (es == mRelayEndpoint.get() && peer->relayState == RelayPending) {
+                        // the relayed stream is up, stop the direct one
+                        DBG("Receiving " << peer->userName << " through the relay");
+                        peer->relayState = RelayActive;
+                        peer->relayStateChangeMs = Time::getMillisecondCounterHiRes();
+                        peer->oursink->uninvite_source(peer->endpoint, peer->remoteSourceId, endpoint_send);
+                    }
+
                     clientListeners.call(&SonobusAudioProcessor::ClientListener::aooClientPeerChangedState, this, "format");
                 }                
             }
@@ -3777,7 +5006,8 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
             const ScopedReadLock sl (mCoreLock);        
 
             RemotePeer * peer = findRemotePeer(es, sinkId);
-            if (peer) {
+            // the direct source going quiet doesn't matter while we get it through the relay or the MCU
+            if (peer && !peer->mcuMixed && !(peer->relayState == RelayActive && es != mRelayEndpoint.get())) {
                 peer->recvActive = peer->recvAllow && e->state > 0;
                 if (!peer->recvActive && !peer->sendActive) {
                     peer->connected = false;
@@ -3805,11 +5035,13 @@ int32_t SonobusAudioProcessor::handleSinkEvents(const aoo_event ** events, int32
                 
                 if (peer->autosizeBufferMode != AutoNetBufferModeOff) {
                     // see if our drop rate exceeds threshold, and increase buffersize if so
+                    // (the Statistical mode sizes from the arrival delays instead, we only track the rate)
                     double nowtime = Time::getMillisecondCounterHiRes();
                     const float dropratethresh = peer->autosizeBufferMode == AutoNetBufferModeInitAuto ? 1.0f : mAutoresizeDropRateThresh;
                     const float adjustlimit = 0.5f; // don't adjust more often than once every 0.5 seconds
 
-                    bool autoinitdone = peer->autosizeBufferMode == AutoNetBufferModeInitAuto && peer->autoNetbufInitCompleted;
+                    bool autoinitdone = (peer->autosizeBufferMode == AutoNetBufferModeInitAuto && peer->autoNetbufInitCompleted)
+                                         || peer->autosizeBufferMode == AutoNetBufferModeStatistical;
                     
                     if (peer->lastDroptime > 0 && !autoinitdone) {
                         double deltatime = (nowtime - peer->lastDroptime) * 1e-3;  
@@ -4119,6 +5351,10 @@ int32_t SonobusAudioProcessor::handleClientEvents(const aoo_event ** events, int
 
             mPendingReconnect = false;
 
+            // the server dropped our relay stream and MCU mix, and the others' with us
+            stopRelaySource();
+            stopMcu();
+
             // don't remove all peers?
             //removeAllRemotePeers();
             
@@ -4139,6 +5375,16 @@ int32_t SonobusAudioProcessor::handleClientEvents(const aoo_event ** events, int
 
                 mSessionConnectionStamp = Time::getMillisecondCounterHiRes();
 
+                if (getGroupMcuEnabled(mCurrentJoinedGroup) && mAooClient) {
+                    // so is the MCU
+                    mMcuEndpoint = findOrAddEndpoint(mServerEndpoint->ipaddr, mServerEndpoint->port);
+                    mAooClient->mcu_join(e->name);
+                }
+                else if (getGroupRelayEnabled(mCurrentJoinedGroup) && mAooClient) {
+                    // the relay is on the server's UDP port
+                    mRelayEndpoint = findOrAddEndpoint(mServerEndpoint->ipaddr, mServerEndpoint->port);
+                    mAooClient->relay_publish(e->name);
+                }
 
             } else {
                 DBG("Couldn't join group " << e->name << " - " << String::fromUTF8(e->errormsg));
@@ -4156,6 +5402,9 @@ int32_t SonobusAudioProcessor::handleClientEvents(const aoo_event ** events, int
                 const ScopedLock sl (mClientLock);        
                 mCurrentJoinedGroup.clear();
 
+                stopRelaySource();
+                stopMcu();
+
                 // assume they are all part of the group, XXX
                 removeAllRemotePeers();
 
@@ -4291,6 +5540,77 @@ int32_t SonobusAudioProcessor::handleClientEvents(const aoo_event ** events, int
             }
             break;
         }
+        case AOONET_CLIENT_RELAY_PUBLISH_EVENT:
+        {
+            aoonet_client_relay_event *e = (aoonet_client_relay_event *)events[i];
+            auto relayendpoint = mRelayEndpoint.get();
+
+            if (e->result > 0 && relayendpoint) {
+                DBG("Publishing to relay stream " << e->stream << " in group " << e->group);
+
+                setupRelaySource();
+                mRelaySource->remove_all();
+                mRelaySource->add_sink(relayendpoint, e->stream, endpoint_send);
+                mRelaySource->start();
+                mRelaySourceActive = true;
+            } else {
+                // the others still reach us directly
+                DBG("Couldn't publish to the relay in " << e->group << " - " << String::fromUTF8(e->errormsg));
+            }
+            break;
+        }
+        case AOONET_CLIENT_RELAY_STREAM_ADD_EVENT:
+        case AOONET_CLIENT_RELAY_STREAM_DEL_EVENT:
+        {
+            aoonet_client_relay_event *e = (aoonet_client_relay_event *)events[i];
+            String user = CharPointer_UTF8 (e->user);
+
+            if (!getGroupRelayEnabled(CharPointer_UTF8 (e->group))) {
+                break;
+            }
+
+            // updateRelayedPeers() picks it up
+            const ScopedLock rl (mRelayLock);
+            if (e->type == AOONET_CLIENT_RELAY_STREAM_ADD_EVENT) {
+                DBG("Relay stream " << e->stream << " of " << user << " available");
+                mRelayStreams[user] = e->stream;
+            } else {
+                DBG("Relay stream " << e->stream << " of " << user << " gone");
+                mRelayStreams.erase(user);
+            }
+            break;
+        }
+        case AOONET_CLIENT_MCU_JOIN_EVENT:
+        {
+            aoonet_client_mcu_event *e = (aoonet_client_mcu_event *)events[i];
+
+            if (e->result > 0 && mMcuEndpoint.get()) {
+                DBG("Joined the MCU as " << e->id << " in group " << e->group);
+                mMcuId = e->id;
+                setupMcu();
+            } else {
+                // the others still reach us directly
+                DBG("Couldn't join the MCU in " << e->group << " - " << String::fromUTF8(e->errormsg));
+            }
+            break;
+        }
+        case AOONET_CLIENT_MCU_ADD_EVENT:
+        case AOONET_CLIENT_MCU_DEL_EVENT:
+        {
+            aoonet_client_mcu_event *e = (aoonet_client_mcu_event *)events[i];
+            String user = CharPointer_UTF8 (e->user);
+
+            // updateMcuPeers() picks it up
+            const ScopedLock ml (mMcuLock);
+            if (e->type == AOONET_CLIENT_MCU_ADD_EVENT) {
+                DBG("MCU participant " << e->id << " " << user << " added");
+                mMcuParticipants[user] = e->id;
+            } else {
+                DBG("MCU participant " << e->id << " " << user << " gone");
+                mMcuParticipants.erase(user);
+            }
+            break;
+        }
         case AOONET_CLIENT_ERROR_EVENT:
         {
             aoonet_client_event *e = (aoonet_client_event *)events[i];
@@ -4406,6 +5726,7 @@ bool SonobusAudioProcessor::disconnectRemotePeer(const String & host, int port,
             remote->connected = false;
             remote->recvActive = false;
             remote->sendActive = false;
+            remote->relayState = RelayOff; // uninvite_all() covered the relay too
         }
     }
 
@@ -4445,6 +5766,7 @@ bool SonobusAudioProcessor::disconnectRemotePeer(int index)
             remote->connected = false;
             remote->recvActive = false;
             remote->sendActive = false;
+            remote->relayState = RelayOff; // uninvite_all() covered the relay too
             
             //mRemotePeers.remove(index);
         }
@@ -4465,9 +5787,19 @@ void SonobusAudioProcessor::setPatchMatrixValue(int srcindex, int destindex, boo
 {
 
     if (srcindex < MAX_PEERS && destindex < MAX_PEERS) {
-        mRemoteSendMatrix[srcindex][destindex] = value;
-
         const ScopedReadLock sl (mCoreLock);        
+
+        {
+            // whoever shares an encoder with the destination would get its new mix
+            const ScopedLock esl (mSharedEncoderLock);
+            if (destindex < mRemotePeers.size() && destindex >= 0) {
+                detachSharedEncoders(mRemotePeers.getUnchecked(destindex));
+            }
+
+            mRemoteSendMatrix[srcindex][destindex] = value;
+            ++mSendRoutingVersion;
+        }
+
         if (destindex < mRemotePeers.size() && destindex >= 0) {
             auto * peer = mRemotePeers.getUnchecked(destindex);
 
@@ -4480,7 +5812,14 @@ void SonobusAudioProcessor::setPatchMatrixValue(int srcindex, int destindex, boo
 
 void SonobusAudioProcessor::adjustRemoteSendMatrix(int index, bool removed)
 {
+    // columns shift, nobody may be regrouped against the matrix until it's consistent again
+    const ScopedLock esl (mSharedEncoderLock);
+
     if (removed) {
+        if (index < mRemotePeers.size()) {
+            detachSharedEncoders(mRemotePeers.getUnchecked(index));
+        }
+
         // adjust mRemoteSendMatrix
         // shift rows
         for (int i=index+1; i < mRemotePeers.size(); ++i) {
@@ -4520,6 +5859,8 @@ void SonobusAudioProcessor::adjustRemoteSendMatrix(int index, bool removed)
         }                
 
     }
+
+    ++mSendRoutingVersion;
 }
 
 bool SonobusAudioProcessor::removeAllRemotePeers()
@@ -4544,7 +5885,12 @@ bool SonobusAudioProcessor::removeAllRemotePeers()
     {
         const ScopedWriteLock slw (mCoreLock);
         mRemotePeers.clearQuick(false); // not deleting objects here
+        rebuildPeerDispatchIndex();
+        publishPeerSnapshot();
     }
+
+    // the audio thread may still be using them, they get freed later on the event thread
+    retireRemotePeers(removed);
     
     // reset matrix
     for (int i=0; i < MAX_PEERS; ++i) {
@@ -4552,8 +5898,7 @@ bool SonobusAudioProcessor::removeAllRemotePeers()
             mRemoteSendMatrix[i][j] = false;
         }
     }
-
-    // they will be cleaned up when removed list goes out of scope
+    ++mSendRoutingVersion;
 
     return true;
 }
@@ -4581,13 +5926,18 @@ bool SonobusAudioProcessor::removeRemotePeer(int index, bool sendblock)
             
             adjustRemoteSendMatrix(index, true);
             
-            std::unique_ptr<RemotePeer> removed(remote);
+            OwnedArray<RemotePeer> removed;
+            removed.add(remote);
 
             {
                 const ScopedWriteLock slw (mCoreLock);
                 mRemotePeers.remove(index, false); // not deleting in scoped write lock
+                rebuildPeerDispatchIndex();
+                publishPeerSnapshot();
             }
 
+            retireRemotePeers(removed);
+
         }
     }
     
@@ -4708,6 +6058,7 @@ void SonobusAudioProcessor::setRemotePeerChannelSoloed(int index, int changroup,
     if (index < mRemotePeers.size() && changroup < MAX_CHANGROUPS) {
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
         remote->chanGroups[changroup].params.soloed = soloed;
+        invalidateMixPlan();
     }
 }
 
@@ -4765,6 +6116,7 @@ void SonobusAudioProcessor::setRemotePeerChannelGroupCount(int index, int count)
         remote->numChanGroups = newcnt;
         remote->modifiedChanGroups = true;
         remote->modifiedMultiChanGroups = true;
+        invalidateMixPlan();
     }
 }
 
@@ -4844,6 +6196,7 @@ void SonobusAudioProcessor::setRemotePeerChannelGroupStartAndCount(int index, in
         RemotePeer * remote = mRemotePeers.getUnchecked(index);
         remote->chanGroups[changroup].params.chanStartIndex = start;
         remote->chanGroups[changroup].params.numChannels = std::max(1, std::min(count, MAX_CHANNELS));
+        remote->chanGroups[changroup].prepareMultichannelEffects();
         remote->modifiedChanGroups = true;
         remote->modifiedMultiChanGroups = true;
     }
@@ -4924,9 +6277,11 @@ bool SonobusAudioProcessor::insertRemotePeerChannelGroup(int index, int atgroup,
         remote->chanGroups[atgroup].params.numChannels = std::max(1, std::min(chcount, MAX_CHANNELS));
         remote->chanGroups[atgroup].params.panDestStartIndex = 0;
         remote->chanGroups[atgroup].params.panDestChannels = std::max(1, std::min(2, getTotalNumOutputChannels()));
+        remote->chanGroups[atgroup].prepareMultichannelEffects();
 
         remote->modifiedChanGroups = true;
         remote->modifiedMultiChanGroups = true;
+        invalidateMixPlan();
         // todo some defaults
     }
 
@@ -4947,6 +6302,7 @@ bool SonobusAudioProcessor::removeRemotePeerChannelGroup(int index, int atgroup)
         }
         remote->modifiedChanGroups = true;
         remote->modifiedMultiChanGroups = true;
+        invalidateMixPlan();
     }
 
     return false;
@@ -4961,6 +6317,7 @@ bool SonobusAudioProcessor::copyRemotePeerChannelGroup(int index, int fromgroup,
         remote->chanGroups[togroup].copyParametersFrom(remote->chanGroups[fromgroup]);
         remote->modifiedChanGroups = true;
         remote->modifiedMultiChanGroups = true;
+        invalidateMixPlan();
     }
     return false;
 }
@@ -5137,7 +6494,9 @@ void SonobusAudioProcessor::updateRemotePeerSendChannels(int index, RemotePeer *
     }
     
     if (remote->sendChannels != newchancnt) {
+        detachSharedEncoders(remote);
         remote->sendChannels = newchancnt;
+        ++mSendRoutingVersion;
         DBG("Peer " << index << "  has new sendChannel count: " << remote->sendChannels);
         if (remote->oursource) {
             setupSourceFormat(remote, remote->oursource.get());
@@ -5210,62 +6569,469 @@ void SonobusAudioProcessor::setRemotePeerBufferTime(int index, float bufferMs)
     }
 }
 
-float SonobusAudioProcessor::getRemotePeerBufferTime(int index) const
+float SonobusAudioProcessor::getRemotePeerBufferTime(int index) const
+{
+    float buftimeMs = 30.0f;
+    
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        buftimeMs = remote->buffertimeMs;
+        // reflect actual truth
+        buftimeMs = jmax((double)buftimeMs, 1000.0f * currSamplesPerBlock / getSampleRate());
+    }
+    return buftimeMs;    
+}
+
+void SonobusAudioProcessor::setRemotePeerAutoresizeBufferMode(int index, SonobusAudioProcessor::AutoNetBufferMode flag)
+{
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        remote->autosizeBufferMode = flag;
+        
+        if (flag == AutoNetBufferModeAutoFull) {
+            remote->netBufAutoBaseline = (1e3*currSamplesPerBlock/getSampleRate()); // at least a process block
+        } else if (flag == AutoNetBufferModeInitAuto) {
+            setRemotePeerBufferTime(index, 0.0f); // reset to zero and start it over
+        } else if (flag == AutoNetBufferModeStatistical) {
+            remote->statNetBufTargetMs = remote->buffertimeMs; // start from where we are
+            remote->lastStatNetBufChangeTime = 0;
+        }
+
+        // clear drop count
+        remote->dataPacketsResent = 0;
+        remote->dataPacketsDropped = 0;
+        remote->lastDropCount = 0;
+        remote->resetDroptime = Time::getMillisecondCounterHiRes();
+        remote->fastDropRate.resetInitVal(0.0f);
+
+        //remote->lastDroptime = 0;
+    }
+}
+
+SonobusAudioProcessor::AutoNetBufferMode SonobusAudioProcessor::getRemotePeerAutoresizeBufferMode(int index, bool & initCompleted) const
+{
+    const ScopedReadLock sl (mCoreLock);        
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        initCompleted = remote->autoNetbufInitCompleted;
+        return remote->autosizeBufferMode;
+    }
+    return AutoNetBufferModeOff;    
+}
+
+// acceptable limit for drop rate in dropinstance/second, above which it will adjust the jitter buffer in Auto modes
+void SonobusAudioProcessor::setAutoresizeBufferDropRateThreshold(float thresh)
+{
+    mAutoresizeDropRateThresh = thresh;
+}
+
+void SonobusAudioProcessor::setStatisticalNetBufferPercentile(float percentile)
+{
+    mStatNetBufPercentile = jlimit(50.0f, 100.0f, percentile);
+
+    const ScopedReadLock sl (mCoreLock);
+    for (auto remote : mRemotePeers) {
+        remote->oursink->set_jitter_percentile(mStatNetBufPercentile.get());
+    }
+}
+
+bool SonobusAudioProcessor::getRemotePeerArrivalJitter(int index, float & retdelayms, float & retmedianms, float & retmaxms) const
+{
+    retdelayms = retmedianms = retmaxms = 0.0f;
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        RemotePeer * remote = mRemotePeers.getUnchecked(index);
+        // jitterStats itself belongs to the send thread
+        const auto stats = remote->publishedJitterStats.load();
+        if (stats.count == 0) return false;
+        retdelayms = stats.delay_ms;
+        retmedianms = stats.median_ms;
+        retmaxms = stats.max_ms;
+        return true;
+    }
+    return false;
+}
+
+// Sizes the jitter buffer of peers in Statistical mode so it covers the chosen percentile
+// of the arrival delay measured by the sink, instead of reacting to drops.
+void SonobusAudioProcessor::updateStatisticalNetBuffers()
+{
+    const ScopedReadLock sl (mCoreLock);
+
+    const double nowtime = Time::getMillisecondCounterHiRes();
+    const float blockms = 1000.0f * currSamplesPerBlock / getSampleRate();
+    const int minsamples = 200; // a couple of seconds worth of blocks before we trust it
+    const float decrlimit = 1.0f; // don't decrease more often than once every second
+
+    for (auto peer : mRemotePeers) {
+        if (!peer->oursink || peer->remoteSourceId == AOO_ID_NONE) continue;
+
+        EndpointState * recvendpoint = nullptr;
+        int32_t recvsourceid = AOO_ID_NONE;
+        getRemotePeerRecvSource(peer, recvendpoint, recvsourceid);
+
+        if (peer->oursink->get_source_jitter_stats(recvendpoint, recvsourceid, peer->jitterStats) <= 0) {
+            peer->jitterStats.count = 0;
+            peer->publishedJitterStats.store(peer->jitterStats);
+            continue;
+        }
+        peer->publishedJitterStats.store(peer->jitterStats);
+
+        if (peer->autosizeBufferMode != AutoNetBufferModeStatistical || peer->latencyMatched
+            || peer->jitterStats.count < minsamples) {
+            continue;
+        }
+
+        // the late packets plus one block of the sender, and at least one of our process blocks
+        float target = peer->jitterStats.delay_ms + jmax(peer->jitterStats.block_ms, blockms);
+
+        // rise quickly, fall slowly
+        if (target > peer->statNetBufTargetMs) {
+            peer->statNetBufTargetMs += 0.5f * (target - peer->statNetBufTargetMs);
+        } else {
+            peer->statNetBufTargetMs += 0.05f * (target - peer->statNetBufTargetMs);
+        }
+
+        // the sink stretches its audio to the new size, but only bother with whole blocks
+        float delta = peer->statNetBufTargetMs - peer->buffertimeMs;
+        if (fabsf(delta) < blockms) {
+            continue;
+        }
+        if (delta < 0.0f && peer->lastStatNetBufChangeTime > 0 && (nowtime - peer->lastStatNetBufChangeTime)*1e-3 < decrlimit) {
+            continue;
+        }
+
+        peer->buffertimeMs = jmax(blockms, blockms * roundf(peer->statNetBufTargetMs / blockms));
+
+        peer->totalEstLatency = peer->smoothPingTime.xbar + 2*peer->buffertimeMs + (1e3*currSamplesPerBlock/getSampleRate());
+        peer->oursink->set_buffersize(peer->buffertimeMs);
+        peer->echosink->set_buffersize(peer->buffertimeMs);
+        peer->latencysink->set_buffersize(peer->buffertimeMs);
+        peer->latencyDirty = true;
+        peer->fillRatioSlow.reset();
+        peer->fillRatio.reset();
+
+        if (peer->hasRealLatency) {
+            peer->totalEstLatency = peer->totalLatency + (peer->buffertimeMs - peer->bufferTimeAtRealLatency);
+        }
+
+        DBG("STAT-Adjusting buffer time to " << (int)peer->buffertimeMs << " ms, p" << peer->jitterStats.percentile << " delay: " << peer->jitterStats.delay_ms);
+
+        peer->lastStatNetBufChangeTime = nowtime;
+
+        sendRemotePeerInfoUpdate(-1, peer); // send to this peer
+    }
+}
+
+
+
+void SonobusAudioProcessor::getRemotePeerRecvSource(RemotePeer * peer, EndpointState *& retendpoint, int32_t & retsourceid)
+{
+    // where the sink gets this peer's stream from right now
+    if (peer->relayState == RelayActive) {
+        retendpoint = mRelayEndpoint.get();
+        retsourceid = peer->relayStreamId;
+    } else {
+        retendpoint = peer->endpoint;
+        retsourceid = peer->remoteSourceId;
+    }
+}
+
+// Switches the peers whose stream is on the server's relay over to it, and back to
+// the direct connection when the relay doesn't deliver it. Called from the send thread.
+void SonobusAudioProcessor::updateRelayedPeers(double nowtimems)
+{
+    const ScopedReadLock sl (mCoreLock);
+
+    auto relayendpoint = mRelayEndpoint.get();
+
+    for (auto peer : mRemotePeers) {
+        // the MCU has them
+        if (!peer->oursink || peer->mcuMixed) continue;
+
+        int32_t streamid = AOO_ID_NONE;
+        if (relayendpoint && peer->userName.isNotEmpty()) {
+            const ScopedLock rl (mRelayLock);
+            auto found = mRelayStreams.find(peer->userName);
+            if (found != mRelayStreams.end()) {
+                streamid = found->second;
+            }
+        }
+
+        if (streamid != peer->relayStreamId) {
+            // gone from the relay, or published again
+            if (peer->relayState == RelayPending || peer->relayState == RelayActive) {
+                fallBackFromRelay(peer, nowtimems);
+            }
+            peer->relayStreamId = streamid;
+            peer->relayState = RelayOff;
+        }
+
+        if (streamid == AOO_ID_NONE) continue;
+
+        switch (peer->relayState) {
+            case RelayOff:
+                // only once the direct connection is up, it stays our fallback
+                if (peer->connected && peer->recvAllow && peer->remoteSourceId != AOO_ID_NONE) {
+                    DBG("Inviting relay stream " << streamid << " of " << peer->userName);
+                    peer->oursink->invite_source(relayendpoint, streamid, endpoint_send);
+                    peer->relayState = RelayPending;
+                    peer->relayStateChangeMs = nowtimems;
+                    peer->lastRelayInviteMs = nowtimems;
+                }
+                break;
+            case RelayPending:
+                if (nowtimems - peer->relayStateChangeMs > RELAY_FORMAT_TIMEOUT_MS) {
+                    DBG("No format from relay stream " << streamid << ", staying direct with " << peer->userName);
+                    fallBackFromRelay(peer, nowtimems);
+                }
+                break;
+            case RelayActive:
+                if (peer->recvAllow && nowtimems - jmax(peer->lastRelayRecvMs, peer->relayStateChangeMs) > RELAY_RECV_TIMEOUT_MS) {
+                    DBG("Relay stream " << streamid << " stalled, going direct with " << peer->userName);
+                    fallBackFromRelay(peer, nowtimems);
+                }
+                break;
+            default:
+                break;
+        }
+
+        // a lost invite is retried, and the relay knows we are still there
+        if ((peer->relayState == RelayPending || peer->relayState == RelayActive) && peer->recvAllow
+            && nowtimems - peer->lastRelayInviteMs > RELAY_INVITE_INTERVAL_MS) {
+            peer->oursink->invite_source(relayendpoint, streamid, endpoint_send);
+            peer->lastRelayInviteMs = nowtimems;
+        }
+    }
+}
+
+void SonobusAudioProcessor::fallBackFromRelay(RemotePeer * peer, double nowtimems)
+{
+    // assumes the core read lock is held
+    auto relayendpoint = mRelayEndpoint.get();
+
+    if (relayendpoint && peer->relayStreamId != AOO_ID_NONE) {
+        peer->oursink->uninvite_source(relayendpoint, peer->relayStreamId, endpoint_send);
+    }
+    if (peer->recvAllow && peer->remoteSourceId != AOO_ID_NONE) {
+        peer->oursink->invite_source(peer->endpoint, peer->remoteSourceId, endpoint_send);
+    }
+
+    peer->relayState = RelayFailed;
+    peer->relayStateChangeMs = nowtimems;
+}
+
+void SonobusAudioProcessor::setupRelaySource()
+{
+    // the relayed stream carries our main send mix, in the default send format
+    if (!mRelaySource || getSampleRate() <= 0.0) return;
+
+    mRelaySendChannels = jmax(1, mSendChannels.get() <= 0 ? mActiveSendChannels : mSendChannels.get());
+
+    int formatIndex = mDefaultAudioFormatIndex;
+    if (formatIndex < 0 || formatIndex >= mAudioFormats.size()) formatIndex = 4; //emergency default
+
+    aoo_format_storage f;
+    if (formatInfoToAooFormat(mAudioFormats.getReference(formatIndex), mRelaySendChannels, f)) {
+        mRelaySource->set_format(f.header);
+    }
+    setupSourceUserFormat(nullptr, mRelaySource.get());
+
+    mRelaySource->setup(getSampleRate(), currSamplesPerBlock, mRelaySendChannels);
+    float sendbufsize = jmax(10.0, SENDBUFSIZE_SCALAR * 1000.0f * currSamplesPerBlock / getSampleRate());
+    mRelaySource->set_buffersize(sendbufsize);
+}
+
+void SonobusAudioProcessor::stopRelaySource()
+{
+    // the server removes our stream itself, and the relayed peers
+    // go back to the direct connection on the next update
+    mRelaySourceActive = false;
+    if (mRelaySource) {
+        mRelaySource->stop();
+        mRelaySource->remove_all();
+    }
+
+    const ScopedLock rl (mRelayLock);
+    mRelayStreams.clear();
+}
+
+bool SonobusAudioProcessor::getGroupRelayEnabled(const String & group) const
+{
+    const ScopedLock rl (mRelayLock);
+    return mRelayGroups.contains(group);
+}
+
+void SonobusAudioProcessor::setGroupRelayEnabled(const String & group, bool flag)
+{
+    const ScopedLock rl (mRelayLock);
+    if (flag) {
+        mRelayGroups.addIfNotAlreadyThere(group);
+    } else {
+        mRelayGroups.removeString(group);
+    }
+}
+
+bool SonobusAudioProcessor::getRemotePeerRelayed(int index)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        return mRemotePeers.getUnchecked(index)->relayState == RelayActive;
+    }
+    return false;
+}
+
+// Stops the direct streams with the peers the MCU mixes for us, and keeps their gain
+// and pan in our mix in step with their level and pan here. Called from the send thread.
+void SonobusAudioProcessor::updateMcuPeers(double nowtimems)
+{
+    auto mcuendpoint = mMcuEndpoint.get();
+    const bool active = mMcuActive.get() && mcuendpoint;
+
+    if (active && !mMcuReceiving.get() && nowtimems - mMcuLastInviteMs > MCU_INVITE_INTERVAL_MS) {
+        // a lost invite is retried
+        mMcuSink->invite_source(mcuendpoint, mMcuId, endpoint_send);
+        mMcuLastInviteMs = nowtimems;
+    }
+
+    String group;
+    {
+        const ScopedLock sl (mClientLock);
+        group = mCurrentJoinedGroup;
+    }
+
+    const ScopedReadLock sl (mCoreLock);
+
+    for (auto peer : mRemotePeers) {
+        if (!peer->oursink) continue;
+
+        bool mixed = false;
+        if (active && peer->userName.isNotEmpty()) {
+            const ScopedLock ml (mMcuLock);
+            mixed = mMcuParticipants.find(peer->userName) != mMcuParticipants.end();
+        }
+
+        if (mixed != peer->mcuMixed) {
+            if (mixed) {
+                // they go into the server's mix, and do the same with us
+                DBG("The MCU mixes " << peer->userName << ", stopping the direct stream");
+                if (peer->relayState == RelayPending || peer->relayState == RelayActive) {
+                    peer->oursink->uninvite_source(mRelayEndpoint.get(), peer->relayStreamId, endpoint_send);
+                    peer->relayState = RelayFailed;
+                    peer->relayStateChangeMs = nowtimems;
+                }
+                if (peer->remoteSourceId != AOO_ID_NONE) {
+                    peer->oursink->uninvite_source(peer->endpoint, peer->remoteSourceId, endpoint_send);
+                }
+                peer->mcuSentGain = -1.0f;
+            }
+            else {
+                DBG("The MCU doesn't mix " << peer->userName << " anymore, going direct");
+                if (peer->recvAllow && peer->remoteSourceId != AOO_ID_NONE) {
+                    peer->oursink->invite_source(peer->endpoint, peer->remoteSourceId, endpoint_send);
+                }
+            }
+            peer->mcuMixed = mixed;
+        }
+
+        if (!mixed || !mAooClient) continue;
+
+        // the level and pan of their first channel group stand for all of them
+        float gain = peer->recvAllow && !peer->chanGroups[0].params.muted ? peer->gain * peer->chanGroups[0].params.gain : 0.0f;
+        float pan = peer->chanGroups[0].params.numChannels == 1 ? peer->chanGroups[0].params.pan[0] : 0.0f;
+
+        if (std::abs(gain - peer->mcuSentGain) > 1e-4f || std::abs(pan - peer->mcuSentPan) > 1e-4f) {
+            mAooClient->mcu_set_gain(group.toRawUTF8(), peer->userName.toRawUTF8(), gain, pan);
+            peer->mcuSentGain = gain;
+            peer->mcuSentPan = pan;
+        }
+    }
+}
+
+void SonobusAudioProcessor::setupMcu()
 {
-    float buftimeMs = 30.0f;
-    
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        buftimeMs = remote->buffertimeMs;
-        // reflect actual truth
-        buftimeMs = jmax((double)buftimeMs, 1000.0f * currSamplesPerBlock / getSampleRate());
+    auto mcuendpoint = mMcuEndpoint.get();
+    if (!mMcuSource || !mMcuSink || !mcuendpoint || getSampleRate() <= 0.0) return;
+
+    // our main send mix goes up in the default send format, like to the relay
+    mMcuSendChannels = jmax(1, mSendChannels.get() <= 0 ? mActiveSendChannels : mSendChannels.get());
+
+    int formatIndex = mDefaultAudioFormatIndex;
+    if (formatIndex < 0 || formatIndex >= mAudioFormats.size()) formatIndex = 4; //emergency default
+
+    aoo_format_storage f;
+    if (formatInfoToAooFormat(mAudioFormats.getReference(formatIndex), mMcuSendChannels, f)) {
+        mMcuSource->set_format(f.header);
     }
-    return buftimeMs;    
-}
+    setupSourceUserFormat(nullptr, mMcuSource.get());
 
-void SonobusAudioProcessor::setRemotePeerAutoresizeBufferMode(int index, SonobusAudioProcessor::AutoNetBufferMode flag)
-{
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        remote->autosizeBufferMode = flag;
-        
-        if (flag == AutoNetBufferModeAutoFull) {
-            remote->netBufAutoBaseline = (1e3*currSamplesPerBlock/getSampleRate()); // at least a process block
-        } else if (flag == AutoNetBufferModeInitAuto) {
-            setRemotePeerBufferTime(index, 0.0f); // reset to zero and start it over
-        }
+    mMcuSource->setup(getSampleRate(), currSamplesPerBlock, mMcuSendChannels);
+    float sendbufsize = jmax(10.0, SENDBUFSIZE_SCALAR * 1000.0f * currSamplesPerBlock / getSampleRate());
+    mMcuSource->set_buffersize(sendbufsize);
 
-        // clear drop count
-        remote->dataPacketsResent = 0;
-        remote->dataPacketsDropped = 0;
-        remote->lastDropCount = 0;
-        remote->resetDroptime = Time::getMillisecondCounterHiRes();
-        remote->fastDropRate.resetInitVal(0.0f);
+    // the mix comes back as stereo, resampled to our rate. Nothing sizes its
+    // jitter buffer automatically, so start from the default with some headroom
+    mMcuSink->setup(getSampleRate(), currSamplesPerBlock, 2);
+    mMcuSink->set_buffersize(jmax(20.0, mBufferTime.get() * 1000.0));
 
-        //remote->lastDroptime = 0;
+    if (!mMcuActive.get()) {
+        mMcuSource->remove_all();
+        mMcuSource->add_sink(mcuendpoint, mMcuId, endpoint_send);
+        mMcuSource->start();
+
+        mMcuSink->uninvite_all();
+        mMcuSink->invite_source(mcuendpoint, mMcuId, endpoint_send);
+        mMcuReceiving = false;
+        mMcuLastInviteMs = Time::getMillisecondCounterHiRes();
+
+        mMcuActive = true;
     }
 }
 
-SonobusAudioProcessor::AutoNetBufferMode SonobusAudioProcessor::getRemotePeerAutoresizeBufferMode(int index, bool & initCompleted) const
+void SonobusAudioProcessor::stopMcu()
 {
-    const ScopedReadLock sl (mCoreLock);        
-    if (index < mRemotePeers.size()) {
-        RemotePeer * remote = mRemotePeers.getUnchecked(index);
-        initCompleted = remote->autoNetbufInitCompleted;
-        return remote->autosizeBufferMode;
+    // the server removes us itself, and the mixed peers
+    // go back to the direct connection on the next update
+    mMcuActive = false;
+    if (mMcuSource) {
+        mMcuSource->stop();
+        mMcuSource->remove_all();
     }
-    return AutoNetBufferModeOff;    
+    if (mMcuSink) {
+        mMcuSink->uninvite_all();
+    }
+    mMcuId = AOO_ID_NONE;
+
+    const ScopedLock ml (mMcuLock);
+    mMcuParticipants.clear();
 }
 
-// acceptable limit for drop rate in dropinstance/second, above which it will adjust the jitter buffer in Auto modes
-void SonobusAudioProcessor::setAutoresizeBufferDropRateThreshold(float thresh)
+bool SonobusAudioProcessor::getGroupMcuEnabled(const String & group) const
 {
-    mAutoresizeDropRateThresh = thresh;
+    const ScopedLock ml (mMcuLock);
+    return mMcuGroups.contains(group);
 }
 
+void SonobusAudioProcessor::setGroupMcuEnabled(const String & group, bool flag)
+{
+    const ScopedLock ml (mMcuLock);
+    if (flag) {
+        mMcuGroups.addIfNotAlreadyThere(group);
+    } else {
+        mMcuGroups.removeString(group);
+    }
+}
 
+bool SonobusAudioProcessor::getRemotePeerMcuMixed(int index)
+{
+    const ScopedReadLock sl (mCoreLock);
+    if (index < mRemotePeers.size()) {
+        return mRemotePeers.getUnchecked(index)->mcuMixed;
+    }
+    return false;
+}
 
 bool SonobusAudioProcessor::getRemotePeerReceiveBufferFillRatio(int index, float & retratio, float & retstddev) const
 {
@@ -5296,7 +7062,17 @@ void SonobusAudioProcessor::setRemotePeerRecvActive(int index, bool active)
         
         // TODO
 #if 1
-        if (active) {
+        if (remote->relayState == RelayPending || remote->relayState == RelayActive) {
+            // it comes through the relay
+            auto relayendpoint = mRelayEndpoint.get();
+            if (active) {
+                remote->oursink->invite_source(relayendpoint, remote->relayStreamId, endpoint_send);
+                remote->relayStateChangeMs = remote->lastRelayInviteMs = Time::getMillisecondCounterHiRes();
+            } else {
+                remote->oursink->uninvite_source(relayendpoint, remote->relayStreamId, endpoint_send);
+            }
+        }
+        else if (active) {
             DBG("inviting peer " <<  remote->ourId << " source " << remote->remoteSourceId);
             remote->oursink->invite_source(remote->endpoint,remote->remoteSourceId, endpoint_send);
         } else {
@@ -5393,6 +7169,7 @@ void SonobusAudioProcessor::setRemotePeerSoloed(int index, bool soloed)
         }
     }
     mAnythingSoloed = anysoloed;
+    invalidateMixPlan();
 }
 
 bool SonobusAudioProcessor::getRemotePeerSoloed(int index) const
@@ -5789,6 +7566,16 @@ SonobusAudioProcessor::RemotePeer *  SonobusAudioProcessor::findRemotePeer(Endpo
             break;
         }
     }
+
+    if (!retpeer && ourId >= 0 && endpoint && endpoint == mRelayEndpoint.get()) {
+        // a peer's stream we get through the relay, the sink is still the peer's own
+        for (auto s : mRemotePeers) {
+            if (s->ourId == ourId) {
+                retpeer = s;
+                break;
+            }
+        }
+    }
         
     return retpeer;        
 }
@@ -5895,6 +7682,16 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
 
         retpeer = new RemotePeer(endpoint, newid);
 
+        retpeer->oursink->set_event_notify(gAooEventNotify, this);
+        retpeer->oursource->set_event_notify(gAooEventNotify, this);
+        retpeer->latencysink->set_event_notify(gAooEventNotify, this);
+        retpeer->latencysource->set_event_notify(gAooEventNotify, this);
+        retpeer->echosink->set_event_notify(gAooEventNotify, this);
+        retpeer->echosource->set_event_notify(gAooEventNotify, this);
+
+        retpeer->oursink->set_jitter_percentile(mStatNetBufPercentile.get());
+        // buffer size changes are stretched in instead of resetting the buffer
+        retpeer->oursink->set_time_stretch(1);
 
         retpeer->userName = username;
         retpeer->groupName = groupname;
@@ -5924,6 +7721,7 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
         
         retpeer->oursink->setup(getSampleRate(), currSamplesPerBlock, getMainBusNumOutputChannels());
         retpeer->oursink->set_buffersize(retpeer->buffertimeMs);
+        retpeer->oursink->set_deferred_decode(mActiveDecodeThreads.get() > 0 ? 1 : 0);
 
         int32_t flags = AOO_PROTOCOL_FLAG_COMPACT_DATA;
         retpeer->oursink->set_option(aoo_opt_protocol_flags, &flags, sizeof(int32_t));
@@ -6002,9 +7800,15 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
         // now add it, once initialized
         {
             const ScopedWriteLock slw (mCoreLock);
+            retpeer->sendMixKey = ++mLastSendMixKey;
             mRemotePeers.add(retpeer);
+            rebuildPeerDispatchIndex();
+            publishPeerSnapshot();
         }
 
+        // anything queued while it wasn't in the list yet
+        notifyEventQueued(retpeer->ourId);
+
         //updateRemotePeerUserFormat(mRemotePeers.size()-1);
 
     }
@@ -6026,9 +7830,7 @@ SonobusAudioProcessor::RemotePeer * SonobusAudioProcessor::doAddRemotePeerIfNece
                 retpeer->echosink->set_buffersize(retpeer->buffertimeMs);
                 
                 for (auto i=0; i < retpeer->numChanGroups && i < MAX_CHANGROUPS; ++i) {
-                    retpeer->chanGroups[i].commitCompressorParams();
-                    retpeer->chanGroups[i].commitExpanderParams();
-                    retpeer->chanGroups[i].commitEqParams();
+                    retpeer->chanGroups[i].publishEffectParams();
                 }
             }
 
@@ -6118,6 +7920,7 @@ bool SonobusAudioProcessor::findAndLoadCacheForPeer(RemotePeer * retpeer)
 
         for (int i=0; i < retpeer->numChanGroups  && i < MAX_CHANGROUPS; ++i) {
             retpeer->chanGroups[i].params = cache.channelGroupParams[i];
+            retpeer->chanGroups[i].commitAllParams();
         }
 
         for (int i=0; i < retpeer->lastMultiNumChanGroups  && i < MAX_CHANGROUPS; ++i) {
@@ -6159,11 +7962,14 @@ bool SonobusAudioProcessor::removeAllRemotePeersWithEndpoint(EndpointState * end
                 const ScopedWriteLock slw (mCoreLock);
 
                 removed.add(mRemotePeers.removeAndReturn(i));
+                rebuildPeerDispatchIndex();
+                publishPeerSnapshot();
             }
         }
     }
 
-    // remote peers will be deleted when removed list goes out of scope
+    // remote peers will be deleted on the event thread once the audio thread is done with them
+    retireRemotePeers(removed);
 
     return didremove;
 }
@@ -6185,11 +7991,15 @@ bool SonobusAudioProcessor::doRemoveRemotePeerIfNecessary(EndpointState * endpoi
             {
                 const ScopedWriteLock slw (mCoreLock);
                 removed.add(mRemotePeers.removeAndReturn(i));
+                rebuildPeerDispatchIndex();
+                publishPeerSnapshot();
             }
             break;
         }
         ++i;
     }
+
+    retireRemotePeers(removed);
     
     return didremove;
     
@@ -6234,7 +8044,9 @@ bool SonobusAudioProcessor::formatInfoToAooFormat(const AudioCodecFormatInfo & i
             fmt->bitrate = info.bitrate * fmt->header.nchannels;
             fmt->complexity = info.complexity;
             fmt->signal_type = info.signal_type;
-            fmt->application_type = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
+            fmt->fec_loss_percent = mOpusFecLossPercent.get();
+            // in-band FEC is only available in the SILK/hybrid modes, which restricted lowdelay doesn't have
+            fmt->application_type = fmt->fec_loss_percent > 0 ? OPUS_APPLICATION_AUDIO : OPUS_APPLICATION_RESTRICTED_LOWDELAY;
             //fmt->application_type = OPUS_APPLICATION_AUDIO;
             
             return true;
@@ -6371,6 +8183,7 @@ void SonobusAudioProcessor::updateRemotePeerUserFormat(int index, RemotePeer * o
 void SonobusAudioProcessor::restoreLayoutFormatForPeer(RemotePeer * remote, bool resetmulti)
 {
     DBG("Restoring layout userformat for peer" );
+    invalidateMixPlan();
     remote->numChanGroups = remote->origNumChanGroups;
 
     for (int i=0; i < MAX_CHANGROUPS && i < remote->numChanGroups; ++i) {
@@ -6504,6 +8317,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
     }
     else if (parameterID == paramSendChannels) {
         mSendChannels = (int) newValue;
+        invalidateMixPlan();
         
         setRemotePeerNominalSendChannelCount(-1, mSendChannels.get());
         updateRemotePeerUserFormat();
@@ -6588,6 +8402,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
 
     else if (parameterID == paramSendFileAudio) {
         mSendPlaybackAudio = newValue > 0;
+        invalidateMixPlan();
 
 #if 0
         if (mTransportSource.isPlaying() && mSendPlaybackAudio.get()) {
@@ -6603,6 +8418,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
     }
     else if (parameterID == paramSendSoundboardAudio) {
         mSendSoundboardAudio = newValue > 0;
+        invalidateMixPlan();
     }
     else if (parameterID == paramHearLatencyTest) {
         mHearLatencyTest = newValue > 0;
@@ -6612,6 +8428,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
     }
     else if (parameterID == paramSendMetAudio) {
         mSendMet = newValue > 0;
+        invalidateMixPlan();
     }
     else if (parameterID == paramMainInMute) {
         mMainInMute = newValue > 0;
@@ -6627,6 +8444,7 @@ void SonobusAudioProcessor::parameterChanged (const String &parameterID, float n
             }
         }
         mAnythingSoloed = anysoloed;
+        invalidateMixPlan();
     }
     else if (parameterID == paramMainSendMute) {
         // allow or disallow sending to all peers
@@ -6883,6 +8701,8 @@ void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBloc
     setupSourceFormat(0, mAooDummySource.get());
     mAooDummySource->setup(sampleRate, samplesPerBlock, getTotalNumInputChannels());
 
+    setupRelaySource();
+
 
 
     if (lastInputChannels == 0 || lastOutputChannels == 0 || mInputChannelGroupCount == 0) {
@@ -6961,6 +8781,9 @@ void SonobusAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBloc
     
     ensureBuffers(samplesPerBlock);
 
+    // resolved for the new buses before the first block
+    updateMixPlan();
+
 
     mMetChannelGroup.init(sampleRate);
     mFilePlaybackChannelGroup.init(sampleRate);
@@ -7015,6 +8838,7 @@ void SonobusAudioProcessor::setupSourceFormatsForAll()
         if (s->sendChannelsOverride > 0) {
             s->sendChannels = jmin(outchannels, s->sendChannelsOverride);
         }
+        ++mSendRoutingVersion;
 
         if (s->oursource) {
             setupSourceFormat(s, s->oursource.get());
@@ -7067,6 +8891,14 @@ void SonobusAudioProcessor::setupSourceFormatsForAll()
         ++i;
     }
 
+    if (mRelaySourceActive.get()) {
+        setupRelaySource();
+    }
+
+    if (mMcuActive.get()) {
+        setupMcu();
+    }
+
     updateRemotePeerUserFormat();
 
 }
@@ -7127,112 +8959,452 @@ void SonobusAudioProcessor::ensureBuffers(int numSamples)
     }
     selfrecchans = totsendchans;
 
-    // plus a possible metronome send
-    if (mSendMet.get()) {
-        totsendchans += 1;
+    // plus a possible metronome send
+    if (mSendMet.get()) {
+        totsendchans += 1;
+    }
+    int fileplaychans = mCurrentAudioFileSource ? mCurrentAudioFileSource->getAudioFormatReader()->numChannels : 2;
+    int fileplaymaxchans = jmax(maxchans, fileplaychans);
+    if (mSendPlaybackAudio.get()) {
+        // plus a possible file sending
+        totsendchans += fileplaychans;
+    }
+
+    meterRmsWindow = getSampleRate() * METER_RMS_SEC / currSamplesPerBlock;
+
+    int soundboardplaychans = soundboardChannelProcessor->getFileSourceNumberOfChannels();
+
+    soundboardChannelProcessor->ensureBuffers(numSamples, maxchans, meterRmsWindow);
+
+    if (mSendSoundboardAudio.get()) {
+        // plus a possible soundboard sending
+        totsendchans += soundboardplaychans;
+    }
+
+    bool needpeersendupdate = false;
+    if (mActiveSendChannels != totsendchans) {
+        mActiveSendChannels = totsendchans;
+        needpeersendupdate = true;
+    }
+
+    int realsendchans = mSendChannels.get() <= 0 ? totsendchans : mSendChannels.get();
+
+
+    mActiveInputChannels = selfrecchans;
+
+    if (sendMeterSource.getNumChannels() < realsendchans) {
+        sendMeterSource.resize (realsendchans, meterRmsWindow);
+    }
+
+    if (filePlaybackMeterSource.getNumChannels() < fileplaychans) {
+        filePlaybackMeterSource.resize (fileplaychans, meterRmsWindow);
+    }
+
+
+    auto maxworkbufchans = jmax(maxchans, totsendchans);
+
+    if (tempBuffer.getNumSamples() < numSamples || tempBuffer.getNumChannels() < maxchans) {
+        tempBuffer.setSize(maxchans, numSamples, false, false, true);
+    }
+    if (mixBuffer.getNumSamples() < numSamples || mixBuffer.getNumChannels() < maxchans) {
+        mixBuffer.setSize(maxchans, numSamples, false, false, true);
+    }
+    if (workBuffer.getNumSamples() < numSamples || workBuffer.getNumChannels() != maxworkbufchans) {
+
+        // only grow the work buffer channel count
+        if (maxworkbufchans > workBuffer.getNumChannels() || workBuffer.getNumSamples() < numSamples) {
+            workBuffer.setSize(maxworkbufchans, numSamples, false, false, true);
+        }
+
+        needpeersendupdate = true;
+    }
+    if (inputBuffer.getNumSamples() < numSamples || inputBuffer.getNumChannels() != maxchans) {
+        inputBuffer.setSize(maxchans, numSamples, false, false, true);
+    }
+    if (monitorBuffer.getNumSamples() < numSamples || monitorBuffer.getNumChannels() != maxchans) {
+        monitorBuffer.setSize(maxchans, numSamples, false, false, true);
+    }
+    if (sendWorkBuffer.getNumSamples() < numSamples || sendWorkBuffer.getNumChannels() != maxworkbufchans) {
+        sendWorkBuffer.setSize(maxworkbufchans, numSamples, false, false, true);
+    }
+    if (inputPostBuffer.getNumSamples() < numSamples || inputPostBuffer.getNumChannels() != totsendchans) {
+        inputPostBuffer.setSize(totsendchans, numSamples, false, false, true);
+        inputPreBuffer.setSize(totsendchans, numSamples, false, false, true);
+    }
+    if (fileBuffer.getNumSamples() < numSamples || fileBuffer.getNumChannels() != fileplaymaxchans) {
+        fileBuffer.setSize(fileplaymaxchans, numSamples, false, false, true);
+    }
+    if (metBuffer.getNumSamples() < numSamples || metBuffer.getNumChannels() != maxchans) {
+        metBuffer.setSize(maxchans, numSamples, false, false, true);
+    }
+    if (mainFxBuffer.getNumSamples() < numSamples || mainFxBuffer.getNumChannels() != maxchans) {
+        mainFxBuffer.setSize(maxchans, numSamples, false, false, true);
+    }
+    if (inputRevBuffer.getNumSamples() < numSamples || inputRevBuffer.getNumChannels() != maxchans) {
+        inputRevBuffer.setSize(maxchans, numSamples, false, false, true);
+    }
+    if (silentBuffer.getNumSamples() < numSamples) {
+        silentBuffer.setSize(1, numSamples, false, false, true);
+        silentBuffer.clear();
+    }
+    if (mcuBuffer.getNumSamples() < numSamples) {
+        mcuBuffer.setSize(2, numSamples, false, false, true);
+    }
+    // one output per peer with room for the work buffer channels, this only records the size,
+    // the send thread allocates it with the next plan
+    mSendMixer.prepare(MAX_PEERS, MAX_PEERS, maxworkbufchans, numSamples);
+
+    if (needpeersendupdate) {
+        const ScopedReadLock sl (mCoreLock);
+        // could be -1 as index meaning all remote peers
+        for (int i=0; i < mRemotePeers.size(); ++i) {
+            RemotePeer * remote = mRemotePeers.getUnchecked(i);
+            updateRemotePeerSendChannels(i, remote);
+        }
+
+        if (mRelaySourceActive.get() && jmax(1, realsendchans) != mRelaySendChannels) {
+            setupRelaySource();
+        }
+        if (mMcuActive.get() && jmax(1, realsendchans) != mMcuSendChannels) {
+            setupMcu();
+        }
+    }
+
+    mTempBufferSamples = jmax(mTempBufferSamples, numSamples);
+    mTempBufferChannels = jmax(maxchans, mTempBufferChannels);
+}
+
+// resolve the routing processBlock() needs from the current settings, everything but
+// the solo state of the peers. It doesn't allocate, so the audio thread can do it too
+void SonobusAudioProcessor::buildMixPlan(MixPlan & plan, int fileChannels) const
+{
+    plan.totalInputChannels = getTotalNumInputChannels();
+    plan.totalOutputChannels = getTotalNumOutputChannels();
+    plan.mainBusInputChannels = getMainBusNumInputChannels();
+
+    // the same as ensureBuffers() sizes the buffers for
+    const int maxchans = jmax(2, jmax(plan.totalOutputChannels, plan.totalInputChannels));
+
+    plan.numInputGroups = jmax(0, jmin(mInputChannelGroupCount, MAX_CHANGROUPS));
+
+    int inputchans = 0;
+    bool anyinputsoloed = false;
+    bool inreverb = false;
+    for (int i=0; i < plan.numInputGroups; ++i) {
+        const auto & params = mInputChannelGroups[i].params;
+        plan.inputGroups[i].srcStart = inputchans;
+        plan.inputGroups[i].numChannels = params.numChannels;
+        inputchans += params.numChannels;
+        anyinputsoloed = anyinputsoloed || params.soloed;
+        inreverb = inreverb || params.inReverbSend > 0.0f;
+    }
+
+    plan.sendMet = mSendMet.get();
+    plan.sendFile = mSendPlaybackAudio.get();
+    plan.sendSoundboard = mSendSoundboardAudio.get();
+    plan.fileChannels = fileChannels;
+
+    // for multichannel send, met and file playback and soundboard follow the last input channel
+    int totsendchans = inputchans;
+    plan.metStartChannel = totsendchans;
+    if (plan.sendMet) {
+        totsendchans += 1;
+    }
+    plan.fileStartChannel = totsendchans;
+    if (plan.sendFile) {
+        totsendchans += fileChannels;
+    }
+    plan.soundboardStartChannel = totsendchans;
+    if (plan.sendSoundboard) {
+        totsendchans += soundboardChannelProcessor->getFileSourceNumberOfChannels();
+    }
+    plan.totalSendChannels = totsendchans;
+
+    plan.sendChannels = mSendChannels.get();
+    plan.realSendChannels = plan.sendChannels <= 0 ? totsendchans : plan.sendChannels;
+    plan.sendPanChannels = plan.sendChannels == 0 ? totsendchans : jmin(jmax(maxchans, totsendchans), plan.sendChannels);
+    plan.sendStraight = plan.sendPanChannels > 2 || plan.sendChannels == 0;
+    // if sending as mono, split the difference about applying gain attentuation for the number of input channels
+    plan.sendPanGain = plan.sendPanChannels == 1 && totsendchans > 0 ? (1.0f/std::max(1.0f, (float)(totsendchans * 0.5f))) : 1.0f;
+
+    plan.monPanChannels = jmin(maxchans, plan.totalOutputChannels);
+    plan.monPanGain = plan.monPanChannels == 1 && plan.mainBusInputChannels > 0 ? (1.0f/std::max(1.0f, (float)(plan.mainBusInputChannels * 0.5f))): 1.0f;
+
+    for (int i=0; i < plan.numInputGroups; ++i) {
+        const auto & params = mInputChannelGroups[i].params;
+        auto & group = plan.inputGroups[i];
+        group.sendDestStart = params.panDestStartIndex;
+        group.sendDestCount = jmin(plan.sendPanChannels, params.panDestChannels);
+        group.monDestStart = params.monDestStartIndex;
+        group.monDestCount = jmin(plan.monPanChannels, params.monDestChannels);
+        group.monMuted = anyinputsoloed && !params.soloed;
+    }
+
+    plan.metSendDestStart = mMetChannelGroup.params.panDestStartIndex;
+    plan.metSendDestCount = jmin(plan.sendPanChannels, mMetChannelGroup.params.panDestChannels);
+    plan.fileSendDestStart = mFilePlaybackChannelGroup.params.panDestStartIndex;
+    plan.fileSendDestCount = jmin(plan.sendPanChannels, mFilePlaybackChannelGroup.params.panDestChannels);
+
+    plan.inReverbEnabled = inreverb;
+}
+
+// called from the send thread and prepareToPlay(), publishes the plan for the audio thread if it changed
+void SonobusAudioProcessor::updateMixPlan()
+{
+    mNeedsMixPlanUpdate = false;
+
+    MixPlan plan;
+    buildMixPlan(plan, mFileSourceChannels.get());
+
+    // groups can get more than 2 channels from places that don't create their
+    // multichannel effects (e.g. the file playback), so catch them here
+    for (int i = 0; i < plan.numInputGroups; ++i) {
+        mInputChannelGroups[i].prepareMultichannelEffects();
+    }
+    mFilePlaybackChannelGroup.prepareMultichannelEffects();
+    mRecFilePlaybackChannelGroup.prepareMultichannelEffects();
+
+    bool anysoloed = mMainMonitorSolo.get();
+    {
+        const ScopedReadLock sl (mCoreLock);
+        for (auto & remote : mRemotePeers) {
+            anysoloed = anysoloed || remote->soloed;
+
+            bool anysubsolo = false;
+            for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
+                anysubsolo = anysubsolo || remote->chanGroups[cgi].params.soloed;
+                remote->chanGroups[cgi].prepareMultichannelEffects();
+            }
+            remote->anySubSoloed = anysubsolo;
+        }
+    }
+    plan.anySoloed = anysoloed;
+
+    const ScopedLock sl (mMixPlanLock);
+    if (plan != mPublishedMixPlan) {
+        mPublishedMixPlan = plan;
+        ++mMixPlanVersion;
+    }
+}
+
+
+struct SonobusAudioProcessor::PeerRecvContext
+{
+    SonobusAudioProcessor & processor;
+    const Array<RemotePeer*> & peers;
+    AudioBuffer<float> & buffer;
+    int numSamples;
+    uint64_t t;
+    bool anysoloed;
+    bool canWriteTracks;
+    int mainBusOutputChannels;
+};
+
+void SonobusAudioProcessor::processPeerReceiveJob(void * context, int index)
+{
+    // worker threads don't inherit the audio thread's denormal setting
+    ScopedNoDenormals noDenormals;
+    tRealtimeThread = true;
+    auto ctx = static_cast<PeerRecvContext*>(context);
+    ctx->processor.processPeerReceive(*ctx, index);
+}
+
+// receive, record and apply effects for one peer, everything except mixing it into the output.
+// called from the audio thread or one of the worker pool threads, with ctx.peers being the audio thread's peer snapshot
+void SonobusAudioProcessor::processPeerReceive(PeerRecvContext & ctx, int rindex)
+{
+    auto remote = ctx.peers.getUnchecked(rindex);
+
+    remote->_mixSkip = true;
+
+    if (!remote->oursink) { 
+        return;
+    }
+
+    auto & buffer = ctx.buffer;
+    const int numSamples = ctx.numSamples;
+    const int mainBusOutputChannels = ctx.mainBusOutputChannels;
+    const uint64_t t = ctx.t;
+    const bool anysoloed = ctx.anysoloed;
+
+    // just in case, should be exceedingly rare this is necessary
+    if (remote->workBuffer.getNumSamples() < currSamplesPerBlock
+        || remote->recvChannels > remote->workBuffer.getNumChannels()
+        || mainBusOutputChannels > remote->workBuffer.getNumChannels()) {
+        remote->workBuffer.setSize(jmax(2, jmax(mainBusOutputChannels, remote->recvChannels)), currSamplesPerBlock, false, false, true);
+    }
+
+    remote->workBuffer.clear(0, numSamples);
+
+    // calculate fill ratio before processing the sink
+    float retratio = 0.0f;
+    EndpointState * recvendpoint = nullptr;
+    int32_t recvsourceid = AOO_ID_NONE;
+    getRemotePeerRecvSource(remote, recvendpoint, recvsourceid);
+    if (remote->oursink->get_sourceoption(recvendpoint, recvsourceid, aoo_opt_buffer_fill_ratio, &retratio, sizeof(retratio)) > 0) {
+        remote->fillRatio.Z *= 0.95;
+        remote->fillRatio.push(retratio);
+        remote->fillRatioSlow.Z *= 0.99;
+        remote->fillRatioSlow.push(retratio);
+    }
+
+    
+    {
+        // get audio data coming in from outside into tempbuf
+        const ScopedReadLock sl (remote->sinkLock); // not contended, should be able to get rid of
+
+        // just in case, should be exceedingly rare this is necessary
+        if (remote->workBuffer.getNumSamples() < currSamplesPerBlock
+            || remote->recvChannels > remote->workBuffer.getNumChannels()
+            || mainBusOutputChannels > remote->workBuffer.getNumChannels()) {
+            remote->workBuffer.setSize(jmax(2, jmax(mainBusOutputChannels, remote->recvChannels)), currSamplesPerBlock, false, false, true);
+        }
+
+        remote->workBuffer.clear(0, numSamples);
+
+        remote->oursink->process((float **)remote->workBuffer.getArrayOfWritePointers(), numSamples, t);
+    }
+
+    
+    // record individual tracks pre-compressor/level/pan, ignoring muting/solo, raw material
+
+    if (ctx.canWriteTracks) {
+        // the writer lock is held by the audio thread for us
+        if (remote->fileWriter)
+        {
+            float *tmpbuf[MAX_PANNERS];
+            int numchan = remote->fileWriter->getWriter()->getNumChannels();
+            for (int i = 0; i < numchan && i < MAX_PANNERS; ++i) {
+                if (i < remote->recvChannels) {
+                    tmpbuf[i] = remote->workBuffer.getWritePointer(i);
+                }
+                else {
+                    tmpbuf[i] = silentBuffer.getWritePointer(0);
+                }
+            }
+            remote->fileWriter->write (tmpbuf, numSamples);
+        }
     }
-    int fileplaychans = mCurrentAudioFileSource ? mCurrentAudioFileSource->getAudioFormatReader()->numChannels : 2;
-    int fileplaymaxchans = jmax(maxchans, fileplaychans);
-    if (mSendPlaybackAudio.get()) {
-        // plus a possible file sending
-        totsendchans += fileplaychans;
+
+    // write out per-user output bus
+    if (remote->recvActive && remote->recvChannels > 0) {
+        if (auto userbus = getBus(false, OutUserBaseBusIndex + rindex)) {
+            if (userbus->isEnabled()) {
+                int index = getChannelIndexInProcessBlockBuffer(false, OutUserBaseBusIndex + rindex, 0);
+                int cnt = getChannelCountOfBus(false, OutUserBaseBusIndex + rindex);
+                for (int i=0; i < cnt; ++i) {
+                    if (i < remote->recvChannels) {
+                        buffer.copyFrom(index+i, 0, remote->workBuffer, i, 0, numSamples);
+                    }
+                    else {
+                        // it should already be clear
+                        //buffer.clear(index+i, 0, numSamples);
+                    }
+                }
+            }
+        }
     }
 
-    meterRmsWindow = getSampleRate() * METER_RMS_SEC / currSamplesPerBlock;
+    
+    // apply effects
 
-    int soundboardplaychans = soundboardChannelProcessor->getFileSourceNumberOfChannels();
+    float usegain = remote->gain;
+    bool wasSilent = false;
 
-    soundboardChannelProcessor->ensureBuffers(numSamples, maxchans, meterRmsWindow);
+    bool forceSilent = false;
 
-    if (mSendSoundboardAudio.get()) {
-        // plus a possible soundboard sending
-        totsendchans += soundboardplaychans;
+    // we get the stuff, but ignore it (either muted or others soloed)
+    if (!remote->recvActive || (anysoloed && !remote->soloed) || remote->resetSafetyMuted) {
+
+        usegain = 0.0f;
+        forceSilent = true;
+
+        if (remote->_lastgain <= 0.0f) {
+            wasSilent = true;
+        }
     }
 
-    bool needpeersendupdate = false;
-    if (mActiveSendChannels != totsendchans) {
-        mActiveSendChannels = totsendchans;
-        needpeersendupdate = true;
+    for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
+        remote->chanGroups[cgi].processBlock(remote->workBuffer, remote->workBuffer, remote->chanGroups[cgi].params.chanStartIndex,  remote->chanGroups[cgi].params.numChannels, silentBuffer, numSamples, usegain);
     }
 
-    int realsendchans = mSendChannels.get() <= 0 ? totsendchans : mSendChannels.get();
+    remote->_lastgain = usegain;
 
 
-    mActiveInputChannels = selfrecchans;
+    remote->recvMeterSource.measureBlock (remote->workBuffer, 0, numSamples);
 
-    if (sendMeterSource.getNumChannels() < realsendchans) {
-        sendMeterSource.resize (realsendchans, meterRmsWindow);
+    for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
+        float redlev = 1.0f;
+        if (remote->chanGroups[cgi].params.compressorParams.enabled && remote->chanGroups[cgi].compressorOutputLevel) {
+            redlev = jlimit(0.0f, 1.0f, Decibels::decibelsToGain(*remote->chanGroups[cgi].compressorOutputLevel));
+        }
+        for (auto j=0; j < remote->chanGroups[cgi].params.numChannels; ++j) {
+            int ch = remote->chanGroups[cgi].params.chanStartIndex + j;
+            remote->recvMeterSource.setReductionLevel(ch, redlev);
+        }
     }
 
-    if (filePlaybackMeterSource.getNumChannels() < fileplaychans) {
-        filePlaybackMeterSource.resize (fileplaychans, meterRmsWindow);
-    }
+    remote->_mixGain = usegain;
+    remote->_mixSkip = wasSilent;
+}
 
+// compile the patch matrix and the pans into the send mixer's gains,
+// called from the send thread with the core read lock held
+void SonobusAudioProcessor::updateSendMixer()
+{
+    const auto & peers = mRemotePeers;
 
-    auto maxworkbufchans = jmax(maxchans, totsendchans);
+    mSendMixer.beginUpdate();
 
-    if (tempBuffer.getNumSamples() < numSamples || tempBuffer.getNumChannels() < maxchans) {
-        tempBuffer.setSize(maxchans, numSamples, false, false, true);
-    }
-    if (mixBuffer.getNumSamples() < numSamples || mixBuffer.getNumChannels() < maxchans) {
-        mixBuffer.setSize(maxchans, numSamples, false, false, true);
+    for (int i=0; i < peers.size() && i < MAX_PEERS; ++i) {
+        mSendMixer.setKey(i, peers.getUnchecked(i)->sendMixKey);
     }
-    if (workBuffer.getNumSamples() < numSamples || workBuffer.getNumChannels() != maxworkbufchans) {
 
-        // only grow the work buffer channel count
-        if (maxworkbufchans > workBuffer.getNumChannels() || workBuffer.getNumSamples() < numSamples) {
-            workBuffer.setSize(maxworkbufchans, numSamples, false, false, true);
+    for (int i=0; i < peers.size() && i < MAX_PEERS; ++i) {
+        auto remote = peers.getUnchecked(i);
+
+        // if it sends what another peer's source encodes, there's no need to mix for it
+        if (!remote->oursource || remote->sharingEncoder.get()) continue;
+
+        bool anyrouted = false;
+        for (int j=0; j < peers.size() && j < MAX_PEERS && !anyrouted; ++j) {
+            anyrouted = mRemoteSendMatrix[j][i];
         }
+        if (!anyrouted) continue;
 
-        needpeersendupdate = true;
-    }
-    if (inputBuffer.getNumSamples() < numSamples || inputBuffer.getNumChannels() != maxchans) {
-        inputBuffer.setSize(maxchans, numSamples, false, false, true);
-    }
-    if (monitorBuffer.getNumSamples() < numSamples || monitorBuffer.getNumChannels() != maxchans) {
-        monitorBuffer.setSize(maxchans, numSamples, false, false, true);
-    }
-    if (sendWorkBuffer.getNumSamples() < numSamples || sendWorkBuffer.getNumChannels() != maxworkbufchans) {
-        sendWorkBuffer.setSize(maxworkbufchans, numSamples, false, false, true);
-    }
-    if (inputPostBuffer.getNumSamples() < numSamples || inputPostBuffer.getNumChannels() != totsendchans) {
-        inputPostBuffer.setSize(totsendchans, numSamples, false, false, true);
-        inputPreBuffer.setSize(totsendchans, numSamples, false, false, true);
-    }
-    if (fileBuffer.getNumSamples() < numSamples || fileBuffer.getNumChannels() != fileplaymaxchans) {
-        fileBuffer.setSize(fileplaymaxchans, numSamples, false, false, true);
-    }
-    if (metBuffer.getNumSamples() < numSamples || metBuffer.getNumChannels() != maxchans) {
-        metBuffer.setSize(maxchans, numSamples, false, false, true);
-    }
-    if (mainFxBuffer.getNumSamples() < numSamples || mainFxBuffer.getNumChannels() != maxchans) {
-        mainFxBuffer.setSize(maxchans, numSamples, false, false, true);
-    }
-    if (inputRevBuffer.getNumSamples() < numSamples || inputRevBuffer.getNumChannels() != maxchans) {
-        inputRevBuffer.setSize(maxchans, numSamples, false, false, true);
-    }
-    if (silentBuffer.getNumSamples() < numSamples) {
-        silentBuffer.setSize(1, numSamples, false, false, true);
-        silentBuffer.clear();
-    }
+        // the mixer limits it to the channels it has room for
+        const int sendchans = remote->sendChannels;
+        mSendMixer.addDestination(i, sendchans);
 
-    if (needpeersendupdate) {
-        const ScopedReadLock sl (mCoreLock);
-        // could be -1 as index meaning all remote peers
-        for (int i=0; i < mRemotePeers.size(); ++i) {
-            RemotePeer * remote = mRemotePeers.getUnchecked(i);
-            updateRemotePeerSendChannels(i, remote);
+        for (int j=0; j < peers.size() && j < MAX_PEERS; ++j) {
+            if (!mRemoteSendMatrix[j][i]) continue;
+            auto crossremote = peers.getUnchecked(j);
+
+            for (int channel = 0; channel < sendchans; ++channel) {
+                if (crossremote->recvChannels > 0 && remote->sendChannels > 1) {
+                    for (int ch=0; ch < crossremote->recvChannels; ++ch) {
+                        const float pan = crossremote->recvChannels == 2 ? crossremote->recvStereoPan[ch] : crossremote->recvPan[ch];
+
+                        // apply pan law
+                        // -1 is left, 1 is right
+                        const float pgain = channel == 0 ? (pan >= 0.0f ? (1.0f - pan) : 1.0f) : (pan >= 0.0f ? 1.0f : (1.0f+pan));
+                        mSendMixer.setGain(channel, j, ch, pgain);
+                    }
+                }
+                else {
+                    mSendMixer.setGain(channel, j, channel, 1.0f);
+                }
+            }
         }
     }
 
-    mTempBufferSamples = jmax(mTempBufferSamples, numSamples);
-    mTempBufferChannels = jmax(maxchans, mTempBufferChannels);
+    mSendMixer.endUpdate();
 }
 
-
 void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
 {
     ScopedNoDenormals noDenormals;
+    tRealtimeThread = true;
     auto totalInputChannels  = getTotalNumInputChannels();
     auto mainBusInputChannels  = getMainBusNumInputChannels();
     auto mainBusOutputChannels = getMainBusNumOutputChannels();
@@ -7249,11 +9421,6 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     float inmonPan1 = mInMonPan1.get();
     float inmonPan2 = mInMonPan2.get();
 
-    int sendChans = mSendChannels.get();
-    bool sendfileaudio = mSendPlaybackAudio.get();
-    bool sendsoundboardaudio = mSendSoundboardAudio.get();
-    bool sendmet = mSendMet.get();
-
     bool userwritingpossible = userWritingPossible.load();
     bool writingpossible = writingPossible.load();
 
@@ -7282,33 +9449,30 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     }
 
 
-    int totsendchans = 0;
-    for (auto i = 0; i < mInputChannelGroupCount && i < MAX_CHANGROUPS; ++i)
-    {
-        totsendchans += mInputChannelGroups[i].params.numChannels;
-    }
-    // plus a possible metronome send
-    if (sendmet) {
-        totsendchans += 1;
-    }
-    if (sendfileaudio) {
-        // plus a possible file sending
-        totsendchans += mCurrentAudioFileSource ? mCurrentAudioFileSource->getAudioFormatReader()->numChannels : 2;
-    }
-    if (sendsoundboardaudio) {
-        // plus a possible soundboard sending
-        totsendchans += soundboardChannelProcessor->getFileSourceNumberOfChannels();
+    // pick up the routing if it was resolved again
+    if (mMixPlanVersion.get() != mAudioMixPlanVersion) {
+        const ScopedTryLock sl (mMixPlanLock);
+        if (sl.isLocked()) {
+            mAudioMixPlan = mPublishedMixPlan;
+            mAudioMixPlanVersion = mMixPlanVersion.get();
+        }
     }
-
-    int realsendchans = sendChans <= 0 ? totsendchans :sendChans;
-
+    auto & plan = mAudioMixPlan;
 
     // THIS SHOULDN"T GENERALLY HAPPEN, it should have been taken care of in prepareToPlay, but just in case.
     // I know this isn't RT safe. UGLY... bad... badness.
-    if (numSamples > mTempBufferSamples || maxchans > mTempBufferChannels || inputPostBuffer.getNumChannels() != totsendchans || inputPostBuffer.getNumSamples() < numSamples  || sendMeterSource.getNumChannels() < realsendchans) {
+    if (numSamples > mTempBufferSamples || maxchans > mTempBufferChannels || inputPostBuffer.getNumChannels() != plan.totalSendChannels || inputPostBuffer.getNumSamples() < numSamples  || sendMeterSource.getNumChannels() < plan.realSendChannels) {
         ensureBuffers(numSamples);
     }
 
+    // the plan can lag a change by a block, if it doesn't fit the buffers anymore resolve it here
+    if (inputPostBuffer.getNumChannels() != plan.totalSendChannels
+        || plan.totalInputChannels != totalInputChannels
+        || plan.totalOutputChannels != totalOutputChannels
+        || plan.mainBusInputChannels != mainBusInputChannels) {
+        buildMixPlan(plan, mCurrentAudioFileSource ? mCurrentAudioFileSource->getAudioFormatReader()->numChannels : 2);
+    }
+
     double useBpm = mMetTempo.get();
     bool syncmethost = mSyncMetToHost.get();
     bool syncmetplayback = mSyncMetStartToPlayback.get();
@@ -7369,15 +9533,7 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         inputPreBuffer.clear(0, numSamples);
     }
 
-    bool inReverbEnabled = false;
-    for (auto i = 0; i < mInputChannelGroupCount && i < MAX_CHANGROUPS; ++i)
-    {
-        if (mInputChannelGroups[i].params.inReverbSend > 0.0f) {
-            inReverbEnabled = true;
-            break;
-        }
-    }
-
+    bool inReverbEnabled = plan.inReverbEnabled;
     bool doinreverb = inReverbEnabled || mLastInputReverbEnabled;
     int revfxchannels = 2;
 
@@ -7387,24 +9543,22 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
 
     // Input Gain and FX processing
-    int destch = 0;
-    for (auto i = 0; i < mInputChannelGroupCount && i < MAX_CHANGROUPS; ++i)
+    for (auto i = 0; i < plan.numInputGroups; ++i)
     {
+        const auto & group = plan.inputGroups[i];
         auto * revbuf = doinreverb ? &inputRevBuffer : nullptr;
 
-        mInputChannelGroups[i].processBlock(buffer, inputPostBuffer, destch, mInputChannelGroups[i].params.numChannels, silentBuffer, numSamples, inGain,
+        mInputChannelGroups[i].processBlock(buffer, inputPostBuffer, group.srcStart, group.numChannels, silentBuffer, numSamples, inGain,
                                             nullptr, revbuf, 0, revfxchannels, inReverbEnabled);
 
         if (writingpossible && mRecordInputPreFX) {
             // copy input as-is for later recording
-            for (int ch = 0; ch < mInputChannelGroups[i].params.numChannels; ++ch) {
+            for (int ch = 0; ch < group.numChannels; ++ch) {
                 int usech = mInputChannelGroups[i].params.chanStartIndex + ch;
                 const auto * srcbuf = usech < buffer.getNumChannels() ? buffer.getReadPointer(usech) : silentBuffer.getReadPointer(0);
-                inputPreBuffer.copyFrom(destch + ch, 0, srcbuf, numSamples);
+                inputPreBuffer.copyFrom(group.srcStart + ch, 0, srcbuf, numSamples);
             }
         }
-
-        destch += mInputChannelGroups[i].params.numChannels;
     }
 
 
@@ -7412,48 +9566,36 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
 
     // compressor makeup meter level per channel
-    destch = 0;
-    for (auto i = 0; i < mInputChannelGroupCount && i < MAX_CHANGROUPS; ++i) {
+    for (auto i = 0; i < plan.numInputGroups; ++i) {
         float redlev = 1.0f;
         if (mInputChannelGroups[i].params.compressorParams.enabled && mInputChannelGroups[i].compressorOutputLevel) {
             redlev = jlimit(0.0f, 1.0f, Decibels::decibelsToGain(*mInputChannelGroups[i].compressorOutputLevel));
         }
-        for (auto j=0; j < mInputChannelGroups[i].params.numChannels; ++j) {
+        for (auto j=0; j < plan.inputGroups[i].numChannels; ++j) {
             //int ch = mInputChannelGroups[i].chanStartIndex + j;
-            int ch = destch + j;
+            int ch = plan.inputGroups[i].srcStart + j;
             postinputMeterSource.setReductionLevel(ch, redlev);
         }
-        destch += mInputChannelGroups[i].params.numChannels;
     }
     
     
     // do the input panning before everything else
-    int sendCh = mSendChannels.get();
-    //int sendPanChannels = sendCh == 0 ?  inputBuffer.getNumChannels() : jmin(inputBuffer.getNumChannels(), jmax(mainBusOutputChannels, sendCh));
-    int sendPanChannels = sendCh == 0 ?  inputPostBuffer.getNumChannels() : jmin(sendWorkBuffer.getNumChannels(), sendCh);
-    //int panChannels = jmin(inputBuffer.getNumChannels(), jmax(mainBusOutputChannels, sendCh));
-    // if sending as mono, split the difference about applying gain attentuation for the number of input channels
-    float tgain = sendPanChannels == 1 && inputPostBuffer.getNumChannels() > 0 ? (1.0f/std::max(1.0f, (float)(inputPostBuffer.getNumChannels() * 0.5f))) : 1.0f;
+    int sendCh = plan.sendChannels;
+    int sendPanChannels = plan.sendPanChannels;
 
     sendWorkBuffer.clear(0, numSamples);
 
-    if (sendPanChannels > 2 || sendCh == 0) {
+    if (plan.sendStraight) {
         // copy straight-thru
         for (auto i = 0; i < sendWorkBuffer.getNumChannels() && i < inputPostBuffer.getNumChannels(); ++i) {
             sendWorkBuffer.copyFrom (i, 0, inputPostBuffer, i, 0, numSamples);
         }
     }
     else {
-        int srcstart = 0;
-
-        for (auto i = 0; i < mInputChannelGroupCount && i < MAX_CHANGROUPS; ++i)
+        for (auto i = 0; i < plan.numInputGroups; ++i)
         {
-            // change dest ch target
-            int dstch = mInputChannelGroups[i].params.panDestStartIndex;  // todo change dest ch target
-            int dstcnt = jmin(sendPanChannels, mInputChannelGroups[i].params.panDestChannels);
-
-            mInputChannelGroups[i].processPan(inputPostBuffer, srcstart, sendWorkBuffer, dstch, dstcnt, numSamples, tgain);
-            srcstart += mInputChannelGroups[i].params.numChannels;
+            const auto & group = plan.inputGroups[i];
+            mInputChannelGroups[i].processPan(inputPostBuffer, group.srcStart, sendWorkBuffer, group.sendDestStart, group.sendDestCount, numSamples, plan.sendPanGain);
         }
     }
 
@@ -7469,37 +9611,19 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     // handle what's going to be monitored
     inputBuffer.clear(0, numSamples);
 
-    bool anyinputsoloed = false;
-    for (auto i = 0; i < mInputChannelGroupCount; ++i) {
-        if (mInputChannelGroups[i].params.soloed) {
-            anyinputsoloed = true;
-            break;
-        }
-    }
-
-    int monPanChannels = jmin(inputBuffer.getNumChannels(), totalOutputChannels);
-    float tmgain = monPanChannels == 1 && mainBusInputChannels > 0 ? (1.0f/std::max(1.0f, (float)(mainBusInputChannels * 0.5f))): 1.0f;
-    int srcstart = 0;
-    for (auto i = 0; i < mInputChannelGroupCount; ++i)
+    for (auto i = 0; i < plan.numInputGroups; ++i)
     {
-        float utmgain = anyinputsoloed && !mInputChannelGroups[i].params.soloed ? 0.0f : tmgain;
-        int dstch = mInputChannelGroups[i].params.monDestStartIndex;
-        int dstcnt = jmin(monPanChannels, mInputChannelGroups[i].params.monDestChannels);
+        const auto & group = plan.inputGroups[i];
+        float utmgain = group.monMuted ? 0.0f : plan.monPanGain;
 
         auto * revbuffer = doreverb ? &mainFxBuffer : nullptr;
 
-        mInputChannelGroups[i].processMonitor(inputPostBuffer, srcstart,
-                                              inputBuffer, dstch, dstcnt,
+        mInputChannelGroups[i].processMonitor(inputPostBuffer, group.srcStart,
+                                              inputBuffer, group.monDestStart, group.monDestCount,
                                               numSamples, utmgain, nullptr, 
                                               revbuffer, 0, fxchannels, mainReverbEnabled, drynow);
-
-        srcstart += mInputChannelGroups[i].params.numChannels;
     }
 
-    // for multichannel send, met and file playback and soundboard follow the last input channel
-    auto metstartch = srcstart;
-    auto filestartch = sendmet ? metstartch + 1 : srcstart;
-
     // write out self-only output bus XXXX FIXME
     /*
     if (auto selfbus = getBus(false, OutSelfBusIndex)) {
@@ -7536,7 +9660,7 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         mRecFilePlaybackChannelGroup.params.numChannels = srcchans;
         mRecFilePlaybackChannelGroup.commitMonitorDelayParams(); // need to do this too
 
-        if (sendfileaudio) {
+        if (plan.sendFile) {
 
             //add to main buffer for going out, mix as appropriate depending on how many channels being sent
             if (sendPanChannels == 1) {
@@ -7556,7 +9680,7 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
                 // copy straight-thru
                 // find file channels TODO
-                auto filech = filestartch; // XXX
+                auto filech = plan.fileStartChannel;
                 //sendWorkBuffer.addFrom (filech, 0, fileBuffer, 0, 0, numSamples);
                 auto fgain = mFilePlaybackChannelGroup.params.gain;
                 auto lastfgain = _lastfplaygain;
@@ -7570,12 +9694,9 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
                 _lastfplaygain = fgain;
             }
             else if (sendPanChannels == 2) {
-                // change dest ch target
-                int dstch = mFilePlaybackChannelGroup.params.panDestStartIndex;  // todo change dest ch target
-                int dstcnt = jmin(sendPanChannels, mFilePlaybackChannelGroup.params.panDestChannels);
                 auto fgain = mFilePlaybackChannelGroup.params.gain;
 
-                mFilePlaybackChannelGroup.processPan(fileBuffer, 0, sendWorkBuffer, dstch, dstcnt, numSamples, fgain);
+                mFilePlaybackChannelGroup.processPan(fileBuffer, 0, sendWorkBuffer, plan.fileSendDestStart, plan.fileSendDestCount, numSamples, fgain);
 
                 _lastfplaygain = fgain;
             }
@@ -7584,9 +9705,8 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     }
 
     bool hassoundboarddata = soundboardChannelProcessor->processAudioBlock(numSamples);
-    if (hassoundboarddata && sendsoundboardaudio) {
-        int startChannel = sendfileaudio ? filestartch + fileChannels : filestartch;
-        soundboardChannelProcessor->sendAudioBlock(sendWorkBuffer, numSamples, sendPanChannels, startChannel);
+    if (hassoundboarddata && plan.sendSoundboard) {
+        soundboardChannelProcessor->sendAudioBlock(sendWorkBuffer, numSamples, sendPanChannels, plan.soundboardStartChannel);
     }
 
     // process metronome
@@ -7632,20 +9752,14 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
         metMeterSource.measureBlock(metBuffer);
 
-        if (sendmet) {
+        if (plan.sendMet) {
 
             if (sendPanChannels > 2) {
                 // copy straight-thru
-                // find Met channel TODO
-                int metch = metstartch;
-                sendWorkBuffer.addFrom (metch, 0, metBuffer, 0, 0, numSamples);
+                sendWorkBuffer.addFrom (plan.metStartChannel, 0, metBuffer, 0, 0, numSamples);
             }
             else {
-                // change dest ch target
-                int dstch = mMetChannelGroup.params.panDestStartIndex;  // todo change dest ch target
-                int dstcnt = jmin(sendPanChannels, mMetChannelGroup.params.panDestChannels);
-
-                mMetChannelGroup.processPan(metBuffer, 0, sendWorkBuffer, dstch, dstcnt, numSamples, 1.0f);
+                mMetChannelGroup.processPan(metBuffer, 0, sendWorkBuffer, plan.metSendDestStart, plan.metSendDestCount, numSamples, 1.0f);
             }
 
 
@@ -7691,169 +9805,51 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
 
     bool hearlatencytest = mHearLatencyTest.get();
 
-    bool anysoloed = mMainMonitorSolo.get();
+    bool anysoloed = plan.anySoloed;
 
 
     // push data for going out
     {
-        const ScopedReadLock sl (mCoreLock);        
+        // no core lock here, the peers in the snapshot stay valid until mPeerReadsDone is incremented
+        ++mPeerReadsStarted;
+        const auto * snapshot = mPeerSnapshot.get();
+        const auto & peers = snapshot->peers;
         
         //mAooSource->process( buffer.getArrayOfReadPointers(), numSamples, t);
         
-        for (auto & remote : mRemotePeers) 
-        {
-            if (remote->soloed) {
-                anysoloed = true;
-                break;
-            }
-        }
-        
         tempBuffer.clear(0, numSamples);
         
-        int rindex = 0;
-        
-        for (auto & remote : mRemotePeers) 
-        {
-            
-            if (!remote->oursink) { 
-                ++rindex;
-                continue;                
-            }
-
-            // just in case, should be exceedingly rare this is necessary
-            if (remote->workBuffer.getNumSamples() < currSamplesPerBlock
-                || remote->recvChannels > remote->workBuffer.getNumChannels()
-                || mainBusOutputChannels > remote->workBuffer.getNumChannels()) {
-                remote->workBuffer.setSize(jmax(2, jmax(mainBusOutputChannels, remote->recvChannels)), currSamplesPerBlock, false, false, true);
-            }
-
-            remote->workBuffer.clear(0, numSamples);
-
-            // calculate fill ratio before processing the sink
-            float retratio = 0.0f;
-            if (remote->oursink->get_sourceoption(remote->endpoint, remote->remoteSourceId, aoo_opt_buffer_fill_ratio, &retratio, sizeof(retratio)) > 0) {
-                remote->fillRatio.Z *= 0.95;
-                remote->fillRatio.push(retratio);
-                remote->fillRatioSlow.Z *= 0.99;
-                remote->fillRatioSlow.push(retratio);
-            }
-
-            
-            {
-                // get audio data coming in from outside into tempbuf
-                const ScopedReadLock sl (remote->sinkLock); // not contended, should be able to get rid of
-
-                // just in case, should be exceedingly rare this is necessary
-                if (remote->workBuffer.getNumSamples() < currSamplesPerBlock
-                    || remote->recvChannels > remote->workBuffer.getNumChannels()
-                    || mainBusOutputChannels > remote->workBuffer.getNumChannels()) {
-                    remote->workBuffer.setSize(jmax(2, jmax(mainBusOutputChannels, remote->recvChannels)), currSamplesPerBlock, false, false, true);
-                }
-
-                remote->workBuffer.clear(0, numSamples);
-
-                remote->oursink->process((float **)remote->workBuffer.getArrayOfWritePointers(), numSamples, t);
-            }
-
-            
-            // record individual tracks pre-compressor/level/pan, ignoring muting/solo, raw material
-
-            if (userwritingpossible) {
-                const ScopedTryLock sl (writerLock);
-                if (sl.isLocked() && remote->fileWriter)
-                {
-                    float *tmpbuf[MAX_PANNERS];
-                    int numchan = remote->fileWriter->getWriter()->getNumChannels();
-                    for (int i = 0; i < numchan && i < MAX_PANNERS; ++i) {
-                        if (i < remote->recvChannels) {
-                            tmpbuf[i] = remote->workBuffer.getWritePointer(i);
-                        }
-                        else {
-                            tmpbuf[i] = silentBuffer.getWritePointer(0);
-                        }
-                    }
-                    remote->fileWriter->write (tmpbuf, numSamples);
-                }
-            }
-
-            // write out per-user output bus
-            if (remote->recvActive && remote->recvChannels > 0) {
-                if (auto userbus = getBus(false, OutUserBaseBusIndex + rindex)) {
-                    if (userbus->isEnabled()) {
-                        int index = getChannelIndexInProcessBlockBuffer(false, OutUserBaseBusIndex + rindex, 0);
-                        int cnt = getChannelCountOfBus(false, OutUserBaseBusIndex + rindex);
-                        for (int i=0; i < cnt; ++i) {
-                            if (i < remote->recvChannels) {
-                                buffer.copyFrom(index+i, 0, remote->workBuffer, i, 0, numSamples);
-                            }
-                            else {
-                                // it should already be clear
-                                //buffer.clear(index+i, 0, numSamples);
-                            }
-                        }
-                    }
-                }
-            }
-
-            
-            // apply effects
-
-            float usegain = remote->gain;
-            bool wasSilent = false;
-
-            bool forceSilent = false;
-
-            // we get the stuff, but ignore it (either muted or others soloed)
-            if (!remote->recvActive || (anysoloed && !remote->soloed) || remote->resetSafetyMuted) {
-
-                usegain = 0.0f;
-                forceSilent = true;
-
-                if (remote->_lastgain <= 0.0f) {
-                    wasSilent = true;
-                }
-            }
-
-            bool anysubsolo = false;
-            for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
-                if (remote->chanGroups[cgi].params.soloed) {
-                    anysubsolo = true;
-                    break;
-                }
-            }
-
-            for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
-                remote->chanGroups[cgi].processBlock(remote->workBuffer, remote->workBuffer, remote->chanGroups[cgi].params.chanStartIndex,  remote->chanGroups[cgi].params.numChannels, silentBuffer, numSamples, usegain);
-            }
+        // per-peer receive processing is independent until the final mix,
+        // so it can be fanned out to the worker pool
+        PeerRecvContext rctx { *this, peers, buffer, numSamples, t, anysoloed, false, mainBusOutputChannels };
 
-            remote->_lastgain = usegain;
+        const ScopedTryLock wsl (writerLock);
+        rctx.canWriteTracks = userwritingpossible && wsl.isLocked();
 
-
-            remote->recvMeterSource.measureBlock (remote->workBuffer, 0, numSamples);
-
-            for (auto cgi = 0; cgi < remote->numChanGroups; ++cgi) {
-                float redlev = 1.0f;
-                if (remote->chanGroups[cgi].params.compressorParams.enabled && remote->chanGroups[cgi].compressorOutputLevel) {
-                    redlev = jlimit(0.0f, 1.0f, Decibels::decibelsToGain(*remote->chanGroups[cgi].compressorOutputLevel));
-                }
-                for (auto j=0; j < remote->chanGroups[cgi].params.numChannels; ++j) {
-                    int ch = remote->chanGroups[cgi].params.chanStartIndex + j;
-                    remote->recvMeterSource.setReductionLevel(ch, redlev);
-                }
+        const int numpeers = peers.size();
+        if (mParallelPeerProcessing.get() && mWorkerPool.isRunning() && numpeers > 1) {
+            // a worker that hasn't started its peer within a quarter block leaves it to us
+            mWorkerPool.run(&SonobusAudioProcessor::processPeerReceiveJob, &rctx, numpeers, 0.25 * numSamples / getSampleRate());
+        }
+        else {
+            for (int rindex = 0; rindex < numpeers; ++rindex) {
+                processPeerReceive(rctx, rindex);
             }
+        }
 
-            ++rindex;
-            
-            if (wasSilent) continue; // can skip the rest, already fully muted/absent
+        // now mix them down in peer order, so the result doesn't depend on the scheduling
+        for (auto & remote : peers) 
+        {
+            if (!remote->oursink || remote->_mixSkip) continue; // already fully muted/absent
             
             float tgain = mainBusOutputChannels == 1 && remote->recvChannels > 0 ? 1.0f/(float)remote->recvChannels : 1.0f;
-            tgain *= usegain; // handles main solo
+            tgain *= remote->_mixGain; // handles main solo
 
 
             for (auto i = 0; i < remote->numChanGroups; ++i)
             {
                 // apply solo muting to the gain here
-                float adjgain = anysubsolo && !remote->chanGroups[i].params.soloed ? 0.0f : tgain;
+                float adjgain = remote->anySubSoloed && !remote->chanGroups[i].params.soloed ? 0.0f : tgain;
                 // todo change dest ch target
                 int dstch = remote->chanGroups[i].params.panDestStartIndex;
                 int dstcnt = jmin(totalOutputChannels, remote->chanGroups[i].params.panDestChannels);
@@ -7870,60 +9866,44 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
         
         
         // send out final outputs
+
+        // the cross-routing the send thread compiled last, it finds the peers by key even if
+        // the snapshot changed since. the ones it doesn't know get the plain send mix until it catches up
+        mSendMixer.usePublishedPlan();
+        const bool crossrouted = mSendMixer.canProcess(numSamples);
+
+        // then mix every peer that has others routed to it in one go
+        if (crossrouted) {
+            for (int j=0; j < peers.size(); ++j) {
+                auto crossremote = peers.getUnchecked(j);
+                mSendMixer.setSource(j, crossremote->sendMixKey, crossremote->workBuffer.getArrayOfReadPointers(), crossremote->workBuffer.getNumChannels());
+            }
+            mSendMixer.process(sendWorkBuffer.getArrayOfReadPointers(), sendWorkBuffer.getNumChannels(), numSamples);
+        }
+
         int i=0;
-        for (auto & remote : mRemotePeers) 
+        for (auto & remote : peers) 
         {
             if (remote->oursource /*&& remote->sendActive */) {
 
-                workBuffer.clear(0, numSamples);
-
-                int sendchans = jmin(workBuffer.getNumChannels(), remote->sendChannels);
+                auto * crossmix = crossrouted ? mSendMixer.getOutput(i, remote->sendMixKey) : nullptr;
 
-                for (int channel = 0; channel < remote->sendChannels && channel < sendWorkBuffer.getNumChannels() && channel < workBuffer.getNumChannels() ; ++channel) {
-                    workBuffer.addFrom(channel, 0, sendWorkBuffer, channel, 0, numSamples);
+                if (crossmix) {
+                    remote->oursource->process((const float **)crossmix, numSamples, t);
                 }
+                else {
+                    workBuffer.clear(0, numSamples);
 
-                // now add any cross-routed input
-                int j=0;
-                for (auto & crossremote : mRemotePeers) 
-                {
-                    if (mRemoteSendMatrix[j][i]) {
-                        for (int channel = 0; channel < remote->sendChannels; ++channel) {
-
-                            // now apply panning
-
-                            if (crossremote->recvChannels > 0 && remote->sendChannels > 1) {
-                                for (int ch=0; ch < crossremote->recvChannels; ++ch) {
-                                    const float pan = crossremote->recvChannels == 2 ? crossremote->recvStereoPan[ch] : crossremote->recvPan[ch];
-                                    const float lastpan = crossremote->recvPanLast[ch];
-                                    
-                                    // apply pan law
-                                    // -1 is left, 1 is right
-                                    float pgain = channel == 0 ? (pan >= 0.0f ? (1.0f - pan) : 1.0f) : (pan >= 0.0f ? 1.0f : (1.0f+pan)) ;
-
-                                    if (pan != lastpan) {
-                                        float plastgain = channel == 0 ? (lastpan >= 0.0f ? (1.0f - lastpan) : 1.0f) : (lastpan >= 0.0f ? 1.0f : (1.0f+lastpan));
-                                        
-                                        workBuffer.addFromWithRamp(channel, 0, crossremote->workBuffer.getReadPointer(ch), numSamples, plastgain, pgain);
-                                    } else {
-                                        workBuffer.addFrom (channel, 0, crossremote->workBuffer, ch, 0, numSamples, pgain);                            
-                                    }
+                    // if it sends what another peer's source encodes, there's no need to mix for it
+                    const bool domix = !remote->sharingEncoder.get();
 
-                                    //remote->recvPanLast[ch] = pan;
-                                }
-                            } else {
-                                
-                                workBuffer.addFrom(channel, 0, crossremote->workBuffer, channel, 0, numSamples);
-                            }
-                            
-                        }                        
-                    }                    
-                    ++j;
+                    for (int channel = 0; domix && channel < remote->sendChannels && channel < sendWorkBuffer.getNumChannels() && channel < workBuffer.getNumChannels() ; ++channel) {
+                        workBuffer.addFrom(channel, 0, sendWorkBuffer, channel, 0, numSamples);
+                    }
+
+                    remote->oursource->process((const float **)workBuffer.getArrayOfReadPointers(), numSamples, t);
                 }
                 
-                
-                remote->oursource->process((const float **)workBuffer.getArrayOfReadPointers(), numSamples, t);
-                
                 //remote->sendMeterSource.measureBlock (workBuffer);
                 
                 
@@ -7967,8 +9947,43 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
             ++i;
         }
 
+        // and once more for the relay, silence while sending is muted keeps the relayed streams up
+        if (mRelaySourceActive.get()) {
+            workBuffer.clear(0, numSamples);
+
+            for (int channel = 0; !mMainSendMute.get() && channel < mRelaySendChannels && channel < sendWorkBuffer.getNumChannels() && channel < workBuffer.getNumChannels(); ++channel) {
+                workBuffer.addFrom(channel, 0, sendWorkBuffer, channel, 0, numSamples);
+            }
+
+            mRelaySource->process((const float **)workBuffer.getArrayOfReadPointers(), numSamples, t);
+        }
+
+        // and for the MCU, whose mix of the others joins the peer mix (unless someone is soloed)
+        if (mMcuActive.get()) {
+            workBuffer.clear(0, numSamples);
+
+            for (int channel = 0; !mMainSendMute.get() && channel < mMcuSendChannels && channel < sendWorkBuffer.getNumChannels() && channel < workBuffer.getNumChannels(); ++channel) {
+                workBuffer.addFrom(channel, 0, sendWorkBuffer, channel, 0, numSamples);
+            }
+
+            mMcuSource->process((const float **)workBuffer.getArrayOfReadPointers(), numSamples, t);
+
+            mcuBuffer.clear(0, numSamples);
+            if (mMcuSink->process((float **)mcuBuffer.getArrayOfWritePointers(), numSamples, t) && !anysoloed) {
+                if (totalOutputChannels == 1) {
+                    tempBuffer.addFrom(0, 0, mcuBuffer, 0, 0, numSamples, 0.5f);
+                    tempBuffer.addFrom(0, 0, mcuBuffer, 1, 0, numSamples, 0.5f);
+                }
+                else {
+                    for (int channel = 0; channel < 2 && channel < totalOutputChannels; ++channel) {
+                        tempBuffer.addFrom(channel, 0, mcuBuffer, channel, 0, numSamples);
+                    }
+                }
+            }
+        }
+
         // update last state
-        for (auto & remote : mRemotePeers) 
+        for (auto & remote : peers) 
         {
             for (int i=0; i < remote->recvChannels; ++i) {
                 const float pan = remote->recvChannels == 2 ? remote->recvStereoPan[i] : remote->recvPan[i];
@@ -7976,8 +9991,8 @@ void SonobusAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
                 remote->recvPanLast[i] = pan;
             }
         }
-        
-        // end scoped lock
+
+        ++mPeerReadsDone;
     }
 
 
@@ -8435,7 +10450,16 @@ void SonobusAudioProcessor::getStateInformationWithOptions(MemoryBlock& destData
     extraTree.setProperty(lastWindowWidthKey, var((int)mPluginWindowWidth), nullptr);
     extraTree.setProperty(lastWindowHeightKey, var((int)mPluginWindowHeight), nullptr);
     extraTree.setProperty(autoresizeDropRateThreshKey, var((float)mAutoresizeDropRateThresh), nullptr);
+    extraTree.setProperty(statNetBufPercentileKey, var((float)mStatNetBufPercentile.get()), nullptr);
     extraTree.setProperty(reconnectServerLossKey, mReconnectAfterServerLoss.get(), nullptr);
+    {
+        const ScopedLock rl (mRelayLock);
+        extraTree.setProperty(relayGroupsKey, mRelayGroups.joinIntoString("\n"), nullptr);
+    }
+    {
+        const ScopedLock ml (mMcuLock);
+        extraTree.setProperty(mcuGroupsKey, mMcuGroups.joinIntoString("\n"), nullptr);
+    }
 
     extraTree.appendChild(mVideoLinkInfo.getValueTree(), nullptr);
     
@@ -8599,9 +10623,21 @@ void SonobusAudioProcessor::setStateInformationWithOptions (const void* data, in
                                                      extraTree.getProperty(lastWindowHeightKey, (int)mPluginWindowHeight)));
 
             setAutoresizeBufferDropRateThreshold(extraTree.getProperty(autoresizeDropRateThreshKey, (float)mAutoresizeDropRateThresh));
+            setStatisticalNetBufferPercentile(extraTree.getProperty(statNetBufPercentileKey, (float)mStatNetBufPercentile.get()));
 
             setReconnectAfterServerLoss(extraTree.getProperty(reconnectServerLossKey, mReconnectAfterServerLoss.get()));
 
+            {
+                const ScopedLock rl (mRelayLock);
+                mRelayGroups = StringArray::fromLines(extraTree.getProperty(relayGroupsKey, "").toString());
+                mRelayGroups.removeEmptyStrings();
+            }
+            {
+                const ScopedLock ml (mMcuLock);
+                mMcuGroups = StringArray::fromLines(extraTree.getProperty(mcuGroupsKey, "").toString());
+                mMcuGroups.removeEmptyStrings();
+            }
+
             
             ValueTree videoinfo = extraTree.getChildWithName(videoLinkInfoKey);
             if (videoinfo.isValid()) {
@@ -8621,6 +10657,7 @@ void SonobusAudioProcessor::setStateInformationWithOptions (const void* data, in
                     if (i >= MAX_CHANGROUPS) break;
                     
                     mInputChannelGroups[i].params.setFromValueTree(channelGroupTree);
+                    mInputChannelGroups[i].commitAllParams();
                     
                     ++i;
                 }
@@ -8656,6 +10693,8 @@ void SonobusAudioProcessor::setStateInformationWithOptions (const void* data, in
             }
         }
 
+        invalidateMixPlan();
+
         
         if (includecache) {
             loadPeerCacheFromState();
@@ -9484,6 +11523,8 @@ void SonobusAudioProcessor::clearTransportURL()
     mTransportSource.setSource (nullptr);
     mCurrentAudioFileSource.reset();
     mCurrTransportURL = URL();
+    mFileSourceChannels = 2;
+    invalidateMixPlan();
 }
 
 bool SonobusAudioProcessor::loadURLIntoTransport (const URL& audioURL)
@@ -9537,6 +11578,8 @@ bool SonobusAudioProcessor::loadURLIntoTransport (const URL& audioURL)
         mCurrTransportURL = URL(audioURL);
 
         mCurrentAudioFileSource.reset (new AudioFormatReaderSource (reader, true));
+        mFileSourceChannels = (int) reader->numChannels;
+        invalidateMixPlan();
 
         mTransportSource.prepareToPlay(currSamplesPerBlock, getSampleRate());
 
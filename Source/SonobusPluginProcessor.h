@@ -18,9 +18,12 @@
 #include "EffectParams.h"
 #include "ChannelGroup.h"
 
-#include "zitaRev.h"
+#include "FaustKernels.h"
 
 #include "SoundboardChannelProcessor.h"
+#include "RealtimeWorkerPool.h"
+#include "NetworkImpairment.h"
+#include "SendMatrixMixer.h"
 
 typedef MVerb<float> MVerbFloat;
 
@@ -28,9 +31,12 @@ namespace SonoAudio {
 class Metronome;
 }
 
+struct EndpointKey;
+
 
 #define MAX_PEERS 32
 #define MAX_CHANGROUPS 64
+#define MAX_PEER_DISPATCH_IDS 256
 #define DEFAULT_SERVER_PORT 10998
 #define DEFAULT_SERVER_HOST "aoo.sonobus.net"
 
@@ -124,7 +130,8 @@ public:
         AutoNetBufferModeOff = 0,
         AutoNetBufferModeAutoIncreaseOnly,
         AutoNetBufferModeAutoFull,        
-        AutoNetBufferModeInitAuto
+        AutoNetBufferModeInitAuto,
+        AutoNetBufferModeStatistical
     };
     
     enum AudioCodecFormatCodec { CodecPCM = 0, CodecOpus };
@@ -275,14 +282,20 @@ public:
     static String paramInputReverbPreDelay;
 
     struct EndpointState;
+    struct EndpointTable;
     struct RemoteSink;
     struct RemoteSource;
     struct RemotePeer;
+    struct RecvPacketArena;
+    struct SendPacketQueue;
 
     int32_t handleSourceEvents(const aoo_event ** events, int32_t n, int32_t sourceId);
     int32_t handleSinkEvents(const aoo_event ** events, int32_t n, int32_t sinkId);
     int32_t handleServerEvents(const aoo_event ** events, int32_t n);
     int32_t handleClientEvents(const aoo_event ** events, int32_t n);
+    // called by our aoo sources and sinks from any thread when they queue an event
+    // realtime: called from the audio thread, only flags the event instead of waking the event thread
+    void notifyEventQueued(int32_t aooId, bool realtime = false);
 
     // server stuff
     void startAooServer();
@@ -324,7 +337,35 @@ public:
     EndpointState * findOrAddRawEndpoint(void * rawaddr);
 
     int getUdpLocalPort() const { return mUdpLocalPort; }
+
+    // receive thread batching stats
+    float getRecvPacketsPerWakeup() const;
+    int getRecvMaxPacketsPerWakeup() const { return mRecvMaxPacketsPerWakeup.get(); }
+    void resetRecvBatchStats();
+    // simulated network impairment on everything received, for testing the jitter buffer
+    // and loss handling on a local network. an inactive setting turns it off
+    void setReceiveImpairment(const SonoAudio::NetworkImpairment::Settings & settings);
+    bool isReceiveImpairmentActive() const { return mRecvImpairmentActive.get(); }
+    SonoAudio::NetworkImpairment::Stats getReceiveImpairmentStats();
+    // time from an aoo object queueing an event until the event thread handles it
+    float getEventReactionTimeMs() const;
+    float getEventMaxReactionTimeMs() const;
+    void resetEventReactionStats();
     IPAddress getLocalIPAddress() const { return mLocalIPAddress; }
+
+    // number of threads decoding received audio, -1 scales with the number of
+    // receiving peers, 0 decodes right on the network receive thread
+    void setDecodeThreadCount(int count) { mDecodeThreadSetting = count; }
+    int getDecodeThreadCount() const { return mDecodeThreadSetting.get(); }
+    int getActiveDecodeThreadCount() const { return mActiveDecodeThreads.get(); }
+
+    // spread the per-peer receive processing in processBlock across a pool of realtime threads
+    void setParallelPeerProcessing(bool flag);
+    bool getParallelPeerProcessing() const { return mParallelPeerProcessing.get(); }
+
+    // share one encoder among peers receiving identical audio in an identical format
+    void setSharedEncodingEnabled(bool flag) { mSharedEncoding = flag; }
+    bool getSharedEncodingEnabled() const { return mSharedEncoding.get(); }
     
 
     int getSendChannels() const { return mSendChannels.get(); }
@@ -417,6 +458,12 @@ public:
     void setAutoresizeBufferDropRateThreshold(float);
     float getAutoresizeBufferDropRateThreshold() const { return mAutoresizeDropRateThresh; }
 
+    // arrival delay percentile the jitter buffer is sized to cover in Statistical mode
+    void setStatisticalNetBufferPercentile(float percentile);
+    float getStatisticalNetBufferPercentile() const { return mStatNetBufPercentile.get(); }
+
+    // arrival delay statistics of the peer's stream over the recent window, in ms (relative to the earliest packet)
+    bool getRemotePeerArrivalJitter(int index, float & retdelayms, float & retmedianms, float & retmaxms) const;
 
     bool getRemotePeerReceiveBufferFillRatio(int index, float & retratio, float & retstddev) const;
 
@@ -556,6 +603,10 @@ public:
     void setDefaultAudioCodecFormat(int formatIndex);
     int getDefaultAudioCodecFormat() const { return mDefaultAudioFormatIndex; }
 
+    // expected packet loss in percent for Opus in-band FEC, 0 disables it
+    void setOpusFecLossPercent(int percent);
+    int getOpusFecLossPercent() const { return mOpusFecLossPercent.get(); }
+
     void setChangingDefaultAudioCodecSetsExisting(bool flag) { mChangingDefaultAudioCodecChangesAll = flag; }
     bool getChangingDefaultAudioCodecSetsExisting() const { return mChangingDefaultAudioCodecChangesAll;}
 
@@ -759,6 +810,24 @@ public:
     bool getReconnectAfterServerLoss() const { return mReconnectAfterServerLoss.get(); }
     void setReconnectAfterServerLoss(bool flag) { mReconnectAfterServerLoss = flag; }
 
+    // use the server's stream relay in this group, if it has one: our send mix is
+    // published once to the server, and the other members' streams are received
+    // through it, falling back to the direct connection for any that fail. Takes
+    // effect the next time the group is joined.
+    bool getGroupRelayEnabled(const String & group) const;
+    void setGroupRelayEnabled(const String & group, bool flag);
+    bool isPublishingToRelay() const { return mRelaySourceActive.get(); }
+    bool getRemotePeerRelayed(int index);
+
+    // use the server's MCU in this group, if it has one: our send mix goes up once, and
+    // the other members on it come back as a single mix made on the server, with the
+    // levels and pans set for them here. Takes effect the next time the group is joined,
+    // and takes precedence over the relay.
+    bool getGroupMcuEnabled(const String & group) const;
+    void setGroupMcuEnabled(const String & group, bool flag);
+    bool isUsingMcu() const { return mMcuActive.get(); }
+    bool getRemotePeerMcuMixed(int index);
+
 
     PeerDisplayMode getPeerDisplayMode() const { return mPeerDisplayMode; }
     void setPeerDisplayMode(PeerDisplayMode mode) { mPeerDisplayMode = mode; }
@@ -840,8 +909,39 @@ private:
     void initializeAoo(int udpPort=0);
     void cleanupAoo();
     
+    EndpointState * addEndpoint(const EndpointKey & key, const void * rawaddr, const String & host, int port, std::unique_ptr<DatagramSocket::RemoteAddrInfo> peerinfo);
+
     void doReceiveData();
+    void processReceivedPackets(int count);
+    void releaseImpairedPackets();
+    int getImpairmentWaitMs(int maxms);
+    void rebuildPeerDispatchIndex();
+    void publishPeerSnapshot();
+    void retireRemotePeers(OwnedArray<RemotePeer> & peers);
+    void waitForPeerSnapshotReaders();
+    void reclaimRetiredPeers();
+    void dispatchAooPacket(EndpointState * endpoint, const char * buf, int32_t nbytes, int32_t type, int32_t id);
+    void dispatchNonAooPacket(EndpointState * endpoint, const char * buf, int32_t nbytes, int32_t type, bool isaoo);
+    struct PeerRecvContext;
+    static void processPeerReceiveJob(void * context, int index);
+    void processPeerReceive(PeerRecvContext & ctx, int rindex);
+    void updateSendMixer();
+
     void doSendData();
+    void updateSharedEncoders();
+    void detachSharedEncoders(RemotePeer * peer);
+    void doDecodeData(int workerIndex);
+    void updateDecodeThreads();
+    void notifyDecodeThreads();
+    void updateStatisticalNetBuffers();
+    void updateRelayedPeers(double nowtimems);
+    void fallBackFromRelay(RemotePeer * peer, double nowtimems);
+    void getRemotePeerRecvSource(RemotePeer * peer, EndpointState *& retendpoint, int32_t & retsourceid);
+    void setupRelaySource();
+    void stopRelaySource();
+    void updateMcuPeers(double nowtimems);
+    void setupMcu();
+    void stopMcu();
     void handleEvents();
 
     bool handleOtherMessage(EndpointState * endpoint, const char *msg, int32_t n);
@@ -903,6 +1003,92 @@ private:
 
     void ensureBuffers(int samples);
 
+    // the routing processBlock() used to derive on every callback from the input
+    // channel groups, the send settings and the solo states. It is resolved off the
+    // audio thread whenever one of those changes and copied by the audio thread.
+    // Only ints and floats, so a rebuilt plan can be compared with the published one.
+    struct MixPlan
+    {
+        struct InputGroup {
+            int srcStart = 0; // in inputPostBuffer
+            int numChannels = 0;
+            int sendDestStart = 0; // pan target in sendWorkBuffer, mono or stereo send only
+            int sendDestCount = 0;
+            int monDestStart = 0; // pan target in inputBuffer
+            int monDestCount = 0;
+            int monMuted = 0; // another input group is soloed
+
+            bool operator== (const InputGroup & o) const {
+                return srcStart == o.srcStart && numChannels == o.numChannels
+                    && sendDestStart == o.sendDestStart && sendDestCount == o.sendDestCount
+                    && monDestStart == o.monDestStart && monDestCount == o.monDestCount
+                    && monMuted == o.monMuted;
+            }
+        };
+
+        // the buses it was resolved for
+        int totalInputChannels = 0;
+        int totalOutputChannels = 0;
+        int mainBusInputChannels = 0;
+
+        int numInputGroups = 0;
+        int totalSendChannels = 0; // input groups plus met, file and soundboard
+        int realSendChannels = 0;
+        int sendChannels = 0; // the setting, 0 is all
+        int sendPanChannels = 0;
+        int sendStraight = 0; // copy the inputs through instead of panning them
+        float sendPanGain = 1.0f;
+        int monPanChannels = 0;
+        float monPanGain = 1.0f;
+
+        int sendMet = 0;
+        int sendFile = 0;
+        int sendSoundboard = 0;
+        int fileChannels = 2;
+        int metStartChannel = 0;
+        int fileStartChannel = 0;
+        int soundboardStartChannel = 0;
+        int metSendDestStart = 0;
+        int metSendDestCount = 0;
+        int fileSendDestStart = 0;
+        int fileSendDestCount = 0;
+
+        int inReverbEnabled = 0;
+        int anySoloed = 0; // main monitor or any peer
+
+        InputGroup inputGroups[MAX_CHANGROUPS];
+
+        // only the input groups in use count
+        bool operator== (const MixPlan & o) const {
+            if (totalInputChannels != o.totalInputChannels || totalOutputChannels != o.totalOutputChannels
+                || mainBusInputChannels != o.mainBusInputChannels
+                || numInputGroups != o.numInputGroups || totalSendChannels != o.totalSendChannels
+                || realSendChannels != o.realSendChannels || sendChannels != o.sendChannels
+                || sendPanChannels != o.sendPanChannels || sendStraight != o.sendStraight || sendPanGain != o.sendPanGain
+                || monPanChannels != o.monPanChannels || monPanGain != o.monPanGain
+                || sendMet != o.sendMet || sendFile != o.sendFile || sendSoundboard != o.sendSoundboard
+                || fileChannels != o.fileChannels || metStartChannel != o.metStartChannel
+                || fileStartChannel != o.fileStartChannel || soundboardStartChannel != o.soundboardStartChannel
+                || metSendDestStart != o.metSendDestStart || metSendDestCount != o.metSendDestCount
+                || fileSendDestStart != o.fileSendDestStart || fileSendDestCount != o.fileSendDestCount
+                || inReverbEnabled != o.inReverbEnabled || anySoloed != o.anySoloed) {
+                return false;
+            }
+            for (int i = 0; i < numInputGroups && i < MAX_CHANGROUPS; ++i) {
+                if (!(inputGroups[i] == o.inputGroups[i])) return false;
+            }
+            return true;
+        }
+        bool operator!= (const MixPlan & o) const { return !(*this == o); }
+    };
+
+    void buildMixPlan(MixPlan & plan, int fileChannels) const;
+    void updateMixPlan();
+    void invalidateMixPlan() {
+        mNeedsMixPlanUpdate = true;
+        notifySendThread();
+    }
+
     void commitCacheForPeer(RemotePeer * peer);
     bool findAndLoadCacheForPeer(RemotePeer * peer);
     
@@ -937,6 +1123,7 @@ private:
     AudioSampleBuffer mainFxBuffer;
     AudioSampleBuffer inputRevBuffer;
     AudioSampleBuffer silentBuffer; // only ever has one channel
+    AudioSampleBuffer mcuBuffer; // the MCU mix, always stereo
     int mTempBufferSamples = 0;
     int mTempBufferChannels = 0;
     
@@ -1011,6 +1198,9 @@ private:
     // above which it will adjust the jitter buffer in Auto modes
     float mAutoresizeDropRateThresh = 0.5f;
 
+    // percentile of the packet arrival delay that the Statistical mode sizes the jitter buffer for
+    Atomic<float> mStatNetBufPercentile { 99.5f };
+
     bool hasInitializedInMonPanners = false;
     
     int maxBlockSize = 4096;
@@ -1023,6 +1213,7 @@ private:
 
     int blocksizeCounter = -1;
     Atomic<bool> mNeedsSampleSetup  { false };
+    Atomic<int> mOpusFecLossPercent { 0 };
 
     float meterRmsWindow = 0.0f;
     
@@ -1060,6 +1251,31 @@ private:
     // AOO stuff
     aoo::isource::pointer mAooDummySource;
 
+    // our send mix published to the server's stream relay, lives as long as the dummy source
+    aoo::isource::pointer mRelaySource;
+    Atomic<bool> mRelaySourceActive { false };
+    Atomic<EndpointState*> mRelayEndpoint { nullptr };
+    int mRelaySendChannels = 0;
+    StringArray mRelayGroups;
+    // streams of the other members on the relay, by user name
+    std::map<String,int32_t> mRelayStreams;
+    CriticalSection mRelayLock;
+
+    // our send mix up to the server's MCU and the mix of the others on it back,
+    // live as long as the dummy source
+    aoo::isource::pointer mMcuSource;
+    aoo::isink::pointer mMcuSink;
+    Atomic<bool> mMcuActive { false };
+    Atomic<EndpointState*> mMcuEndpoint { nullptr };
+    int32_t mMcuId = AOO_ID_NONE;
+    int mMcuSendChannels = 0;
+    Atomic<bool> mMcuReceiving { false };
+    double mMcuLastInviteMs = 0;
+    StringArray mMcuGroups;
+    // the other members on the MCU, by user name
+    std::map<String,int32_t> mMcuParticipants;
+    CriticalSection mMcuLock;
+
     aoo::net::iserver::pointer mAooServer;
     aoo::net::iclient::pointer mAooClient;
 
@@ -1076,15 +1292,23 @@ private:
     Atomic<bool> mPendingUnmute {false}; // jlc
     uint32 mPendingUnmuteAtStamp = 0;
 
+    Atomic<bool> mSharedEncoding { true };
+    // held while regrouping, and by the setters while detaching peers and changing the matrix
+    CriticalSection mSharedEncoderLock;
+    double mLastPeerRebalanceMs = 0.0;
+
     // we will add sinks for any peer we invite, as part of a RemoteSource
     
     
     std::unique_ptr<DatagramSocket> mUdpSocket;
+    std::unique_ptr<RecvPacketArena> mRecvArena;
+    std::unique_ptr<SendPacketQueue> mSendQueue;
     int mUdpLocalPort;
     IPAddress mLocalIPAddress;
     
     class SendThread;
     class RecvThread;
+    class DecodeThread;
     class EventThread;
     class ServerThread;
     class ClientThread;
@@ -1095,9 +1319,25 @@ private:
     CriticalSection  mSourceFormatLock;
 
     OwnedArray<EndpointState> mEndpoints;
+    Atomic<EndpointTable*> mEndpointTable { nullptr };
+    OwnedArray<EndpointTable> mEndpointTables; // current and retired tables, freed in cleanupAoo
     
     OwnedArray<RemotePeer> mRemotePeers;
 
+    // receive dispatch index from ourId to peer, rebuilt with mCoreLock write lock held whenever mRemotePeers changes
+    RemotePeer * mPeerDispatchById[MAX_PEER_DISPATCH_IDS] = {};
+
+    // immutable copy of mRemotePeers for the audio thread, which reads it without taking mCoreLock.
+    // replaced snapshots and removed peers are retired and only freed (on the event thread) once
+    // every audio callback that could still see them has finished
+    struct PeerSnapshot;
+    struct RetiredPeers;
+    Atomic<PeerSnapshot*> mPeerSnapshot { nullptr };
+    Atomic<uint64> mPeerReadsStarted { 0 };
+    Atomic<uint64> mPeerReadsDone { 0 };
+    OwnedArray<RetiredPeers> mRetiredPeers;
+    CriticalSection mRetiredPeersLock;
+
 
     Array<AooServerConnectionInfo> mRecentConnectionInfos;
     CriticalSection  mRecentsLock;
@@ -1141,6 +1381,23 @@ private:
     void initFormats();
     
     bool mRemoteSendMatrix[MAX_PEERS][MAX_PEERS];
+
+    // the cross-routing, recompiled on the send thread whenever mSendRoutingVersion
+    // was bumped (matrix, peers, channel counts) and handed over to the audio thread
+    SonoAudio::SendMatrixMixer mSendMixer;
+    Atomic<int> mSendRoutingVersion { 0 };
+    int mSendMixerVersion = -1;
+    // for RemotePeer::sendMixKey, with the core write lock held
+    uint64 mLastSendMixKey = 0;
+
+    // published by updateMixPlan(), the audio thread keeps its own copy
+    MixPlan mPublishedMixPlan;
+    CriticalSection mMixPlanLock;
+    Atomic<int> mMixPlanVersion { 0 };
+    Atomic<bool> mNeedsMixPlanUpdate { true };
+    Atomic<int> mFileSourceChannels { 2 };
+    MixPlan mAudioMixPlan;
+    int mAudioMixPlanVersion = -1;
     
     
     void notifySendThread() {
@@ -1152,9 +1409,35 @@ private:
     Atomic<int>   mNeedSendSentinel  { 0 };
 
 
+    Atomic<int64>  mRecvWakeupCount { 0 };
+    Atomic<int64>  mRecvPacketCount { 0 };
+    Atomic<int>    mRecvMaxPacketsPerWakeup { 0 };
+
+    // only touched by the recv thread, except for setup under the lock
+    std::unique_ptr<SonoAudio::NetworkImpairment> mRecvImpairment;
+    CriticalSection mRecvImpairmentLock;
+    Atomic<bool>   mRecvImpairmentActive { false };
+
+    // the event thread sleeps on this until an aoo object queues an event.
+    // one bit per peer ourId with pending events, "other" for anything outside the index
+    WaitableEvent  mEventWaitable;
+    std::atomic<uint32> mPendingEventPeers[MAX_PEER_DISPATCH_IDS / 32] = {};
+    Atomic<bool>   mPendingEventOther { false };
+    std::atomic<bool> mEventPendingFromAudio { false };
+    Atomic<int64>  mEventSignalTicks { 0 };
+    Atomic<int64>  mEventWakeupCount { 0 };
+    Atomic<int64>  mEventReactionTicks { 0 };
+    Atomic<int64>  mEventMaxReactionTicks { 0 };
+
     std::unique_ptr<SendThread> mSendThread;
     std::unique_ptr<RecvThread> mRecvThread;
+    OwnedArray<DecodeThread> mDecodeThreads;
+    Atomic<int> mDecodeThreadSetting { -1 };
+    Atomic<int> mActiveDecodeThreads { 0 };
     std::unique_ptr<EventThread> mEventThread;
+
+    SonoAudio::RealtimeWorkerPool mWorkerPool;
+    Atomic<bool> mParallelPeerProcessing { false };
     std::unique_ptr<ServerThread> mServerThread;
     std::unique_ptr<ClientThread> mClientThread;
 
@@ -1167,7 +1450,7 @@ private:
     std::unique_ptr<Reverb> mMainReverb;
     Reverb::Parameters mMainReverbParams;
     MVerbFloat mMReverb;
-    zitaRev mZitaReverb;
+    SonoAudio::ReverbKernel mZitaReverb;
     MapUI  mZitaControl;
 
     ReverbModel mLastReverbModel = ReverbModelMVerb;
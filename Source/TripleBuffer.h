@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPLv3-or-later WITH Appstore-exception
+// Copyright (C) 2021 Jesse Chappell
+
+#pragma once
+
+#include <atomic>
+
+namespace SonoAudio {
+
+/*
+ Hands the latest value of T from a writer thread to the audio thread without
+ locks. There are three slots, the one the reader is using, the latest published
+ one and the one being written, so neither side ever waits for the other, and a
+ value the writer publishes twice while the reader is busy just replaces the
+ older one. Only one thread may write at a time.
+ */
+template <typename T>
+class TripleBuffer
+{
+public:
+    // writer side
+    T & getWriteSlot() { return slots[writeIndex]; }
+
+    void publish()
+    {
+        writeIndex = shared.exchange(writeIndex | newFlag, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // reader side, returns nullptr if nothing was published since the last call.
+    // the slot belongs to the reader until the next call that returns a new one
+    T * getNewValue()
+    {
+        if ((shared.load(std::memory_order_relaxed) & newFlag) == 0) return nullptr;
+        readIndex = shared.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        return &slots[readIndex];
+    }
+
+private:
+    static constexpr int indexMask = 3;
+    static constexpr int newFlag = 4;
+
+    T slots[3];
+    int writeIndex = 0;
+    std::atomic<int> shared { 1 };
+    int readIndex = 2;
+};
+
+}
@@ -98,6 +98,21 @@ extern "C"
  #define AOO_RESEND_MAXNUMFRAMES 16
 #endif
 
+// number of most recent blocks used for the arrival jitter statistics
+#ifndef AOO_JITTER_WINDOW
+ #define AOO_JITTER_WINDOW 2048
+#endif
+
+// default percentile of the arrival delay reported in aoo_jitter_stats
+#ifndef AOO_JITTER_PERCENTILE
+ #define AOO_JITTER_PERCENTILE 99.5
+#endif
+
+// default resampler quality (aoo_resample_quality)
+#ifndef AOO_RESAMPLE_QUALITY
+ #define AOO_RESAMPLE_QUALITY AOO_RESAMPLE_MEDIUM
+#endif
+
 // initialize AoO library - call only once!
 AOO_API void aoo_initialize(void);
 
@@ -358,12 +373,78 @@ typedef enum aoo_option
     // For sources, send an optional userformat blob along with the format messages
     // ---
     // Could be used for any purpose (channel layouts, labels, etc)
-    aoo_opt_userformat
+    aoo_opt_userformat,
+    // For sources, share the encoder of another source (aoo_source *, or NULL to stop sharing)
+    // ---
+    // The source stops encoding its own input and instead sends the blocks encoded
+    // by the given source, using its own salt, sequence numbers and resend history.
+    // Both sources must have the same format, otherwise setting it fails.
+    // The source stops following if the format of either source changes.
+    aoo_opt_encode_leader,
+    // For sinks, defer decoding of received blocks (int32_t)
+    // ---
+    // If > 0, handle_message() only reassembles the incoming blocks
+    // and the actual decoding is done in aoo_sink_decode(), which
+    // can be called from one or more separate decoder threads.
+    aoo_opt_deferred_decode,
+    // Event notification (aoo_event_notify)
+    // ---
+    // The function is called whenever an event has been queued, so events
+    // can be handled on demand instead of polling events_available().
+    // It is called on whatever thread queued the event (possibly the audio thread),
+    // so it must return quickly and must not call back into the source/sink.
+    // Set it before the source/sink is in use.
+    aoo_opt_event_notify,
+    // For sinks, the percentile of the arrival delay reported in aoo_jitter_stats (float)
+    // ---
+    // Defaults to AOO_JITTER_PERCENTILE.
+    aoo_opt_jitter_percentile,
+    // Arrival jitter statistics (aoo_jitter_stats)
+    // ---
+    // This is a read-only option used for sink::get_sourceoption().
+    // The sink timestamps every new block and compares it against its nominal
+    // arrival time (sequence number * block duration), over the last AOO_JITTER_WINDOW blocks.
+    aoo_opt_jitter_stats,
+    // For sinks, resize the source buffers by time-stretching (int32_t)
+    // ---
+    // If > 0, changing aoo_opt_buffersize doesn't reset the source buffers.
+    // Instead the sink gradually drops or repeats pitch periods of the
+    // queued audio until the buffer has reached its new size, and it
+    // does the same to bring the buffer back after it has been
+    // filled up or drained by network jitter.
+    aoo_opt_time_stretch,
+    // Resampler quality (aoo_resample_quality)
+    // ---
+    // Used for samplerate conversion and for following the clock drift
+    // (see aoo_opt_dynamic_resampling). Higher settings use longer filters.
+    // Defaults to AOO_RESAMPLE_QUALITY.
+    aoo_opt_resample_quality
 } aoo_option;
 
+typedef enum aoo_resample_quality
+{
+    // linear interpolation (cheapest, but aliases)
+    AOO_RESAMPLE_LINEAR,
+    // windowed sinc, 32 taps
+    AOO_RESAMPLE_MEDIUM,
+    // windowed sinc, 64 taps
+    AOO_RESAMPLE_HIGH
+} aoo_resample_quality;
+
 #define AOO_ARG(x) &x, sizeof(x)
 #define AOO_ARG_NULL 0, 0
 
+typedef struct aoo_jitter_stats
+{
+    // arrival delays relative to the earliest block in the window (in ms)
+    float delay_ms; // at the requested percentile
+    float median_ms;
+    float max_ms;
+    float percentile;
+    float block_ms; // duration of one source block
+    int32_t count; // number of blocks in the window
+} aoo_jitter_stats;
+
 /*//////////////////// AoO source /////////////////////*/
 
 #ifdef __cplusplus
@@ -560,6 +641,9 @@ AOO_API int32_t aoo_sink_handle_message(aoo_sink *sink, const char *data, int32_
 // send outgoing messages - will call the reply function (threadsafe, but not reentrant)
 AOO_API int32_t aoo_sink_send(aoo_sink *sink);
 
+// decode received blocks when aoo_opt_deferred_decode is set (always threadsafe)
+AOO_API int32_t aoo_sink_decode(aoo_sink *sink);
+
 // process audio (threadsafe, but not reentrant)
 AOO_API int32_t aoo_sink_process(aoo_sink *sink, aoo_sample **data,
                                  int32_t nsamples, uint64_t t);
@@ -698,6 +782,13 @@ typedef int32_t (*aoo_codec_decode)(
 
 typedef int32_t (*aoo_codec_reset)(void *) ;
 
+// Recover the block *preceding* the given input bytes from any
+// forward error correction data they contain, with the same
+// arguments as aoo_codec_decode. Returns the number of samples per
+// channel, or a negative error code. Codecs which don't have FEC
+// leave this NULL, and the sink just conceals the missing block.
+typedef aoo_codec_decode aoo_codec_decode_fec;
+
 
 typedef struct aoo_codec
 {
@@ -719,6 +810,7 @@ typedef struct aoo_codec
     aoo_codec_readformat decoder_readformat;
     aoo_codec_decode decoder_decode;
     aoo_codec_reset decoder_reset;
+    aoo_codec_decode_fec decoder_decode_fec; // optional
 } aoo_codec;
 
 // register an external codec plugin
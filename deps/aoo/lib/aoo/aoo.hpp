@@ -123,6 +123,14 @@ public:
         return get_option(aoo_opt_dynamic_resampling, AOO_ARG(n));
     }
 
+    int32_t set_resample_quality(int32_t q){
+        return set_option(aoo_opt_resample_quality, AOO_ARG(q));
+    }
+
+    int32_t get_resample_quality(int32_t& q){
+        return get_option(aoo_opt_resample_quality, AOO_ARG(q));
+    }
+
     int32_t set_timefilter_bandwidth(float f){
         return set_option(aoo_opt_timefilter_bandwidth, AOO_ARG(f));
     }
@@ -171,6 +179,24 @@ public:
         return set_option(aoo_opt_userformat, ufmt, size);
     }
 
+    // share the encoded stream of another source (nullptr to stop)
+    int32_t set_encode_leader(isource * leader){
+        return set_option(aoo_opt_encode_leader, AOO_ARG(leader));
+    }
+
+    int32_t get_encode_leader(isource *& leader){
+        return get_option(aoo_opt_encode_leader, AOO_ARG(leader));
+    }
+
+    int32_t set_event_notify(aoo_eventnotifyfn fn, void *user){
+        aoo_event_notify n { fn, user };
+        return set_option(aoo_opt_event_notify, AOO_ARG(n));
+    }
+
+    int32_t get_event_notify(aoo_event_notify& n){
+        return get_option(aoo_opt_event_notify, AOO_ARG(n));
+    }
+
 
     virtual int32_t set_option(int32_t opt, void *ptr, int32_t size) = 0;
     virtual int32_t get_option(int32_t opt, void *ptr, int32_t size) = 0;
@@ -240,6 +266,9 @@ public:
     // send outgoing messages - will call the reply function (threadsafe, but not reentrant)
     virtual int32_t send() = 0;
 
+    // decode received blocks when deferred decoding is enabled (always threadsafe)
+    virtual int32_t decode() = 0;
+
     // process audio (threadsafe, but not reentrant)
     virtual int32_t process(aoo_sample **data, int32_t nsamples, uint64_t t) = 0;
 
@@ -281,6 +310,14 @@ public:
         return get_option(aoo_opt_dynamic_resampling, AOO_ARG(n));
     }
 
+    int32_t set_resample_quality(int32_t q){
+        return set_option(aoo_opt_resample_quality, AOO_ARG(q));
+    }
+
+    int32_t get_resample_quality(int32_t& q){
+        return get_option(aoo_opt_resample_quality, AOO_ARG(q));
+    }
+
     int32_t set_timefilter_bandwidth(float f){
         return set_option(aoo_opt_timefilter_bandwidth, AOO_ARG(f));
     }
@@ -321,6 +358,39 @@ public:
         return get_option(aoo_opt_resend_maxnumframes, AOO_ARG(n));
     }
 
+    int32_t set_jitter_percentile(float p){
+        return set_option(aoo_opt_jitter_percentile, AOO_ARG(p));
+    }
+
+    int32_t get_jitter_percentile(float& p){
+        return get_option(aoo_opt_jitter_percentile, AOO_ARG(p));
+    }
+
+    int32_t set_time_stretch(int32_t n){
+        return set_option(aoo_opt_time_stretch, AOO_ARG(n));
+    }
+
+    int32_t get_time_stretch(int32_t& n){
+        return get_option(aoo_opt_time_stretch, AOO_ARG(n));
+    }
+
+    int32_t set_deferred_decode(int32_t n){
+        return set_option(aoo_opt_deferred_decode, AOO_ARG(n));
+    }
+
+    int32_t get_deferred_decode(int32_t& n){
+        return get_option(aoo_opt_deferred_decode, AOO_ARG(n));
+    }
+
+    int32_t set_event_notify(aoo_eventnotifyfn fn, void *user){
+        aoo_event_notify n { fn, user };
+        return set_option(aoo_opt_event_notify, AOO_ARG(n));
+    }
+
+    int32_t get_event_notify(aoo_event_notify& n){
+        return get_option(aoo_opt_event_notify, AOO_ARG(n));
+    }
+
     virtual int32_t set_option(int32_t opt, void *ptr, int32_t size) = 0;
     virtual int32_t get_option(int32_t opt, void *ptr, int32_t size) = 0;
 
@@ -335,6 +405,10 @@ public:
         return get_sourceoption(endpoint, id, aoo_opt_format, AOO_ARG(f));
     }
 
+    int32_t get_source_jitter_stats(void *endpoint, int32_t id, aoo_jitter_stats& stats){
+        return get_sourceoption(endpoint, id, aoo_opt_jitter_stats, AOO_ARG(stats));
+    }
+
     virtual int32_t request_source_codec_change(void *endpoint, int32_t id, aoo_format & f) = 0;
     
     virtual int32_t set_sourceoption(void *endpoint, int32_t id,
@@ -77,6 +77,21 @@ extern "C"
 #define AOONET_MSG_LEAVE "/leave"
 #define AOONET_MSG_LEAVE_LEN 6
 
+#define AOONET_MSG_RELAY "/relay"
+#define AOONET_MSG_RELAY_LEN 6
+
+#define AOONET_MSG_PUBLISH "/publish"
+#define AOONET_MSG_PUBLISH_LEN 8
+
+#define AOONET_MSG_UNPUBLISH "/unpublish"
+#define AOONET_MSG_UNPUBLISH_LEN 10
+
+#define AOONET_MSG_MCU "/mcu"
+#define AOONET_MSG_MCU_LEN 4
+
+#define AOONET_MSG_GAIN "/gain"
+#define AOONET_MSG_GAIN_LEN 5
+
 typedef enum aoonet_type
 {
     AOO_TYPE_SERVER = 1000,
@@ -105,6 +120,12 @@ typedef enum aoonet_event_type
     AOONET_CLIENT_PEER_JOIN_EVENT,
     AOONET_CLIENT_PEER_JOINFAIL_EVENT,
     AOONET_CLIENT_PEER_LEAVE_EVENT,
+    AOONET_CLIENT_RELAY_PUBLISH_EVENT,
+    AOONET_CLIENT_RELAY_STREAM_ADD_EVENT,
+    AOONET_CLIENT_RELAY_STREAM_DEL_EVENT,
+    AOONET_CLIENT_MCU_JOIN_EVENT,
+    AOONET_CLIENT_MCU_ADD_EVENT,
+    AOONET_CLIENT_MCU_DEL_EVENT,
     // server events
     AOONET_SERVER_ERROR_EVENT = 1000,
     AOONET_SERVER_PING_EVENT,
@@ -160,6 +181,26 @@ typedef struct aoonet_client_peer_event
     int32_t length;
 } aoonet_client_peer_event;
 
+// reply to aoonet_client_relay_publish() (no user), or a stream of
+// another group member that became available on the relay or went away
+typedef struct aoonet_client_relay_event
+{
+    AOONET_REPLY_EVENT
+    const char *group;
+    const char *user;
+    int32_t stream;
+} aoonet_client_relay_event;
+
+// reply to aoonet_client_mcu_join() (no user), or another group
+// member that started or stopped using the MCU
+typedef struct aoonet_client_mcu_event
+{
+    AOONET_REPLY_EVENT
+    const char *group;
+    const char *user;
+    int32_t id;
+} aoonet_client_mcu_event;
+
 
 /*///////////////////////// AOO server /////////////////////////*/
 
@@ -177,6 +218,11 @@ typedef struct aoonet_server aoonet_server;
 // create a new AOO server instance, listening on the given port
 AOO_API aoonet_server * aoonet_server_new(int port, int32_t *err);
 
+// same, but with 'nthreads' threads that share the client connections
+// and the UDP requests between them (Linux only, elsewhere and with 0
+// everything runs on the thread that calls aoonet_server_run)
+AOO_API aoonet_server * aoonet_server_new_threaded(int port, int32_t nthreads, int32_t *err);
+
 // destroy AOO server instance
 AOO_API void aoonet_server_free(aoonet_server *server);
 
@@ -194,6 +240,16 @@ AOO_API int32_t aoonet_server_events_available(aoonet_server *server);
 AOO_API int32_t aoonet_server_handle_events(aoonet_server *server,
                                             aoo_eventhandler fn, void *user);
 
+// enable the stream relay (before aoonet_server_run). Group members can then
+// publish their stream once to the server, which forwards the data packets
+// to the other members that subscribed to it, see aoonet_client_relay_publish().
+AOO_API int32_t aoonet_server_set_relay(aoonet_server *server, int32_t enable);
+
+// enable the MCU (before aoonet_server_run). Group members can then send their
+// stream to the server and get back a single mix of everyone else in the group,
+// see aoonet_client_mcu_join().
+AOO_API int32_t aoonet_server_set_mcu(aoonet_server *server, int32_t enable);
+
 // LATER add methods to add/remove users and groups
 // and set/get server options, group options and user options
 
@@ -241,6 +297,31 @@ AOO_API int32_t aoonet_client_group_leave(aoonet_client *client, const char *gro
 // leave an AOO group
 AOO_API int32_t aoonet_client_group_watch_public(aoonet_client *client, bool watch);
 
+// ask the server for a relay stream in a group we have joined. The reply is an
+// AOONET_CLIENT_RELAY_PUBLISH_EVENT with the stream ID, an AoO source then sends
+// to the server's UDP endpoint with that ID as the sink ID. The other members get
+// an AOONET_CLIENT_RELAY_STREAM_ADD_EVENT and subscribe by inviting the source
+// with the stream ID at the server's UDP endpoint.
+AOO_API int32_t aoonet_client_relay_publish(aoonet_client *client, const char *group);
+
+// remove our relay stream from a group
+AOO_API int32_t aoonet_client_relay_unpublish(aoonet_client *client, const char *group);
+
+// ask the server to mix a group we have joined for us. The reply is an
+// AOONET_CLIENT_MCU_JOIN_EVENT with our participant ID: an AoO source sends our
+// stream to the server's UDP endpoint with that ID as the sink ID, and an AoO sink
+// invites the source with that ID there to receive the mix of the others.
+// The other members get an AOONET_CLIENT_MCU_ADD_EVENT, so they know that
+// we don't need their stream anymore.
+AOO_API int32_t aoonet_client_mcu_join(aoonet_client *client, const char *group);
+
+// stop using the MCU in a group
+AOO_API int32_t aoonet_client_mcu_leave(aoonet_client *client, const char *group);
+
+// set the gain and pan (-1 to 1) of another member in our mix
+AOO_API int32_t aoonet_client_mcu_set_gain(aoonet_client *client, const char *group,
+                                           const char *user, float gain, float pan);
+
 // handle messages from peers (threadsafe, but not reentrant)
 // 'addr' should be sockaddr *
 AOO_API int32_t aoonet_client_handle_message(aoonet_client *client,
@@ -42,8 +42,8 @@ public:
     // smart pointer for AoO source instance
     using pointer = std::unique_ptr<iserver, deleter>;
 
-    // create a new AoO source instance
-    static iserver * create(int port, int32_t *err);
+    // create a new AoO server instance, see aoonet_server_new_threaded() for 'nthreads'
+    static iserver * create(int port, int32_t *err, int32_t nthreads = 0);
 
     // destroy the AoO source instance
     static void destroy(iserver *server);
@@ -70,12 +70,24 @@ public:
     // get number of currently active users
     virtual int32_t get_user_count() const = 0;
 
+    // enable the stream relay, see aoonet_server_set_relay()
+    virtual int32_t set_relay(bool enable) = 0;
+
+    // get number of currently published relay streams
+    virtual int32_t get_relay_stream_count() const = 0;
+
+    // enable the MCU, see aoonet_server_set_mcu()
+    virtual int32_t set_mcu(bool enable) = 0;
+
+    // get number of users that get their mix from the MCU
+    virtual int32_t get_mcu_participant_count() const = 0;
+
 protected:
     ~iserver(){} // non-virtual!
 };
 
-inline iserver * iserver::create(int port, int32_t *err){
-    return aoonet_server_new(port, err);
+inline iserver * iserver::create(int port, int32_t *err, int32_t nthreads){
+    return aoonet_server_new_threaded(port, nthreads, err);
 }
 
 inline void iserver::destroy(iserver *server){
@@ -123,6 +135,20 @@ public:
     // register interest in public groups
     virtual int32_t group_watch_public(bool watch) = 0;
 
+    // publish/remove our relay stream in a group, see aoonet_client_relay_publish()
+    virtual int32_t relay_publish(const char *group) = 0;
+
+    virtual int32_t relay_unpublish(const char *group) = 0;
+
+    // join/leave the MCU mix of a group, see aoonet_client_mcu_join()
+    virtual int32_t mcu_join(const char *group) = 0;
+
+    virtual int32_t mcu_leave(const char *group) = 0;
+
+    // gain and pan of another member in our mix
+    virtual int32_t mcu_set_gain(const char *group, const char *user,
+                                 float gain, float pan) = 0;
+
     // handle messages from peers (threadsafe, but not reentrant)
     // 'addr' should be sockaddr *
     virtual int32_t handle_message(const char *data, int32_t n, void *addr) = 0;
@@ -24,6 +24,7 @@ typedef struct aoo_format_opus
     int32_t complexity; // 0: default
     int32_t signal_type;
     int32_t application_type; 
+    int32_t fec_loss_percent; // 0: no in-band FEC, otherwise the expected packet loss in %
 } aoo_format_opus;
 
 AOO_API void aoo_codec_opus_setup(aoo_codec_registerfn fn);
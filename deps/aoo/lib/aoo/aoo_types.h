@@ -72,6 +72,18 @@ typedef int32_t (*aoo_eventhandler)(
         int32_t n           // number of events
 );
 
+// event notification function, called right after an event has been queued
+typedef void (*aoo_eventnotifyfn)(
+        void *,             // user
+        int32_t             // id of the source/sink
+);
+
+typedef struct aoo_event_notify
+{
+    aoo_eventnotifyfn fn; // NULL: no notification
+    void *user;
+} aoo_event_notify;
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -39,6 +39,21 @@
 #define AOONET_MSG_SERVER_GROUP_PUBLIC \
     AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_GROUP AOONET_MSG_PUBLIC
 
+#define AOONET_MSG_SERVER_RELAY_PUBLISH \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_RELAY AOONET_MSG_PUBLISH
+
+#define AOONET_MSG_SERVER_RELAY_UNPUBLISH \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_RELAY AOONET_MSG_UNPUBLISH
+
+#define AOONET_MSG_SERVER_MCU_JOIN \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_MCU AOONET_MSG_JOIN
+
+#define AOONET_MSG_SERVER_MCU_LEAVE \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_MCU AOONET_MSG_LEAVE
+
+#define AOONET_MSG_SERVER_MCU_GAIN \
+    AOO_MSG_DOMAIN AOONET_MSG_SERVER AOONET_MSG_MCU AOONET_MSG_GAIN
+
 
 #define AOONET_MSG_GROUP_JOIN \
     AOONET_MSG_GROUP AOONET_MSG_JOIN
@@ -58,6 +73,24 @@
 #define AOONET_MSG_GROUP_PUBLIC_DEL \
     AOONET_MSG_GROUP AOONET_MSG_PUBLIC AOONET_MSG_DEL
 
+#define AOONET_MSG_RELAY_PUBLISH \
+    AOONET_MSG_RELAY AOONET_MSG_PUBLISH
+
+#define AOONET_MSG_RELAY_ADD \
+    AOONET_MSG_RELAY AOONET_MSG_ADD
+
+#define AOONET_MSG_RELAY_DEL \
+    AOONET_MSG_RELAY AOONET_MSG_DEL
+
+#define AOONET_MSG_MCU_JOIN \
+    AOONET_MSG_MCU AOONET_MSG_JOIN
+
+#define AOONET_MSG_MCU_ADD \
+    AOONET_MSG_MCU AOONET_MSG_ADD
+
+#define AOONET_MSG_MCU_DEL \
+    AOONET_MSG_MCU AOONET_MSG_DEL
+
 #define AOONET_MSG_GROUP_PUBLIC \
     AOONET_MSG_GROUP AOONET_MSG_PUBLIC
 
@@ -344,6 +377,68 @@ int32_t aoo::net::client::group_watch_public(bool watch) {
     return 1;
 }
 
+int32_t aoonet_client_relay_publish(aoonet_client *client, const char *group){
+    return client->relay_publish(group);
+}
+
+int32_t aoo::net::client::relay_publish(const char *group){
+    push_command(std::make_unique<relay_publish_cmd>(group, true));
+
+    signal();
+
+    return 1;
+}
+
+int32_t aoonet_client_relay_unpublish(aoonet_client *client, const char *group){
+    return client->relay_unpublish(group);
+}
+
+int32_t aoo::net::client::relay_unpublish(const char *group){
+    push_command(std::make_unique<relay_publish_cmd>(group, false));
+
+    signal();
+
+    return 1;
+}
+
+int32_t aoonet_client_mcu_join(aoonet_client *client, const char *group){
+    return client->mcu_join(group);
+}
+
+int32_t aoo::net::client::mcu_join(const char *group){
+    push_command(std::make_unique<mcu_join_cmd>(group, true));
+
+    signal();
+
+    return 1;
+}
+
+int32_t aoonet_client_mcu_leave(aoonet_client *client, const char *group){
+    return client->mcu_leave(group);
+}
+
+int32_t aoo::net::client::mcu_leave(const char *group){
+    push_command(std::make_unique<mcu_join_cmd>(group, false));
+
+    signal();
+
+    return 1;
+}
+
+int32_t aoonet_client_mcu_set_gain(aoonet_client *client, const char *group,
+                                   const char *user, float gain, float pan){
+    return client->mcu_set_gain(group, user, gain, pan);
+}
+
+int32_t aoo::net::client::mcu_set_gain(const char *group, const char *user,
+                                       float gain, float pan){
+    push_command(std::make_unique<mcu_gain_cmd>(group, user, gain, pan));
+
+    signal();
+
+    return 1;
+}
+
 int32_t aoonet_client_handle_message(aoonet_client *client, const char *data,
                                      int32_t n, void *addr)
 {
@@ -709,6 +804,36 @@ void client::do_group_watch_public(bool watch){
     send_server_message_tcp(msg.Data(), (int32_t) msg.Size());
 }
 
+void client::do_relay_publish(const std::string &group, bool publish){
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(publish ? AOONET_MSG_SERVER_RELAY_PUBLISH
+                                     : AOONET_MSG_SERVER_RELAY_UNPUBLISH)
+        << group.c_str() << osc::EndMessage;
+
+    send_server_message_tcp(msg.Data(), (int32_t) msg.Size());
+}
+
+void client::do_mcu_join(const std::string &group, bool join){
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(join ? AOONET_MSG_SERVER_MCU_JOIN
+                                  : AOONET_MSG_SERVER_MCU_LEAVE)
+        << group.c_str() << osc::EndMessage;
+
+    send_server_message_tcp(msg.Data(), (int32_t) msg.Size());
+}
+
+void client::do_mcu_set_gain(const std::string &group, const std::string &user,
+                             float gain, float pan){
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(AOONET_MSG_SERVER_MCU_GAIN)
+        << group.c_str() << user.c_str() << gain << pan << osc::EndMessage;
+
+    send_server_message_tcp(msg.Data(), (int32_t) msg.Size());
+}
+
 void client::send_message_udp(const char *data, int32_t size, const ip_address& addr)
 {
     sendfn_(udpsocket_, data, size, (void *)&addr.address);
@@ -1001,6 +1126,18 @@ void client::handle_server_message_tcp(const osc::ReceivedMessage& msg){
             handle_peer_add(msg);
         } else if (!strcmp(pattern, AOONET_MSG_PEER_LEAVE)){
             handle_peer_remove(msg);
+        } else if (!strcmp(pattern, AOONET_MSG_RELAY_PUBLISH)){
+            handle_relay_publish(msg);
+        } else if (!strcmp(pattern, AOONET_MSG_RELAY_ADD)){
+            handle_relay_stream(msg, true);
+        } else if (!strcmp(pattern, AOONET_MSG_RELAY_DEL)){
+            handle_relay_stream(msg, false);
+        } else if (!strcmp(pattern, AOONET_MSG_MCU_JOIN)){
+            handle_mcu_join(msg);
+        } else if (!strcmp(pattern, AOONET_MSG_MCU_ADD)){
+            handle_mcu_participant(msg, true);
+        } else if (!strcmp(pattern, AOONET_MSG_MCU_DEL)){
+            handle_mcu_participant(msg, false);
         } else {
             LOG_ERROR("aoo_client: unknown server message " << pattern);
         }
@@ -1183,6 +1320,78 @@ void client::handle_peer_remove(const osc::ReceivedMessage& msg){
     LOG_VERBOSE("aoo_client: peer " << group << "|" << user << " left");
 }
 
+void client::handle_relay_publish(const osc::ReceivedMessage& msg){
+    auto it = msg.ArgumentsBegin();
+    std::string group = (it++)->AsString();
+    int32_t status = (it++)->AsInt32();
+    std::string errmsg = (it++)->AsString();
+    int32_t stream = (it++)->AsInt32();
+    if (status > 0){
+        LOG_VERBOSE("aoo_client: relay stream " << stream << " in group " << group);
+        auto e = std::make_unique<relay_event>(
+            AOONET_CLIENT_RELAY_PUBLISH_EVENT, group.c_str(), nullptr, stream);
+        push_event(std::move(e));
+    } else {
+        LOG_WARNING("aoo_client: couldn't publish relay stream in group "
+                    << group << ": " << errmsg);
+        auto e = std::make_unique<relay_event>(
+            AOONET_CLIENT_RELAY_PUBLISH_EVENT, group.c_str(), nullptr, 0,
+            status, errmsg.c_str());
+        push_event(std::move(e));
+    }
+}
+
+void client::handle_relay_stream(const osc::ReceivedMessage& msg, bool add){
+    auto it = msg.ArgumentsBegin();
+    std::string group = (it++)->AsString();
+    std::string user = (it++)->AsString();
+    int32_t stream = (it++)->AsInt32();
+
+    LOG_VERBOSE("aoo_client: relay stream " << stream << " of " << group
+                << "|" << user << (add ? " added" : " removed"));
+
+    auto e = std::make_unique<relay_event>(
+        add ? AOONET_CLIENT_RELAY_STREAM_ADD_EVENT : AOONET_CLIENT_RELAY_STREAM_DEL_EVENT,
+        group.c_str(), user.c_str(), stream);
+    push_event(std::move(e));
+}
+
+void client::handle_mcu_join(const osc::ReceivedMessage& msg){
+    auto it = msg.ArgumentsBegin();
+    std::string group = (it++)->AsString();
+    int32_t status = (it++)->AsInt32();
+    std::string errmsg = (it++)->AsString();
+    int32_t id = (it++)->AsInt32();
+    if (status > 0){
+        LOG_VERBOSE("aoo_client: MCU participant " << id << " in group " << group);
+        auto e = std::make_unique<mcu_event>(
+            AOONET_CLIENT_MCU_JOIN_EVENT, group.c_str(), nullptr, id);
+        push_event(std::move(e));
+    } else {
+        LOG_WARNING("aoo_client: couldn't join MCU in group "
+                    << group << ": " << errmsg);
+        auto e = std::make_unique<mcu_event>(
+            AOONET_CLIENT_MCU_JOIN_EVENT, group.c_str(), nullptr, 0,
+            status, errmsg.c_str());
+        push_event(std::move(e));
+    }
+}
+
+void client::handle_mcu_participant(const osc::ReceivedMessage& msg, bool add){
+    auto it = msg.ArgumentsBegin();
+    std::string group = (it++)->AsString();
+    std::string user = (it++)->AsString();
+    int32_t id = (it++)->AsInt32();
+
+    LOG_VERBOSE("aoo_client: MCU participant " << id << " of " << group
+                << "|" << user << (add ? " added" : " removed"));
+
+    auto e = std::make_unique<mcu_event>(
+        add ? AOONET_CLIENT_MCU_ADD_EVENT : AOONET_CLIENT_MCU_DEL_EVENT,
+        group.c_str(), user.c_str(), id);
+    push_event(std::move(e));
+}
+
 void client::handle_server_message_udp(const osc::ReceivedMessage &msg, int onset){
     auto pattern = msg.AddressPattern() + onset;
     try {
@@ -1275,6 +1484,42 @@ client::peer_event::~peer_event()
     }
 }
 
+client::relay_event::relay_event(int32_t type, const char *group, const char *user,
+                                 int32_t stream, int32_t result, const char *errmsg)
+{
+    relay_event_.type = type;
+    relay_event_.result = result;
+    relay_event_.errormsg = copy_string(errmsg);
+    relay_event_.group = copy_string(group);
+    relay_event_.user = copy_string(user);
+    relay_event_.stream = stream;
+}
+
+client::relay_event::~relay_event()
+{
+    delete relay_event_.errormsg;
+    delete relay_event_.group;
+    delete relay_event_.user;
+}
+
+client::mcu_event::mcu_event(int32_t type, const char *group, const char *user,
+                             int32_t id, int32_t result, const char *errmsg)
+{
+    mcu_event_.type = type;
+    mcu_event_.result = result;
+    mcu_event_.errormsg = copy_string(errmsg);
+    mcu_event_.group = copy_string(group);
+    mcu_event_.user = copy_string(user);
+    mcu_event_.id = id;
+}
+
+client::mcu_event::~mcu_event()
+{
+    delete mcu_event_.errormsg;
+    delete mcu_event_.group;
+    delete mcu_event_.user;
+}
+
 /*///////////////////// peer //////////////////////////*/
 
 peer::peer(client& client,
@@ -107,6 +107,8 @@ public:
             aoonet_client_event client_event_;
             aoonet_client_group_event group_event_;
             aoonet_client_peer_event peer_event_;
+            aoonet_client_relay_event relay_event_;
+            aoonet_client_mcu_event mcu_event_;
         };
     };
 
@@ -128,6 +130,16 @@ public:
 
     int32_t group_watch_public(bool watch) override;
 
+    int32_t relay_publish(const char *group) override;
+
+    int32_t relay_unpublish(const char *group) override;
+
+    int32_t mcu_join(const char *group) override;
+
+    int32_t mcu_leave(const char *group) override;
+
+    int32_t mcu_set_gain(const char *group, const char *user,
+                         float gain, float pan) override;
 
     int32_t handle_message(const char *data, int32_t n, void *addr) override;
 
@@ -151,6 +163,13 @@ public:
 
     void do_group_watch_public(bool watch);
 
+    void do_relay_publish(const std::string& group, bool publish);
+
+    void do_mcu_join(const std::string& group, bool join);
+
+    void do_mcu_set_gain(const std::string& group, const std::string& user,
+                         float gain, float pan);
+
     double ping_interval() const { return ping_interval_.load(); }
 
     double request_interval() const { return request_interval_.load(); }
@@ -245,6 +264,14 @@ private:
 
     void handle_peer_remove(const osc::ReceivedMessage& msg);
 
+    void handle_relay_publish(const osc::ReceivedMessage& msg);
+
+    void handle_relay_stream(const osc::ReceivedMessage& msg, bool add);
+
+    void handle_mcu_join(const osc::ReceivedMessage& msg);
+
+    void handle_mcu_participant(const osc::ReceivedMessage& msg, bool add);
+
     void signal();
 
     /*////////////////////// events /////////////////////*/
@@ -271,6 +298,20 @@ public:
         ~peer_event();
     };
 
+    struct relay_event : ievent
+    {
+        relay_event(int32_t type, const char *group, const char *user,
+                    int32_t stream, int32_t result = 1, const char *errmsg = 0);
+        ~relay_event();
+    };
+
+    struct mcu_event : ievent
+    {
+        mcu_event(int32_t type, const char *group, const char *user,
+                  int32_t id, int32_t result = 1, const char *errmsg = 0);
+        ~mcu_event();
+    };
+
     /*////////////////////// commands ///////////////////*/
 private:
     struct connect_cmd : icommand
@@ -338,6 +379,45 @@ private:
         }
         bool watch;
     };
+
+    struct relay_publish_cmd : icommand
+    {
+        relay_publish_cmd(const std::string& _group, bool _publish)
+            : group(_group), publish(_publish){}
+
+        void perform(client &obj) override {
+            obj.do_relay_publish(group, publish);
+        }
+        std::string group;
+        bool publish;
+    };
+
+    struct mcu_join_cmd : icommand
+    {
+        mcu_join_cmd(const std::string& _group, bool _join)
+            : group(_group), join(_join){}
+
+        void perform(client &obj) override {
+            obj.do_mcu_join(group, join);
+        }
+        std::string group;
+        bool join;
+    };
+
+    struct mcu_gain_cmd : icommand
+    {
+        mcu_gain_cmd(const std::string& _group, const std::string& _user,
+                     float _gain, float _pan)
+            : group(_group), user(_user), gain(_gain), pan(_pan){}
+
+        void perform(client &obj) override {
+            obj.do_mcu_set_gain(group, user, gain, pan);
+        }
+        std::string group;
+        std::string user;
+        float gain;
+        float pan;
+    };
 };
 
 } // net
@@ -47,7 +47,8 @@ void print_settings(const aoo_format_opus& f){
                 << ", bitrate = " << f.bitrate
                 << ", complexity = " << f.complexity
                 << ", application = " << apptype
-                << ", signal type = " << type);
+                << ", signal type = " << type
+                << ", fec loss = " << f.fec_loss_percent << "%");
 }
 
 /*/////////////////////// codec base ////////////////////////*/
@@ -100,6 +101,12 @@ void validate_format(aoo_format_opus& f)
     if (f.application_type == 0) {
         f.application_type = OPUS_APPLICATION_AUDIO;
     }
+    // validate FEC loss percentage
+    if (f.fec_loss_percent < 0){
+        f.fec_loss_percent = 0;
+    } else if (f.fec_loss_percent > 100){
+        f.fec_loss_percent = 100;
+    }
     // bitrate, complexity and signal type should be validated by opus
 }
 
@@ -195,6 +202,12 @@ int32_t encoder_setformat(void *enc, aoo_format *f){
         // signal type
         opus_multistream_encoder_ctl(c->state, OPUS_SET_SIGNAL(fmt->signal_type));
         opus_multistream_encoder_ctl(c->state, OPUS_GET_SIGNAL(&fmt->signal_type));
+        // in-band FEC
+        // NOTE: Opus only adds FEC data in SILK/hybrid mode, so this has no effect
+        // with OPUS_APPLICATION_RESTRICTED_LOWDELAY (CELT only); the sink will
+        // just conceal lost blocks then.
+        opus_multistream_encoder_ctl(c->state, OPUS_SET_INBAND_FEC(fmt->fec_loss_percent > 0 ? 1 : 0));
+        opus_multistream_encoder_ctl(c->state, OPUS_SET_PACKET_LOSS_PERC(fmt->fec_loss_percent));
     } else {
         LOG_ERROR("Opus: opus_encoder_create() failed with error code " << error);
         return 0;
@@ -212,7 +225,7 @@ int32_t encoder_setformat(void *enc, aoo_format *f){
 
 int32_t encoder_writeformat(void *enc, aoo_format *fmt,
                             char *buf, int32_t size){
-    if (size >= 16){
+    if (size >= 20){
         // if encoder is null we assume the format passed in
         // is actually a reference to an aoo_format_opus,
         // and this call is used for serialization purposes
@@ -229,7 +242,8 @@ int32_t encoder_writeformat(void *enc, aoo_format *fmt,
         aoo::to_bytes<int32_t>(ofmt->complexity, buf + 4);
         aoo::to_bytes<int32_t>(ofmt->signal_type, buf + 8);
         aoo::to_bytes<int32_t>(ofmt->application_type, buf + 12);
-        return 16;
+        aoo::to_bytes<int32_t>(ofmt->fec_loss_percent, buf + 16);
+        return 20;
     } else {
         LOG_WARNING("Opus: couldn't write settings");
         return -1;
@@ -257,6 +271,12 @@ int32_t encoder_readformat(void *enc, aoo_format *fmt,
         } else {
             f.application_type = OPUS_APPLICATION_AUDIO;
         }
+        if (size >= 20) {
+            f.fec_loss_percent = aoo::from_bytes<int32_t>(buf + 16);
+            retsize = 20;
+        } else {
+            f.fec_loss_percent = 0;
+        }
         
         if (encoder_setformat(c, reinterpret_cast<aoo_format *>(&f))){
             // it could have been modified during validation, need to re-write the base format of 
@@ -321,6 +341,26 @@ int32_t decoder_decode(void *dec,
     return 0;
 }
 
+int32_t decoder_decode_fec(void *dec,
+                           const char *buf, int32_t size,
+                           aoo_sample *s, int32_t n)
+{
+    auto c = static_cast<decoder *>(dec);
+    if (c->state){
+        // if the packet doesn't contain any FEC data, Opus falls back to PLC
+        auto framesize = n / c->format.header.nchannels;
+        auto result = opus_multistream_decode_float(
+                    c->state, (const unsigned char *)buf, size, s, framesize, 1);
+        if (result > 0){
+            return result;
+        } else if (result < 0) {
+            LOG_VERBOSE("Opus: opus_decode_float() with FEC failed with error code " << result);
+            return result;
+        }
+    }
+    return 0;
+}
+
 bool decoder_dosetformat(decoder *c, aoo_format_opus& f){
     if (c->state){
         opus_multistream_decoder_destroy(c->state);
@@ -407,6 +447,12 @@ int32_t decoder_readformat(void *dec, aoo_format *fmt,
         } else {
             f.application_type = OPUS_APPLICATION_AUDIO;
         }
+        if (size >= 20) {
+            f.fec_loss_percent = aoo::from_bytes<int32_t>(buf + 16);
+            retsize = 20;
+        } else {
+            f.fec_loss_percent = 0;
+        }
         
         if (decoder_dosetformat(c, f)){
             return retsize; // number of bytes
@@ -445,7 +491,8 @@ aoo_codec codec_class = {
     decoder_getformat,
     decoder_readformat,
     decoder_decode,
-    decoder_reset
+    decoder_reset,
+    decoder_decode_fec
 };
 
 } // namespace
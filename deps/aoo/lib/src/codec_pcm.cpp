@@ -391,7 +391,8 @@ aoo_codec codec_class = {
     codec_getformat,
     decoder_readformat,
     decoder_decode,
-    codec_reset
+    codec_reset,
+    nullptr // no FEC
 };
 
 } // namespace
@@ -13,6 +13,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <cmath>
 
 /*/////////////// version ////////////////////*/
 
@@ -693,6 +694,12 @@ void block_queue::resize(int32_t n){
     size_ = 0;
 }
 
+void block_queue::expand(int32_t n){
+    if (n > capacity()){
+        blocks_.resize(n);
+    }
+}
+
 bool block_queue::empty() const {
     return size_ == 0;
 }
@@ -847,25 +854,161 @@ std::ostream& operator<<(std::ostream& os, const block_queue& b){
 /*////////////////////////// dynamic_resampler /////////////////////////////*/
 
 #define AOO_RESAMPLER_SPACE 2.5 // was 3 // jlc was 8
+#define AOO_RESAMPLER_PHASES 256 // number of filter phases (interpolated)
+#define AOO_RESAMPLER_CUTOFF 0.9 // relative to the lower Nyquist frequency
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+  #include <xmmintrin.h>
+  #define AOO_RESAMPLER_SIMD 1
+  typedef __m128 vec4f;
+  static inline vec4f vec4_load(const float *p){ return _mm_loadu_ps(p); }
+  static inline void vec4_store(float *p, vec4f v){ _mm_storeu_ps(p, v); }
+  static inline vec4f vec4_set(float f){ return _mm_set1_ps(f); }
+  static inline vec4f vec4_add(vec4f a, vec4f b){ return _mm_add_ps(a, b); }
+  static inline vec4f vec4_sub(vec4f a, vec4f b){ return _mm_sub_ps(a, b); }
+  static inline vec4f vec4_madd(vec4f acc, vec4f a, vec4f b){ return _mm_add_ps(acc, _mm_mul_ps(a, b)); }
+  // a b c d -> a a b b / c c d d
+  static inline vec4f vec4_duplo(vec4f v){ return _mm_unpacklo_ps(v, v); }
+  static inline vec4f vec4_duphi(vec4f v){ return _mm_unpackhi_ps(v, v); }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define AOO_RESAMPLER_SIMD 1
+  typedef float32x4_t vec4f;
+  static inline vec4f vec4_load(const float *p){ return vld1q_f32(p); }
+  static inline void vec4_store(float *p, vec4f v){ vst1q_f32(p, v); }
+  static inline vec4f vec4_set(float f){ return vdupq_n_f32(f); }
+  static inline vec4f vec4_add(vec4f a, vec4f b){ return vaddq_f32(a, b); }
+  static inline vec4f vec4_sub(vec4f a, vec4f b){ return vsubq_f32(a, b); }
+  static inline vec4f vec4_madd(vec4f acc, vec4f a, vec4f b){ return vmlaq_f32(acc, a, b); }
+  static inline vec4f vec4_duplo(vec4f v){ return vzipq_f32(v, v).val[0]; }
+  static inline vec4f vec4_duphi(vec4f v){ return vzipq_f32(v, v).val[1]; }
+#else
+  #define AOO_RESAMPLER_SIMD 0
+#endif
+
+// interpolate the coefficients between two filter phases
+static void interpolate_coeffs(const float *a, const float *b, float fract,
+                               float *out, int32_t n){
+#if AOO_RESAMPLER_SIMD
+    auto f = vec4_set(fract);
+    for (int i = 0; i < n; i += 4){
+        auto va = vec4_load(a + i);
+        vec4_store(out + i, vec4_madd(va, vec4_sub(vec4_load(b + i), va), f));
+    }
+#else
+    for (int i = 0; i < n; ++i){
+        out[i] = a[i] + (b[i] - a[i]) * fract;
+    }
+#endif
+}
 
-void dynamic_resampler::setup(int32_t nfrom, int32_t nto, int32_t srfrom, int32_t srto, int32_t nchannels){
+// apply the filter to 'ntaps' interleaved frames, writing a single frame.
+// (the number of taps is always a multiple of 4.)
+template<typename T>
+static void filter_frame(const T *x, const float *c, int32_t ntaps,
+                         int32_t nchannels, T *out){
+    for (int j = 0; j < nchannels; ++j){
+        float sum = 0;
+        for (int k = 0; k < ntaps; ++k){
+            sum += x[k * nchannels + j] * c[k];
+        }
+        out[j] = sum;
+    }
+}
+
+#if AOO_RESAMPLER_SIMD
+static void filter_frame(const float *x, const float *c, int32_t ntaps,
+                         int32_t nchannels, float *out){
+    if (nchannels == 1){
+        auto acc = vec4_set(0);
+        for (int k = 0; k < ntaps; k += 4){
+            acc = vec4_madd(acc, vec4_load(x + k), vec4_load(c + k));
+        }
+        float v[4];
+        vec4_store(v, acc);
+        out[0] = (v[0] + v[1]) + (v[2] + v[3]);
+    } else if (nchannels == 2){
+        // L R L R * c0 c0 c1 c1
+        auto acc1 = vec4_set(0);
+        auto acc2 = vec4_set(0);
+        for (int k = 0; k < ntaps; k += 4){
+            auto vc = vec4_load(c + k);
+            acc1 = vec4_madd(acc1, vec4_load(x + k * 2), vec4_duplo(vc));
+            acc2 = vec4_madd(acc2, vec4_load(x + k * 2 + 4), vec4_duphi(vc));
+        }
+        float v[4];
+        vec4_store(v, vec4_add(acc1, acc2));
+        out[0] = v[0] + v[2];
+        out[1] = v[1] + v[3];
+    } else if ((nchannels & 3) == 0){
+        // 4 channels at a time
+        for (int j = 0; j < nchannels; j += 4){
+            auto acc = vec4_set(0);
+            for (int k = 0; k < ntaps; ++k){
+                acc = vec4_madd(acc, vec4_load(x + k * nchannels + j), vec4_set(c[k]));
+            }
+            vec4_store(out + j, acc);
+        }
+    } else {
+        filter_frame<float>(x, c, ntaps, nchannels, out);
+    }
+}
+#endif
+
+void dynamic_resampler::setup(int32_t nfrom, int32_t nto, int32_t srfrom, int32_t srto, int32_t nchannels,
+                              int32_t quality){
     nchannels_ = nchannels;
+    ntaps_ = quality == AOO_RESAMPLE_HIGH ? 64 : quality == AOO_RESAMPLE_MEDIUM ? 32 : 0;
     auto blocksize = std::max<int32_t>(nfrom, nto);
 #if 0
     // this doesn't work as expected...
     auto ratio = srfrom > srto ? (double)srfrom / (double)srto : (double)srto / (double)srfrom;
     buffer_.resize(blocksize * nchannels_ * ratio * AOO_RESAMPLER_SPACE); // extra space for fluctuations
 #else
-    buffer_.resize(blocksize * nchannels_ * AOO_RESAMPLER_SPACE); // extra space for fluctuations
+    // extra space for fluctuations + the frames we still read from
+    size_ = ((int32_t)(blocksize * AOO_RESAMPLER_SPACE) + history()) * nchannels_;
 #endif
+    // copy of the first frames at the end
+    buffer_.resize(size_ + history() * nchannels_);
+    if (ntaps_ > 0){
+        // lowpass below the lower Nyquist frequency
+        make_filter(AOO_RESAMPLER_CUTOFF * std::min<double>(1.0, (double)srto / (double)srfrom));
+    }
     clear();
 }
 
+// Blackman windowed sinc, one row per phase plus an extra row for
+// interpolating the last phase. The filter has a delay of ntaps/2 - 1 frames.
+void dynamic_resampler::make_filter(double cutoff){
+    auto n = ntaps_;
+    filter_.resize((AOO_RESAMPLER_PHASES + 1) * n);
+    coeffs_.resize(n);
+    for (int p = 0; p <= AOO_RESAMPLER_PHASES; ++p){
+        auto row = &filter_[p * n];
+        double phase = (double)p / AOO_RESAMPLER_PHASES;
+        double sum = 0;
+        for (int k = 0; k < n; ++k){
+            double t = k - (n / 2 - 1) - phase;
+            double x = M_PI * t * cutoff;
+            double sinc = x != 0 ? std::sin(x) / x : 1.0;
+            double w = 0.42 + 0.5 * std::cos(2 * M_PI * t / n) + 0.08 * std::cos(4 * M_PI * t / n);
+            row[k] = sinc * w;
+            sum += row[k];
+        }
+        // unity gain for every phase
+        for (int k = 0; k < n; ++k){
+            row[k] /= sum;
+        }
+    }
+}
+
 void dynamic_resampler::clear(){
     ratio_ = 1;
     rdpos_ = 0;
     wrpos_ = 0;
     balance_ = 0;
+    // the filter reads past samples
+    std::fill(buffer_.begin(), buffer_.end(), 0);
 }
 
 void dynamic_resampler::update(double srfrom, double srto){
@@ -879,7 +1022,7 @@ void dynamic_resampler::update(double srfrom, double srto){
     if (counter == 100){
         DO_LOG("srfrom: " << srfrom << ", srto: " << srto);
         DO_LOG("resample factor: " << ratio_);
-        DO_LOG("balance: " << balance_ << ", size: " << buffer_.size());
+        DO_LOG("balance: " << balance_ << ", size: " << size_);
         counter = 0;
     } else {
         counter++;
@@ -888,11 +1031,12 @@ void dynamic_resampler::update(double srfrom, double srto){
 }
 
 int32_t dynamic_resampler::write_available(){
-    return (double)buffer_.size() - balance_; // !
+    // don't overwrite the frames we still read from
+    return (double)size_ - balance_ - history() * nchannels_; // !
 }
 
 void dynamic_resampler::write(const aoo_sample *data, int32_t n){
-    auto size = (int32_t)buffer_.size();
+    auto size = size_;
     auto end = wrpos_ + n;
     int32_t split;
     if (end > size){
@@ -902,6 +1046,11 @@ void dynamic_resampler::write(const aoo_sample *data, int32_t n){
     }
     std::copy(data, data + split, &buffer_[wrpos_]);
     std::copy(data + split, data + n, &buffer_[0]);
+    // update the copy at the end
+    auto tail = (int32_t)buffer_.size() - size;
+    if (split < n || wrpos_ < tail){
+        std::copy(&buffer_[0], &buffer_[tail], &buffer_[size]);
+    }
     wrpos_ += n;
     if (wrpos_ >= size){
         wrpos_ -= size;
@@ -914,29 +1063,23 @@ int32_t dynamic_resampler::read_available(){
 }
 
 void dynamic_resampler::read(aoo_sample *data, int32_t n){
-    auto size = (int32_t)buffer_.size();
+    auto size = size_;
     auto limit = size / nchannels_;
     int32_t intpos = (int32_t)rdpos_;
     if (ratio_ != 1.0 || (rdpos_ - intpos) != 0.0){
-        // interpolating version
-        double incr = 1. / ratio_;
-        assert(incr > 0);
-        for (int i = 0; i < n; i += nchannels_){
-            int32_t index = (int32_t)rdpos_;
-            double fract = rdpos_ - (double)index;
-            for (int j = 0; j < nchannels_; ++j){
-                double a = buffer_[index * nchannels_ + j];
-                double b = buffer_[((index + 1) * nchannels_ + j) % size];
-                data[i + j] = a + (b - a) * fract;
-            }
-            rdpos_ += incr;
-            if (rdpos_ >= limit){
-                rdpos_ -= limit;
-            }
+        if (ntaps_ > 0){
+            read_sinc(data, n);
+        } else {
+            read_linear(data, n);
         }
-        balance_ -= n * incr;
     } else {
-        // non-interpolating (faster) version
+        // non-interpolating (faster) version, delayed like the filter
+        if (ntaps_ > 0){
+            intpos -= ntaps_ / 2 - 1;
+            if (intpos < 0){
+                intpos += limit;
+            }
+        }
         int32_t pos = intpos * nchannels_;
         int32_t end = pos + n;
         int n1, n2;
@@ -961,6 +1104,186 @@ void dynamic_resampler::read(aoo_sample *data, int32_t n){
     }
 }
 
+void dynamic_resampler::read_linear(aoo_sample *data, int32_t n){
+    auto limit = size_ / nchannels_;
+    double incr = 1. / ratio_;
+    assert(incr > 0);
+    for (int i = 0; i < n; i += nchannels_){
+        int32_t index = (int32_t)rdpos_;
+        aoo_sample fract = rdpos_ - (double)index;
+        // no wrap around needed, the next frame is copied past the end
+        auto x = &buffer_[index * nchannels_];
+        for (int j = 0; j < nchannels_; ++j){
+            aoo_sample a = x[j];
+            aoo_sample b = x[nchannels_ + j];
+            data[i + j] = a + (b - a) * fract;
+        }
+        rdpos_ += incr;
+        if (rdpos_ >= limit){
+            rdpos_ -= limit;
+        }
+    }
+    balance_ -= n * incr;
+}
+
+void dynamic_resampler::read_sinc(aoo_sample *data, int32_t n){
+    auto limit = size_ / nchannels_;
+    auto ntaps = ntaps_;
+    double incr = 1. / ratio_;
+    assert(incr > 0);
+    for (int i = 0; i < n; i += nchannels_){
+        int32_t index = (int32_t)rdpos_;
+        double phase = (rdpos_ - (double)index) * AOO_RESAMPLER_PHASES;
+        int32_t p = (int32_t)phase;
+        interpolate_coeffs(&filter_[p * ntaps], &filter_[(p + 1) * ntaps],
+                           phase - p, coeffs_.data(), ntaps);
+        // the window ends at the frame after 'index'
+        int32_t start = index - (ntaps - 2);
+        if (start < 0){
+            start += limit;
+        }
+        filter_frame(&buffer_[start * nchannels_], coeffs_.data(), ntaps, nchannels_, data + i);
+        rdpos_ += incr;
+        if (rdpos_ >= limit){
+            rdpos_ -= limit;
+        }
+    }
+    balance_ -= n * incr;
+}
+
+/*////////////////////////// time_stretcher /////////////////////////////*/
+
+#define AOO_STRETCH_MINPERIOD 2.5 // ms
+#define AOO_STRETCH_MAXPERIOD 12 // ms
+#define AOO_STRETCH_SEARCHRATE 4000 // Hz, for the coarse period search
+
+void time_stretcher::setup(int32_t blocksize, int32_t samplerate, int32_t nchannels){
+    nchannels_ = nchannels;
+    minperiod_ = std::max<int32_t>(1, samplerate * AOO_STRETCH_MINPERIOD * 0.001);
+    maxperiod_ = std::max<int32_t>(minperiod_, samplerate * AOO_STRETCH_MAXPERIOD * 0.001);
+    decimation_ = std::max<int32_t>(1, samplerate / AOO_STRETCH_SEARCHRATE);
+    // two periods to search in, one more to insert and room for the next block
+    buffer_.resize((3 * maxperiod_ + 2 * blocksize) * nchannels_);
+    mono_.resize(2 * maxperiod_);
+    clear();
+}
+
+void time_stretcher::clear(){
+    size_ = 0;
+}
+
+void time_stretcher::write(const aoo_sample *data, int32_t n){
+    assert(n <= write_available());
+    std::copy(data, data + n, buffer_.data() + size_);
+    size_ += n;
+}
+
+void time_stretcher::read_commit(int32_t n){
+    assert(n <= size_);
+    std::copy(buffer_.data() + n, buffer_.data() + size_, buffer_.data());
+    size_ -= n;
+}
+
+// find the period T for which the frames [0, T) best match the frames [T, 2T):
+// first on a decimated mono signal, then refined at the full rate.
+int32_t time_stretcher::find_period(int32_t maxperiod){
+    auto nframes = size_ / nchannels_;
+    maxperiod = std::min<int32_t>(std::min(maxperiod, maxperiod_), nframes / 2);
+    if (maxperiod < minperiod_){
+        return 0;
+    }
+    // mono, low-passed by averaging over the decimation factor
+    auto d = decimation_;
+    auto nmono = 2 * maxperiod / d;
+    auto src = buffer_.data();
+    for (int i = 0; i < nmono; ++i){
+        aoo_sample sum = 0;
+        for (int j = 0; j < d * nchannels_; ++j){
+            sum += *src++;
+        }
+        mono_[i] = sum;
+    }
+    auto match = [](const aoo_sample *x, const aoo_sample *y, int32_t n, int32_t stride, double& energy){
+        double xy = 0, xx = 0, yy = 0;
+        for (int i = 0; i < n * stride; i += stride){
+            xy += x[i] * y[i];
+            xx += x[i] * x[i];
+            yy += y[i] * y[i];
+        }
+        energy = xx + yy;
+        return xy / std::sqrt(xx * yy + 1e-12);
+    };
+    int32_t best = maxperiod;
+    double bestmatch = -2;
+    double energy = 0;
+    for (int32_t t = (minperiod_ + d - 1) / d; t <= maxperiod / d; ++t){
+        auto m = match(&mono_[0], &mono_[t], t, 1, energy);
+        if (m > bestmatch){
+            bestmatch = m;
+            best = t * d;
+        }
+    }
+    if (energy < 1e-8 || d == 1){
+        // (almost) silent or already at the full rate
+        return best;
+    }
+    // refine on the first channel
+    auto lo = std::max<int32_t>(minperiod_, best - d);
+    auto hi = std::min<int32_t>(maxperiod, best + d);
+    bestmatch = -2;
+    for (int32_t t = lo; t <= hi; ++t){
+        auto m = match(buffer_.data(), buffer_.data() + t * nchannels_, t, nchannels_, energy);
+        if (m > bestmatch){
+            bestmatch = m;
+            best = t;
+        }
+    }
+    return best;
+}
+
+int32_t time_stretcher::compress(int32_t maxperiod){
+    auto t = find_period(maxperiod);
+    if (t <= 0){
+        return 0;
+    }
+    // cross-fade [0, T) into [T, 2T) and drop the second period
+    auto x = buffer_.data();
+    auto y = x + t * nchannels_;
+    for (int i = 0; i < t; ++i){
+        aoo_sample w = (i + 0.5) / t;
+        for (int j = 0; j < nchannels_; ++j){
+            auto k = i * nchannels_ + j;
+            x[k] += (y[k] - x[k]) * w;
+        }
+    }
+    std::copy(x + 2 * t * nchannels_, x + size_, y);
+    size_ -= t * nchannels_;
+    return t;
+}
+
+int32_t time_stretcher::expand(int32_t maxperiod){
+    maxperiod = std::min<int32_t>(maxperiod, write_available() / nchannels_);
+    auto t = find_period(maxperiod);
+    if (t <= 0){
+        return 0;
+    }
+    // make room for a new period after [0, T), which cross-fades
+    // from [T, 2T) back to [0, T), so that [T, 2T) follows seamlessly
+    auto x = buffer_.data();
+    auto n = t * nchannels_;
+    std::copy_backward(x + n, x + size_, x + size_ + n);
+    size_ += n;
+    auto y = x + 2 * n; // the old [T, 2T)
+    for (int i = 0; i < t; ++i){
+        aoo_sample w = (i + 0.5) / t;
+        for (int j = 0; j < nchannels_; ++j){
+            auto k = i * nchannels_ + j;
+            x[n + k] = y[k] + (x[k] - y[k]) * w;
+        }
+    }
+    return t;
+}
+
 /*//////////////////////// timer //////////////////////*/
 
 timer::timer(const timer& other){
@@ -11,6 +11,7 @@
 
 #include <vector>
 #include <array>
+#include <algorithm>
 #include <memory>
 #include <atomic>
 
@@ -23,7 +24,8 @@ uint32_t make_version(uint8_t protocolflags = 0);
 
 class dynamic_resampler {
 public:
-    void setup(int32_t nfrom, int32_t nto, int32_t srfrom, int32_t srto, int32_t nchannels);
+    void setup(int32_t nfrom, int32_t nto, int32_t srfrom, int32_t srto, int32_t nchannels,
+               int32_t quality = AOO_RESAMPLE_QUALITY);
     void clear();
     void update(double srfrom, double srto);
     int32_t write_available();
@@ -31,12 +33,54 @@ public:
     int32_t read_available();
     void read(aoo_sample* data, int32_t n);
 private:
+    void make_filter(double cutoff);
+    void read_linear(aoo_sample* data, int32_t n);
+    void read_sinc(aoo_sample* data, int32_t n);
+    // frames that are read before the current position (at least one for linear interpolation)
+    int32_t history() const { return std::max<int32_t>(1, ntaps_); }
+    // the ring buffer is followed by a copy of its first 'ntaps_' frames,
+    // so that reading never has to wrap around in the middle of a frame/filter.
     std::vector<aoo_sample> buffer_;
+    int32_t size_ = 0; // ring buffer size in samples
     int32_t nchannels_ = 0;
     double rdpos_ = 0;
     int32_t wrpos_ = 0;
     double balance_ = 0;
     double ratio_ = 1.0;
+    // polyphase filter bank, (nphases + 1) x ntaps
+    std::vector<float> filter_;
+    std::vector<float> coeffs_; // interpolated between two phases
+    int32_t ntaps_ = 0; // 0: linear interpolation
+};
+
+// changes the length of (interleaved) audio by dropping or
+// repeating single pitch periods, using a WSOLA-style search
+// for the period with the best match.
+class time_stretcher {
+public:
+    void setup(int32_t blocksize, int32_t samplerate, int32_t nchannels);
+    void clear();
+    int32_t write_available() const { return (int32_t)buffer_.size() - size_; }
+    void write(const aoo_sample* data, int32_t n);
+    int32_t read_available() const { return size_; }
+    const aoo_sample* read_data() const { return buffer_.data(); }
+    void read_commit(int32_t n);
+    // shortest and longest period in frames
+    int32_t min_period() const { return minperiod_; }
+    int32_t max_period() const { return maxperiod_; }
+    // remove/insert one period of at most 'maxperiod' frames at the start
+    // of the buffer, returns the number of frames removed/inserted.
+    int32_t compress(int32_t maxperiod);
+    int32_t expand(int32_t maxperiod);
+private:
+    int32_t find_period(int32_t maxperiod);
+    std::vector<aoo_sample> buffer_;
+    std::vector<aoo_sample> mono_;
+    int32_t size_ = 0;
+    int32_t nchannels_ = 0;
+    int32_t minperiod_ = 0;
+    int32_t maxperiod_ = 0;
+    int32_t decimation_ = 1;
 };
 
 class base_codec {
@@ -99,6 +143,17 @@ public:
     int32_t decode(const char *buf, int32_t size, aoo_sample *s, int32_t n){
         return codec_->decoder_decode(obj_, buf, size, s, n);
     }
+    // packet loss concealment for a missing block
+    int32_t conceal(aoo_sample *s, int32_t n){
+        return codec_->decoder_decode(obj_, nullptr, 0, s, n);
+    }
+    bool has_fec() const {
+        return codec_->decoder_decode_fec != nullptr;
+    }
+    // recover the block before 'buf' from its FEC data
+    int32_t decode_fec(const char *buf, int32_t size, aoo_sample *s, int32_t n){
+        return codec_->decoder_decode_fec(obj_, buf, size, s, n);
+    }
     int32_t reset() {
         return codec_->decoder_reset(obj_);
     }
@@ -169,6 +224,7 @@ class block_queue {
 public:
     void clear();
     void resize(int32_t n);
+    void expand(int32_t n); // grow and keep the blocks
     bool empty() const;
     bool full() const;
     int32_t size() const;
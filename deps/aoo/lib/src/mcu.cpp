@@ -0,0 +1,424 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include "mcu.hpp"
+
+#include "aoo/aoo_pcm.h"
+#if USE_CODEC_OPUS
+#include "aoo/aoo_opus.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace aoo {
+namespace net {
+
+/*//////////////////// participant ////////////////////*/
+
+mcu::participant::participant(mcu& _owner, int32_t _id, const std::string& _group,
+                              const std::string& _user, const ip_address& _publisher)
+    : id(_id), group(_group), user(_user), publisher(_publisher)
+{
+    upstream.owner = &_owner;
+    downstream.owner = &_owner;
+
+    sink.reset(aoo::isink::create(id));
+    sink->setup(AOO_MCU_SAMPLERATE, AOO_MCU_BLOCKSIZE, AOO_MCU_CHANNELS);
+    sink->set_buffersize(AOO_MCU_BUFFERSIZE);
+
+    source.reset(aoo::isource::create(id));
+    source->setup(AOO_MCU_SAMPLERATE, AOO_MCU_BLOCKSIZE, AOO_MCU_CHANNELS);
+
+    aoo_format_storage f;
+    memset(&f, 0, sizeof(f));
+#if USE_CODEC_OPUS
+    auto fmt = (aoo_format_opus *)&f;
+    fmt->header.codec = AOO_CODEC_OPUS;
+    fmt->bitrate = AOO_MCU_BITRATE * AOO_MCU_CHANNELS;
+    // one encoder per participant, so go easy on the CPU
+    fmt->complexity = 5;
+    fmt->signal_type = OPUS_SIGNAL_MUSIC;
+    fmt->application_type = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
+#else
+    auto fmt = (aoo_format_pcm *)&f;
+    fmt->header.codec = AOO_CODEC_PCM;
+    fmt->bitdepth = AOO_PCM_INT16;
+#endif
+    fmt->header.nchannels = AOO_MCU_CHANNELS;
+    fmt->header.samplerate = AOO_MCU_SAMPLERATE;
+    fmt->header.blocksize = AOO_MCU_BLOCKSIZE;
+    source->set_format(fmt->header);
+    source->start();
+
+    input.resize(AOO_MCU_BLOCKSIZE * AOO_MCU_CHANNELS);
+    output.resize(AOO_MCU_BLOCKSIZE * AOO_MCU_CHANNELS);
+}
+
+/*//////////////////// mcu ////////////////////*/
+
+mcu::mcu(int sock, bool threaded)
+    : socket_(sock), random_(std::random_device{}())
+{
+    sum_.resize(AOO_MCU_BLOCKSIZE * AOO_MCU_CHANNELS);
+    if (threaded){
+        thread_ = std::thread([this](){ run(); });
+    }
+}
+
+mcu::~mcu(){
+    quit_ = true;
+    if (thread_.joinable()){
+        thread_.join();
+    }
+}
+
+int32_t mcu::add_participant(const std::string& group, const std::string& user,
+                             const ip_address& addr)
+{
+    unique_lock lock(mutex_);
+    // positive IDs only, the negative ones are the wildcard and 'none'
+    std::uniform_int_distribution<int32_t> dist(1, INT32_MAX);
+    int32_t id;
+    do {
+        id = dist(random_);
+    } while (participants_.count(id));
+
+    auto p = std::make_shared<participant>(*this, id, group, user, addr);
+    participants_.emplace(id, p);
+
+    auto& grp = groups_[group];
+    grp.members.push_back(std::move(p));
+    {
+        std::lock_guard<std::mutex> glock(gain_mutex_);
+        grp.dirty = true;
+    }
+
+    LOG_VERBOSE("aoo_server: added MCU participant " << id << " for "
+                << user << " in group " << group);
+
+    return id;
+}
+
+bool mcu::remove_participant(int32_t id){
+    unique_lock lock(mutex_);
+    auto it = participants_.find(id);
+    if (it == participants_.end()){
+        return false;
+    }
+    auto p = it->second;
+    participants_.erase(it);
+
+    auto git = groups_.find(p->group);
+    if (git != groups_.end()){
+        auto& members = git->second.members;
+        members.erase(std::remove(members.begin(), members.end(), p), members.end());
+        if (members.empty()){
+            groups_.erase(git);
+        } else {
+            std::lock_guard<std::mutex> glock(gain_mutex_);
+            git->second.dirty = true;
+        }
+    }
+
+    LOG_VERBOSE("aoo_server: removed MCU participant " << id);
+    return true;
+}
+
+int32_t mcu::num_participants() const {
+    shared_lock lock(mutex_);
+    return (int32_t) participants_.size();
+}
+
+bool mcu::set_gain(const std::string& group, const std::string& listener,
+                   const std::string& talker, float gain, float pan)
+{
+    shared_lock lock(mutex_);
+    auto git = groups_.find(group);
+    if (git == groups_.end()){
+        return false;
+    }
+    auto& grp = git->second;
+    for (auto& p : grp.members){
+        if (p->user == listener){
+            std::lock_guard<std::mutex> glock(gain_mutex_);
+            if (gain == 1.f && pan == 0.f){
+                p->gains.erase(talker);
+            } else {
+                auto& g = p->gains[talker];
+                g.gain = std::max<float>(0.f, gain);
+                g.pan = std::min<float>(1.f, std::max<float>(-1.f, pan));
+            }
+            grp.dirty = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+mcu::participant_ptr mcu::find_participant(int32_t id) const {
+    shared_lock lock(mutex_);
+    auto it = participants_.find(id);
+    if (it != participants_.end()){
+        return it->second;
+    } else {
+        return nullptr;
+    }
+}
+
+bool mcu::handle_message(const char *data, int32_t n, int32_t type, int32_t id,
+                         const ip_address& addr)
+{
+    // the participant keeps itself alive while we're using it,
+    // even if it leaves in the meantime
+    auto p = find_participant(id);
+    if (!p){
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(p->message_mutex);
+
+    if (type == AOO_TYPE_SINK){
+        // from the client's source
+        if (check_address(p->upstream, *p, addr)){
+            p->sink->handle_message(data, n, &p->upstream, send_reply);
+        }
+    } else if (type == AOO_TYPE_SOURCE){
+        // from the client's sink
+        if (check_address(p->downstream, *p, addr)){
+            p->source->handle_message(data, n, &p->downstream, send_reply);
+        }
+    }
+    return true;
+}
+
+bool mcu::check_address(endpoint& ep, const participant& p, const ip_address& addr){
+    std::lock_guard<std::mutex> lock(ep.mutex);
+    if (ep.valid && ep.address == addr){
+        return true;
+    }
+    // same rule as the relay: the client must be on the same host as the
+    // participant's TCP connection, the port can change (e.g. a NAT rebinding)
+    if (addr.same_host(p.publisher)){
+        ep.address = addr;
+        ep.valid = true;
+        return true;
+    } else {
+        LOG_WARNING("aoo_server: MCU message for " << p.id << " from wrong host "
+                    << addr.name());
+        return false;
+    }
+}
+
+void mcu::process(uint64_t t){
+    std::lock_guard<std::mutex> plock(process_mutex_);
+    shared_lock lock(mutex_);
+
+    for (auto& it : groups_){
+        auto& grp = it.second;
+        {
+            std::lock_guard<std::mutex> glock(gain_mutex_);
+            if (grp.dirty){
+                update_gains(grp);
+                grp.dirty = false;
+            }
+        }
+
+        mix_group_block(grp, t);
+
+        for (auto& p : grp.members){
+            p->sink->send();
+            p->source->send();
+            handle_events(*p);
+        }
+    }
+}
+
+void mcu::update_gains(mix_group& grp){
+    auto n = grp.members.size();
+    grp.gains_left.assign(n * n, 1.f);
+    grp.gains_right.assign(n * n, 1.f);
+    grp.custom.assign(n, false);
+
+    for (size_t i = 0; i < n; ++i){
+        auto& listener = *grp.members[i];
+        if (listener.gains.empty()){
+            continue;
+        }
+        grp.custom[i] = true;
+        for (size_t j = 0; j < n; ++j){
+            auto it = listener.gains.find(grp.members[j]->user);
+            if (it != listener.gains.end()){
+                // balance: the far side goes down, the near side stays
+                auto pan = it->second.pan;
+                auto gain = it->second.gain;
+                grp.gains_left[i * n + j] = gain * (pan > 0.f ? 1.f - pan : 1.f);
+                grp.gains_right[i * n + j] = gain * (pan < 0.f ? 1.f + pan : 1.f);
+            }
+        }
+    }
+}
+
+void mcu::mix_group_block(mix_group& grp, uint64_t t){
+    const int32_t bs = AOO_MCU_BLOCKSIZE;
+    const auto n = grp.members.size();
+
+    // decode every upstream and sum them up
+    std::fill(sum_.begin(), sum_.end(), 0);
+    for (auto& p : grp.members){
+        aoo_sample *channels[AOO_MCU_CHANNELS];
+        for (int ch = 0; ch < AOO_MCU_CHANNELS; ++ch){
+            channels[ch] = p->input.data() + ch * bs;
+        }
+        p->active = p->sink->process(channels, bs, t) > 0;
+        if (!p->active){
+            continue;
+        }
+        // a mono source only writes the first channel
+        if (p->upstream_channels.load() == 1){
+            std::copy(channels[0], channels[0] + bs, channels[1]);
+        }
+        for (int i = 0; i < bs * AOO_MCU_CHANNELS; ++i){
+            sum_[i] += p->input[i];
+        }
+    }
+
+    // one mix-minus per listener
+    for (size_t i = 0; i < n; ++i){
+        auto& listener = *grp.members[i];
+        auto out = listener.output.data();
+
+        if (!grp.custom[i]){
+            // everyone else at unity gain
+            if (listener.active){
+                for (int k = 0; k < bs * AOO_MCU_CHANNELS; ++k){
+                    out[k] = sum_[k] - listener.input[k];
+                }
+            } else {
+                std::copy(sum_.begin(), sum_.end(), out);
+            }
+        } else {
+            std::fill(listener.output.begin(), listener.output.end(), 0);
+            for (size_t j = 0; j < n; ++j){
+                auto& talker = *grp.members[j];
+                if (j == i || !talker.active){
+                    continue;
+                }
+                auto gl = grp.gains_left[i * n + j];
+                auto gr = grp.gains_right[i * n + j];
+                auto in = talker.input.data();
+                if (gl != 0.f){
+                    for (int k = 0; k < bs; ++k){
+                        out[k] += in[k] * gl;
+                    }
+                }
+                if (gr != 0.f){
+                    for (int k = 0; k < bs; ++k){
+                        out[bs + k] += in[bs + k] * gr;
+                    }
+                }
+            }
+        }
+
+        const aoo_sample *channels[AOO_MCU_CHANNELS];
+        for (int ch = 0; ch < AOO_MCU_CHANNELS; ++ch){
+            channels[ch] = out + ch * bs;
+        }
+        listener.source->process(channels, bs, t);
+    }
+}
+
+void mcu::handle_events(participant& p){
+    if (p.sink->events_available()){
+        p.sink->handle_events([](void *user, const aoo_event **events, int32_t n){
+            auto p = static_cast<participant *>(user);
+            for (int i = 0; i < n; ++i){
+                if (events[i]->type == AOO_SOURCE_FORMAT_EVENT){
+                    auto e = (const aoo_source_event *)events[i];
+                    aoo_format_storage f;
+                    if (p->sink->get_source_format(e->endpoint, e->id, f) > 0){
+                        p->upstream_channels.store(f.header.nchannels);
+                        LOG_VERBOSE("aoo_server: MCU participant " << p->id << " sends "
+                                    << f.header.nchannels << " channel(s)");
+                    }
+                }
+            }
+            return (int32_t)1;
+        }, &p);
+    }
+
+    if (p.source->events_available()){
+        p.source->handle_events([](void *user, const aoo_event **events, int32_t n){
+            auto p = static_cast<participant *>(user);
+            for (int i = 0; i < n; ++i){
+                if (events[i]->type == AOO_INVITE_EVENT){
+                    auto e = (const aoo_sink_event *)events[i];
+                    if (e->endpoint == &p->downstream){
+                        p->source->add_sink(e->endpoint, e->id, send_reply);
+                        int32_t flags = e->flags;
+                        p->source->set_sinkoption(e->endpoint, e->id, aoo_opt_protocol_flags,
+                                                  &flags, sizeof(int32_t));
+                    }
+                } else if (events[i]->type == AOO_UNINVITE_EVENT){
+                    auto e = (const aoo_sink_event *)events[i];
+                    p->source->remove_sink(e->endpoint, e->id);
+                }
+            }
+            return (int32_t)1;
+        }, &p);
+    }
+}
+
+void mcu::run(){
+    using clock = std::chrono::steady_clock;
+    const auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>((double)AOO_MCU_BLOCKSIZE / AOO_MCU_SAMPLERATE));
+
+    auto deadline = clock::now();
+    while (!quit_){
+        process(time_tag::now().to_uint64());
+
+        deadline += period;
+        auto now = clock::now();
+        if (now - deadline > period * 4){
+            // we fell behind (e.g. the machine was suspended), don't try to catch up
+            LOG_DEBUG("aoo_server: MCU is late, resetting the clock");
+            deadline = now;
+        } else if (deadline > now){
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+}
+
+int32_t mcu::send_reply(void *user, const char *data, int32_t n){
+    auto ep = static_cast<endpoint *>(user);
+    ip_address addr;
+    {
+        std::lock_guard<std::mutex> lock(ep->mutex);
+        if (!ep->valid){
+            return 0;
+        }
+        addr = ep->address;
+    }
+
+    auto result = ::sendto(ep->owner->socket_, data, n, 0,
+                           (const struct sockaddr *)&addr.address, addr.length);
+    if (result < 0){
+        int err = socket_errno();
+    #ifdef _WIN32
+        if (err != WSAEWOULDBLOCK)
+    #else
+        if (err != EWOULDBLOCK)
+    #endif
+        {
+            LOG_ERROR("aoo_server: MCU send() failed (" << err << ")");
+        }
+        return 0;
+    }
+    return n;
+}
+
+} // net
+} // aoo
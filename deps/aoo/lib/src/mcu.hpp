@@ -0,0 +1,163 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "aoo/aoo.hpp"
+#include "aoo/aoo_utils.hpp"
+
+#include "sync.hpp"
+#include "time.hpp"
+#include "net_utils.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// the mixes are made at this rate and block size, the upstreams are resampled.
+// 240 samples is a 5 ms Opus frame.
+#define AOO_MCU_SAMPLERATE 48000
+#define AOO_MCU_BLOCKSIZE 240
+
+// every talker is mixed as stereo, and every mix is stereo
+#define AOO_MCU_CHANNELS 2
+
+// jitter buffer for each upstream, in ms
+#define AOO_MCU_BUFFERSIZE 40
+
+// Opus bitrate of the mixes per channel (PCM without Opus)
+#define AOO_MCU_BITRATE 64000
+
+namespace aoo {
+namespace net {
+
+// Mixes the streams of a group on the server, so every participant sends one
+// stream up and receives one mix back, however many are in the group.
+//
+// Each participant has a server assigned ID. Its client adds the server as a
+// sink with that ID and invites the server as a source with that ID, on the
+// server's UDP port. The server decodes every upstream and sends each
+// participant the sum of all the others (mix-minus), with the gain and pan
+// the participant has set for each of them.
+//
+// All methods are thread safe.
+class mcu {
+public:
+    // 'sock' is the server's UDP socket, the mixes are sent from it.
+    // if 'threaded' the mixes are made on an own thread in real time,
+    // otherwise process() has to be called once per block.
+    mcu(int sock, bool threaded = true);
+    ~mcu();
+
+    // returns the new participant ID
+    int32_t add_participant(const std::string& group, const std::string& user,
+                            const ip_address& addr);
+
+    bool remove_participant(int32_t id);
+
+    int32_t num_participants() const;
+
+    // gain and pan (-1 is left, 1 is right) of 'talker' in the mix that 'listener'
+    // gets, both user names in 'group'. The default is 1 and centered.
+    bool set_gain(const std::string& group, const std::string& listener,
+                  const std::string& talker, float gain, float pan);
+
+    // an AoO source or sink message, 'type' and 'id' come from aoo_parse_pattern().
+    // returns false if the ID isn't one of our participants.
+    bool handle_message(const char *data, int32_t n, int32_t type, int32_t id,
+                        const ip_address& addr);
+
+    // decode all upstreams, then mix and encode one block for every participant.
+    // 't' is the NTP time of the block, see time_tag::to_uint64()
+    void process(uint64_t t);
+private:
+    struct endpoint {
+        mcu *owner = nullptr;
+        std::mutex mutex;
+        ip_address address;
+        bool valid = false;
+    };
+
+    struct gain_setting {
+        float gain = 1.f;
+        float pan = 0.f;
+    };
+
+    struct participant {
+        participant(mcu& _owner, int32_t _id, const std::string& _group,
+                    const std::string& _user, const ip_address& _publisher);
+
+        const int32_t id;
+        const std::string group;
+        const std::string user;
+        // the TCP address of the client, only the host is checked
+        const ip_address publisher;
+
+        endpoint upstream; // the client's source
+        endpoint downstream; // the client's sink
+        aoo::isink::pointer sink; // decodes the upstream
+        aoo::isource::pointer source; // encodes the mix
+        std::atomic<int32_t> upstream_channels{1};
+        // the UDP threads of the server can call handle_message() at the
+        // same time, but the sink and source handlers aren't reentrant
+        std::mutex message_mutex;
+
+        // only the ones that differ from the default, by talker name
+        std::unordered_map<std::string, gain_setting> gains;
+
+        // per block, only touched by process()
+        std::vector<aoo_sample> input;
+        std::vector<aoo_sample> output;
+        bool active = false;
+    };
+
+    using participant_ptr = std::shared_ptr<participant>;
+
+    // the participants of a group with their gains as a matrix,
+    // rebuilt whenever someone joins, leaves or changes a gain
+    struct mix_group {
+        std::vector<participant_ptr> members;
+        // [listener * n + talker] for the left and right channel,
+        // empty if every listener uses the default gains
+        std::vector<float> gains_left;
+        std::vector<float> gains_right;
+        std::vector<bool> custom; // listener has any non-default gain
+        bool dirty = true;
+    };
+
+    int socket_;
+    std::unordered_map<int32_t, participant_ptr> participants_;
+    std::unordered_map<std::string, mix_group> groups_;
+    mutable aoo::shared_mutex mutex_;
+    std::mutex gain_mutex_; // participant::gains and mix_group::dirty
+    std::mt19937 random_;
+    // process() is not reentrant
+    std::mutex process_mutex_;
+    std::vector<aoo_sample> sum_;
+
+    std::thread thread_;
+    std::atomic<bool> quit_{false};
+
+    participant_ptr find_participant(int32_t id) const;
+
+    bool check_address(endpoint& ep, const participant& p, const ip_address& addr);
+
+    void update_gains(mix_group& grp);
+
+    void mix_group_block(mix_group& grp, uint64_t t);
+
+    void handle_events(participant& p);
+
+    void run();
+
+    static int32_t send_reply(void *user, const char *data, int32_t n);
+};
+
+} // net
+} // aoo
@@ -85,6 +85,18 @@ struct ip_address {
         }
     }
 
+    // same address, the port doesn't matter
+    bool same_host(const ip_address& other) const {
+        if (address.ss_family == AF_INET && other.address.ss_family == AF_INET){
+            auto a = (const struct sockaddr_in *)&address;
+            auto b = (const struct sockaddr_in *)&other.address;
+            return a->sin_addr.s_addr == b->sin_addr.s_addr;
+        } else {
+            // IPv6 not supported yet
+            return false;
+        }
+    }
+
     std::string name() const {
         if (address.ss_family == AF_INET){
             return inet_ntoa(reinterpret_cast<const struct sockaddr_in *>(&address)->sin_addr);
@@ -0,0 +1,582 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#include "relay.hpp"
+
+#include "oscpack/osc/OscOutboundPacketStream.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace aoo {
+namespace net {
+
+namespace {
+
+// "/aoo/<type>/<id><pattern>"
+void make_address(char *buf, size_t size, const char *type,
+                  int32_t id, const char *pattern)
+{
+    snprintf(buf, size, "%s%s/%d%s", AOO_MSG_DOMAIN, type, id, pattern);
+}
+
+const int32_t max_addr_size = AOO_MSG_DOMAIN_LEN + AOO_MSG_SINK_LEN + 16 + AOO_MSG_UNINVITE_LEN;
+
+} // namespace
+
+relay::relay()
+    : random_(std::random_device{}()) {}
+
+int32_t relay::add_stream(const std::string& group, const std::string& user,
+                          const ip_address& publisher)
+{
+    unique_lock lock(mutex_);
+    // positive IDs only, the negative ones are the wildcard and 'none'
+    std::uniform_int_distribution<int32_t> dist(1, INT32_MAX);
+    int32_t id;
+    do {
+        id = dist(random_);
+    } while (streams_.count(id));
+
+    auto s = std::make_shared<stream>(id, group, user, publisher);
+    s->history.resize(AOO_RELAY_HISTORY_SIZE);
+    s->last_prune = time_tag::now();
+    streams_.emplace(id, std::move(s));
+
+    LOG_VERBOSE("aoo_server: added relay stream " << id << " for "
+                << user << " in group " << group);
+
+    return id;
+}
+
+bool relay::remove_stream(int32_t id){
+    unique_lock lock(mutex_);
+    if (streams_.erase(id) > 0){
+        LOG_VERBOSE("aoo_server: removed relay stream " << id);
+        return true;
+    } else {
+        return false;
+    }
+}
+
+int32_t relay::num_streams() const {
+    shared_lock lock(mutex_);
+    return (int32_t) streams_.size();
+}
+
+std::shared_ptr<relay::stream> relay::find_stream(int32_t id) const {
+    shared_lock lock(mutex_);
+    auto it = streams_.find(id);
+    if (it != streams_.end()){
+        return it->second;
+    } else {
+        return nullptr;
+    }
+}
+
+void relay::handle_message(int sock, const osc::ReceivedMessage& msg,
+                           int32_t type, int32_t id, int32_t onset,
+                           const ip_address& addr)
+{
+    // the stream keeps itself alive while we're using it, even if
+    // the publisher leaves in the meantime
+    auto s = find_stream(id);
+    if (!s){
+        LOG_DEBUG("aoo_server: no relay stream " << id);
+        return;
+    }
+
+    auto pattern = msg.AddressPattern() + onset;
+
+    std::lock_guard<std::mutex> lock(s->mutex);
+
+    auto now = time_tag::now();
+    if (time_tag::duration(s->last_prune, now) > 1.0){
+        prune_subscribers(*s, now);
+        s->last_prune = now;
+    }
+
+    try {
+        if (type == AOO_TYPE_SINK){
+            // from the publisher's source
+            if (!strcmp(pattern, AOO_MSG_DATA)){
+                handle_data(sock, *s, msg, addr);
+            } else if (!strcmp(pattern, AOO_MSG_FORMAT)){
+                handle_format(sock, *s, msg, addr);
+            } else if (!strcmp(pattern, AOO_MSG_PING)){
+                handle_source_ping(sock, *s, msg, addr);
+            } else {
+                LOG_WARNING("aoo_server: unknown relay message " << msg.AddressPattern());
+            }
+        } else if (type == AOO_TYPE_SOURCE){
+            // from a subscriber's sink
+            if (!strcmp(pattern, AOO_MSG_DATA)){
+                handle_data_request(sock, *s, msg, addr);
+            } else if (!strcmp(pattern, AOO_MSG_PING)){
+                handle_sink_ping(sock, *s, msg, addr);
+            } else if (!strcmp(pattern, AOO_MSG_INVITE)){
+                handle_invite(sock, *s, msg, addr);
+            } else if (!strcmp(pattern, AOO_MSG_UNINVITE)){
+                handle_uninvite(*s, msg, addr);
+            } else if (!strcmp(pattern, AOO_MSG_FORMAT)){
+                handle_format_request(sock, *s, msg, addr);
+            } else if (!strcmp(pattern, AOO_MSG_CODEC_CHANGE)){
+                // the publisher picks the codec for everyone
+            } else {
+                LOG_WARNING("aoo_server: unknown relay message " << msg.AddressPattern());
+            }
+        }
+    } catch (const osc::Exception& e){
+        LOG_ERROR("aoo_server: exception on handling relay message "
+                  << msg.AddressPattern() << ": " << e.what());
+    }
+}
+
+bool relay::check_upstream(stream& s, const ip_address& addr){
+    if (s.has_upstream && s.upstream == addr){
+        return true;
+    }
+    // the source must be on the same host as the publisher's TCP connection;
+    // the port can change (e.g. a NAT rebinding)
+    if (addr.same_host(s.publisher)){
+        s.upstream = addr;
+        s.has_upstream = true;
+        return true;
+    } else {
+        LOG_WARNING("aoo_server: relay stream " << s.id << " from unknown host "
+                    << addr.name() << ":" << addr.port());
+        return false;
+    }
+}
+
+relay::subscriber * relay::find_subscriber(stream& s, const ip_address& addr, int32_t sink){
+    for (auto& sub : s.subscribers){
+        if (sub.sink == sink && sub.address == addr){
+            return &sub;
+        }
+    }
+    return nullptr;
+}
+
+void relay::prune_subscribers(stream& s, time_tag now){
+    auto it = std::remove_if(s.subscribers.begin(), s.subscribers.end(), [&](auto& sub){
+        return time_tag::duration(sub.last_seen, now) > AOO_RELAY_SUBSCRIBER_TIMEOUT;
+    });
+    if (it != s.subscribers.end()){
+        LOG_VERBOSE("aoo_server: relay stream " << s.id << ": dropped "
+                    << (s.subscribers.end() - it) << " inactive subscriber(s)");
+        s.subscribers.erase(it, s.subscribers.end());
+    }
+}
+
+/*///////////////////// publisher //////////////////////////*/
+
+// /aoo/sink/<stream>/format <src> <version> <salt> <nchannels> <samplerate>
+// <blocksize> <codec> <settings> [<userformat>]
+
+void relay::handle_format(int sock, stream& s, const osc::ReceivedMessage& msg,
+                          const ip_address& addr)
+{
+    if (!check_upstream(s, addr)){
+        return;
+    }
+
+    auto it = msg.ArgumentsBegin();
+    s.source = (it++)->AsInt32();
+    s.version = (it++)->AsInt32();
+    auto salt = (it++)->AsInt32();
+    s.nchannels = (it++)->AsInt32();
+    s.samplerate = (it++)->AsInt32();
+    s.blocksize = (it++)->AsInt32();
+    s.codec = (it++)->AsString();
+
+    const void *settings;
+    osc::osc_bundle_element_size_t size;
+    (it++)->AsBlob(settings, size);
+    s.settings.assign((const char *)settings, (const char *)settings + size);
+
+    s.userformat.clear();
+    if (msg.ArgumentCount() > 8){
+        const void *userfmt;
+        osc::osc_bundle_element_size_t ufsize;
+        (it++)->AsBlob(userfmt, ufsize);
+        s.userformat.assign((const char *)userfmt, (const char *)userfmt + ufsize);
+    }
+
+    if (salt != s.salt){
+        // a new stream, the old frames are useless
+        for (auto& f : s.history){
+            f.sequence = -1;
+        }
+        s.newest_sequence = -1;
+        s.pending.clear();
+        s.salt = salt;
+    }
+    s.has_format = true;
+
+    LOG_DEBUG("aoo_server: relay stream " << s.id << ": format from source " << s.source);
+
+    for (auto& sub : s.subscribers){
+        send_format(sock, s, sub);
+    }
+}
+
+// /aoo/sink/<stream>/data <src> <salt> <seq> <sr> <channel_onset>
+// <totalsize> <numpackets> <packetnum> <data>
+
+void relay::handle_data(int sock, stream& s, const osc::ReceivedMessage& msg,
+                        const ip_address& addr)
+{
+    if (!check_upstream(s, addr)){
+        return;
+    }
+
+    auto it = msg.ArgumentsBegin();
+    s.source = (it++)->AsInt32();
+    auto salt = (it++)->AsInt32();
+    auto seq = (it++)->AsInt32();
+    auto sr = (it++)->AsDouble();
+    auto channel = (it++)->AsInt32();
+    auto totalsize = (it++)->AsInt32();
+    auto nframes = (it++)->AsInt32();
+    auto index = (it++)->AsInt32();
+    const void *blobdata;
+    osc::osc_bundle_element_size_t blobsize;
+    (it++)->AsBlob(blobdata, blobsize);
+
+    if (salt != s.salt){
+        // data before the format, the subscribers couldn't use it anyway
+        LOG_DEBUG("aoo_server: relay stream " << s.id << ": data with unknown salt");
+        return;
+    }
+
+    bool late = false;
+    if (seq <= s.newest_sequence){
+        // the publisher only resends what we asked for, which the subscribers that
+        // asked don't have; but the redundant copies (see AOO_SEND_REDUNDANCY) are only
+        // passed on once. Newest first, they are usually right behind the original.
+        auto size = (int32_t)s.history.size();
+        for (int32_t i = 1; i <= size; ++i){
+            auto& f = s.history[(s.history_head - i + size) % size];
+            if (f.sequence == seq && f.frame_index == index && f.salt == salt){
+                return;
+            }
+        }
+        late = true;
+    } else {
+        s.newest_sequence = seq;
+    }
+
+    // overwrite the oldest frame
+    auto& f = s.history[s.history_head];
+    s.history_head = (s.history_head + 1) % (int32_t)s.history.size();
+    f.sequence = seq;
+    f.frame_index = index;
+    f.salt = salt;
+    f.samplerate = sr;
+    f.channel = channel;
+    f.totalsize = totalsize;
+    f.nframes = nframes;
+    f.data.assign((const char *)blobdata, (const char *)blobdata + blobsize);
+
+    // a resent frame only goes to whoever asked for it,
+    // one that nobody asked for just came out of order
+    if (late && send_resent(sock, s, f)){
+        return;
+    }
+
+    for (auto& sub : s.subscribers){
+        send_data(sock, s, sub, f);
+    }
+}
+
+// /aoo/sink/<stream>/ping <src> <time>
+
+void relay::handle_source_ping(int sock, stream& s, const osc::ReceivedMessage& msg,
+                               const ip_address& addr)
+{
+    if (!check_upstream(s, addr)){
+        return;
+    }
+
+    auto it = msg.ArgumentsBegin();
+    s.source = (it++)->AsInt32();
+    auto tt = (it++)->AsTimeTag();
+
+    for (auto& sub : s.subscribers){
+        char buf[AOO_MAXPACKETSIZE];
+        osc::OutboundPacketStream reply(buf, sizeof(buf));
+        char address[max_addr_size];
+        make_address(address, sizeof(address), AOO_MSG_SINK, sub.sink, AOO_MSG_PING);
+
+        reply << osc::BeginMessage(address) << s.id << osc::TimeTag(tt)
+              << osc::EndMessage;
+
+        send_message(sock, reply.Data(), (int32_t) reply.Size(), sub.address);
+    }
+}
+
+/*///////////////////// subscribers //////////////////////////*/
+
+// /aoo/src/<stream>/invite <sink> [<flags>]
+
+void relay::handle_invite(int sock, stream& s, const osc::ReceivedMessage& msg,
+                          const ip_address& addr)
+{
+    auto it = msg.ArgumentsBegin();
+    auto sink = (it++)->AsInt32();
+    // the flags are ignored, the data goes out in the publisher's format
+
+    auto sub = find_subscriber(s, addr, sink);
+    if (sub){
+        // the sink re-invites to keep the subscription alive;
+        // resending the format would restart its stream
+        sub->last_seen = time_tag::now();
+        return;
+    }
+
+    s.subscribers.push_back(subscriber { addr, sink, time_tag::now() });
+
+    LOG_VERBOSE("aoo_server: relay stream " << s.id << ": new subscriber "
+                << addr.name() << ":" << addr.port() << " (sink " << sink << ")");
+
+    if (s.has_format){
+        send_format(sock, s, s.subscribers.back());
+    }
+}
+
+// /aoo/src/<stream>/uninvite <sink>
+
+void relay::handle_uninvite(stream& s, const osc::ReceivedMessage& msg,
+                            const ip_address& addr)
+{
+    auto sink = msg.ArgumentsBegin()->AsInt32();
+
+    auto it = std::find_if(s.subscribers.begin(), s.subscribers.end(), [&](auto& sub){
+        return sub.sink == sink && sub.address == addr;
+    });
+    if (it != s.subscribers.end()){
+        s.subscribers.erase(it);
+        LOG_VERBOSE("aoo_server: relay stream " << s.id << ": removed subscriber "
+                    << addr.name() << ":" << addr.port() << " (sink " << sink << ")");
+    }
+}
+
+// /aoo/src/<stream>/format <sink> <version>
+
+void relay::handle_format_request(int sock, stream& s, const osc::ReceivedMessage& msg,
+                                  const ip_address& addr)
+{
+    auto sink = msg.ArgumentsBegin()->AsInt32();
+
+    auto sub = find_subscriber(s, addr, sink);
+    if (sub){
+        sub->last_seen = time_tag::now();
+        if (s.has_format){
+            send_format(sock, s, *sub);
+        }
+    }
+}
+
+// /aoo/src/<stream>/data <sink> <salt> <seq0> <frame0> <seq1> <frame1> ...
+
+void relay::handle_data_request(int sock, stream& s, const osc::ReceivedMessage& msg,
+                                const ip_address& addr)
+{
+    auto it = msg.ArgumentsBegin();
+    auto sink = (it++)->AsInt32();
+    auto salt = (it++)->AsInt32();
+
+    auto sub = find_subscriber(s, addr, sink);
+    if (!sub){
+        return;
+    }
+    sub->last_seen = time_tag::now();
+
+    if (salt != s.salt){
+        return; // an old stream
+    }
+
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream request(buf, sizeof(buf));
+    int32_t nmissing = 0;
+
+    if (s.has_upstream && s.source != AOO_ID_NONE){
+        char address[max_addr_size];
+        make_address(address, sizeof(address), AOO_MSG_SOURCE, s.source, AOO_MSG_DATA);
+        request << osc::BeginMessage(address) << s.id << salt;
+    }
+
+    int npairs = (msg.ArgumentCount() - 2) / 2;
+    while (npairs--){
+        auto seq = (it++)->AsInt32();
+        auto index = (it++)->AsInt32(); // < 0: all frames of the block
+
+        // newest first, most requests are for recent frames
+        int32_t nfound = 0;
+        int32_t nframes = 0;
+        auto size = (int32_t)s.history.size();
+        for (int32_t i = 1; i <= size; ++i){
+            auto& f = s.history[(s.history_head - i + size) % size];
+            if (f.sequence == seq && f.salt == salt
+                && (index < 0 || f.frame_index == index)){
+                send_data(sock, s, *sub, f);
+                nfound++;
+                nframes = f.nframes;
+                if (index >= 0){
+                    break;
+                }
+            }
+        }
+
+        // only ask the publisher for what we don't have all of. It resends the
+        // whole block, the frames we already sent are dropped as duplicates
+        bool found = nfound > 0 && (index >= 0 || nfound >= nframes);
+        if (!found && s.has_upstream && s.source != AOO_ID_NONE){
+            request << seq << index;
+            nmissing++;
+            add_pending(s, *sub, seq, index);
+        }
+    }
+
+    if (nmissing > 0){
+        request << osc::EndMessage;
+        send_message(sock, request.Data(), (int32_t) request.Size(), s.upstream);
+    }
+}
+
+// /aoo/src/<stream>/ping <sink> <time1> <time2> <lost_blocks>
+
+void relay::handle_sink_ping(int sock, stream& s, const osc::ReceivedMessage& msg,
+                             const ip_address& addr)
+{
+    auto it = msg.ArgumentsBegin();
+    auto sink = (it++)->AsInt32();
+    auto tt1 = (it++)->AsTimeTag();
+    auto tt2 = (it++)->AsTimeTag();
+    auto lost = (it++)->AsInt32();
+
+    auto sub = find_subscriber(s, addr, sink);
+    if (!sub){
+        return;
+    }
+    sub->last_seen = time_tag::now();
+
+    // pass it on, so the publisher still sees how its stream is doing
+    if (s.has_upstream && s.source != AOO_ID_NONE){
+        char buf[AOO_MAXPACKETSIZE];
+        osc::OutboundPacketStream reply(buf, sizeof(buf));
+        char address[max_addr_size];
+        make_address(address, sizeof(address), AOO_MSG_SOURCE, s.source, AOO_MSG_PING);
+
+        reply << osc::BeginMessage(address) << s.id << osc::TimeTag(tt1)
+              << osc::TimeTag(tt2) << lost << osc::EndMessage;
+
+        send_message(sock, reply.Data(), (int32_t) reply.Size(), s.upstream);
+    }
+}
+
+void relay::add_pending(stream& s, const subscriber& sub, int32_t seq, int32_t index){
+    // forget the ones that are too old to still come
+    auto it = std::remove_if(s.pending.begin(), s.pending.end(), [&](auto& p){
+        return p.sequence < s.newest_sequence - AOO_RELAY_HISTORY_SIZE;
+    });
+    s.pending.erase(it, s.pending.end());
+
+    for (auto p = s.pending.begin(); p != s.pending.end(); ){
+        if (p->sink == sub.sink && p->address == sub.address && p->sequence == seq){
+            if (p->frame_index < 0 || p->frame_index == index){
+                return; // already waiting for it
+            }
+            if (index < 0){
+                // the whole block replaces the single frames
+                p = s.pending.erase(p);
+                continue;
+            }
+        }
+        ++p;
+    }
+
+    if ((int32_t)s.pending.size() >= AOO_RELAY_MAX_PENDING){
+        s.pending.erase(s.pending.begin());
+    }
+    s.pending.push_back(pending_request { sub.address, sub.sink, seq, index });
+}
+
+bool relay::send_resent(int sock, stream& s, const frame& f){
+    bool requested = false;
+    auto keep = s.pending.begin();
+    for (auto p = s.pending.begin(); p != s.pending.end(); ++p){
+        if (p->sequence == f.sequence && (p->frame_index < 0 || p->frame_index == f.frame_index)){
+            requested = true;
+            if (auto sub = find_subscriber(s, p->address, p->sink)){
+                send_data(sock, s, *sub, f);
+            }
+            // a whole block waits for the rest of its frames
+            if (p->frame_index >= 0){
+                continue;
+            }
+        }
+        if (keep != p){
+            *keep = std::move(*p);
+        }
+        ++keep;
+    }
+    s.pending.erase(keep, s.pending.end());
+    return requested;
+}
+
+/*///////////////////// sending //////////////////////////*/
+
+void relay::send_format(int sock, const stream& s, const subscriber& sub){
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    char address[max_addr_size];
+    make_address(address, sizeof(address), AOO_MSG_SINK, sub.sink, AOO_MSG_FORMAT);
+
+    // the stream ID takes the place of the source ID
+    msg << osc::BeginMessage(address) << s.id << s.version << s.salt
+        << s.nchannels << s.samplerate << s.blocksize << s.codec.c_str()
+        << osc::Blob(s.settings.data(), (int32_t)s.settings.size());
+    if (!s.userformat.empty()){
+        msg << osc::Blob(s.userformat.data(), (int32_t)s.userformat.size());
+    }
+    msg << osc::EndMessage;
+
+    send_message(sock, msg.Data(), (int32_t) msg.Size(), sub.address);
+}
+
+void relay::send_data(int sock, const stream& s, const subscriber& sub, const frame& f){
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    char address[max_addr_size];
+    make_address(address, sizeof(address), AOO_MSG_SINK, sub.sink, AOO_MSG_DATA);
+
+    msg << osc::BeginMessage(address) << s.id << f.salt << f.sequence << f.samplerate
+        << f.channel << f.totalsize << f.nframes << f.frame_index
+        << osc::Blob(f.data.data(), (int32_t)f.data.size()) << osc::EndMessage;
+
+    send_message(sock, msg.Data(), (int32_t) msg.Size(), sub.address);
+}
+
+void relay::send_message(int sock, const char *data, int32_t size,
+                         const ip_address& addr)
+{
+    auto result = ::sendto(sock, data, size, 0,
+                           (const struct sockaddr *)&addr.address, addr.length);
+    if (result < 0){
+        int err = socket_errno();
+    #ifdef _WIN32
+        if (err != WSAEWOULDBLOCK)
+    #else
+        if (err != EWOULDBLOCK)
+    #endif
+        {
+            LOG_ERROR("aoo_server: relay send() failed (" << err << ")");
+        }
+    }
+}
+
+} // net
+} // aoo
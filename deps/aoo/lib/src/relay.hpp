@@ -0,0 +1,180 @@
+/* Copyright (c) 2010-Now Christof Ressi, Winfried Ritsch and others.
+ * For information on usage and redistribution, and for a DISCLAIMER OF ALL
+ * WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+#pragma once
+
+#include "aoo/aoo.h"
+#include "aoo/aoo_utils.hpp"
+
+#include "sync.hpp"
+#include "time.hpp"
+#include "net_utils.hpp"
+
+#include "oscpack/osc/OscReceivedElements.h"
+
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// number of data frames each stream keeps for resend requests
+#define AOO_RELAY_HISTORY_SIZE 1024
+
+// resend requests passed on to the publisher that each stream remembers,
+// so the frames it resends only go to the subscribers that asked for them
+#define AOO_RELAY_MAX_PENDING 1024
+
+// subscribers that haven't sent anything (invites, pings, requests)
+// for this long are dropped, in seconds
+#define AOO_RELAY_SUBSCRIBER_TIMEOUT 30.0
+
+namespace aoo {
+namespace net {
+
+// Forwards the stream a client publishes to every group member that subscribed
+// to it, so the publisher only has to upload it once. The data is never decoded.
+//
+// Each stream has a server assigned ID. The publisher's source adds the server
+// as a sink with that ID, and the subscribers invite it as a source with that ID
+// on the server address. Format, data and ping messages are passed on to the
+// subscribers, with their own sink ID; the salt and the sequence numbers stay
+// the same. Resend requests are answered from a history of recent frames, and
+// only the missing ones are asked from the publisher. What it resends goes to
+// the subscribers that asked for it.
+//
+// All methods are thread safe.
+class relay {
+public:
+    relay();
+
+    // returns the new stream ID
+    int32_t add_stream(const std::string& group, const std::string& user,
+                       const ip_address& publisher);
+
+    bool remove_stream(int32_t id);
+
+    int32_t num_streams() const;
+
+    // a /aoo/sink or /aoo/src message for one of the streams,
+    // 'type' and 'id' come from aoo_parse_pattern()
+    void handle_message(int sock, const osc::ReceivedMessage& msg,
+                        int32_t type, int32_t id, int32_t onset,
+                        const ip_address& addr);
+private:
+    struct frame {
+        int32_t sequence = -1;
+        int32_t frame_index = 0;
+        int32_t salt = 0;
+        double samplerate = 0;
+        int32_t channel = 0;
+        int32_t totalsize = 0;
+        int32_t nframes = 0;
+        std::vector<char> data;
+    };
+
+    struct subscriber {
+        ip_address address;
+        int32_t sink = 0;
+        time_tag last_seen;
+    };
+
+    // a subscriber waiting for a frame we asked the publisher for
+    struct pending_request {
+        ip_address address;
+        int32_t sink = 0;
+        int32_t sequence = -1;
+        int32_t frame_index = 0; // < 0: all frames of the block
+    };
+
+    struct stream {
+        stream(int32_t _id, const std::string& _group, const std::string& _user,
+               const ip_address& _publisher)
+            : id(_id), group(_group), user(_user), publisher(_publisher) {}
+
+        const int32_t id;
+        const std::string group;
+        const std::string user;
+        // the TCP address of the publisher, only the host is checked
+        const ip_address publisher;
+
+        std::mutex mutex;
+        // the publisher's source
+        ip_address upstream;
+        bool has_upstream = false;
+        int32_t source = AOO_ID_NONE;
+        // the last format message
+        bool has_format = false;
+        int32_t version = 0;
+        int32_t salt = 0;
+        int32_t nchannels = 0;
+        int32_t samplerate = 0;
+        int32_t blocksize = 0;
+        std::string codec;
+        std::vector<char> settings;
+        std::vector<char> userformat;
+        // recent frames, in the order they arrived
+        std::vector<frame> history;
+        int32_t history_head = 0;
+        int32_t newest_sequence = -1;
+        // requests passed on to the publisher, oldest first
+        std::vector<pending_request> pending;
+        std::vector<subscriber> subscribers;
+        time_tag last_prune;
+    };
+
+    std::unordered_map<int32_t, std::shared_ptr<stream>> streams_;
+    mutable aoo::shared_mutex mutex_;
+    std::mt19937 random_;
+
+    std::shared_ptr<stream> find_stream(int32_t id) const;
+
+    bool check_upstream(stream& s, const ip_address& addr);
+
+    subscriber * find_subscriber(stream& s, const ip_address& addr, int32_t sink);
+
+    void prune_subscribers(stream& s, time_tag now);
+
+    void add_pending(stream& s, const subscriber& sub, int32_t seq, int32_t index);
+
+    // returns false if nobody asked for it
+    bool send_resent(int sock, stream& s, const frame& f);
+
+    // from the publisher
+    void handle_format(int sock, stream& s, const osc::ReceivedMessage& msg,
+                       const ip_address& addr);
+
+    void handle_data(int sock, stream& s, const osc::ReceivedMessage& msg,
+                     const ip_address& addr);
+
+    void handle_source_ping(int sock, stream& s, const osc::ReceivedMessage& msg,
+                            const ip_address& addr);
+
+    // from the subscribers
+    void handle_invite(int sock, stream& s, const osc::ReceivedMessage& msg,
+                       const ip_address& addr);
+
+    void handle_uninvite(stream& s, const osc::ReceivedMessage& msg,
+                         const ip_address& addr);
+
+    void handle_format_request(int sock, stream& s, const osc::ReceivedMessage& msg,
+                               const ip_address& addr);
+
+    void handle_data_request(int sock, stream& s, const osc::ReceivedMessage& msg,
+                             const ip_address& addr);
+
+    void handle_sink_ping(int sock, stream& s, const osc::ReceivedMessage& msg,
+                          const ip_address& addr);
+
+    void send_format(int sock, const stream& s, const subscriber& sub);
+
+    void send_data(int sock, const stream& s, const subscriber& sub, const frame& f);
+
+    void send_message(int sock, const char *data, int32_t size,
+                      const ip_address& addr);
+};
+
+} // net
+} // aoo
@@ -8,6 +8,11 @@
 #include <algorithm>
 #include <random>
 
+#if AOO_SERVER_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #define AOONET_MSG_CLIENT_PING \
     AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_PING
 
@@ -39,6 +44,24 @@
 #define AOONET_MSG_CLIENT_PEER_LEAVE \
     AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_PEER AOONET_MSG_LEAVE
 
+#define AOONET_MSG_CLIENT_RELAY_PUBLISH \
+    AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_RELAY AOONET_MSG_PUBLISH
+
+#define AOONET_MSG_CLIENT_RELAY_ADD \
+    AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_RELAY AOONET_MSG_ADD
+
+#define AOONET_MSG_CLIENT_RELAY_DEL \
+    AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_RELAY AOONET_MSG_DEL
+
+#define AOONET_MSG_CLIENT_MCU_JOIN \
+    AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_MCU AOONET_MSG_JOIN
+
+#define AOONET_MSG_CLIENT_MCU_ADD \
+    AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_MCU AOONET_MSG_ADD
+
+#define AOONET_MSG_CLIENT_MCU_DEL \
+    AOO_MSG_DOMAIN AOONET_MSG_CLIENT AOONET_MSG_MCU AOONET_MSG_DEL
+
 #define AOONET_MSG_GROUP_JOIN \
     AOONET_MSG_GROUP AOONET_MSG_JOIN
 
@@ -48,6 +71,21 @@
 #define AOONET_MSG_GROUP_PUBLIC \
     AOONET_MSG_GROUP AOONET_MSG_PUBLIC
 
+#define AOONET_MSG_RELAY_PUBLISH \
+    AOONET_MSG_RELAY AOONET_MSG_PUBLISH
+
+#define AOONET_MSG_RELAY_UNPUBLISH \
+    AOONET_MSG_RELAY AOONET_MSG_UNPUBLISH
+
+#define AOONET_MSG_MCU_JOIN \
+    AOONET_MSG_MCU AOONET_MSG_JOIN
+
+#define AOONET_MSG_MCU_LEAVE \
+    AOONET_MSG_MCU AOONET_MSG_LEAVE
+
+#define AOONET_MSG_MCU_GAIN \
+    AOONET_MSG_MCU AOONET_MSG_GAIN
+
 
 namespace aoo {
 namespace net {
@@ -60,6 +98,10 @@ char * copy_string(const char * s);
 /*//////////////////// AoO server /////////////////////*/
 
 aoonet_server * aoonet_server_new(int port, int32_t *err) {
+    return aoonet_server_new_threaded(port, 0, err);
+}
+
+aoonet_server * aoonet_server_new_threaded(int port, int32_t nthreads, int32_t *err) {
     int val = 0;
 
     // make 'any' address
@@ -89,6 +131,15 @@ aoonet_server * aoonet_server_new(int port, int32_t *err) {
     }
 #endif
 
+#if AOO_SERVER_EPOLL && defined(SO_REUSEPORT)
+    // so that the other shards can bind their UDP sockets to the same port
+    val = 1;
+    if (setsockopt(udpsocket, SOL_SOCKET, SO_REUSEPORT, (char *)&val, sizeof(val)) < 0){
+        LOG_WARNING("aoo_server: couldn't set SO_REUSEPORT");
+        // ignore, only the first shard will get UDP messages
+    }
+#endif
+
     if (bind(udpsocket, (sockaddr *)&sa, sizeof(sa)) < 0){
         *err = aoo::net::socket_errno();
         LOG_ERROR("aoo_server: couldn't bind UDP socket (" << *err << ")");
@@ -147,7 +198,7 @@ aoonet_server * aoonet_server_new(int port, int32_t *err) {
     }
 
     // listen
-    if (listen(tcpsocket, 32) < 0){
+    if (listen(tcpsocket, SOMAXCONN) < 0){
         *err = aoo::net::socket_errno();
         LOG_ERROR("aoo_server: listen() failed (" << *err << ")");
         aoo::net::socket_close(tcpsocket);
@@ -155,11 +206,11 @@ aoonet_server * aoonet_server_new(int port, int32_t *err) {
         return nullptr;
     }
 
-    return new aoo::net::server(tcpsocket, udpsocket);
+    return new aoo::net::server(tcpsocket, udpsocket, nthreads);
 }
 
-aoo::net::server::server(int tcpsocket, int udpsocket)
-    : tcpsocket_(tcpsocket), udpsocket_(udpsocket)
+aoo::net::server::server(int tcpsocket, int udpsocket, int32_t nthreads)
+    : tcpsocket_(tcpsocket), udpsocket_(udpsocket), nthreads_(std::max<int32_t>(0, nthreads))
 {
 #ifdef _WIN32
     waitevent_ = CreateEvent(NULL, FALSE, FALSE, NULL);
@@ -192,6 +243,9 @@ aoo::net::server::~server() {
     close(waitpipe_[1]);
 #endif
 
+    // the MCU thread sends on the UDP socket
+    mcu_.reset();
+
     socket_close(tcpsocket_);
     socket_close(udpsocket_);
 }
@@ -201,6 +255,13 @@ int32_t aoonet_server_run(aoonet_server *server){
 }
 
 int32_t aoo::net::server::run(){
+#if AOO_SERVER_EPOLL
+    if (!start_shards()){
+        stop_shards();
+        return 0;
+    }
+#endif
+
     while (!quit_.load()){
         // wait for networking or other events
         wait_for_event();
@@ -223,6 +284,9 @@ int32_t aoo::net::server::run(){
     for (int i = 0; i < clients_.size(); ++i){
         clients_[i]->close(false);
     }
+#if AOO_SERVER_EPOLL
+    stop_shards();
+#endif
     
     return 1;
 }
@@ -272,6 +336,47 @@ int32_t aoo::net::server::handle_events(aoo_eventhandler fn, void *user){
     return n;
 }
 
+int32_t aoonet_server_set_relay(aoonet_server *server, int32_t enable){
+    return server->set_relay(enable != 0);
+}
+
+int32_t aoo::net::server::set_relay(bool enable){
+    // only before run(), the network threads don't lock 'relay_'
+    if (enable){
+        if (!relay_){
+            relay_ = std::make_unique<relay>();
+        }
+    } else {
+        relay_.reset();
+    }
+    return 1;
+}
+
+int32_t aoo::net::server::get_relay_stream_count() const {
+    return relay_ ? relay_->num_streams() : 0;
+}
+
+int32_t aoonet_server_set_mcu(aoonet_server *server, int32_t enable){
+    return server->set_mcu(enable != 0);
+}
+
+int32_t aoo::net::server::set_mcu(bool enable){
+    // only before run(), the network threads don't lock 'mcu_'
+    if (enable){
+        if (!mcu_){
+            // mixes in real time on its own thread
+            mcu_ = std::make_unique<mcu>(udpsocket_);
+        }
+    } else {
+        mcu_.reset();
+    }
+    return 1;
+}
+
+int32_t aoo::net::server::get_mcu_participant_count() const {
+    return mcu_ ? mcu_->num_participants() : 0;
+}
+
 namespace aoo {
 namespace net {
 
@@ -310,7 +415,7 @@ std::shared_ptr<user> server::get_user(const std::string& name,
         // create new user (LATER add option to disallow this)
         if (true){
             usr = std::make_shared<user>(name, pwd);
-            users_.push_back(usr);
+            users_.emplace(name, usr);
             e = error::none;
             return usr;
         } else {
@@ -322,12 +427,8 @@ std::shared_ptr<user> server::get_user(const std::string& name,
 
 std::shared_ptr<user> server::find_user(const std::string& name)
 {
-    for (auto& usr : users_){
-        if (usr->name == name){
-            return usr;
-        }
-    }
-    return nullptr;
+    auto it = users_.find(name);
+    return it != users_.end() ? it->second : nullptr;
 }
 
 std::shared_ptr<group> server::get_group(const std::string& name,
@@ -353,7 +454,10 @@ std::shared_ptr<group> server::get_group(const std::string& name,
         // create new group (LATER add option to disallow this)
         if (true){
             grp = std::make_shared<group>(name, pwd, is_public);
-            groups_.push_back(grp);
+            groups_.emplace(name, grp);
+            if (is_public){
+                public_groups_.add(grp);
+            }
             e = error::none;
             return grp;
         } else {
@@ -365,22 +469,31 @@ std::shared_ptr<group> server::get_group(const std::string& name,
 
 std::shared_ptr<group> server::find_group(const std::string& name)
 {
-    for (auto& grp : groups_){
-        if (grp->name == name){
-            return grp;
-        }
+    auto it = groups_.find(name);
+    return it != groups_.end() ? it->second : nullptr;
+}
+
+void server::remove_group(std::shared_ptr<group> grp)
+{
+    // 'grp' keeps it alive until we're done
+    if (grp->is_public){
+        public_groups_.remove(*grp);
+        on_public_group_removed(*grp);
     }
-    return nullptr;
+    groups_.erase(grp->name);
 }
 
 int32_t server::get_group_count() const
 {
+    // the shards change the registries while they hold it
+    std::lock_guard<std::mutex> lock(state_mutex_);
     return (int32_t) groups_.size();
 }
 
 int32_t server::get_user_count() const
 {
-    return (int32_t) users_.size();    
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    return (int32_t) users_.size();
 }
 
 void server::on_user_joined(user &usr){
@@ -393,36 +506,68 @@ void server::on_user_left(user &usr){
     auto e = std::make_unique<user_event>(AOONET_SERVER_USER_LEAVE_EVENT,
                                           usr.name.c_str());
     push_event(std::move(e));
+
+    // LATER add an option so that users will persist
+    public_watchers_.remove(usr);
+    users_.erase(usr.name);
 }
 
 void server::on_user_joined_group(user& usr, group& grp){
+    char buf[AOO_MAXPACKETSIZE];
+
+    auto make_message = [&](osc::OutboundPacketStream& msg, user& u){
+        auto e = u.endpoint;
+
+        msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_JOIN)
+            << grp.name.c_str() << u.name.c_str()
+            << e->public_address.name().c_str() << e->public_address.port()
+            << e->local_address.name().c_str() << e->local_address.port()
+            << e->token
+            << osc::EndMessage;
+    };
+
     // 1) send the new member to existing group members
-    // 2) send existing group members to the new member
+    // (the same message for all of them)
+    osc::OutboundPacketStream newmsg(buf, sizeof(buf));
+    make_message(newmsg, usr);
+
     for (auto& peer : grp.users()){
         if (peer.get() != &usr){
-            char buf[AOO_MAXPACKETSIZE];
+            peer->endpoint->send_message(newmsg.Data(), (int32_t) newmsg.Size());
+        }
+    }
 
-            auto notify = [&](client_endpoint* dest, user& u){
-                auto e = u.endpoint;
+    // 2) send existing group members to the new member
+    for (auto& peer : grp.users()){
+        if (peer.get() != &usr){
+            char peerbuf[AOO_MAXPACKETSIZE];
+            osc::OutboundPacketStream msg(peerbuf, sizeof(peerbuf));
+            make_message(msg, *peer);
 
-                osc::OutboundPacketStream msg(buf, sizeof(buf));
-                msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_JOIN)
-                    << grp.name.c_str() << u.name.c_str()
-                    << e->public_address.name().c_str() << e->public_address.port()
-                    << e->local_address.name().c_str() << e->local_address.port()
-                    << e->token
-                    << osc::EndMessage;
+            usr.endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+        }
+    }
 
-                dest->send_message(msg.Data(), (int32_t) msg.Size());
-            };
+    // 3) send the relay streams of the group to the new member
+    for (auto& stream : grp.relay_streams){
+        char streambuf[AOO_MAXPACKETSIZE];
+        osc::OutboundPacketStream msg(streambuf, sizeof(streambuf));
+        msg << osc::BeginMessage(AOONET_MSG_CLIENT_RELAY_ADD)
+            << grp.name.c_str() << stream.first.c_str() << stream.second
+            << osc::EndMessage;
 
-            // notify new member
-            notify(usr.endpoint, *peer);
+        usr.endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+    }
 
-            // notify existing member
-            notify(peer->endpoint, usr);
+    // 4) send the MCU participants of the group to the new member
+    for (auto& participant : grp.mcu_participants){
+        char mcubuf[AOO_MAXPACKETSIZE];
+        osc::OutboundPacketStream msg(mcubuf, sizeof(mcubuf));
+        msg << osc::BeginMessage(AOONET_MSG_CLIENT_MCU_ADD)
+            << grp.name.c_str() << participant.first.c_str() << participant.second
+            << osc::EndMessage;
 
-        }
+        usr.endpoint->send_message(msg.Data(), (int32_t) msg.Size());
     }
 
     if (grp.is_public) {
@@ -435,35 +580,176 @@ void server::on_user_joined_group(user& usr, group& grp){
 }
 
 void server::on_user_left_group(user& usr, group& grp){
+    on_user_unpublished(usr, grp);
+    on_user_left_mcu(usr, grp);
+
     // notify group members
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_LEAVE)
+          << grp.name.c_str() << usr.name.c_str()
+          << osc::EndMessage;
+
     for (auto& peer : grp.users()){
         if (peer.get() != &usr){
-            char buf[AOO_MAXPACKETSIZE];
-            osc::OutboundPacketStream msg(buf, sizeof(buf));
-            msg << osc::BeginMessage(AOONET_MSG_CLIENT_PEER_LEAVE)
-                  << grp.name.c_str() << usr.name.c_str()
-                  << osc::EndMessage;
-
             peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
         }
     }
 
-    if (grp.is_public) {
+    auto e = std::make_unique<group_event>(AOONET_SERVER_GROUP_LEAVE_EVENT,
+                                           grp.name.c_str(), usr.name.c_str());
+    push_event(std::move(e));
+
+    // automatically purge empty groups
+    // LATER add an option so that groups will persist
+    if (grp.num_users() == 0){
+        auto ptr = find_group(grp.name);
+        if (ptr.get() == &grp){
+            remove_group(ptr);
+        }
+    } else if (grp.is_public) {
         on_public_group_modified(grp);
+    }
+}
 
-        update(); // possibly prune empty
+int32_t server::on_user_published(user& usr, group& grp, const ip_address& addr){
+    if (!relay_){
+        return 0;
     }
 
-    auto e = std::make_unique<group_event>(AOONET_SERVER_GROUP_LEAVE_EVENT,
-                                           grp.name.c_str(), usr.name.c_str());
-    push_event(std::move(e));
+    auto it = grp.relay_streams.find(usr.name);
+    if (it != grp.relay_streams.end()){
+        return it->second; // already published
+    }
+
+    auto id = relay_->add_stream(grp.name, usr.name, addr);
+    grp.relay_streams.emplace(usr.name, id);
+
+    // notify group members
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(AOONET_MSG_CLIENT_RELAY_ADD)
+        << grp.name.c_str() << usr.name.c_str() << id
+        << osc::EndMessage;
+
+    for (auto& peer : grp.users()){
+        if (peer.get() != &usr){
+            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+        }
+    }
+
+    return id;
+}
+
+bool server::on_user_unpublished(user& usr, group& grp){
+    auto it = grp.relay_streams.find(usr.name);
+    if (it == grp.relay_streams.end()){
+        return false;
+    }
+    auto id = it->second;
+    grp.relay_streams.erase(it);
+    if (relay_){
+        relay_->remove_stream(id);
+    }
+
+    // notify group members
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(AOONET_MSG_CLIENT_RELAY_DEL)
+        << grp.name.c_str() << usr.name.c_str() << id
+        << osc::EndMessage;
+
+    for (auto& peer : grp.users()){
+        if (peer.get() != &usr){
+            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+        }
+    }
+
+    return true;
+}
+
+int32_t server::on_user_joined_mcu(user& usr, group& grp, const ip_address& addr){
+    if (!mcu_){
+        return 0;
+    }
+
+    auto it = grp.mcu_participants.find(usr.name);
+    if (it != grp.mcu_participants.end()){
+        return it->second; // already joined
+    }
+
+    auto id = mcu_->add_participant(grp.name, usr.name, addr);
+    grp.mcu_participants.emplace(usr.name, id);
+
+    // notify group members
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(AOONET_MSG_CLIENT_MCU_ADD)
+        << grp.name.c_str() << usr.name.c_str() << id
+        << osc::EndMessage;
+
+    for (auto& peer : grp.users()){
+        if (peer.get() != &usr){
+            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+        }
+    }
+
+    return id;
+}
+
+bool server::on_user_left_mcu(user& usr, group& grp){
+    auto it = grp.mcu_participants.find(usr.name);
+    if (it == grp.mcu_participants.end()){
+        return false;
+    }
+    auto id = it->second;
+    grp.mcu_participants.erase(it);
+    if (mcu_){
+        mcu_->remove_participant(id);
+    }
+
+    // notify group members
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream msg(buf, sizeof(buf));
+    msg << osc::BeginMessage(AOONET_MSG_CLIENT_MCU_DEL)
+        << grp.name.c_str() << usr.name.c_str() << id
+        << osc::EndMessage;
+
+    for (auto& peer : grp.users()){
+        if (peer.get() != &usr){
+            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
+        }
+    }
+
+    return true;
+}
+
+bool server::on_user_mcu_gain(user& usr, group& grp, const std::string& talker,
+                              float gain, float pan)
+{
+    if (mcu_ && grp.mcu_participants.count(usr.name)){
+        return mcu_->set_gain(grp.name, usr.name, talker, gain, pan);
+    } else {
+        return false;
+    }
+}
+
+void server::set_watch_public_groups(user& usr, bool watch){
+    usr.watch_public_groups = watch;
+
+    auto ptr = find_user(usr.name);
+    if (ptr.get() == &usr){
+        if (watch){
+            public_watchers_.add(ptr);
+        } else {
+            public_watchers_.remove(usr);
+        }
+    }
 }
 
 void server::on_user_wants_public_groups(user& usr){
     // 1) send all existing public groups to the user
-    for (auto& grp : groups_){
-        if (!grp->is_public) continue;
-
+    for (auto& grp : public_groups_.items()){
         char buf[AOO_MAXPACKETSIZE];
 
         osc::OutboundPacketStream msg(buf, sizeof(buf));
@@ -487,10 +773,8 @@ void server::on_public_group_modified(group& grp)
     << osc::EndMessage;
 
     // notify all users who care
-    for (auto & peer : users_) {
-        if (peer->watch_public_groups) {
-            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
-        }
+    for (auto & peer : public_watchers_.items()) {
+        peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
     }
 }
 
@@ -505,10 +789,8 @@ void server::on_public_group_removed(group& grp)
     << osc::EndMessage;
 
     // notify all users who care
-    for (auto & peer : users_) {
-        if (peer->watch_public_groups) {
-            peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
-        }
+    for (auto & peer : public_watchers_.items()) {
+        peer->endpoint->send_message(msg.Data(), (int32_t) msg.Size());
     }
 }
 
@@ -561,7 +843,7 @@ void server::wait_for_event(){
         WSAEnumNetworkEvents(udpsocket_, udpevent_, &ne);
 
         if (ne.lNetworkEvents & FD_READ){
-            receive_udp();
+            receive_udp(udpsocket_);
         }
     } else if (index >= 0 && index < numclients){
         // iterate over all clients, starting at index (= the first item which caused an event)
@@ -590,6 +872,33 @@ void server::wait_for_event(){
             }
         }
     }
+#elif AOO_SERVER_EPOLL
+    // the shards do all the client and UDP I/O, here we only accept new clients
+    // (and poll the only shard ourselves when there are no threads)
+    struct epoll_event events[16];
+    int result = epoll_wait(epollfd_, events, 16, -1);
+    if (result < 0){
+        int err = errno;
+        if (err != EINTR){
+            LOG_ERROR("aoo_server: epoll_wait failed (" << err << ")");
+        }
+        return;
+    }
+
+    for (int i = 0; i < result; ++i){
+        auto ptr = events[i].data.ptr;
+        if (ptr == waitpipe_){
+            // clear pipe
+            char c;
+            read(waitpipe_[0], &c, 1);
+        } else if (quit_.load()){
+            return;
+        } else if (ptr == &tcpsocket_){
+            accept_clients();
+        } else if (!shards_.empty() && ptr == shards_[0].get()){
+            poll_shard(*shards_[0], 0);
+        }
+    }
 #else
     // allocate three extra slots for master TCP socket, UDP socket and wait pipe
     int numfds = (int)(clients_.size() + 3);
@@ -652,7 +961,7 @@ void server::wait_for_event(){
     }
 
     if (fds[udpindex].revents & POLLIN){
-        receive_udp();
+        receive_udp(udpsocket_);
     }
 
 
@@ -672,44 +981,267 @@ void server::wait_for_event(){
     }
 }
 
-void server::update(){
-    // remove closed clients
-    auto result = std::remove_if(clients_.begin(), clients_.end(),
-                                 [](auto& c){ return !c->is_active(); });
-    clients_.erase(result, clients_.end());
-    // automatically purge stale users
-    // LATER add an option so that users will persist
-    for (auto it = users_.begin(); it != users_.end(); ){
-        if (!(*it)->is_active()){
-            it = users_.erase(it);
+#if AOO_SERVER_EPOLL
+bool server::start_shards(){
+    epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd_ < 0){
+        LOG_ERROR("aoo_server: epoll_create1 failed (" << errno << ")");
+        return false;
+    }
+
+    // the wait pipe and the listening socket belong to the run() thread
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = waitpipe_;
+    epoll_ctl(epollfd_, EPOLL_CTL_ADD, waitpipe_[0], &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &tcpsocket_;
+    epoll_ctl(epollfd_, EPOLL_CTL_ADD, tcpsocket_, &ev);
+
+    // the other shards open their own UDP socket on the same port
+    sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    memset(&sa, 0, sizeof(sa));
+    getsockname(udpsocket_, (sockaddr *)&sa, &salen);
+
+    int32_t nshards = std::max<int32_t>(1, nthreads_);
+    for (int i = 0; i < nshards; ++i){
+        shards_.push_back(std::make_unique<shard>());
+        auto& s = *shards_.back();
+
+        s.epollfd = epoll_create1(EPOLL_CLOEXEC);
+        s.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (s.epollfd < 0 || s.wakefd < 0){
+            LOG_ERROR("aoo_server: couldn't create shard (" << errno << ")");
+            return false;
+        }
+
+        if (i == 0){
+            s.udpsocket = udpsocket_;
         } else {
-            ++it;
+        #ifdef SO_REUSEPORT
+            int val = 1;
+            int sock = socket(AF_INET, SOCK_DGRAM, 0);
+            if (sock >= 0 && (socket_set_nonblocking(sock, 1) < 0
+                    || setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *)&val, sizeof(val)) < 0
+                    || bind(sock, (sockaddr *)&sa, salen) < 0))
+            {
+                LOG_WARNING("aoo_server: couldn't bind UDP socket for shard "
+                            << i << " (" << socket_errno() << ")");
+                socket_close(sock);
+                sock = -1;
+            }
+            s.udpsocket = sock;
+            s.own_udpsocket = sock >= 0;
+        #endif
+        }
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = &s.wakefd;
+        epoll_ctl(s.epollfd, EPOLL_CTL_ADD, s.wakefd, &ev);
+        if (s.udpsocket >= 0){
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.ptr = &s.udpsocket;
+            epoll_ctl(s.epollfd, EPOLL_CTL_ADD, s.udpsocket, &ev);
         }
     }
-    // automatically purge empty groups
-    // LATER add an option so that groups will persist
-    for (auto it = groups_.begin(); it != groups_.end(); ){
-        if ((*it)->num_users() == 0){
-            if ((*it)->is_public) {
-                on_public_group_removed(*(*it));
+
+    if (nthreads_ > 0){
+        for (auto& s : shards_){
+            auto ptr = s.get();
+            s->thread = std::thread([this, ptr](){ run_shard(*ptr); });
+        }
+    } else {
+        // an epoll instance is pollable itself
+        ev.events = EPOLLIN;
+        ev.data.ptr = shards_[0].get();
+        epoll_ctl(epollfd_, EPOLL_CTL_ADD, shards_[0]->epollfd, &ev);
+    }
+
+    LOG_VERBOSE("aoo_server: running with " << nshards << " shard(s)");
+    return true;
+}
+
+void server::stop_shards(){
+    for (auto& s : shards_){
+        if (s->thread.joinable()){
+            uint64_t one = 1;
+            write(s->wakefd, &one, sizeof(one));
+            s->thread.join();
+        }
+    }
+
+    for (auto& s : shards_){
+        // see run()
+        for (auto& c : s->clients){
+            c->close(false);
+        }
+        s->clients.clear();
+        for (auto& a : s->accepted){
+            socket_close(a.first);
+        }
+        s->accepted.clear();
+
+        if (s->own_udpsocket){
+            socket_close(s->udpsocket);
+        }
+        if (s->wakefd >= 0){
+            ::close(s->wakefd);
+        }
+        if (s->epollfd >= 0){
+            ::close(s->epollfd);
+        }
+    }
+    shards_.clear();
+
+    if (epollfd_ >= 0){
+        ::close(epollfd_);
+        epollfd_ = -1;
+    }
+}
+
+void server::run_shard(shard& s){
+    while (!quit_.load()){
+        poll_shard(s, -1);
+    }
+}
+
+void server::poll_shard(shard& s, int timeout){
+    struct epoll_event events[64];
+    int result = epoll_wait(s.epollfd, events, 64, timeout);
+    if (result < 0){
+        int err = errno;
+        if (err != EINTR){
+            LOG_ERROR("aoo_server: epoll_wait failed (" << err << ")");
+        }
+        return;
+    }
+
+    if (quit_.load()) {
+        return;
+    }
+
+    // all sockets are edge triggered, so every handler
+    // below must read (or write) until it would block
+    bool didclose = false;
+    for (int i = 0; i < result; ++i){
+        auto ptr = events[i].data.ptr;
+        if (ptr == &s.wakefd){
+            uint64_t count;
+            read(s.wakefd, &count, sizeof(count));
+
+            std::vector<std::pair<int, ip_address>> accepted;
+            {
+                std::lock_guard<std::mutex> lock(s.accept_mutex);
+                accepted.swap(s.accepted);
             }
+            for (auto& a : accepted){
+                add_client(s, a.first, a.second);
+            }
+        } else if (ptr == &s.udpsocket){
+            receive_udp(s.udpsocket);
+        } else {
+            auto c = static_cast<client_endpoint *>(ptr);
+            if (!c->is_active()){
+                continue;
+            }
+            auto flags = events[i].events;
+            bool ok = true;
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                // receive data from client
+                ok = c->receive_data();
+            }
+            if (ok && (flags & EPOLLOUT)){
+                // there's room in the socket again
+                ok = c->flush_send();
+            }
+            if (!ok){
+                c->close();
+                didclose = true;
+            }
+        }
+    }
 
-            it = groups_.erase(it);
+    if (didclose){
+        // remove closed clients
+        auto it = std::remove_if(s.clients.begin(), s.clients.end(),
+                                 [](auto& c){ return !c->is_active(); });
+        s.num_clients -= (int32_t)(s.clients.end() - it);
+        s.clients.erase(it, s.clients.end());
+    }
+}
+
+void server::accept_clients(){
+    while (true){
+        ip_address addr;
+        int sock = accept(tcpsocket_, (struct sockaddr *)&addr.address, &addr.length);
+        if (sock >= 0){
+            LOG_VERBOSE("aoo_server: accepted client (IP: "
+                        << addr.name() << ", port: " << addr.port() << ")");
+
+            // the shard with the fewest clients gets it
+            auto best = shards_[0].get();
+            for (auto& s : shards_){
+                if (s->num_clients.load() < best->num_clients.load()){
+                    best = s.get();
+                }
+            }
+            best->num_clients++;
+
+            if (nthreads_ > 0){
+                {
+                    std::lock_guard<std::mutex> lock(best->accept_mutex);
+                    best->accepted.emplace_back(sock, addr);
+                }
+                uint64_t one = 1;
+                write(best->wakefd, &one, sizeof(one));
+            } else {
+                add_client(*best, sock, addr);
+            }
         } else {
-            ++it;
+            int err = socket_errno();
+            if (err != EWOULDBLOCK){
+                LOG_ERROR("aoo_server: couldn't accept client (" << err << ")");
+            }
+            break;
         }
     }
 }
 
-void server::receive_udp(){
-    if (udpsocket_ < 0){
+void server::add_client(shard& s, int sock, const ip_address& addr){
+    auto c = std::make_unique<client_endpoint>(*this, sock, addr);
+    if (c->is_active()){
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c.get();
+        if (epoll_ctl(s.epollfd, EPOLL_CTL_ADD, sock, &ev) == 0){
+            s.clients.push_back(std::move(c));
+            return;
+        }
+        LOG_ERROR("aoo_server: couldn't add client socket to epoll (" << errno << ")");
+    }
+    s.num_clients--;
+}
+#endif
+
+void server::update(){
+    // remove closed clients
+    // (their users and empty groups are already gone, see on_user_left()
+    // and on_user_left_group())
+    auto result = std::remove_if(clients_.begin(), clients_.end(),
+                                 [](auto& c){ return !c->is_active(); });
+    clients_.erase(result, clients_.end());
+}
+
+void server::receive_udp(int sock){
+    if (sock < 0){
         return;
     }
     // read as much data as possible until recv() would block
     while (true){
         char buf[AOO_MAXPACKETSIZE];
         ip_address addr;
-        int32_t result = recvfrom(udpsocket_, buf, sizeof(buf), 0,
+        int32_t result = recvfrom(sock, buf, sizeof(buf), 0,
                                (struct sockaddr *)&addr.address, &addr.length);
         if (result > 0){
             try {
@@ -718,17 +1250,26 @@ void server::receive_udp(){
 
                 int32_t type;
                 auto onset = aoonet_parse_pattern(buf, result, &type);
+                // NOTE: keep reading, the socket might be edge triggered
                 if (!onset){
-                    LOG_WARNING("aoo_server: not an AOO NET message!");
-                    return;
+                    // AoO source and sink messages for the MCU and the relay streams
+                    int32_t id;
+                    if ((mcu_ || relay_) && (onset = aoo_parse_pattern(buf, result, &type, &id))){
+                        if (!(mcu_ && mcu_->handle_message(buf, result, type, id, addr)) && relay_){
+                            relay_->handle_message(sock, msg, type, id, onset, addr);
+                        }
+                    } else {
+                        LOG_WARNING("aoo_server: not an AOO NET message!");
+                    }
+                    continue;
                 }
 
                 if (type != AOO_TYPE_SERVER){
                     LOG_WARNING("aoo_server: not a client message!");
-                    return;
+                    continue;
                 }
 
-                handle_udp_message(msg, onset, addr);
+                handle_udp_message(sock, msg, onset, addr);
             } catch (const osc::Exception& e){
                 LOG_ERROR("aoo_server: exception in receive_udp: " << e.what());
             }
@@ -754,10 +1295,10 @@ void server::receive_udp(){
     }
 }
 
-void server::send_udp_message(const char *msg, int32_t size,
+void server::send_udp_message(int sock, const char *msg, int32_t size,
                               const ip_address &addr)
 {
-    auto result = ::sendto(udpsocket_, msg, size, 0,
+    auto result = ::sendto(sock, msg, size, 0,
                           (struct sockaddr *)&addr.address, addr.length);
     if (result < 0){
         int err = socket_errno();
@@ -775,7 +1316,7 @@ void server::send_udp_message(const char *msg, int32_t size,
     }
 }
 
-void server::handle_udp_message(const osc::ReceivedMessage &msg, int onset,
+void server::handle_udp_message(int sock, const osc::ReceivedMessage &msg, int onset,
                                 const ip_address& addr)
 {
     auto pattern = msg.AddressPattern() + onset;
@@ -789,7 +1330,7 @@ void server::handle_udp_message(const osc::ReceivedMessage &msg, int onset,
             reply << osc::BeginMessage(AOONET_MSG_CLIENT_PING)
                   << osc::EndMessage;
 
-            send_udp_message(reply.Data(), (int32_t) reply.Size(), addr);
+            send_udp_message(sock, reply.Data(), (int32_t) reply.Size(), addr);
         } else if (!strcmp(pattern, AOONET_MSG_REQUEST)){
             // reply with /reply message
             char buf[512];
@@ -797,7 +1338,7 @@ void server::handle_udp_message(const osc::ReceivedMessage &msg, int onset,
             reply << osc::BeginMessage(AOONET_MSG_CLIENT_REPLY)
                   << addr.name().c_str() << addr.port() << osc::EndMessage;
 
-            send_udp_message(reply.Data(), (int32_t) reply.Size(), addr);
+            send_udp_message(sock, reply.Data(), (int32_t) reply.Size(), addr);
         } else {
             LOG_ERROR("aoo_server: unknown message " << pattern);
         }
@@ -819,7 +1360,8 @@ void server::signal(){
 
 void user::on_close(server& s){
     // disconnect user from groups
-    for (auto& grp : groups_){
+    // (the list holds on to the groups, even if the server removes them)
+    for (auto& grp : groups_.items()){
         grp->remove_user(*this);
         s.on_user_left_group(*this, *grp);
     }
@@ -827,38 +1369,21 @@ void user::on_close(server& s){
     s.on_user_left(*this);
 
     groups_.clear();
-    // clear endpoint so the server knows it can remove the user
     endpoint = nullptr;
 }
 
 bool user::add_group(std::shared_ptr<group> grp){
-    auto it = std::find(groups_.begin(), groups_.end(), grp);
-    if (it == groups_.end()){
-        groups_.push_back(grp);
-        return true;
-    } else {
-        return false;
-    }
+    return groups_.add(std::move(grp));
 }
 
 bool user::remove_group(const group& grp){
-    // find by address
-    auto it = std::find_if(groups_.begin(), groups_.end(),
-                           [&](auto& g){ return g.get() == &grp; });
-    if (it != groups_.end()){
-        groups_.erase(it);
-        return true;
-    } else {
-        return false;
-    }
+    return groups_.remove(grp);
 }
 
 /*////////////////////////// group /////////////////////////*/
 
-bool group::add_user(std::shared_ptr<user> grp){
-    auto it = std::find(users_.begin(), users_.end(), grp);
-    if (it == users_.end()){
-        users_.push_back(grp);
+bool group::add_user(std::shared_ptr<user> usr){
+    if (users_.add(std::move(usr))){
         return true;
     } else {
         LOG_ERROR("group::add_user: bug");
@@ -867,11 +1392,7 @@ bool group::add_user(std::shared_ptr<user> grp){
 }
 
 bool group::remove_user(const user& usr){
-    // find by address
-    auto it = std::find_if(users_.begin(), users_.end(),
-                           [&](auto& u){ return u.get() == &usr; });
-    if (it != users_.end()){
-        users_.erase(it);
+    if (users_.remove(usr)){
         return true;
     } else {
         LOG_ERROR("group::remove_user: bug");
@@ -927,6 +1448,9 @@ client_endpoint::~client_endpoint(){
 
 void client_endpoint::close(bool notify){
     if (socket >= 0){
+        // other shards might be sending to us
+        std::lock_guard<std::mutex> lock(server_->state_mutex());
+
         LOG_VERBOSE("aoo_server: close client endpoint");
         socket_close(socket);
         socket = -1;
@@ -938,52 +1462,76 @@ void client_endpoint::close(bool notify){
 }
 
 void client_endpoint::send_message(const char *msg, int32_t size){
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (socket < 0){
+        return;
+    }
     if (sendbuffer_.write_packet((const uint8_t *)msg, size)){
-        while (true){
-            uint8_t buf[1024];
-            int32_t total = 0;
-            // first try to send pending data
-            if (!pending_send_data_.empty()){
-                 std::copy(pending_send_data_.begin(), pending_send_data_.end(), buf);
-                 total = (int32_t) pending_send_data_.size();
-                 pending_send_data_.clear();
-            } else if (sendbuffer_.read_available()){
-                 total = sendbuffer_.read_bytes(buf, sizeof(buf));
-            } else {
-                break;
-            }
+        send_pending();
+        LOG_DEBUG("aoo_server: sent " << msg << " to client");
+    } else {
+        LOG_ERROR("aoo_server: couldn't send " << msg << " to client");
+    }
+}
+
+bool client_endpoint::flush_send(){
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (socket < 0){
+        return true;
+    }
+    return send_pending();
+}
 
-            int32_t nbytes = 0;
-            while (nbytes < total){
-                auto res = ::send(socket, (char *)buf + nbytes, total - nbytes, 0);
-                if (res >= 0){
-                    nbytes += res;
-                #if 0
-                    LOG_VERBOSE("aoo_server: sent " << res << " bytes");
-                #endif
+// call with send_mutex_ locked
+bool client_endpoint::send_pending(){
+    while (true){
+        uint8_t buf[1024];
+        int32_t total = 0;
+        // first try to send pending data
+        if (!pending_send_data_.empty()){
+             std::copy(pending_send_data_.begin(), pending_send_data_.end(), buf);
+             total = (int32_t) pending_send_data_.size();
+             pending_send_data_.clear();
+        } else if (sendbuffer_.read_available()){
+             total = sendbuffer_.read_bytes(buf, sizeof(buf));
+        } else {
+            break;
+        }
+
+        int32_t nbytes = 0;
+        while (nbytes < total){
+        #ifdef MSG_NOSIGNAL
+            // a client that is gone must not raise SIGPIPE
+            auto res = ::send(socket, (char *)buf + nbytes, total - nbytes, MSG_NOSIGNAL);
+        #else
+            auto res = ::send(socket, (char *)buf + nbytes, total - nbytes, 0);
+        #endif
+            if (res >= 0){
+                nbytes += res;
+            #if 0
+                LOG_VERBOSE("aoo_server: sent " << res << " bytes");
+            #endif
+            } else {
+                auto err = socket_errno();
+            #ifdef _WIN32
+                if (err != WSAEWOULDBLOCK)
+            #else
+                if (err != EWOULDBLOCK)
+            #endif
+                {
+                    // TODO handle error
+                    LOG_ERROR("aoo_server: send() failed (" << err << ")");
+                    return false;
                 } else {
-                    auto err = socket_errno();
-                #ifdef _WIN32
-                    if (err != WSAEWOULDBLOCK)
-                #else
-                    if (err != EWOULDBLOCK)
-                #endif
-                    {
-                        // TODO handle error
-                        LOG_ERROR("aoo_server: send() failed (" << err << ")");
-                    } else {
-                        // store in pending buffer
-                        pending_send_data_.assign(buf + nbytes, buf + total);
-                        LOG_VERBOSE("aoo_server: send() would block");
-                    }
-                    return;
+                    // store in pending buffer
+                    pending_send_data_.assign(buf + nbytes, buf + total);
+                    LOG_VERBOSE("aoo_server: send() would block");
                 }
+                return true;
             }
         }
-        LOG_DEBUG("aoo_server: sent " << msg << " to client");
-    } else {
-        LOG_ERROR("aoo_server: couldn't send " << msg << " to client");
     }
+    return true;
 }
 
 bool client_endpoint::receive_data(){
@@ -1019,6 +1567,7 @@ bool client_endpoint::receive_data(){
         recvbuffer_.write_bytes((uint8_t *)buffer, (int32_t)result);
 
         // handle packets
+        std::lock_guard<std::mutex> lock(server_->state_mutex());
         uint8_t buf[AOO_MAXPACKETSIZE];
         while (true){
             auto size = recvbuffer_.read_packet(buf, sizeof(buf));
@@ -1090,6 +1639,16 @@ void client_endpoint::handle_message(const osc::ReceivedMessage &msg){
             handle_group_leave(msg);
         } else if (!strcmp(pattern, AOONET_MSG_GROUP_PUBLIC)){
             handle_group_public(msg);
+        } else if (!strcmp(pattern, AOONET_MSG_RELAY_PUBLISH)){
+            handle_relay_publish(msg);
+        } else if (!strcmp(pattern, AOONET_MSG_RELAY_UNPUBLISH)){
+            handle_relay_unpublish(msg);
+        } else if (!strcmp(pattern, AOONET_MSG_MCU_JOIN)){
+            handle_mcu_join(msg);
+        } else if (!strcmp(pattern, AOONET_MSG_MCU_LEAVE)){
+            handle_mcu_leave(msg);
+        } else if (!strcmp(pattern, AOONET_MSG_MCU_GAIN)){
+            handle_mcu_gain(msg);
         } else {
             LOG_ERROR("aoo_server: unknown message " << msg.AddressPattern());
         }
@@ -1244,7 +1803,7 @@ void client_endpoint::handle_group_public(const osc::ReceivedMessage& msg)
     server::error err;
     if (user_){
         // register interest in seeing public groups
-        user_->watch_public_groups = shouldWatch;
+        server_->set_watch_public_groups(*user_, shouldWatch);
 
         if (shouldWatch) {
             // send current batch
@@ -1263,6 +1822,118 @@ void client_endpoint::handle_group_public(const osc::ReceivedMessage& msg)
     send_message(reply.Data(), (int32_t)reply.Size());
 }
 
+void client_endpoint::handle_relay_publish(const osc::ReceivedMessage& msg)
+{
+    int result = 0;
+    int32_t stream = 0;
+    std::string errmsg;
+
+    auto it = msg.ArgumentsBegin();
+    std::string name = (it++)->AsString();
+
+    if (user_){
+        auto grp = server_->find_group(name);
+        if (grp && grp->has_user(*user_)){
+            // the upstream is expected from the host of this connection
+            stream = server_->on_user_published(*user_, *grp, addr_);
+            if (stream){
+                result = 1;
+            } else {
+                errmsg = "relay not enabled";
+            }
+        } else {
+            errmsg = "not a group member";
+        }
+    } else {
+        errmsg = "not logged in";
+    }
+
+    // send reply
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream reply(buf, sizeof(buf));
+    reply << osc::BeginMessage(AOONET_MSG_CLIENT_RELAY_PUBLISH)
+          << name.c_str() << result << errmsg.c_str() << stream << osc::EndMessage;
+
+    send_message(reply.Data(), (int32_t)reply.Size());
+}
+
+void client_endpoint::handle_relay_unpublish(const osc::ReceivedMessage& msg)
+{
+    auto it = msg.ArgumentsBegin();
+    std::string name = (it++)->AsString();
+
+    if (user_){
+        auto grp = server_->find_group(name);
+        if (grp){
+            server_->on_user_unpublished(*user_, *grp);
+        }
+    }
+}
+
+void client_endpoint::handle_mcu_join(const osc::ReceivedMessage& msg)
+{
+    int result = 0;
+    int32_t id = 0;
+    std::string errmsg;
+
+    auto it = msg.ArgumentsBegin();
+    std::string name = (it++)->AsString();
+
+    if (user_){
+        auto grp = server_->find_group(name);
+        if (grp && grp->has_user(*user_)){
+            // the upstream is expected from the host of this connection
+            id = server_->on_user_joined_mcu(*user_, *grp, addr_);
+            if (id){
+                result = 1;
+            } else {
+                errmsg = "MCU not enabled";
+            }
+        } else {
+            errmsg = "not a group member";
+        }
+    } else {
+        errmsg = "not logged in";
+    }
+
+    // send reply
+    char buf[AOO_MAXPACKETSIZE];
+    osc::OutboundPacketStream reply(buf, sizeof(buf));
+    reply << osc::BeginMessage(AOONET_MSG_CLIENT_MCU_JOIN)
+          << name.c_str() << result << errmsg.c_str() << id << osc::EndMessage;
+
+    send_message(reply.Data(), (int32_t)reply.Size());
+}
+
+void client_endpoint::handle_mcu_leave(const osc::ReceivedMessage& msg)
+{
+    auto it = msg.ArgumentsBegin();
+    std::string name = (it++)->AsString();
+
+    if (user_){
+        auto grp = server_->find_group(name);
+        if (grp){
+            server_->on_user_left_mcu(*user_, *grp);
+        }
+    }
+}
+
+void client_endpoint::handle_mcu_gain(const osc::ReceivedMessage& msg)
+{
+    auto it = msg.ArgumentsBegin();
+    std::string name = (it++)->AsString();
+    std::string talker = (it++)->AsString();
+    float gain = (it++)->AsFloat();
+    float pan = (it++)->AsFloat();
+
+    if (user_){
+        auto grp = server_->find_group(name);
+        if (grp){
+            server_->on_user_mcu_gain(*user_, *grp, talker, gain, pan);
+        }
+    }
+}
+
 /*///////////////////// events ////////////////////////*/
 
 server::event::event(int32_t type, int32_t result,
@@ -9,6 +9,8 @@
 
 #include "lockfree.hpp"
 #include "net_utils.hpp"
+#include "relay.hpp"
+#include "mcu.hpp"
 #include "SLIP.hpp"
 
 #include "oscpack/osc/OscOutboundPacketStream.h"
@@ -18,6 +20,18 @@
 #include <unordered_map>
 #include <vector>
 #include <random>
+#include <mutex>
+#include <thread>
+
+// on Linux the server waits with epoll and can spread the client
+// connections over several threads, see server::shard
+#ifndef AOO_SERVER_EPOLL
+ #ifdef __linux__
+  #define AOO_SERVER_EPOLL 1
+ #else
+  #define AOO_SERVER_EPOLL 0
+ #endif
+#endif
 
 namespace aoo {
 namespace net {
@@ -30,6 +44,54 @@ using user_list = std::vector<std::shared_ptr<user>>;
 struct group;
 using group_list = std::vector<std::shared_ptr<group>>;
 
+// a list of shared pointers with constant time insertion, removal and
+// lookup by address. Removing moves the last element into the gap,
+// so the order isn't kept.
+template<typename T>
+class indexed_list {
+public:
+    using list_type = std::vector<std::shared_ptr<T>>;
+
+    bool add(std::shared_ptr<T> ptr){
+        if (!index_.emplace(ptr.get(), items_.size()).second){
+            return false;
+        }
+        items_.push_back(std::move(ptr));
+        return true;
+    }
+
+    bool remove(const T& item){
+        auto it = index_.find(&item);
+        if (it == index_.end()){
+            return false;
+        }
+        auto pos = it->second;
+        index_.erase(it);
+        if (pos + 1 != items_.size()){
+            items_[pos] = std::move(items_.back());
+            index_[items_[pos].get()] = pos;
+        }
+        items_.pop_back();
+        return true;
+    }
+
+    bool contains(const T& item) const {
+        return index_.count(&item) > 0;
+    }
+
+    void clear(){
+        items_.clear();
+        index_.clear();
+    }
+
+    size_t size() const { return items_.size(); }
+
+    const list_type& items() const { return items_; }
+private:
+    list_type items_;
+    std::unordered_map<const T *, size_t> index_;
+};
+
 
 class client_endpoint {
     server *server_;
@@ -41,8 +103,12 @@ public:
 
     bool is_active() const { return socket >= 0; }
 
+    // thread safe, can be called from any shard
     void send_message(const char *msg, int32_t);
 
+    // send what is still buffered, returns false on error
+    bool flush_send();
+
     bool receive_data();
 
     int socket = -1;
@@ -59,6 +125,9 @@ private:
     SLIP sendbuffer_;
     SLIP recvbuffer_;
     std::vector<uint8_t> pending_send_data_;
+    std::mutex send_mutex_;
+
+    bool send_pending();
 
     void handle_message(const osc::ReceivedMessage& msg);
 
@@ -71,6 +140,16 @@ private:
     void handle_group_leave(const osc::ReceivedMessage& msg);
 
     void handle_group_public(const osc::ReceivedMessage& msg);
+
+    void handle_relay_publish(const osc::ReceivedMessage& msg);
+
+    void handle_relay_unpublish(const osc::ReceivedMessage& msg);
+
+    void handle_mcu_join(const osc::ReceivedMessage& msg);
+
+    void handle_mcu_leave(const osc::ReceivedMessage& msg);
+
+    void handle_mcu_gain(const osc::ReceivedMessage& msg);
 };
 
 struct user {
@@ -93,9 +172,9 @@ struct user {
 
     int32_t num_groups() const { return (int32_t) groups_.size(); }
 
-    const group_list& groups() { return groups_; }
+    const group_list& groups() { return groups_.items(); }
 private:
-    group_list groups_;
+    indexed_list<group> groups_;
 };
 
 struct group {
@@ -106,16 +185,22 @@ struct group {
     const std::string name;
     const std::string password;
     const bool is_public;
+    // relay stream IDs by user name
+    std::unordered_map<std::string, int32_t> relay_streams;
+    // MCU participant IDs by user name
+    std::unordered_map<std::string, int32_t> mcu_participants;
 
     bool add_user(std::shared_ptr<user> usr);
 
     bool remove_user(const user& usr);
 
+    bool has_user(const user& usr) const { return users_.contains(usr); }
+
     int32_t num_users() const { return (int32_t)users_.size(); }
 
-    const user_list& users() { return users_; }
+    const user_list& users() { return users_.items(); }
 private:
-    user_list users_;
+    indexed_list<user> users_;
 };
 
 class server final : public iserver {
@@ -145,7 +230,7 @@ public:
         };
     };
 
-    server(int tcpsocket, int udpsocket);
+    server(int tcpsocket, int udpsocket, int32_t nthreads = 0);
     ~server();
 
     int32_t run() override;
@@ -168,6 +253,12 @@ public:
 
     int32_t get_group_count() const override;
     int32_t get_user_count() const override;
+
+    int32_t set_relay(bool enable) override;
+    int32_t get_relay_stream_count() const override;
+
+    int32_t set_mcu(bool enable) override;
+    int32_t get_mcu_participant_count() const override;
     
     void on_user_joined(user& usr);
 
@@ -179,9 +270,27 @@ public:
 
     void on_user_wants_public_groups(user& usr);
 
+    void set_watch_public_groups(user& usr, bool watch);
+
     void on_public_group_modified(group& grp);
     void on_public_group_removed(group& grp);
 
+    // returns the stream ID, or 0 if the relay is disabled
+    int32_t on_user_published(user& usr, group& grp, const ip_address& addr);
+
+    bool on_user_unpublished(user& usr, group& grp);
+
+    // returns the participant ID, or 0 if the MCU is disabled
+    int32_t on_user_joined_mcu(user& usr, group& grp, const ip_address& addr);
+
+    bool on_user_left_mcu(user& usr, group& grp);
+
+    bool on_user_mcu_gain(user& usr, group& grp, const std::string& talker,
+                          float gain, float pan);
+
+    // guards the users, groups and everything the client messages do with them,
+    // so the shards see the same state
+    std::mutex& state_mutex() { return state_mutex_; }
 
 private:
     int tcpsocket_;
@@ -191,8 +300,52 @@ private:
     HANDLE udpevent_;
 #endif
     std::vector<std::unique_ptr<client_endpoint>> clients_;
-    user_list users_;
-    group_list groups_;
+    // registries by name; users are removed when they log out
+    // and groups as soon as the last member has left
+    std::unordered_map<std::string, std::shared_ptr<user>> users_;
+    std::unordered_map<std::string, std::shared_ptr<group>> groups_;
+    indexed_list<group> public_groups_;
+    // users with watch_public_groups set, the only ones that
+    // hear about changes to the public groups
+    indexed_list<user> public_watchers_;
+    // mutable for the counts, which any thread may ask for
+    mutable std::mutex state_mutex_;
+    std::unique_ptr<relay> relay_;
+    std::unique_ptr<mcu> mcu_;
+    int32_t nthreads_ = 0;
+#if AOO_SERVER_EPOLL
+    // A shard owns a set of client connections and does all the I/O on them
+    // with its own (edge triggered) epoll instance, so a wakeup only touches
+    // the clients that are ready. Each shard also has its own UDP socket on the
+    // server port (SO_REUSEPORT), the kernel spreads the probes over them.
+    // With nthreads = 0 there is a single shard, polled by the run() thread.
+    struct shard {
+        int epollfd = -1;
+        int wakefd = -1;
+        int udpsocket = -1;
+        bool own_udpsocket = false;
+        std::thread thread;
+        std::vector<std::unique_ptr<client_endpoint>> clients;
+        // sockets accepted by the run() thread, waiting to be picked up
+        std::mutex accept_mutex;
+        std::vector<std::pair<int, ip_address>> accepted;
+        std::atomic<int32_t> num_clients{0};
+    };
+    std::vector<std::unique_ptr<shard>> shards_;
+    int epollfd_ = -1;
+
+    bool start_shards();
+
+    void stop_shards();
+
+    void run_shard(shard& s);
+
+    void poll_shard(shard& s, int timeout);
+
+    void accept_clients();
+
+    void add_client(shard& s, int sock, const ip_address& addr);
+#endif
     // queues
     lockfree::queue<std::unique_ptr<icommand>> commands_;
     lockfree::queue<std::unique_ptr<ievent>> events_;
@@ -213,12 +366,14 @@ private:
 
     void update();
 
-    void receive_udp();
+    void remove_group(std::shared_ptr<group> grp);
+
+    void receive_udp(int sock);
 
-    void send_udp_message(const char *msg, int32_t size,
+    void send_udp_message(int sock, const char *msg, int32_t size,
                           const ip_address& addr);
 
-    void handle_udp_message(const osc::ReceivedMessage& msg, int onset,
+    void handle_udp_message(int sock, const osc::ReceivedMessage& msg, int onset,
                             const ip_address& addr);
 
     void signal();
@@ -6,6 +6,7 @@
 #include "aoo/aoo_utils.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 
 /*//////////////////// aoo_sink /////////////////////*/
@@ -60,6 +61,7 @@ int32_t aoo::sink::invite_source(void *endpoint, int32_t id, aoo_replyfn fn){
         sources_.emplace_front(endpoint, fn, id, 0);
         src = &sources_.front();
         src->set_protocol_flags(protocol_flags_);
+        notify_event(); // "add" event
     }
     src->request_invite();
 
@@ -150,7 +152,13 @@ int32_t aoo::sink::set_option(int32_t opt, void *ptr, int32_t size)
         auto bufsize = std::max<int32_t>(0, as<int32_t>(ptr));
         if (bufsize != buffersize_){
             buffersize_ = bufsize;
-            update_sources();
+            if (time_stretch_){
+                for (auto& src : sources_){
+                    src.resize(*this);
+                }
+            } else {
+                update_sources();
+            }
         }
         break;
     }
@@ -159,6 +167,17 @@ int32_t aoo::sink::set_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(int32_t);
         dynamic_resampling_ = std::max<int32_t>(0, as<int32_t>(ptr));
         break;
+    // resampler quality
+    case aoo_opt_resample_quality:
+    {
+        CHECKARG(int32_t);
+        auto quality = std::min<int32_t>(AOO_RESAMPLE_HIGH, std::max<int32_t>(0, as<int32_t>(ptr)));
+        if (quality != resample_quality_){
+            resample_quality_ = quality;
+            update_sources();
+        }
+        break;
+    }
     // timefilter bandwidth
     case aoo_opt_timefilter_bandwidth:
         CHECKARG(float);
@@ -202,6 +221,33 @@ int32_t aoo::sink::set_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(int32_t);
         protocol_flags_ = as<int32_t>(ptr) & 0xff;
         break;
+    // deferred decoding
+    case aoo_opt_deferred_decode:
+        CHECKARG(int32_t);
+        deferred_decode_ = as<int32_t>(ptr) > 0;
+        break;
+    // event notification
+    case aoo_opt_event_notify:
+        CHECKARG(aoo_event_notify);
+        event_notify_user_ = as<aoo_event_notify>(ptr).user;
+        event_notify_fn_ = as<aoo_event_notify>(ptr).fn;
+        break;
+    // jitter statistics
+    case aoo_opt_jitter_percentile:
+        CHECKARG(float);
+        jitter_percentile_ = std::min<float>(100.f, std::max<float>(0.f, as<float>(ptr)));
+        break;
+    // time stretching
+    case aoo_opt_time_stretch:
+    {
+        CHECKARG(int32_t);
+        int32_t stretch = as<int32_t>(ptr) > 0;
+        if (stretch != time_stretch_){
+            time_stretch_ = stretch;
+            update_sources(); // the queues are sized differently
+        }
+        break;
+    }
     // unknown
     default:
         LOG_WARNING("aoo_sink: unsupported option " << opt);
@@ -232,6 +278,11 @@ int32_t aoo::sink::get_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(float);
         as<float>(ptr) = bandwidth_;
         break;
+    // resampler quality
+    case aoo_opt_resample_quality:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = resample_quality_;
+        break;
     // resend packetsize
     case aoo_opt_packetsize:
         CHECKARG(int32_t);
@@ -256,6 +307,23 @@ int32_t aoo::sink::get_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(int32_t);
         as<int32_t>(ptr) = protocol_flags_;
         break;
+    case aoo_opt_deferred_decode:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = deferred_decode_;
+        break;
+    case aoo_opt_event_notify:
+        CHECKARG(aoo_event_notify);
+        as<aoo_event_notify>(ptr).fn = event_notify_fn_;
+        as<aoo_event_notify>(ptr).user = event_notify_user_;
+        break;
+    case aoo_opt_jitter_percentile:
+        CHECKARG(float);
+        as<float>(ptr) = jitter_percentile_;
+        break;
+    case aoo_opt_time_stretch:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = time_stretch_;
+        break;
     // unknown
     default:
         LOG_WARNING("aoo_sink: unsupported option " << opt);
@@ -310,6 +378,9 @@ int32_t aoo::sink::get_sourceoption(void *endpoint, int32_t id,
         case aoo_opt_buffer_fill_ratio:
             CHECKARG(float);
             return src->get_buffer_fill_ratio(as<float>(p));
+        case aoo_opt_jitter_stats:
+            CHECKARG(aoo_jitter_stats);
+            return src->get_jitter_stats(*this, as<aoo_jitter_stats>(p));
         case aoo_opt_userformat:
             return src->get_userformat(static_cast<char*>(p), size);
         // unsupported
@@ -400,6 +471,20 @@ int32_t aoo::sink::send(){
     return didsomething;
 }
 
+int32_t aoo_sink_decode(aoo_sink *sink){
+    return sink->decode();
+}
+
+int32_t aoo::sink::decode(){
+    bool didsomething = false;
+    for (auto& s: sources_){
+        if (s.decode()){
+            didsomething = true;
+        }
+    }
+    return didsomething;
+}
+
 int32_t aoo_sink_process(aoo_sink *sink, aoo_sample **data,
                          int32_t nsamples, uint64_t t) {
     return sink->process(data, nsamples, t);
@@ -580,6 +665,7 @@ int32_t sink::handle_format_message(void *endpoint, aoo_replyfn fn,
         sources_.emplace_front(endpoint, fn, id, salt);
         src = &sources_.front();
         src->set_protocol_flags(protocol_flags_);
+        notify_event(); // "add" event
     }
 
     return src->handle_format(*this, salt, f, (const char *)settings, size, version, (const char *) userfmt, ufsize);
@@ -618,6 +704,7 @@ int32_t sink::handle_data_message(void *endpoint, aoo_replyfn fn,
         sources_.emplace_front(endpoint, fn, id, salt);
         src = &sources_.front();
         src->set_protocol_flags(protocol_flags_);
+        notify_event(); // "add" event
         src->request_format();
         return 0;
     }
@@ -683,6 +770,67 @@ int32_t sink::handle_ping_message(void *endpoint, aoo_replyfn fn,
     }
 }
 
+/*////////////////////////// jitter_estimator /////////////////////////////*/
+
+void jitter_estimator::reset(){
+    scoped_lock<spinlock> l(lock_);
+    head_ = 0;
+    count_ = 0;
+    newest_ = -1;
+}
+
+void jitter_estimator::add(int32_t sequence, double time, double period){
+    // reset() may come from another thread, so newest_ is only touched with the lock held
+    scoped_lock<spinlock> l(lock_);
+    // only new blocks, resent or reordered ones would just look late
+    if (sequence <= newest_){
+        return;
+    }
+    if (period != period_){
+        // different block duration, the old offsets aren't comparable anymore
+        head_ = 0;
+        count_ = 0;
+        period_ = period;
+    }
+    newest_ = sequence;
+    offsets_[head_] = time - sequence * period;
+    head_ = (head_ + 1) % AOO_JITTER_WINDOW;
+    if (count_ < AOO_JITTER_WINDOW){
+        count_++;
+    }
+}
+
+bool jitter_estimator::get_stats(float percentile, aoo_jitter_stats& stats){
+    // copy the window and sort it, this is only called every now and then
+    std::vector<double> offsets;
+    double period;
+    {
+        scoped_lock<spinlock> l(lock_);
+        offsets.assign(offsets_, offsets_ + count_);
+        period = period_;
+    }
+
+    stats.percentile = percentile;
+    stats.block_ms = period * 1000.0;
+    stats.count = (int32_t)offsets.size();
+    if (offsets.empty()){
+        stats.delay_ms = stats.median_ms = stats.max_ms = 0;
+        return 1;
+    }
+
+    std::sort(offsets.begin(), offsets.end());
+    // relative to the block that arrived earliest
+    auto earliest = offsets.front();
+    auto at = [&](double p){
+        auto index = std::min<size_t>(offsets.size() - 1, (size_t)(p * 0.01 * offsets.size()));
+        return (float)((offsets[index] - earliest) * 1000.0);
+    };
+    stats.delay_ms = at(percentile);
+    stats.median_ms = at(50.0);
+    stats.max_ms = (float)((offsets.back() - earliest) * 1000.0);
+    return 1;
+}
+
 /*////////////////////////// source_desc /////////////////////////////*/
 
 source_desc::source_desc(void *endpoint, aoo_replyfn fn, int32_t id, int32_t salt)
@@ -723,14 +871,19 @@ void source_desc::request_codec_change(aoo_format & f)
 }
 
 int32_t source_desc::get_buffer_fill_ratio(float &ratio){
-    if (audioqueue_.capacity() > 0) {
-        ratio = (audioqueue_.read_available() * audioqueue_.blocksize()) / (float)audioqueue_.capacity();
+    if (target_blocks_ > 0) {
+        // relative to the nominal size, the queue may be larger with time stretching
+        ratio = std::min<float>(1.f, audioqueue_.read_available() / (float)target_blocks_);
     } else {
         ratio = 0.0f;
     }
     return 1;
 }
 
+int32_t source_desc::get_jitter_stats(const sink& s, aoo_jitter_stats& stats){
+    return jitter_.get_stats(s.jitter_percentile(), stats);
+}
+
 int32_t source_desc::get_userformat(char *buf, int32_t size){
     shared_lock lock(mutex_);
     if (userformat_.empty()) return 0;
@@ -750,21 +903,96 @@ void source_desc::update(const sink &s){
     do_update(s);
 }
 
+void source_desc::resize(const sink &s){
+    // take writer lock!
+    unique_lock lock(mutex_);
+    if (!decoder_ || decoder_->blocksize() <= 0 || decoder_->samplerate() <= 0){
+        return;
+    }
+    if (!s.time_stretch() || target_blocks_ <= 0){
+        do_update(s);
+        return;
+    }
+    // only set the new size, process() stretches the queued audio towards it
+    int32_t nbuffers = buffer_blocks(s);
+    int32_t capacity = queue_capacity(s, nbuffers);
+    if (capacity > infoqueue_.capacity()){
+        grow_queues(capacity);
+    }
+    LOG_VERBOSE("resize source buffer from " << target_blocks_ << " to " << nbuffers << " blocks");
+    target_blocks_ = nbuffers;
+}
+
+// called with the writer lock; move the queued blocks into larger queues
+void source_desc::grow_queues(int32_t capacity){
+    auto nsamples = audioqueue_.blocksize();
+    auto n = std::min(audioqueue_.read_available(), infoqueue_.read_available());
+    std::vector<aoo_sample> samples(n * nsamples);
+    std::vector<block_info> infos(n);
+    for (int i = 0; i < n; ++i){
+        std::copy(audioqueue_.read_data(), audioqueue_.read_data() + nsamples, &samples[i * nsamples]);
+        audioqueue_.read_commit();
+        infoqueue_.read(infos[i]);
+    }
+    audioqueue_.resize(capacity * nsamples, nsamples);
+    infoqueue_.resize(capacity, 1);
+    for (int i = 0; i < n; ++i){
+        std::copy(&samples[i * nsamples], &samples[(i + 1) * nsamples], audioqueue_.write_data());
+        audioqueue_.write_commit();
+        infoqueue_.write(infos[i]);
+    }
+    // same for the blocks which haven't been decoded yet
+    auto maxblocksize = decodedata_.blocksize();
+    auto m = std::min(decodedata_.read_available(), decodequeue_.read_available());
+    std::vector<char> data(m * maxblocksize);
+    std::vector<decode_job> jobs(m);
+    for (int i = 0; i < m; ++i){
+        std::copy(decodedata_.read_data(), decodedata_.read_data() + maxblocksize, &data[i * maxblocksize]);
+        decodedata_.read_commit();
+        decodequeue_.read(jobs[i]);
+    }
+    decodedata_.resize(capacity * maxblocksize, maxblocksize);
+    decodequeue_.resize(capacity, 1);
+    for (int i = 0; i < m; ++i){
+        std::copy(&data[i * maxblocksize], &data[(i + 1) * maxblocksize], decodedata_.write_data());
+        decodedata_.write_commit();
+        decodequeue_.write(jobs[i]);
+    }
+    blockqueue_.expand(capacity + 8);
+}
+
+// the buffer size in blocks
+int32_t source_desc::buffer_blocks(const sink& s) const {
+    // recalculate buffersize from ms to samples
+    double bufsize = (double)s.buffersize() * decoder_->samplerate() * 0.001;
+    bufsize = std::max(bufsize, (double)s.blocksize()); // needs to be at least one processing blocksize worth!
+    auto d = div(bufsize, decoder_->blocksize());
+    int32_t nbuffers = d.quot + (d.rem != 0); // round up
+    return std::max<int32_t>(1, nbuffers); // e.g. if buffersize_ is 0
+}
+
+// with time stretching, leave room for late blocks arriving in a burst,
+// so they end up in the audio buffer (where they can be stretched away)
+int32_t source_desc::queue_capacity(const sink& s, int32_t nbuffers) const {
+    return s.time_stretch() ? nbuffers * 2 + 2 : nbuffers;
+}
+
 void source_desc::do_update(const sink &s){
     // resize audio ring buffer
     if (decoder_ && decoder_->blocksize() > 0 && decoder_->samplerate() > 0){
-        // recalculate buffersize from ms to samples
-        double bufsize = (double)s.buffersize() * decoder_->samplerate() * 0.001;
-        bufsize = std::max(bufsize, (double)s.blocksize()); // needs to be at least one processing blocksize worth!
-        auto d = div(bufsize, decoder_->blocksize());
-        int32_t nbuffers = d.quot + (d.rem != 0); // round up
-        nbuffers = std::max<int32_t>(1, nbuffers); // e.g. if buffersize_ is 0
+        int32_t nbuffers = buffer_blocks(s);
+        int32_t capacity = queue_capacity(s, nbuffers);
         // resize audio buffer and initially fill with zeros.
         auto nsamples = decoder_->nchannels() * decoder_->blocksize();
-        audioqueue_.resize(nbuffers * nsamples, nsamples);
-        infoqueue_.resize(nbuffers, 1);
+        audioqueue_.resize(capacity * nsamples, nsamples);
+        infoqueue_.resize(capacity, 1);
+        // (over)allocate for the largest possible encoded block
+        auto maxblocksize = (int32_t)sizeof(double) * nsamples;
+        decodedata_.resize(capacity * maxblocksize, maxblocksize);
+        decodequeue_.resize(capacity, 1);
+        target_blocks_ = nbuffers;
         int count = 0;
-        while (audioqueue_.write_available() && infoqueue_.write_available()){
+        while (count < nbuffers && audioqueue_.write_available() && infoqueue_.write_available()){
             audioqueue_.write_commit();
             // push nominal samplerate + default channel (0)
             block_info i;
@@ -780,9 +1008,13 @@ void source_desc::do_update(const sink &s){
     #endif
         // setup resampler
         resampler_.setup(decoder_->blocksize(), s.blocksize(),
-                            decoder_->samplerate(), s.samplerate(), decoder_->nchannels());
+                            decoder_->samplerate(), s.samplerate(), decoder_->nchannels(),
+                            s.resample_quality());
+        stretcher_.setup(decoder_->blocksize(), decoder_->samplerate(), decoder_->nchannels());
+        stretch_fill_ = nbuffers * decoder_->blocksize();
+        stretch_wait_ = 0;
         // resize block queue
-        blockqueue_.resize(nbuffers + 8); // (32) extra capacity for network jitter (allows lower buffersizes) (should be option?)
+        blockqueue_.resize(capacity + 8); // (32) extra capacity for network jitter (allows lower buffersizes) (should be option?)
         newest_ = 0;
         next_ = -1;
         nextneedsfadein_ = 0;
@@ -809,6 +1041,10 @@ int32_t source_desc::handle_format(const sink& s, int32_t salt, const aoo_format
     // take writer lock!
     unique_lock lock(mutex_);
 
+    if (salt != salt_){
+        // new stream, the sequence numbers start over
+        jitter_.reset();
+    }
     salt_ = salt;
 
     // create/change decoder if needed
@@ -844,7 +1080,7 @@ int32_t source_desc::handle_format(const sink& s, int32_t salt, const aoo_format
     e.type = AOO_SOURCE_FORMAT_EVENT;
     e.source.endpoint = endpoint_;
     e.source.id = id_;
-    push_event(e);
+    push_event(s, e);
 
     return 1;
 }
@@ -879,31 +1115,38 @@ int32_t source_desc::handle_data(const sink& s, int32_t salt, const aoo::data_pa
         nextneedsfadein_ = next_;
     }
 
-    // check data packet
-    if (!check_packet(d)){
-        return 0;
+    // timestamp the first packet we get of every new block
+    if (decoder_->blocksize() > 0 && decoder_->samplerate() > 0){
+        auto now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        jitter_.add(d.sequence, now, (double)decoder_->blocksize() / (double)decoder_->samplerate());
     }
 
-    // add data packet
-    if (!add_packet(d)){
-        return 0;
-    }
+    // check and add data packet
+    bool result = check_packet(d) && add_packet(d);
+    if (result){
+        // process blocks and hand them to the decoder
+        process_blocks();
 
-    // process blocks and send audio
-    process_blocks();
+    #if 1
+        check_outdated_blocks();
+    #endif
 
-#if 1
-    check_outdated_blocks();
-#endif
+        // check and resend missing blocks
+        check_missing_blocks(s);
 
-    // check and resend missing blocks
-    check_missing_blocks(s);
+    #if AOO_DEBUG_BLOCK_BUFFER
+        DO_LOG("block buffer: size = " << blockqueue_.size() << " / " << blockqueue_.capacity());
+    #endif
+    }
 
-#if AOO_DEBUG_BLOCK_BUFFER
-    DO_LOG("block buffer: size = " << blockqueue_.size() << " / " << blockqueue_.capacity());
-#endif
+    // decode right away, unless a decoder thread does it for us.
+    // if another thread is decoding already, we just leave it to that one.
+    if (!s.deferred_decode() && decodelock_.try_lock()){
+        decode_blocks();
+        decodelock_.unlock();
+    }
 
-    return 1;
+    return result;
 }
 
 // /aoo/sink/<id>/ping <src> <time>
@@ -931,7 +1174,7 @@ int32_t source_desc::handle_ping(const sink &s, time_tag tt){
     e.ping.tt1 = tt.to_uint64();
     e.ping.tt2 = tt2.to_uint64();
     e.ping.tt3 = 0;
-    push_event(e);
+    push_event(s, e);
 
     return 1;
 }
@@ -977,25 +1220,25 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
         // push packet loss event
         e.type = AOO_BLOCK_LOST_EVENT;
         e.block_loss.count = lost;
-        push_event(e);
+        push_event(s, e);
     }
     if (reordered > 0){
         // push packet reorder event
         e.type = AOO_BLOCK_REORDERED_EVENT;
         e.block_reorder.count = reordered;
-        push_event(e);
+        push_event(s, e);
     }
     if (resent > 0){
         // push packet resend event
         e.type = AOO_BLOCK_RESENT_EVENT;
         e.block_resend.count = resent;
-        push_event(e);
+        push_event(s, e);
     }
     if (gap > 0){
         // push packet gap event
         e.type = AOO_BLOCK_GAP_EVENT;
         e.block_gap.count = gap;
-        push_event(e);
+        push_event(s, e);
     }
 
     // don't process anything until the first few blocks are recv'd into the blockqueue
@@ -1018,21 +1261,35 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
     DO_LOG("audioqueue: " << audioqueue_.read_available() << " / " << capacity);
 #endif
 
-    while (audioqueue_.read_available() && infoqueue_.read_available()
-           && readsamples > resampler_.read_available() && resampler_.write_available() >= nsamples){
-
-        // get block info and set current channel + samplerate
-        block_info info;
-        infoqueue_.read(info);
-        channel_ = info.channel;
-        samplerate_ = info.sr;
+    if (s.time_stretch()){
+        time_stretch(s, numsampleframes);
+    }
 
-        // write audio into resampler
-        resampler_.write(audioqueue_.read_data(), nsamples);
+    while (readsamples > resampler_.read_available()){
+        if (stretcher_.read_available() > 0){
+            // first the audio which has been pulled into the time stretcher
+            auto n = std::min(stretcher_.read_available(), nsamples);
+            if (resampler_.write_available() < n){
+                break;
+            }
+            resampler_.write(stretcher_.read_data(), n);
 
-        audioqueue_.read_commit();
+            stretcher_.read_commit(n);
+        } else if (audioqueue_.read_available() && infoqueue_.read_available()
+                   && resampler_.write_available() >= nsamples){
+            // get block info and set current channel + samplerate
+            block_info info;
+            infoqueue_.read(info);
+            channel_ = info.channel;
+            samplerate_ = info.sr;
 
+            // write audio into resampler
+            resampler_.write(audioqueue_.read_data(), nsamples);
 
+            audioqueue_.read_commit();
+        } else {
+            break;
+        }
     }
     // update resampler
     resampler_.update(samplerate_, s.real_samplerate());
@@ -1068,7 +1325,7 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
             e.source_state.endpoint = endpoint_;
             e.source_state.id = id_;
             e.source_state.state = AOO_SOURCE_STATE_PLAY;
-            push_event(e);
+            push_event(s, e);
         }
 
         return true;
@@ -1080,7 +1337,7 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
             e.source_state.endpoint = endpoint_;
             e.source_state.id = id_;
             e.source_state.state = AOO_SOURCE_STATE_STOP;
-            push_event(e);
+            push_event(s, e);
 
             LOG_VERBOSE("UNDERRUN resampler avail " << resampler_.read_available() << "  readsamp: " << readsamples);
 
@@ -1092,6 +1349,71 @@ bool source_desc::process(const sink& s, aoo_sample *buffer, int32_t stride, int
     }
 }
 
+#define AOO_STRETCH_SMOOTHING 0.25 // time constant of the smoothed buffer fill in seconds
+#define AOO_STRETCH_SPACING 10 // play at least this many periods between two changes
+
+// Bring the (smoothed) buffer fill towards the nominal buffer size by dropping
+// or repeating one pitch period at a time. Spacing the changes keeps the tempo
+// change below 1/AOO_STRETCH_SPACING, so it is not noticeable.
+void source_desc::time_stretch(const sink& s, int32_t numsampleframes){
+    auto nchannels = decoder_->nchannels();
+    auto blocksize = decoder_->blocksize();
+    int32_t fill = audioqueue_.read_available() * blocksize + stretcher_.read_available() / nchannels;
+    int32_t target = target_blocks_ * blocksize;
+
+    double coeff = std::min<double>(1.0, numsampleframes / (s.samplerate() * AOO_STRETCH_SMOOTHING));
+    stretch_fill_ += (fill - stretch_fill_) * coeff;
+
+    if (stretch_wait_ > 0){
+        stretch_wait_ -= numsampleframes;
+        return;
+    }
+
+    auto diff = (int32_t)(stretch_fill_ - target);
+    bool compress = diff >= stretcher_.min_period() && fill > target;
+    bool expand = -diff >= stretcher_.min_period() && fill < target;
+    if (!compress && !expand){
+        return;
+    }
+    // don't drop/repeat more than the difference, so we don't overshoot
+    auto maxperiod = std::min(std::abs(diff), stretcher_.max_period());
+
+    // pull enough audio to search the periods
+    auto nsamples = audioqueue_.blocksize();
+    while (stretcher_.read_available() < 2 * maxperiod * nchannels
+           && audioqueue_.read_available() && infoqueue_.read_available()
+           && stretcher_.write_available() >= nsamples)
+    {
+        block_info info;
+        infoqueue_.read(info);
+        channel_ = info.channel;
+        samplerate_ = info.sr;
+
+        stretcher_.write(audioqueue_.read_data(), nsamples);
+
+        audioqueue_.read_commit();
+    }
+
+    auto n = compress ? stretcher_.compress(maxperiod) : stretcher_.expand(maxperiod);
+    if (n > 0){
+        stretch_fill_ += compress ? -n : n;
+        stretch_wait_ = n * AOO_STRETCH_SPACING;
+        LOG_DEBUG((compress ? "dropped " : "repeated ") << n << " frames, buffer fill: "
+                  << fill << ", target: " << target);
+    }
+}
+
+void source_desc::push_event(const sink& s, const event& e){
+    {
+        scoped_lock<spinlock> l(eventqueuelock_);
+        if (!eventqueue_.write_available()){
+            return;
+        }
+        eventqueue_.write(e);
+    }
+    s.notify_event();
+}
+
 int32_t source_desc::handle_events(aoo_eventhandler fn, void *user){
     // copy events - always lockfree! (the eventqueue is never resized)
     auto n = eventqueue_.read_available();
@@ -1161,19 +1483,12 @@ bool source_desc::check_packet(const data_packet &d){
         next_ = d.sequence;
         // push empty blocks to keep the buffer full, but leave room for one block!
         int count = 0;
-        auto nsamples = audioqueue_.blocksize();
-        while (audioqueue_.write_available() > 1 && infoqueue_.write_available() > 1){
-            auto ptr = audioqueue_.write_data();
-            if (!decoder_->decode(nullptr, 0, ptr, nsamples)) {
-                LOG_WARNING("decode failed nsamples: " << nsamples << " audioqavail: " << audioqueue_.write_available());
-            }
-            audioqueue_.write_commit();
-            // push nominal samplerate + current channel
-            block_info i;
-            i.sr = decoder_->samplerate();
-            i.channel = channel_;
-            infoqueue_.write(i);
-
+        // push nominal samplerate + current channel
+        block_info i;
+        i.sr = decoder_->samplerate();
+        i.channel = channel_;
+        while (fill_available() > 1){
+            push_block(nullptr, 0, i, decode_job::CONCEAL);
             count++;
         }
 
@@ -1213,17 +1528,12 @@ bool source_desc::add_packet(const data_packet& d){
                 ack_list_.clear();
                 // push empty blocks to keep the buffer full, but leave room for one block!
                 int count = 0;
-                auto nsamples = audioqueue_.blocksize();
-                while (audioqueue_.write_available() > 1 && infoqueue_.write_available() > 1){
-                    auto ptr = audioqueue_.write_data();
-                    decoder_->decode(nullptr, 0, ptr, nsamples);
-                    audioqueue_.write_commit();
-                    // push nominal samplerate + current channel
-                    block_info i;
-                    i.sr = decoder_->samplerate();
-                    i.channel = channel_;
-                    infoqueue_.write(i);
-
+                // push nominal samplerate + current channel
+                block_info i;
+                i.sr = decoder_->samplerate();
+                i.channel = channel_;
+                while (fill_available() > 1){
+                    push_block(nullptr, 0, i, decode_job::CONCEAL);
                     count++;
                 }
                 // record dropped blocks
@@ -1232,16 +1542,12 @@ bool source_desc::add_packet(const data_packet& d){
                 next_ = d.sequence;
                 LOG_VERBOSE("dropped " << count << " blocks to handle buffer overrun");
             } else {
-                if (audioqueue_.write_available() && infoqueue_.write_available()){
-                    auto ptr = audioqueue_.write_data();
-                    auto nsamples = audioqueue_.blocksize();
-                    decoder_->decode(nullptr, 0, ptr, nsamples);
-                    audioqueue_.write_commit();
+                if (decode_write_available() > 0){
                     // push nominal samplerate + current channel
                     block_info i;
                     i.sr = decoder_->samplerate();
                     i.channel = channel_;
-                    infoqueue_.write(i);
+                    push_block(nullptr, 0, i, decode_job::CONCEAL);
                 }
                 // record dropped block
                 streamstate_.add_lost(1);
@@ -1285,10 +1591,11 @@ void source_desc::process_blocks(){
 
     auto b = blockqueue_.begin();
     int32_t next = next_;
-    while (b != blockqueue_.end() && audioqueue_.write_available())
+    while (b != blockqueue_.end() && decode_write_available() > 0)
     {
         const char *data;
         int32_t size;
+        bool fec = false;
         block_info i;
         const bool dofadein = b->sequence == nextneedsfadein_;
         
@@ -1312,7 +1619,19 @@ void source_desc::process_blocks(){
                 b++;
             }
 
-            LOG_VERBOSE("dropped block " << next);
+            // if the following block is already here, try to recover
+            // the missing one from its FEC data (if the codec has any).
+            // NOTE: 'b' stays at the following block, we still need it!
+            if (b != blockqueue_.end() && b->sequence == next + 1 && b->complete()
+                && decoder_->has_fec())
+            {
+                data = b->data();
+                size = b->size();
+                fec = true;
+                LOG_VERBOSE("recover block " << next << " from FEC");
+            } else {
+                LOG_VERBOSE("dropped block " << next);
+            }
             streamstate_.add_lost(1);
         } else {
             // wait for block
@@ -1321,16 +1640,87 @@ void source_desc::process_blocks(){
 
         next++;
 
+        // hand the block to the decoder; without data it does packet loss concealment
+        push_block(data, size, i, fec ? decode_job::FEC : data ? decode_job::DATA : decode_job::CONCEAL, dofadein);
+        if (dofadein){
+            nextneedsfadein_ = -1;
+        }
+    }
+    next_ = next;
+    // pop blocks
+    auto count = b - blockqueue_.begin();
+    while (count--){
+    #if 1
+        // remove block from acklist
+        ack_list_.remove(blockqueue_.front().sequence);
+    #endif
+        // pop block
+        LOG_DEBUG("pop block " << blockqueue_.front().sequence);
+        blockqueue_.pop_front();
+    }
+    LOG_DEBUG("next: " << next_);
+}
+
+// the number of blocks that can still be handed to the decoder,
+// taking into account the ones which haven't been decoded yet.
+int32_t source_desc::decode_write_available(){
+    auto n = std::min(audioqueue_.write_available(), infoqueue_.write_available())
+            - decodequeue_.read_available();
+    return std::min(n, decodequeue_.write_available());
+}
+
+// the number of blocks that can be handed to the decoder
+// until the buffer has reached its nominal size.
+int32_t source_desc::fill_available(){
+    return decode_write_available() - (infoqueue_.capacity() - target_blocks_);
+}
+
+// called on the network thread
+bool source_desc::push_block(const char *data, int32_t size, const block_info& info,
+                             int32_t mode, bool fadein){
+    if (!decodequeue_.write_available() || !decodedata_.write_available()){
+        return false;
+    }
+    if (mode != decode_job::CONCEAL){
+        if (size > decodedata_.blocksize()){
+            LOG_WARNING("aoo_sink: block too large (" << size << " bytes)");
+            mode = decode_job::CONCEAL;
+            size = 0;
+        } else {
+            std::copy(data, data + size, decodedata_.write_data());
+        }
+    }
+    decodedata_.write_commit();
+
+    decode_job job;
+    job.info = info;
+    job.size = size;
+    job.mode = mode;
+    job.fadein = fadein;
+    decodequeue_.write(job);
+    return true;
+}
+
+// called with decodelock_ on the network thread or a decoder thread.
+int32_t source_desc::decode_blocks(){
+    int32_t count = 0;
+    while (decodequeue_.read_available() && decodedata_.read_available()
+           && audioqueue_.write_available() && infoqueue_.write_available())
+    {
+        auto& job = *decodequeue_.read_data();
+        auto data = decodedata_.read_data();
         // decode data and push samples
         auto ptr = audioqueue_.write_data();
         auto nsamples = audioqueue_.blocksize();
-        // decode audio data
-        if (decoder_->decode(data, size, ptr, nsamples) < 0){
+        auto result = job.mode == decode_job::FEC ? decoder_->decode_fec(data, job.size, ptr, nsamples)
+                    : job.mode == decode_job::DATA ? decoder_->decode(data, job.size, ptr, nsamples)
+                    : decoder_->conceal(ptr, nsamples);
+        if (result < 0){
             LOG_WARNING("aoo_sink: couldn't decode block!");
             // decoder failed - fill with zeros
             std::fill(ptr, ptr + nsamples, 0);
         }
-        else if (dofadein) {
+        else if (job.fadein) {
             // fade the samples in
             LOG_VERBOSE("fading in block");
             auto nchannels = decoder_->nchannels();
@@ -1342,28 +1732,35 @@ void source_desc::process_blocks(){
                     ptr[j*nchannels+i] *= gain;
                     gain += gaindelta;
                 }
-            }                   
-            
-            nextneedsfadein_ = -1;
+            }
         }
         audioqueue_.write_commit();
 
         // push info
-        infoqueue_.write(i);
+        infoqueue_.write(job.info);
+
+        // commit last, so the network thread never overestimates the free space
+        decodedata_.read_commit();
+        decodequeue_.read_commit();
+        count++;
     }
-    next_ = next;
-    // pop blocks
-    auto count = b - blockqueue_.begin();
-    while (count--){
-    #if 1
-        // remove block from acklist
-        ack_list_.remove(blockqueue_.front().sequence);
-    #endif
-        // pop block
-        LOG_DEBUG("pop block " << blockqueue_.front().sequence);
-        blockqueue_.pop_front();
+    return count;
+}
+
+bool source_desc::decode(){
+    // synchronize with handle_format() and update()!
+    shared_lock lock(mutex_);
+
+    if (!decoder_){
+        return false;
     }
-    LOG_DEBUG("next: " << next_);
+    // someone else is decoding this source
+    if (!decodelock_.try_lock()){
+        return false;
+    }
+    auto count = decode_blocks();
+    decodelock_.unlock();
+    return count > 0;
 }
 
 void source_desc::check_outdated_blocks(){
@@ -127,8 +127,41 @@ struct block_info {
     int32_t channel;
 };
 
+// a completed block waiting to be decoded
+struct decode_job {
+    enum mode {
+        DATA,
+        FEC, // recover from the FEC data of the following block
+        CONCEAL
+    };
+    block_info info;
+    int32_t size;
+    int32_t mode;
+    bool fadein;
+};
+
 class sink;
 
+// Arrival times of the most recent blocks, relative to their nominal time
+// (sequence number * block duration). The spread of these offsets is the
+// jitter that the buffer has to absorb.
+class jitter_estimator {
+public:
+    void reset();
+
+    // called for the first packet of every new block
+    void add(int32_t sequence, double time, double period);
+
+    bool get_stats(float percentile, aoo_jitter_stats& stats);
+private:
+    double offsets_[AOO_JITTER_WINDOW];
+    int32_t head_ = 0;
+    int32_t count_ = 0;
+    int32_t newest_ = -1;
+    double period_ = 0;
+    spinlock lock_;
+};
+
 class source_desc {
 public:
     typedef union event
@@ -158,6 +191,8 @@ public:
     
     int32_t get_buffer_fill_ratio(float &ratio);
 
+    int32_t get_jitter_stats(const sink& s, aoo_jitter_stats& stats);
+
     int32_t get_userformat(char * buf, int32_t size);
 
     int32_t get_current_salt() const { return salt_; }
@@ -167,6 +202,9 @@ public:
     // methods
     void update(const sink& s);
 
+    // change the buffer size without resetting (with aoo_opt_time_stretch)
+    void resize(const sink& s);
+
     int32_t handle_format(const sink& s, int32_t salt, const aoo_format& f,
                           const char *settings, int32_t size, int32_t version, const char *userformat=nullptr, int32_t ufsize=0);
 
@@ -181,6 +219,8 @@ public:
 
     bool process(const sink& s, aoo_sample *buffer, int32_t stride, int32_t numsampleframes);
 
+    bool decode();
+
     void request_recover(){ streamstate_.request_recover(); }
 
     void request_format(){ streamstate_.request_format(); }
@@ -196,6 +236,14 @@ private:
         int32_t frame;
     };
     void do_update(const sink& s);
+
+    int32_t buffer_blocks(const sink& s) const;
+
+    int32_t queue_capacity(const sink& s, int32_t nbuffers) const;
+
+    void grow_queues(int32_t capacity);
+
+    void time_stretch(const sink& s, int32_t numsampleframes);
     // handle messages
     bool check_packet(const data_packet& d);
 
@@ -203,6 +251,15 @@ private:
 
     void process_blocks();
 
+    int32_t decode_write_available();
+
+    int32_t fill_available();
+
+    bool push_block(const char *data, int32_t size, const block_info& info,
+                    int32_t mode, bool fadein = false);
+
+    int32_t decode_blocks();
+
     void check_outdated_blocks();
 
     void check_missing_blocks(const sink& s);
@@ -238,16 +295,22 @@ private:
     block_ack_list ack_list_;
     lockfree::queue<aoo_sample> audioqueue_;
     lockfree::queue<block_info> infoqueue_;
+    // completed blocks are handed from the network thread to the
+    // decoder stage, which fills audioqueue_ and infoqueue_.
+    lockfree::queue<char> decodedata_;
+    lockfree::queue<decode_job> decodequeue_;
+    spinlock decodelock_; // only one thread may decode at a time
     lockfree::queue<data_request> resendqueue_;
+    jitter_estimator jitter_;
     lockfree::queue<event> eventqueue_;
     spinlock eventqueuelock_;
-    void push_event(const event& e){
-        scoped_lock<spinlock> l(eventqueuelock_);
-        if (eventqueue_.write_available()){
-            eventqueue_.write(e);
-        }
-    }
+    void push_event(const sink& s, const event& e);
     dynamic_resampler resampler_;
+    // time stretching (audio thread)
+    time_stretcher stretcher_;
+    int32_t target_blocks_ = 0; // nominal buffer size; the queues may be larger
+    double stretch_fill_ = 0; // smoothed buffer fill in frames
+    int32_t stretch_wait_ = 0; // frames until the next period may be dropped/repeated
     // thread synchronization
     aoo::shared_mutex mutex_; // LATER replace with a spinlock?
 };
@@ -272,6 +335,8 @@ public:
 
     int32_t send() override;
 
+    int32_t decode() override;
+
     int32_t process(aoo_sample **data, int32_t nsampframes, uint64_t t) override;
 
     int32_t events_available() override;
@@ -318,6 +383,21 @@ public:
 
     int32_t protocol_flags() const { return protocol_flags_; }
 
+    bool deferred_decode() const { return deferred_decode_.load(std::memory_order_relaxed); }
+
+    float jitter_percentile() const { return jitter_percentile_.load(std::memory_order_relaxed); }
+
+    bool time_stretch() const { return time_stretch_.load(std::memory_order_relaxed); }
+
+    int32_t resample_quality() const { return resample_quality_.load(std::memory_order_relaxed); }
+
+    void notify_event() const {
+        auto fn = event_notify_fn_.load(std::memory_order_acquire);
+        if (fn){
+            fn(event_notify_user_.load(std::memory_order_relaxed), id());
+        }
+    }
+
 private:
     // settings
     std::atomic<int32_t> id_;
@@ -333,10 +413,16 @@ private:
     std::atomic<float> resend_interval_{ AOO_RESEND_INTERVAL * 0.001 };
     std::atomic<int32_t> resend_maxnumframes_{ AOO_RESEND_MAXNUMFRAMES };
     std::atomic<int32_t> protocol_flags_{ 0 };
+    std::atomic<int32_t> deferred_decode_{ 0 };
+    std::atomic<float> jitter_percentile_{ AOO_JITTER_PERCENTILE };
+    std::atomic<int32_t> time_stretch_{ 0 };
+    std::atomic<aoo_eventnotifyfn> event_notify_fn_{ nullptr };
+    std::atomic<void *> event_notify_user_{ nullptr };
     // the sources
     lockfree::list<source_desc> sources_;
     // timing
     std::atomic<int32_t> dynamic_resampling_{ 1 };
+    std::atomic<int32_t> resample_quality_{ AOO_RESAMPLE_QUALITY };
     std::atomic<float> bandwidth_{ AOO_TIMEFILTER_BANDWIDTH };
     time_dll dll_;
     bool ignore_dll_ = false;
@@ -37,7 +37,11 @@ void aoo_source_free(aoo_source *src){
     delete static_cast<aoo::source *>(src);
 }
 
-aoo::source::~source() {}
+aoo::source::~source() {
+    // stop sharing our encoder, and stop using someone else's
+    detach_followers();
+    detach_from_leader();
+}
 
 template<typename T>
 T& as(void *p){
@@ -114,6 +118,18 @@ int32_t aoo::source::set_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(int32_t);
         dynamic_resampling_ = std::max<int32_t>(0, as<int32_t>(ptr));
         break;
+    // resampler quality
+    case aoo_opt_resample_quality:
+    {
+        CHECKARG(int32_t);
+        auto quality = std::min<int32_t>(AOO_RESAMPLE_HIGH, std::max<int32_t>(0, as<int32_t>(ptr)));
+        if (quality != resample_quality_){
+            resample_quality_ = quality;
+            unique_lock lock(update_mutex_); // writer lock!
+            update();
+        }
+        break;
+    }
     // timefilter bandwidth
     case aoo_opt_timefilter_bandwidth:
         CHECKARG(float);
@@ -152,6 +168,16 @@ int32_t aoo::source::set_option(int32_t opt, void *ptr, int32_t size)
     // format
     case aoo_opt_userformat:
         return set_userformat(ptr, size);
+    // encoder sharing
+    case aoo_opt_encode_leader:
+        CHECKARG(isource *);
+        return set_encode_leader(static_cast<source *>(as<isource *>(ptr)));
+    // event notification
+    case aoo_opt_event_notify:
+        CHECKARG(aoo_event_notify);
+        event_notify_user_ = as<aoo_event_notify>(ptr).user;
+        event_notify_fn_ = as<aoo_event_notify>(ptr).fn;
+        break;
     // unknown
     default:
         LOG_WARNING("aoo_source: unsupported option " << opt);
@@ -193,6 +219,11 @@ int32_t aoo::source::get_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(float);
         as<float>(ptr) = bandwidth_;
         break;
+    // resampler quality
+    case aoo_opt_resample_quality:
+        CHECKARG(int32_t);
+        as<int32_t>(ptr) = resample_quality_;
+        break;
     // resend buffer size
     case aoo_opt_resend_buffersize:
         CHECKARG(int32_t);
@@ -213,6 +244,16 @@ int32_t aoo::source::get_option(int32_t opt, void *ptr, int32_t size)
         CHECKARG(int32_t);
         as<int32_t>(ptr) = redundancy_;
         break;
+    // encoder sharing
+    case aoo_opt_encode_leader:
+        CHECKARG(isource *);
+        as<isource *>(ptr) = leader_.load();
+        break;
+    case aoo_opt_event_notify:
+        CHECKARG(aoo_event_notify);
+        as<aoo_event_notify>(ptr).fn = event_notify_fn_;
+        as<aoo_event_notify>(ptr).user = event_notify_user_;
+        break;
     // unknown
     default:
         LOG_WARNING("aoo_source: unsupported option " << opt);
@@ -546,7 +587,10 @@ int32_t aoo::source::process(const aoo_sample **data, int32_t n, uint64_t t){
         double period = (double)blocksize_ / (double)samplerate_;
         int nblocks = error / period + 0.5;
         LOG_VERBOSE("skip " << nblocks << " blocks");
-        dropped_ += nblocks;
+        // when following, the leader forwards its own dropped blocks
+        if (!leader_.load()){
+            dropped_ += nblocks;
+        }
         timer_.reset();
     } else {
         auto elapsed = timer_.get_elapsed();
@@ -601,6 +645,13 @@ int32_t aoo::source::process(const aoo_sample **data, int32_t n, uint64_t t){
          return 0;
      }
 
+    if (leader_.load()){
+        // our blocks come already encoded from the leader, which
+        // doesn't fade for us, so there's nothing left to push out
+        pushing_silent_frames_ = 0;
+        return 1;
+    }
+
     
 
 
@@ -743,34 +794,89 @@ namespace aoo {
 
 // /aoo/sink/<id>/data <src> <salt> <seq> <sr> <channel_onset> <totalsize> <nframes> <frame> <data>
 
-void endpoint::send_data(int32_t src, int32_t salt, const aoo::data_packet& d) const{
-    // call without lock!
-
-    char buf[AOO_MAXPACKETSIZE];
-    osc::OutboundPacketStream msg(buf, sizeof(buf));
+// The data messages are written by hand instead of with osc::OutboundPacketStream:
+// the leading part (address, typetags, <src> and <salt>) stays the same for a
+// stream, so for our sinks it is only built once (see sink_desc::update_data_template())
+// and per frame we just copy it and append the remaining arguments and the blob.
+
+static inline int32_t write_osc_string(char *buf, const char *s){
+    auto len = (int32_t)strlen(s);
+    auto padded = (len + 4) & ~3; // always at least one terminating zero
+    memcpy(buf, s, len);
+    memset(buf + len, 0, padded - len);
+    return padded;
+}
 
-    if (id != AOO_ID_WILDCARD){
-        const int32_t max_addr_size = AOO_MSG_DOMAIN_LEN
-                + AOO_MSG_SINK_LEN + 16 + AOO_MSG_DATA_LEN;
-        char address[max_addr_size];
+static int32_t write_data_template(char *buf, int32_t sink, int32_t src, int32_t salt){
+    char address[AOO_MSG_DOMAIN_LEN + AOO_MSG_SINK_LEN + 16 + AOO_MSG_DATA_LEN];
+    if (sink != AOO_ID_WILDCARD){
         snprintf(address, sizeof(address), "%s%s/%d%s",
-                 AOO_MSG_DOMAIN, AOO_MSG_SINK, id, AOO_MSG_DATA);
-
-        msg << osc::BeginMessage(address);
+                 AOO_MSG_DOMAIN, AOO_MSG_SINK, sink, AOO_MSG_DATA);
     } else {
-        msg << osc::BeginMessage(AOO_MSG_DOMAIN AOO_MSG_SINK AOO_MSG_WILDCARD AOO_MSG_DATA);
+        snprintf(address, sizeof(address), "%s",
+                 AOO_MSG_DOMAIN AOO_MSG_SINK AOO_MSG_WILDCARD AOO_MSG_DATA);
     }
+    auto n = write_osc_string(buf, address);
+    n += write_osc_string(buf + n, ",iiidiiiib");
+    aoo::to_bytes<int32_t>(src, buf + n);
+    aoo::to_bytes<int32_t>(salt, buf + n + 4);
+    return n + 8;
+}
 
-    msg << src << salt << d.sequence << d.samplerate << d.channel
-        << d.totalsize << d.nframes << d.framenum
-        << osc::Blob(d.data, d.size) << osc::EndMessage;
+// <seq> <sr> <channel_onset> <totalsize> <numpackets> <packetnum> <data>
+static void send_data_frame(const endpoint& ep, const char *tmpl, int32_t tmplsize,
+                            const aoo::data_packet& d){
+    char buf[AOO_MAXPACKETSIZE];
+    auto padded = (d.size + 3) & ~3;
+    auto msgsize = tmplsize + 32 + padded;
+    if (msgsize > (int32_t)sizeof(buf)){
+        LOG_ERROR("aoo_source: data frame too large (" << d.size << " bytes)");
+        return;
+    }
+
+    memcpy(buf, tmpl, tmplsize);
+    auto ptr = buf + tmplsize;
+    aoo::to_bytes<int32_t>(d.sequence, ptr);
+    aoo::to_bytes<double>(d.samplerate, ptr + 4);
+    aoo::to_bytes<int32_t>(d.channel, ptr + 12);
+    aoo::to_bytes<int32_t>(d.totalsize, ptr + 16);
+    aoo::to_bytes<int32_t>(d.nframes, ptr + 20);
+    aoo::to_bytes<int32_t>(d.framenum, ptr + 24);
+    aoo::to_bytes<int32_t>(d.size, ptr + 28);
+    ptr += 32;
+    if (d.size > 0){
+        memcpy(ptr, d.data, d.size);
+    }
+    memset(ptr + d.size, 0, padded - d.size);
 
     LOG_DEBUG("send block: seq = " << d.sequence << ", sr = " << d.samplerate
               << ", chn = " << d.channel << ", totalsize = " << d.totalsize
-              << ", nframes = " << d.nframes << ", frame = " << d.framenum << ", size " << d.size << " msgsize: " << msg.Size() << "  overhead = " << (int) (100 * (1.0 - d.size/(double)msg.Size())) << "%");
+              << ", nframes = " << d.nframes << ", frame = " << d.framenum << ", size " << d.size << " msgsize: " << msgsize << "  overhead = " << (int) (100 * (1.0 - d.size/(double)msgsize)) << "%");
 
+    ep.send(buf, msgsize);
+}
 
-    send(msg.Data(), (int32_t)msg.Size());
+void endpoint::send_data(int32_t src, int32_t salt, const aoo::data_packet& d) const{
+    // call without lock!
+    char tmpl[AOO_DATA_TEMPLATESIZE];
+    auto n = write_data_template(tmpl, id, src, salt);
+    send_data_frame(*this, tmpl, n, d);
+}
+
+void sink_desc::update_data_template(int32_t src, int32_t salt){
+    data_template_size = write_data_template(data_template, id, src, salt);
+    data_template_src = src;
+    data_template_salt = salt;
+    data_template_id = id;
+}
+
+void sink_desc::send_data(int32_t src, int32_t salt, const aoo::data_packet& d) const{
+    // call without lock!
+    if (has_data_template(src, salt)){
+        send_data_frame(*this, data_template, data_template_size, d);
+    } else {
+        endpoint::send_data(src, salt, d);
+    }
 }
 
 // /d <salt> <seq> <data>
@@ -779,28 +885,46 @@ void endpoint::send_data(int32_t src, int32_t salt, const aoo::data_packet& d) c
 void endpoint::send_data_compact(int32_t src, int32_t salt, const aoo::data_packet& d, bool sendrate) {
     // call without lock!
 
+    // address and typetags are constant
+    static const char header[] = AOO_MSG_COMPACT_DATA "\0\0" ",iib\0\0\0\0";
+    static const char header_rate[] = AOO_MSG_COMPACT_DATA "\0\0" ",iidb\0\0\0";
+    static_assert(sizeof(header) - 1 == 12 && sizeof(header_rate) - 1 == 12, "bad compact data header");
+
     char buf[AOO_MAXPACKETSIZE];
-    osc::OutboundPacketStream msg(buf, sizeof(buf));
-    
-    msg << osc::BeginMessage(AOO_MSG_COMPACT_DATA);
+    auto padded = (d.size + 3) & ~3;
+    auto msgsize = 12 + 12 + (sendrate ? 8 : 0) + padded;
+    if (msgsize > (int32_t)sizeof(buf)){
+        LOG_ERROR("aoo_source: data frame too large (" << d.size << " bytes)");
+        return;
+    }
+
+    memcpy(buf, sendrate ? header_rate : header, 12);
+    auto ptr = buf + 12;
 
     // the salt is how we identify both ourselves and our target
-    
-    msg << salt << d.sequence;
-    
+    aoo::to_bytes<int32_t>(salt, ptr);
+    aoo::to_bytes<int32_t>(d.sequence, ptr + 4);
+    ptr += 8;
+
     // only use the 4 argument version (with samplerate as double) if there is big enough divergence from prior samplerate
     if (sendrate) {
-        msg << d.samplerate;
+        aoo::to_bytes<double>(d.samplerate, ptr);
+        ptr += 8;
     }
-    
-    msg << osc::Blob(d.data, d.size) << osc::EndMessage;
+
+    aoo::to_bytes<int32_t>(d.size, ptr);
+    ptr += 4;
+    if (d.size > 0){
+        memcpy(ptr, d.data, d.size);
+    }
+    memset(ptr + d.size, 0, padded - d.size);
 
     LOG_DEBUG("send compact block: seq = " << d.sequence << ", sr = " << d.samplerate
               << ", chn = " << d.channel << ", totalsize = " << d.totalsize
-              << ", nframes = " << d.nframes << ", frame = " << d.framenum << ", size " << d.size << " msgsize: " << msg.Size() << "  overhead = " << (int) (100 * (1.0 - d.size/(double)msg.Size())) << "%");
+              << ", nframes = " << d.nframes << ", frame = " << d.framenum << ", size " << d.size << " msgsize: " << msgsize << "  overhead = " << (int) (100 * (1.0 - d.size/(double)msgsize)) << "%");
 
 
-    send(msg.Data(), (int32_t)msg.Size());
+    send(buf, msgsize);
 }
 
 // /aoo/sink/<id>/format <src> <version> <salt> <numchannels> <samplerate> <blocksize> <codec> <options...> [<userformat..>]
@@ -945,7 +1069,7 @@ void source::update(){
         // resampler
        // if (blocksize_ != encoder_->blocksize() || samplerate_ != encoder_->samplerate()){
             resampler_.setup(blocksize_, encoder_->blocksize(),
-                             samplerate_, encoder_->samplerate(), nchannels_);
+                             samplerate_, encoder_->samplerate(), nchannels_, resample_quality_);
             resampler_.update(samplerate_, encoder_->samplerate());
         //} else {
         //    resampler_.clear();
@@ -956,6 +1080,11 @@ void source::update(){
         
         // reset encoder state to avoid old garbage
         encoder_->reset();
+
+        // the format might have changed, so stop any encoder sharing
+        // (the client has to set it up again)
+        detach_followers();
+        detach_from_leader();
         
         // reset time DLL to be on the safe side
         timer_.reset();
@@ -1021,7 +1150,8 @@ bool source::send_format(){
     if (format_changed){
         // only copy sinks which require a format update!
         shared_lock sinklock(sink_mutex_);
-        auto sinks = (aoo::sink_desc *)alloca((sinks_.size() + 1) * sizeof(aoo::endpoint)); // avoid alloca(0)
+        // only the endpoints, sink_desc is much larger
+        auto sinks = (aoo::endpoint *)alloca((sinks_.size() + 1) * sizeof(aoo::endpoint)); // avoid alloca(0)
         int numsinks = 0;
         for (auto& sink : sinks_){
             if (sink.format_changed.exchange(false)){
@@ -1149,49 +1279,45 @@ bool source::send_data(){
         // send empty block
         d.sequence = sequence_++;
         d.samplerate = encoder_->samplerate(); // use nominal samplerate
-        d.totalsize = 0;
-        d.nframes = 0;
-        d.framenum = 0;
-        d.data = nullptr;
-        d.size = 0;
         // now we can unlock
         updatelock.unlock();
 
-        // make local copy of sink descriptors
-        shared_lock listlock(sink_mutex_);
-        int32_t numsinks = (int32_t) sinks_.size();
-        auto sinks = (sink_desc *)alloca((numsinks + 1) * sizeof(sink_desc)); // avoid alloca(0)
-        std::copy(sinks_.begin(), sinks_.end(), sinks);
+        send_empty_block(salt, d);
 
-        // unlock before sending!
-        listlock.unlock();
+        // followers drop it, too
+        forward_block(nullptr, 0, d.samplerate);
 
-        // send block to sinks
-        for (int i = 0; i < numsinks; ++i){
-            sinks[i].send_data(id(), salt, d);            
-        }
         --dropped_;
-    } else if (audioqueue_.read_available() && srqueue_.read_available()){
-        // make local copy of sink descriptors
-        shared_lock listlock(sink_mutex_);
-        int32_t numsinks = (int32_t) sinks_.size();
-        auto sinks = (sink_desc *)alloca((numsinks + 1) * sizeof(sink_desc)); // avoid alloca(0)
-        std::copy(sinks_.begin(), sinks_.end(), sinks);
+    } else if (leader_.load() && sharedinfoqueue_.read_available() && sharedqueue_.read_available()){
+        // send a block encoded by our leader
+        shared_block_info info;
+        sharedinfoqueue_.read(info);
 
-        // unlock before sending!
-        listlock.unlock();
+        d.sequence = sequence_++;
+        d.samplerate = info.samplerate;
 
+        if (info.size > 0){
+            sendbuffer_.resize(info.size);
+            std::copy(sharedqueue_.read_data(), sharedqueue_.read_data() + info.size, sendbuffer_.data());
+            sharedqueue_.read_commit();
+
+            d.totalsize = info.size;
+            send_block(updatelock, salt, d);
+        } else {
+            sharedqueue_.read_commit();
+            updatelock.unlock();
+
+            send_empty_block(salt, d);
+        }
+    } else if (!leader_.load() && audioqueue_.read_available() && srqueue_.read_available()){
         d.sequence = sequence_++;
         srqueue_.read(d.samplerate); // always read samplerate from ringbuffer
 
-        // for compact data sending purposes... only send rate when necessary
-        bool sendrate = false;
-        if (abs(d.samplerate - prev_sent_samplerate_) > 0.1) {
-            sendrate = true;
-            prev_sent_samplerate_ = d.samplerate;
-        }
-        
-        if (numsinks){
+        shared_lock listlock(sink_mutex_);
+        bool havesinks = !sinks_.empty();
+        listlock.unlock();
+
+        if (havesinks || has_followers()){
             // copy and convert audio samples to blob data
             auto nchannels = encoder_->nchannels();
             auto blocksize = encoder_->blocksize();
@@ -1202,49 +1328,10 @@ bool source::send_data(){
             audioqueue_.read_commit();
 
             if (d.totalsize > 0){
-                // calculate number of frames
-                auto maxpacketsize = packetsize_ - AOO_DATA_HEADERSIZE;
-                auto dv = div(d.totalsize, maxpacketsize);
-                d.nframes = dv.quot + (dv.rem != 0);
-
-                // save block
-                history_.push(d.sequence, d.samplerate, sendbuffer_.data(),
-                              d.totalsize, d.nframes, maxpacketsize);
+                // hand it to anyone sharing our encoder
+                forward_block(sendbuffer_.data(), d.totalsize, d.samplerate);
 
-                // unlock before sending!
-                updatelock.unlock();
-
-                // from here on we don't hold any lock!
-
-                // send a single frame to all sinks
-                // /AoO/<sink>/data <src> <salt> <seq> <sr> <channel_onset> <totalsize> <numpackets> <packetnum> <data>
-                auto dosend = [&](int32_t frame, const char* data, auto n){
-                    d.framenum = frame;
-                    d.data = data;
-                    d.size = n;
-                    for (int i = 0; i < numsinks; ++i){
-                        d.channel = sinks[i].channel;
-                        // if the protocol_flags allow using the compact data message, use it if appropriate
-                        if (d.nframes == 1 && d.channel == 0 && sinks[i].protocol_flags & AOO_PROTOCOL_FLAG_COMPACT_DATA) {
-                            sinks[i].send_data_compact(id(), salt, d, sendrate);                
-                        } else {
-                            sinks[i].send_data(id(), salt, d);
-                        }
-                    }
-                };
-
-                auto ntimes = redundancy_.load();
-                for (auto i = 0; i < ntimes; ++i){
-                    auto ptr = sendbuffer_.data();
-                    // send large frames (might be 0)
-                    for (int32_t j = 0; j < dv.quot; ++j, ptr += maxpacketsize){
-                        dosend(j, ptr, maxpacketsize);
-                    }
-                    // send remaining bytes as a single frame (might be the only one!)
-                    if (dv.rem){
-                        dosend(dv.quot, ptr, dv.rem);
-                    }
-                }
+                send_block(updatelock, salt, d);
             } else {
                 LOG_WARNING("aoo_source: couldn't encode audio data!");
             }
@@ -1272,6 +1359,230 @@ bool source::send_data(){
     return 1;
 }
 
+// send the encoded block in sendbuffer_ to all sinks.
+// called with update lock, returns without it.
+void source::send_block(shared_lock& updatelock, int32_t salt, data_packet& d){
+    // for compact data sending purposes... only send rate when necessary
+    bool sendrate = false;
+    if (abs(d.samplerate - prev_sent_samplerate_) > 0.1) {
+        sendrate = true;
+        prev_sent_samplerate_ = d.samplerate;
+    }
+
+    // calculate number of frames
+    auto maxpacketsize = packetsize_ - AOO_DATA_HEADERSIZE;
+    auto dv = div(d.totalsize, maxpacketsize);
+    d.nframes = dv.quot + (dv.rem != 0);
+
+    // save block
+    history_.push(d.sequence, d.samplerate, sendbuffer_.data(),
+                  d.totalsize, d.nframes, maxpacketsize);
+
+    // unlock before sending!
+    updatelock.unlock();
+
+    update_data_templates(salt);
+
+    // make local copy of sink descriptors
+    shared_lock listlock(sink_mutex_);
+    int32_t numsinks = (int32_t) sinks_.size();
+    auto sinks = (sink_desc *)alloca((numsinks + 1) * sizeof(sink_desc)); // avoid alloca(0)
+    std::copy(sinks_.begin(), sinks_.end(), sinks);
+    listlock.unlock();
+
+    // from here on we don't hold any lock!
+
+    // send a single frame to all sinks
+    // /AoO/<sink>/data <src> <salt> <seq> <sr> <channel_onset> <totalsize> <numpackets> <packetnum> <data>
+    auto dosend = [&](int32_t frame, const char* data, auto n){
+        d.framenum = frame;
+        d.data = data;
+        d.size = n;
+        for (int i = 0; i < numsinks; ++i){
+            d.channel = sinks[i].channel;
+            // if the protocol_flags allow using the compact data message, use it if appropriate
+            if (d.nframes == 1 && d.channel == 0 && sinks[i].protocol_flags & AOO_PROTOCOL_FLAG_COMPACT_DATA) {
+                sinks[i].send_data_compact(id(), salt, d, sendrate);                
+            } else {
+                sinks[i].send_data(id(), salt, d);
+            }
+        }
+    };
+
+    auto ntimes = redundancy_.load();
+    for (auto i = 0; i < ntimes; ++i){
+        auto ptr = sendbuffer_.data();
+        // send large frames (might be 0)
+        for (int32_t j = 0; j < dv.quot; ++j, ptr += maxpacketsize){
+            dosend(j, ptr, maxpacketsize);
+        }
+        // send remaining bytes as a single frame (might be the only one!)
+        if (dv.rem){
+            dosend(dv.quot, ptr, dv.rem);
+        }
+    }
+}
+
+// call without update lock!
+void source::send_empty_block(int32_t salt, data_packet& d){
+    d.totalsize = 0;
+    d.nframes = 0;
+    d.framenum = 0;
+    d.data = nullptr;
+    d.size = 0;
+
+    update_data_templates(salt);
+
+    // make local copy of sink descriptors
+    shared_lock listlock(sink_mutex_);
+    int32_t numsinks = (int32_t) sinks_.size();
+    auto sinks = (sink_desc *)alloca((numsinks + 1) * sizeof(sink_desc)); // avoid alloca(0)
+    std::copy(sinks_.begin(), sinks_.end(), sinks);
+
+    // unlock before sending!
+    listlock.unlock();
+
+    // send block to sinks
+    for (int i = 0; i < numsinks; ++i){
+        sinks[i].send_data(id(), salt, d);            
+    }
+}
+
+// (re)build the data message templates of our sinks if the salt or our id changed,
+// or if a sink has been added since
+void source::update_data_templates(int32_t salt){
+    auto src = id();
+    {
+        shared_lock lock(sink_mutex_);
+        if (std::all_of(sinks_.begin(), sinks_.end(),
+                        [&](const sink_desc& s){ return s.has_data_template(src, salt); })){
+            return;
+        }
+    }
+
+    unique_lock lock(sink_mutex_); // writer lock!
+    for (auto& s : sinks_){
+        if (!s.has_data_template(src, salt)){
+            s.update_data_template(src, salt);
+        }
+    }
+}
+
+/*///////////////////// encoder sharing ////////////////////////*/
+
+// A follower skips its own resampling and encoding and gets the blocks
+// encoded by the leader through sharedqueue_/sharedinfoqueue_, which are
+// written by the leader's send_data() and read by the follower's send_data().
+// Each follower still has its own salt, sequence numbers and history buffer,
+// so for its sinks it just looks like a regular stream.
+
+bool source::same_format(source& other){
+    if (!encoder_ || !other.encoder_ || strcmp(encoder_->name(), other.encoder_->name())){
+        return false;
+    }
+    aoo_format f1, f2;
+    char settings1[AOO_CODEC_MAXSETTINGSIZE];
+    char settings2[AOO_CODEC_MAXSETTINGSIZE];
+    auto size1 = encoder_->write_format(f1, settings1, sizeof(settings1));
+    auto size2 = other.encoder_->write_format(f2, settings2, sizeof(settings2));
+    return size1 >= 0 && size1 == size2
+        && f1.nchannels == f2.nchannels && f1.samplerate == f2.samplerate
+        && f1.blocksize == f2.blocksize && !memcmp(settings1, settings2, size1);
+}
+
+int32_t source::set_encode_leader(source *leader){
+    if (leader == this){
+        return 0;
+    }
+    if (leader == leader_.load()){
+        return 1;
+    }
+
+    detach_from_leader();
+
+    if (!leader){
+        LOG_VERBOSE("aoo_source " << id() << ": stop sharing encoder");
+        return 1;
+    }
+
+    {
+        unique_lock lock(update_mutex_); // writer lock!
+        shared_lock leaderlock(leader->update_mutex_);
+
+        if (!same_format(*leader) || leader->leader_.load()){
+            LOG_WARNING("aoo_source " << id() << ": can't share encoder of source "
+                        << leader->id() << ", format differs or it is following itself");
+            return 0;
+        }
+
+        // start a new stream for our sinks, this also stops any sharing of our own encoder
+        update();
+
+        // room for as many blocks as the leader can buffer, plus some extra
+        auto nblocks = (leader->audioqueue_.blocksize() > 0 ?
+                            leader->audioqueue_.capacity() / leader->audioqueue_.blocksize() : 0) + 4;
+        auto maxblocksize = (int32_t)sizeof(double) * encoder_->nchannels() * encoder_->blocksize();
+        sharedqueue_.resize(nblocks * maxblocksize, maxblocksize);
+        sharedinfoqueue_.resize(nblocks, 1);
+    }
+
+    {
+        unique_lock lock(leader->follower_mutex_);
+        leader->followers_.push_back(this);
+        leader_ = leader;
+    }
+
+    LOG_VERBOSE("aoo_source " << id() << ": sharing encoder of source " << leader->id());
+    return 1;
+}
+
+void source::detach_from_leader(){
+    auto leader = leader_.load();
+    if (leader){
+        unique_lock lock(leader->follower_mutex_);
+        auto it = std::find(leader->followers_.begin(), leader->followers_.end(), this);
+        if (it != leader->followers_.end()){
+            leader->followers_.erase(it);
+        }
+        leader_ = nullptr;
+    }
+}
+
+void source::detach_followers(){
+    unique_lock lock(follower_mutex_);
+    for (auto& f : followers_){
+        f->leader_ = nullptr;
+    }
+    followers_.clear();
+}
+
+bool source::has_followers(){
+    shared_lock lock(follower_mutex_);
+    return !followers_.empty();
+}
+
+void source::forward_block(const char *data, int32_t size, double samplerate){
+    shared_lock lock(follower_mutex_);
+    for (auto& f : followers_){
+        // don't let blocks pile up for followers which aren't sending
+        if (!f->play_.load()){
+            continue;
+        }
+        if (f->sharedinfoqueue_.write_available() && f->sharedqueue_.write_available()
+            && size <= f->sharedqueue_.blocksize())
+        {
+            if (size > 0){
+                std::copy(data, data + size, f->sharedqueue_.write_data());
+            }
+            f->sharedqueue_.write_commit();
+            f->sharedinfoqueue_.write(shared_block_info { samplerate, size });
+        } else {
+            // follower is behind, it will send an empty block instead
+            f->dropped_++;
+        }
+    }
+}
+
 bool source::send_ping(){
     // if stream is stopped, the timer won't increment anyway
     auto elapsed = timer_.get_elapsed();
@@ -1382,6 +1693,7 @@ void source::handle_invite(void *endpoint, aoo_replyfn fn,
             e.sink.id = id;
             e.sink.flags = flags;
             eventqueue_.write(e);
+            notify_event();
         }
     } else {
         LOG_VERBOSE("ignoring '" << AOO_MSG_INVITE << "' message: sink already added");
@@ -1409,6 +1721,7 @@ void source::handle_uninvite(void *endpoint, aoo_replyfn fn,
             // Use 'id' because we want the individual sink! ('sink.id' might be a wildcard)
             e.sink.id = id;
             eventqueue_.write(e);
+            notify_event();
         }
     } else {
         LOG_VERBOSE("ignoring '" << AOO_MSG_UNINVITE << "' message: sink not found");
@@ -1448,6 +1761,7 @@ void source::handle_ping(void *endpoint, aoo_replyfn fn,
             e.ping.tt3 = aoo_osctime_get(); // use real system time
         #endif
             eventqueue_.write(e);
+            notify_event();
         }
     } else {
         LOG_VERBOSE("ignoring '" << AOO_MSG_PING << "' message: sink not found");
@@ -1526,6 +1840,7 @@ void source::handle_codec_change(void *endpoint, aoo_replyfn fn,
             // Use 'id' because we want the individual sink! ('sink.id' might be a wildcard)
             e.sink.id = id;
             eventqueue_.write(e);
+            notify_event();
         }
     } else {
         LOG_VERBOSE("ignoring '" << AOO_CHANGECODEC_EVENT << "' message: sink not found");
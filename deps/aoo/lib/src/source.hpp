@@ -15,8 +15,13 @@
 #include "oscpack/osc/OscOutboundPacketStream.h"
 #include "oscpack/osc/OscReceivedElements.h"
 
+#include <cstring>
+
 namespace aoo {
 
+// address pattern (max. 32 bytes) + typetags (12 bytes) + <src> <salt>
+#define AOO_DATA_TEMPLATESIZE 52
+
 struct endpoint {
     endpoint() = default;
     endpoint(void *_user, aoo_replyfn _fn, int32_t _id)
@@ -73,7 +78,9 @@ struct sink_desc : endpoint {
         : endpoint(other.user, other.fn, other.id),
           channel(other.channel.load()),
           format_changed(other.format_changed.load()),
-          protocol_flags(other.protocol_flags.load()){}
+          protocol_flags(other.protocol_flags.load()){
+        copy_data_template(other);
+    }
     sink_desc& operator=(const sink_desc& other){
         user = other.user;
         fn = other.fn;
@@ -81,6 +88,7 @@ struct sink_desc : endpoint {
         channel = other.channel.load();
         format_changed = other.format_changed.load();
         protocol_flags = other.protocol_flags.load();
+        copy_data_template(other);
         return *this;
     }
 
@@ -89,6 +97,34 @@ struct sink_desc : endpoint {
     std::atomic<bool> format_changed;
     std::atomic<int8_t> protocol_flags;
 
+    // the part of the data message that doesn't change between blocks of a stream,
+    // only rebuilt when the source id, the salt or the sink id changes
+    char data_template[AOO_DATA_TEMPLATESIZE];
+    int32_t data_template_size = 0;
+    int32_t data_template_src = 0;
+    int32_t data_template_salt = 0;
+    int32_t data_template_id = 0;
+
+    // methods
+    bool has_data_template(int32_t src, int32_t salt) const {
+        return data_template_size > 0 && data_template_src == src
+                && data_template_salt == salt && data_template_id == id;
+    }
+
+    void update_data_template(int32_t src, int32_t salt);
+
+    void send_data(int32_t src, int32_t salt, const data_packet& data) const;
+
+private:
+    void copy_data_template(const sink_desc& other){
+        data_template_size = other.data_template_size;
+        data_template_src = other.data_template_src;
+        data_template_salt = other.data_template_salt;
+        data_template_id = other.data_template_id;
+        if (data_template_size > 0){
+            memcpy(data_template, other.data_template, data_template_size);
+        }
+    }
 };
 
 class source final : public isource {
@@ -174,11 +210,24 @@ class source final : public isource {
     std::atomic<int32_t> resend_buffersize_{ AOO_RESEND_BUFSIZE };
     std::atomic<int32_t> redundancy_{ AOO_SEND_REDUNDANCY };
     std::atomic<int32_t> dynamic_resampling_{ 1 };
+    std::atomic<int32_t> resample_quality_{ AOO_RESAMPLE_QUALITY };
     std::atomic<float> bandwidth_{ AOO_TIMEFILTER_BANDWIDTH };
     std::atomic<float> ping_interval_{ AOO_PING_INTERVAL * 0.001 };
     std::atomic<int32_t> protocol_flags_{ 0 };
     std::atomic<int32_t> respect_codec_change_req_{ 0 };
     std::vector<char> userformat_;
+    std::atomic<aoo_eventnotifyfn> event_notify_fn_{ nullptr };
+    std::atomic<void *> event_notify_user_{ nullptr };
+    // encoder sharing
+    struct shared_block_info {
+        double samplerate;
+        int32_t size; // 0: dropped block
+    };
+    std::atomic<source *> leader_{nullptr};
+    lockfree::queue<char> sharedqueue_;
+    lockfree::queue<shared_block_info> sharedinfoqueue_;
+    std::vector<source *> followers_;
+    aoo::shared_mutex follower_mutex_;
     // runtime
     double prev_sent_samplerate_ = 0.0;
     std::atomic<int32_t> activeplay_ { 0 };
@@ -194,6 +243,13 @@ class source final : public isource {
 
     int32_t make_salt();
 
+    void notify_event() const {
+        auto fn = event_notify_fn_.load(std::memory_order_acquire);
+        if (fn){
+            fn(event_notify_user_.load(std::memory_order_relaxed), id());
+        }
+    }
+
     void update();
 
     void update_historybuffer();
@@ -202,6 +258,24 @@ class source final : public isource {
 
     bool send_data();
 
+    void send_block(shared_lock& updatelock, int32_t salt, data_packet& d);
+
+    void send_empty_block(int32_t salt, data_packet& d);
+
+    void update_data_templates(int32_t salt);
+
+    bool same_format(source& other);
+
+    int32_t set_encode_leader(source *leader);
+
+    void detach_from_leader();
+
+    void detach_followers();
+
+    bool has_followers();
+
+    void forward_block(const char *data, int32_t size, double samplerate);
+
     bool resend_data();
 
     bool send_ping();